@@ -0,0 +1,348 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Profiles the heap used to load a synthetic snapshot into memory, as the
+ * symbol views do: every vm entry, capability and symbol copied into arrays
+ * with get_all_*_info, their strings interned into an arena, against the
+ * strdup of every string of every row that it replaced. Each load runs in a
+ * child process of its own, so that its peak resident size is not muddied by
+ * the other.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o arena_bench arena_bench.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3
+ * ./arena_bench [libraries] [symbols per library] [caps per library]
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "arena.h"
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+
+#define LIB_FORMAT	"/usr/lib/libsynth%d.so.1"
+#define LIB_SIZE	0x100000UL
+
+/* What a load measured, sent back by its child */
+typedef struct load_result {
+	double seconds;
+	long rss_kb;		/* Growth of the peak resident size */
+	u_long rows;
+	u_long allocs;		/* malloc calls made for the strings */
+	size_t bytes;		/* Bytes asked for the strings */
+} load_result;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long max_rss_kb(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/* A snapshot of libs libraries, with their symbols and capabilities */
+static void make_snapshot(const char *path, int libs, int syms, int caps)
+{
+	sqlite3 *db;
+	char lib_path[64], name[64];
+	int rc;
+	int64_t elf_id;
+
+	unlink(path);
+	rc = sqlite3_open(path, &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	rc = create_vm_cap_db(db);
+	assert(rc == 0);
+	rc = create_elf_sym_db(db);
+	assert(rc == 0);
+	begin_transaction(db);
+	int64_t snapshot_id = snapshot_begin(db, 1000, 0);
+	assert(snapshot_id != 0);
+
+	vm_info *vms = calloc(libs, sizeof(vm_info));
+	cap_writer caps_writer;
+	rc = cap_writer_open(db, &caps_writer);
+	assert(rc == 0);
+	for (int lib=0; lib<libs; lib++) {
+		uint64_t base = 0x40000000UL + lib*LIB_SIZE;
+		snprintf(lib_path, sizeof(lib_path), LIB_FORMAT, lib);
+
+		elf_file_info file = { .source_path = lib_path, .dev = 0x5e, .ino = lib + 1, .size = syms };
+		sym_writer writer;
+		elf_id = elf_file_insert(db, &file);
+		assert(elf_id != 0);
+		rc = sym_writer_open(db, &writer, file.elf_id);
+		assert(rc == 0);
+		for (int k=0; k<syms; k++) {
+			uint64_t value = (uint64_t)k * (LIB_SIZE / syms) & ~15ULL;
+			int func = k % 4 != 3;
+			snprintf(name, sizeof(name), "%s_%d_%d", func ? "synth_func" : "synth_obj", lib, k);
+			sym_writer_insert(&writer, lib_path, name, value, func ? " 12" : " 20", func ? "FUNC" : "OBJECT",
+			    "GLOBAL", value, 16);
+		}
+		sym_writer_close(&writer);
+		snapshot_elf_add(db, file.elf_id, base);
+
+		for (int k=0; k<caps; k++) {
+			uint64_t addr = base + ((uint64_t)k * (LIB_SIZE / caps) & ~15ULL);
+			cap_writer_insert(&caps_writer, addr, lib_path, base, CAP_PERM_LOAD, base, base + LIB_SIZE);
+		}
+
+		vms[lib].start_addr = base;
+		vms[lib].end_addr = base + LIB_SIZE;
+		vms[lib].mmap_path = strdup(lib_path);
+		vms[lib].compart_id = lib;
+	}
+	cap_writer_close(&caps_writer);
+	rc = insert_vm_info(db, snapshot_id, vms, libs);
+	assert(rc == libs);
+	snapshot_end(db, 0);
+	commit_transaction(db);
+	sqlite3_close(db);
+
+	for (int lib=0; lib<libs; lib++) {
+		free(vms[lib].mmap_path);
+	}
+	free(vms);
+}
+
+static char *counted_strdup(const char *s, load_result *result)
+{
+	if (s == NULL) {
+		return NULL;
+	}
+	result->allocs++;
+	result->bytes += strlen(s) + 1;
+	return strdup(s);
+}
+
+static void *grow(void *array, int count, int *capacity, size_t elem_size)
+{
+	if (count == *capacity) {
+		*capacity = *capacity == 0 ? 64 : *capacity*2;
+		array = realloc(array, *capacity*elem_size);
+		assert(array != NULL);
+	}
+	return array;
+}
+
+/* The rows loaded as get_all_*_info used to, with a strdup for each string */
+static void load_strdup(sqlite3 *db, load_result *result)
+{
+	db_cursor cursor;
+	vm_info vm, *vms = NULL;
+	cap_info cap, *caps = NULL;
+	sym_info sym, *syms = NULL;
+	int vm_count = 0, cap_count = 0, sym_count = 0, capacity;
+	int rc;
+
+	capacity = 0;
+	rc = vm_cursor_open(db, &cursor);
+	assert(rc == 0);
+	while (vm_cursor_next(&cursor, &vm) == 1) {
+		vms = grow(vms, vm_count, &capacity, sizeof(vm_info));
+		vm.mmap_path = counted_strdup(vm.mmap_path, result);
+		vms[vm_count++] = vm;
+	}
+	db_cursor_close(&cursor);
+
+	capacity = 0;
+	rc = cap_cursor_open(db, &cursor, NULL);
+	assert(rc == 0);
+	while (cap_cursor_next(&cursor, &cap) == 1) {
+		caps = grow(caps, cap_count, &capacity, sizeof(cap_info));
+		cap.cap_loc_path = counted_strdup(cap.cap_loc_path, result);
+		caps[cap_count++] = cap;
+	}
+	db_cursor_close(&cursor);
+
+	capacity = 0;
+	rc = sym_cursor_open(db, &cursor);
+	assert(rc == 0);
+	while (sym_cursor_next(&cursor, &sym) == 1) {
+		syms = grow(syms, sym_count, &capacity, sizeof(sym_info));
+		sym.source_path = counted_strdup(sym.source_path, result);
+		sym.sym_name = counted_strdup(sym.sym_name, result);
+		sym.shndx = counted_strdup(sym.shndx, result);
+		sym.type = counted_strdup(sym.type, result);
+		sym.bind = counted_strdup(sym.bind, result);
+		syms[sym_count++] = sym;
+	}
+	db_cursor_close(&cursor);
+
+	result->rows = vm_count + cap_count + sym_count;
+	result->rss_kb = max_rss_kb();
+	for (int i=0; i<vm_count; i++) {
+		free(vms[i].mmap_path);
+	}
+	for (int i=0; i<cap_count; i++) {
+		free(caps[i].cap_loc_path);
+	}
+	for (int i=0; i<sym_count; i++) {
+		free(syms[i].source_path);
+		free(syms[i].sym_name);
+		free(syms[i].shndx);
+		free(syms[i].type);
+		free(syms[i].bind);
+	}
+	free(vms);
+	free(caps);
+	free(syms);
+}
+
+/* The rows loaded by get_all_*_info, with their strings interned */
+static void load_arena(sqlite3 *db, load_result *result)
+{
+	arena strings_arena;
+	str_table strings;
+	vm_info *vms;
+	cap_info *caps;
+	sym_info *syms;
+
+	arena_init(&strings_arena, 0);
+	str_table_init(&strings, &strings_arena);
+	int vm_count = get_all_vm_info(db, &strings, &vms);
+	int cap_count = get_all_cap_info(db, &strings, &caps);
+	int sym_count = get_all_sym_info(db, &strings, &syms);
+	assert(vm_count >= 0 && cap_count >= 0 && sym_count >= 0);
+
+	// One malloc per block, and one per size of the table of the strings
+	u_long table_allocs = 0;
+	for (u_long slots=strings.capacity; slots>=256; slots/=2) {
+		table_allocs++;
+	}
+	result->rows = vm_count + cap_count + sym_count;
+	result->allocs = strings_arena.block_count + table_allocs;
+	result->bytes = strings_arena.reserved + strings.capacity*sizeof(char *);
+	result->rss_kb = max_rss_kb();
+	free(vms);
+	free(caps);
+	free(syms);
+	str_table_free(&strings);
+	arena_free(&strings_arena);
+}
+
+/* Runs load in a child process on the snapshot at path */
+static load_result run_load(const char *path, void (*load)(sqlite3 *, load_result *))
+{
+	load_result result = {};
+	int fds[2];
+	int rc;
+
+	if (pipe(fds) != 0) {
+		err(1, "pipe");
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		sqlite3 *db;
+		close(fds[0]);
+		rc = sqlite3_open(path, &db);
+		assert(rc == SQLITE_OK);
+		// The page cache of sqlite is filled before the baseline is taken
+		assert(sym_info_count(db) >= 0 && cap_info_count(db) >= 0);
+		long rss_start = max_rss_kb();
+		double start = now();
+		load(db, &result);
+		result.seconds = now() - start;
+		result.rss_kb -= rss_start;
+		sqlite3_close(db);
+		if (write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+		errx(1, "The load did not finish");
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return result;
+}
+
+static void print_result(const char *name, load_result *r)
+{
+	printf("%-14s %9lu %10lu %12zu %10ld %8.3f\n", name, r->rows, r->allocs, r->bytes, r->rss_kb, r->seconds);
+}
+
+int main(int argc, char *argv[])
+{
+	int libs = argc > 1 ? atoi(argv[1]) : 200;
+	int syms = argc > 2 ? atoi(argv[2]) : 2000;
+	int caps = argc > 3 ? atoi(argv[3]) : 1000;
+	char path[] = "/tmp/arena_bench.XXXXXX";
+	int fd = mkstemp(path);
+
+	if (libs <= 0 || syms <= 0 || caps <= 0 || fd < 0) {
+		errx(1, "usage: arena_bench [libraries] [symbols per library] [caps per library]");
+	}
+	close(fd);
+	set_print_level(NOPRINT);
+
+	make_snapshot(path, libs, syms, caps);
+	load_result old = run_load(path, load_strdup);
+	load_result new = run_load(path, load_arena);
+	unlink(path);
+
+	printf("%-14s %9s %10s %12s %10s %8s\n", "load", "rows", "allocs", "string bytes", "rss kB", "seconds");
+	print_result("strdup", &old);
+	print_result("arena+intern", &new);
+	printf("%.0fx fewer allocations, %.1fx less resident memory\n", (double)old.allocs / new.allocs,
+	    new.rss_kb > 0 ? (double)old.rss_kb / new.rss_kb : 0.0);
+	return 0;
+}
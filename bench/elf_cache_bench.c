@@ -0,0 +1,119 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Times the symbol loading of 50 snapshots of processes that map the same
+ * ELF files at different bases: with the symbol cache, where each file is
+ * parsed for the first snapshot only, against parsing every file for every
+ * snapshot as scan_mem used to.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o elf_cache_bench elf_cache_bench.c \
+ *     ../src/elf_utils.c ../src/db_process.c ../src/arena.c ../src/common.c \
+ *     ../src/run_stats.c -lelf -lsqlite3
+ * ./elf_cache_bench /lib/libc.so.7 /lib/libthr.so.3 /libexec/ld-elf.so.1
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_process.h"
+#include "elf_utils.h"
+
+#define SNAPSHOTS	50
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Loads the files into SNAPSHOTS snapshots, in a single database if shared */
+static double bench_load(char **paths, int count, int shared, int *parsed)
+{
+	sqlite3 *db = NULL;
+	special_sections sections;
+	double start = now();
+	int rc;
+	int64_t snapshot_id;
+
+	*parsed = 0;
+	for (int s=0; s<SNAPSHOTS; s++) {
+		if (db == NULL) {
+			rc = sqlite3_open(":memory:", &db);
+			assert(rc == SQLITE_OK);
+			rc = migrate_db(db);
+			assert(rc == 0);
+		}
+		begin_transaction(db);
+		snapshot_id = snapshot_begin(db, 1000+s, 0);
+		assert(snapshot_id != 0);
+		for (int i=0; i<count; i++) {
+			int rc = load_elf_file(db, paths[i], 0x40000000UL + (s*count + i)*0x1000000UL, &sections);
+			assert(rc >= 0);
+			*parsed += rc;
+		}
+		commit_transaction(db);
+		if (!shared) {
+			sqlite3_close(db);
+			db = NULL;
+		}
+	}
+	if (db != NULL) {
+		sqlite3_close(db);
+	}
+	return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	char *self[] = { argv[0] };
+	char **paths = argc > 1 ? &argv[1] : self;
+	int count = argc > 1 ? argc-1 : 1;
+	int parsed;
+
+	set_print_level(NOPRINT);
+
+	double t = bench_load(paths, count, 0, &parsed);
+	printf("parsed for every snapshot: %d files parsed in %.3fs\n", parsed, t);
+	double cached = bench_load(paths, count, 1, &parsed);
+	printf("symbol cache:              %d files parsed in %.3fs (%.1fx)\n", parsed, cached, t / cached);
+	return 0;
+}
@@ -0,0 +1,230 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Times the parsing and storing of the symbols of symbol-heavy ELF files,
+ * such as a libc with its debug symbols, into a new database each time:
+ * through the prepared statement of sym_writer, with the files parsed by one
+ * thread and then by several. The old path, multi-row INSERTs built by
+ * appending each symbol with asprintf and strdup and run every 200 symbols,
+ * is timed on the same files for comparison.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o elf_sym_bench elf_sym_bench.c \
+ *     ../src/elf_utils.c ../src/db_process.c ../src/arena.c ../src/common.c \
+ *     ../src/run_stats.c -lelf -lsqlite3 -lpthread
+ * ./elf_sym_bench /usr/lib/debug/lib/libc.so.7.debug /usr/lib/debug/lib/libthr.so.3.debug
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <gelf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_process.h"
+#include "elf_utils.h"
+
+#define WORKERS	4
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static sqlite3 *open_bench_db(void)
+{
+	sqlite3 *db;
+	int rc;
+	int64_t snapshot_id;
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	rc = create_elf_sym_db(db);
+	assert(rc == 0);
+	snapshot_id = snapshot_begin(db, 1000, 0);
+	assert(snapshot_id != 0);
+	return db;
+}
+
+static sqlite3_int64 sym_rows(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 rows;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM elf_sym;", -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	rows = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return rows;
+}
+
+static void flush_values(sqlite3 *db, char *values)
+{
+	char *query;
+
+	asprintf(&query, "INSERT INTO elf_sym(source_path_id, st_name, st_value, st_shndx, type, bind, addr, "
+	    "st_size, elf_id) VALUES %s;", values);
+	sql_query_exec(db, query, NULL, NULL);
+	free(query);
+}
+
+/* The symbols of path stored as get_elf_info used to, leaks included, under its path_id */
+static void old_store_symbols(sqlite3 *db, const char *path)
+{
+	int fd;
+	Elf *elfFile = read_elf(path, &fd);
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	GElf_Sym sym;
+	path_cache path_ids;
+	int rc;
+
+	assert(elfFile != NULL);
+	rc = path_cache_open(db, &path_ids);
+	assert(rc == 0);
+	long path_id = (long)path_cache_id(&path_ids, path);
+	path_cache_close(&path_ids);
+	while ((scn = elf_nextscn(elfFile, scn)) != NULL) {
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type != SHT_DYNSYM && shdr.sh_type != SHT_SYMTAB) {
+			continue;
+		}
+		Elf_Data *data = elf_getdata(scn, NULL);
+		char *values = NULL;
+		int index = 0;
+
+		for (int i=0; gelf_getsym(data, i, &sym) != NULL; i++) {
+			const char *name = elf_strptr(elfFile, shdr.sh_link, sym.st_name);
+			if (name == NULL) {
+				continue;
+			}
+			char *value;
+			asprintf(&value, "(%ld, \"%s\", %lu, \"%3s\", \"%s\", \"%s\", %lu, %lu, %d)",
+			    path_id, name, (u_long)sym.st_value, "UND", "FUNC", "GLOBAL",
+			    (u_long)sym.st_value, (u_long)sym.st_size, 1);
+			if (index == 0) {
+				values = strdup(value);
+			} else {
+				char *temp;
+				asprintf(&temp, "%s,%s", values, value);
+				values = strdup(temp);
+				free(temp);
+			}
+			free(value);
+			index++;
+			if ((i % 200) == 0) {
+				flush_values(db, values);
+				values = NULL;
+				index = 0;
+			}
+		}
+		if (values != NULL) {
+			flush_values(db, values);
+			free(values);
+		}
+	}
+	close_elf(elfFile, fd);
+}
+
+static double bench_old(char **paths, int count, sqlite3_int64 *rows)
+{
+	sqlite3 *db = open_bench_db();
+	double start = now();
+
+	begin_transaction(db);
+	for (int i=0; i<count; i++) {
+		old_store_symbols(db, paths[i]);
+	}
+	commit_transaction(db);
+
+	double t = now() - start;
+	*rows = sym_rows(db);
+	sqlite3_close(db);
+	return t;
+}
+
+static double bench_load(char **paths, int count, int workers, sqlite3_int64 *rows)
+{
+	sqlite3 *db = open_bench_db();
+	u_long *bases = calloc(count, sizeof(u_long));
+	special_sections *sections = calloc(count, sizeof(special_sections));
+	double start = now();
+	int rc;
+
+	for (int i=0; i<count; i++) {
+		bases[i] = 0x40000000UL + i*0x1000000UL;
+	}
+	begin_transaction(db);
+	rc = load_elf_files(db, count, (const char **)paths, bases, sections, workers);
+	assert(rc == count);
+	commit_transaction(db);
+
+	double t = now() - start;
+	*rows = sym_rows(db);
+	sqlite3_close(db);
+	free(bases);
+	free(sections);
+	return t;
+}
+
+int main(int argc, char *argv[])
+{
+	char *self[] = { argv[0] };
+	char **paths = argc > 1 ? &argv[1] : self;
+	int count = argc > 1 ? argc-1 : 1;
+	sqlite3_int64 rows;
+
+	set_print_level(NOPRINT);
+
+	double old = bench_old(paths, count, &rows);
+	printf("asprintf batches:  %lld symbols in %.3fs (%.0f symbols/s)\n", rows, old, rows / old);
+	double t = bench_load(paths, count, 1, &rows);
+	printf("sym_writer:        %lld symbols in %.3fs (%.0f symbols/s, %.1fx)\n", rows, t, rows / t, old / t);
+	t = bench_load(paths, count, WORKERS, &rows);
+	printf("%d parsing threads: %lld symbols in %.3fs (%.0f symbols/s, %.1fx)\n", WORKERS, rows, t, rows / t, old / t);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+#-
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (c) 2023 Jessica Man
+#
+# This software was developed by the University of Cambridge Computer
+# Laboratory (Department of Computer Science and Technology) as part of the
+# CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+# EPSRC grant EP/V000292/1.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+#
+
+#
+# Generates a synthetic chericat database to benchmark the views on: a number
+# of vm entries, and capabilities spread over them with a mix of permissions.
+#
+# usage: gen_fixture_db.py <db file> [vm entries] [capabilities]
+
+import os
+import random
+import sqlite3
+import sys
+
+# Must match DB_SCHEMA_VERSION and the tables created by db_process.c
+SCHEMA_VERSION = 6
+SCHEMA = """
+CREATE TABLE paths(path_id INTEGER PRIMARY KEY, path VARCHAR NOT NULL UNIQUE,
+    basename VARCHAR NOT NULL, suffix VARCHAR NOT NULL);
+CREATE INDEX paths_basename ON paths(basename);
+CREATE TABLE vm(start_addr INTEGER NOT NULL, end_addr INTEGER NOT NULL,
+    mmap_path_id INTEGER NOT NULL, compart_id INTEGER NOT NULL, kve_protection INTEGER NOT NULL,
+    mmap_flags INTEGER NOT NULL, vnode_type INTEGER NOT NULL, plt_addr INTEGER,
+    plt_size INTEGER, got_addr INTEGER, got_size INTEGER, snapshot_id INTEGER);
+CREATE TABLE cap_info(cap_loc_addr INTEGER NOT NULL, cap_loc_path_id INTEGER NOT NULL,
+    cap_addr INTEGER NOT NULL, perms INTEGER NOT NULL, base INTEGER NOT NULL, top INTEGER NOT NULL,
+    snapshot_id INTEGER);
+CREATE INDEX cap_info_snapshot_loc ON cap_info(snapshot_id, cap_loc_addr, perms);
+CREATE INDEX cap_info_snapshot_path ON cap_info(snapshot_id, cap_loc_path_id);
+CREATE VIEW vm_with_path AS SELECT v.start_addr, v.end_addr, p.path AS mmap_path, v.compart_id,
+    v.kve_protection, v.mmap_flags, v.vnode_type, v.plt_addr, v.plt_size, v.got_addr, v.got_size,
+    v.snapshot_id FROM vm v JOIN paths p ON p.path_id = v.mmap_path_id;
+CREATE VIEW cap_info_with_path AS SELECT c.cap_loc_addr, p.path AS cap_loc_path, c.cap_addr, c.perms,
+    c.base, c.top, c.snapshot_id FROM cap_info c JOIN paths p ON p.path_id = c.cap_loc_path_id;
+CREATE TABLE snapshot(snapshot_id INTEGER PRIMARY KEY, pid INTEGER, started INTEGER,
+    command VARCHAR, duration REAL);
+INSERT INTO snapshot VALUES(1, 0, 0, 'gen_fixture_db.py', NULL);
+"""
+
+# CAP_PERM_* combinations, see cap_decode.h
+PERMS = [0x1 | 0x8, 0x1 | 0x2 | 0x8 | 0x10, 0x1 | 0x4 | 0x8, 0x1 | 0x2 | 0x4 | 0x8 | 0x10 | 0x20, 0x2]
+
+VM_BASE = 0x40000000
+VM_SIZE = 0x100000
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: gen_fixture_db.py <db file> [vm entries] [capabilities]")
+    path = sys.argv[1]
+    nvm = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+    ncaps = int(sys.argv[3]) if len(sys.argv) > 3 else 1000000
+
+    if os.path.exists(path):
+        os.remove(path)
+    random.seed(1)
+    db = sqlite3.connect(path)
+    db.executescript(SCHEMA)
+    db.execute("PRAGMA user_version = %d" % SCHEMA_VERSION)
+
+    # Four vm entries per library, path_id n is /usr/lib/lib<n-1>.so
+    nlibs = (nvm + 3) // 4
+    db.executemany("INSERT INTO paths VALUES (?,?,?,'')",
+                   [(n + 1, "/usr/lib/lib%d.so" % n, "lib%d.so" % n) for n in range(nlibs)])
+
+    vms = []
+    for i in range(nvm):
+        start = VM_BASE + i * VM_SIZE
+        vms.append((start, start + VM_SIZE, i // 4 + 1, i // 16, 0x1f, 0, 2, None, None, None, None, 1))
+    db.executemany("INSERT INTO vm VALUES (?,?,?,?,?,?,?,?,?,?,?,?)", vms)
+
+    def caps():
+        for _ in range(ncaps):
+            vm = vms[random.randrange(nvm)]
+            loc = vm[0] + random.randrange(VM_SIZE // 16) * 16
+            target = vms[random.randrange(nvm)]
+            addr = target[0] + random.randrange(VM_SIZE // 16) * 16
+            yield (loc, vm[2], addr, random.choice(PERMS), target[0], target[1], 1)
+    db.executemany("INSERT INTO cap_info VALUES (?,?,?,?,?,?,?)", caps())
+    db.commit()
+    db.close()
+
+if __name__ == "__main__":
+    main()
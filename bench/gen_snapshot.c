@@ -0,0 +1,460 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Generates the snapshot of a synthetic process of any size, to benchmark
+ * chericat at scales no real process has to be found for: a number of vm
+ * entries, of which three in four belong to mapped libraries, with a given
+ * share of their writable pages holding a run of capabilities, a mix of
+ * permissions, the libraries spread over a number of compartments, and a
+ * symbol table of a given size for each library.
+ *
+ * The synthetic target is scanned by a scan_pool as a traced process would
+ * be, through a target_recorder. The pages it reads are written to the raw
+ * snapshot (-o), the reads themselves to the record file (-R) that ingest
+ * replays, and the raw snapshot is then ingested into the database (-f),
+ * with the symbols of the libraries made up as they are stored.
+ * The capabilities and tags are worked out from their address and the seed,
+ * so the same options always give the same snapshot.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o gen_snapshot gen_snapshot.c \
+ *     ../src/target_log.c ../src/snapshot_ingest.c ../src/raw_snapshot.c \
+ *     ../src/scan_pool.c ../src/mpmc_ring.c ../src/tag_scan.c ../src/cap_decode.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3 \
+ *     -lpthread
+ * ./gen_snapshot -o synth.raw [-R synth.rec] [-f synth.db] [-m vm entries]
+ *     [-P pages per entry] [-t % of pages with capabilities] [-c capabilities per page]
+ *     [-x ro:rw:rx:rwx] [-C compartments] [-s symbols per library] [-S seed] [-j workers]
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+#include "raw_snapshot.h"
+#include "scan_pool.h"
+#include "snapshot_ingest.h"
+#include "synthetic_cap.h"
+#include "tag_scan.h"
+#include "target_log.h"
+
+#define VM_BASE		0x40000000ULL
+#define LIB_FORMAT	"/usr/lib/libsynth%d.so.1"
+#define LIB_PATH_SIZE	64
+
+/* The vm entries of a library: text, data, .got and its anonymous bss */
+#define LIB_ENTRIES	4
+
+static int nvm = 1000;
+static u_long pages_per_vm = 16;
+static int tagged_percent = 25;
+static int caps_per_page = 8;
+static int mix_weights[4] = { 4, 4, 1, 1 };
+static int ncomparts = 8;
+static int syms_per_lib = 1000;
+static uint64_t seed = 1;
+
+/* The vm entries of the synthetic process, and their paths */
+static raw_vm_entry *vms;
+static char (*paths)[LIB_PATH_SIZE];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* splitmix64, the value of a page or slot of the target for the seed */
+static uint64_t mix(uint64_t x)
+{
+	x += seed * 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* Every fourth group of entries is a heap, the others are a library */
+static int entry_lib(int i)
+{
+	int group = i / LIB_ENTRIES;
+
+	if (group % 4 == 3) {
+		return -1;
+	}
+	return group - group/4;
+}
+
+static int vm_has_caps(int i)
+{
+	return vms[i].protection & 2;
+}
+
+/* The first slot and number of the capabilities of page, 0 if it holds none */
+static int page_caps(u_long page, int *first_slot)
+{
+	uint64_t h = mix(page);
+
+	if (h % 100 >= (uint64_t)tagged_percent) {
+		return 0;
+	}
+	*first_slot = (h >> 32) % (TAG_SCAN_TAGS_PER_PAGE - caps_per_page + 1);
+	return caps_per_page;
+}
+
+static ssize_t read_synthetic_tags(void *arg, u_long start, unsigned char *tagsbuf, size_t len)
+{
+	memset(tagsbuf, 0, len);
+	for (size_t i=0; i<len/TAG_SCAN_BYTES_PER_PAGE; i++) {
+		unsigned char *tags = &tagsbuf[i*TAG_SCAN_BYTES_PER_PAGE];
+		int first;
+		int n = page_caps(start + i*TAG_SCAN_PAGE_SIZE, &first);
+		for (int slot=first; slot<first+n; slot++) {
+			tags[slot/8] |= 1 << (slot%8);
+		}
+	}
+	return len;
+}
+
+/* A capability to a slot of any vm entry, with a permission mix picked by weight */
+static int read_synthetic_caps(void *arg, u_long addr, unsigned char *capbuf, int nslots)
+{
+	int total = mix_weights[0] + mix_weights[1] + mix_weights[2] + mix_weights[3];
+
+	for (int i=0; i<nslots; i++) {
+		u_long loc = addr + i*TAG_SCAN_GRANULE_SIZE;
+		uint64_t h = mix(loc);
+		const raw_vm_entry *vm = &vms[h % nvm];
+		uint64_t target = vm->start + ((h >> 20) % ((vm->end - vm->start) / 16)) * 16;
+		int w = (h >> 48) % total;
+		int m = 0;
+		while (w >= mix_weights[m]) {
+			w -= mix_weights[m++];
+		}
+
+		unsigned char *slot = &capbuf[i*CAP_DECODE_SLOT_SIZE];
+		slot[0] = 1;
+		synthetic_cap(&slot[1], target, m);
+	}
+	return 0;
+}
+
+static int read_synthetic_data(void *arg, u_long addr, void *buf, size_t len)
+{
+	return -1;
+}
+
+static void make_vm_map(void)
+{
+	vms = calloc(nvm, sizeof(raw_vm_entry));
+	paths = calloc(nvm, sizeof(*paths));
+	if (vms == NULL || paths == NULL) {
+		errx(1, "Cannot allocate %d vm entries", nvm);
+	}
+
+	uint64_t size = pages_per_vm*TAG_SCAN_PAGE_SIZE;
+	uint64_t reservation = VM_BASE;
+	for (int i=0; i<nvm; i++) {
+		raw_vm_entry *vm = &vms[i];
+		int lib = entry_lib(i);
+		int k = i % LIB_ENTRIES;
+
+		vm->start = VM_BASE + i*(size + TAG_SCAN_PAGE_SIZE);
+		vm->end = vm->start + size;
+		if (k == 0) {
+			reservation = vm->start;
+		}
+		vm->reservation = reservation;
+		vm->protection = k == 0 && lib >= 0 ? 5 : 3;
+		vm->type = lib >= 0 && k < 3 ? 2 : 1;
+		if (lib >= 0 && k < 3) {
+			snprintf(paths[i], LIB_PATH_SIZE, LIB_FORMAT, lib);
+		}
+		vm->path = paths[i];
+	}
+}
+
+static void write_rtld_records(raw_writer *writer)
+{
+	for (int i=0; i<nvm; i+=LIB_ENTRIES) {
+		int lib = entry_lib(i);
+		if (lib < 0) {
+			continue;
+		}
+		int last = i + LIB_ENTRIES - 1 < nvm ? i + LIB_ENTRIES - 1 : nvm - 1;
+		raw_linkmap_obj obj = { lib % ncomparts + 1, vms[i].start, vms[last].end, paths[i] };
+		raw_write_linkmap_obj(writer, &obj);
+	}
+
+	// Compartment c holds libraries c-1, c-1+ncomparts, ..., named after the first
+	char name[LIB_PATH_SIZE];
+	for (int c=1; c<=ncomparts; c++) {
+		int first = -1;
+		for (int i=0; i<nvm && first < 0; i+=LIB_ENTRIES) {
+			if (entry_lib(i) == c-1) {
+				first = i;
+			}
+		}
+		if (first < 0) {
+			break;
+		}
+		snprintf(name, sizeof(name), "libsynth%d.so.1", c-1);
+		raw_compart compart = { c, 0, 1, vms[first].start, vms[first].end, name, name };
+		raw_write_compart(writer, &compart);
+	}
+}
+
+/* The raw snapshot and record file being written by the scan */
+typedef struct gen_output {
+	raw_writer raw;
+	u_long pages;
+	u_long caps;
+} gen_output;
+
+/* Writes the capabilities of a page as scan_mem_raw does */
+static void write_page(void *arg, const raw_page *raw)
+{
+	gen_output *out = arg;
+	unsigned char caps[RAW_TAGS_PER_PAGE*RAW_CAP_SIZE];
+	int ncaps = 0;
+
+	for (int slot=raw->first_slot; slot<TAG_SCAN_TAGS_PER_PAGE; slot++) {
+		if ((raw->tags[slot/8] & (1 << (slot%8))) == 0) {
+			continue;
+		}
+		memcpy(&caps[ncaps*RAW_CAP_SIZE],
+		    &raw->slots[(slot-raw->first_slot)*CAP_DECODE_SLOT_SIZE + 1], RAW_CAP_SIZE);
+		ncaps++;
+	}
+
+	raw_page_caps page = { raw->page, raw->tags, caps, ncaps };
+	raw_write_page(&out->raw, &page);
+	out->pages++;
+	out->caps += ncaps;
+}
+
+static void open_output(raw_writer *writer, const char *path)
+{
+	raw_snapshot_header header = {
+		.page_size = TAG_SCAN_PAGE_SIZE,
+		.cap_size = CAP_DECODE_CAP_SIZE,
+		.machine = RAW_MACHINE_AARCH64,
+		.pid = 1000,
+		.timestamp = time(NULL),
+	};
+	if (raw_writer_open(writer, path, &header) != 0) {
+		errx(1, "Unable to create %s", path);
+	}
+	for (int i=0; i<nvm; i++) {
+		raw_write_vm_entry(writer, &vms[i]);
+	}
+}
+
+static void close_output(raw_writer *writer, const char *path, u_long pages, u_long caps)
+{
+	raw_snapshot_end end = { pages, caps, 0 };
+
+	raw_write_end(writer, &end);
+	if (raw_writer_close(writer) != 0) {
+		errx(1, "Unable to write %s", path);
+	}
+}
+
+/* Stores syms_per_lib made-up symbols for the library at path */
+static int synthetic_elf(sqlite3 *db, const char *path, uint64_t base, ingest_elf_sections *sections)
+{
+	int lib;
+
+	if (sscanf(path, LIB_FORMAT, &lib) != 1) {
+		return -1;
+	}
+	uint64_t size = pages_per_vm*TAG_SCAN_PAGE_SIZE;
+	elf_file_info file = {
+		.source_path = path,
+		.dev = 0x5e,
+		.ino = lib + 1,
+		.mtime = (int64_t)seed,
+		.size = syms_per_lib,
+	};
+
+	if (elf_file_find(db, &file) == 0) {
+		sym_writer writer;
+		char name[64];
+
+		if (elf_file_insert(db, &file) == 0 || sym_writer_open(db, &writer, file.elf_id) != 0) {
+			return -1;
+		}
+		for (int k=0; k<syms_per_lib; k++) {
+			uint64_t value = (uint64_t)k * (size / syms_per_lib) & ~15ULL;
+			int func = k % 4 != 3;
+			snprintf(name, sizeof(name), "%s_%d_%d", func ? "synth_func" : "synth_obj", lib, k);
+			sym_writer_insert(&writer, path, name, value, func ? " 12" : " 20", func ? "FUNC" : "OBJECT",
+			    "GLOBAL", value, 16);
+		}
+		sym_writer_close(&writer);
+
+		// The .plt closes the text entry, the .got is the third entry of the library
+		file.plt_addr = size - 0x100;
+		file.plt_size = 0x100;
+		file.got_addr = 2*(size + TAG_SCAN_PAGE_SIZE);
+		file.got_size = size;
+		elf_file_set_sections(db, &file);
+	}
+	snapshot_elf_add(db, file.elf_id, base);
+
+	sections->plt_addr = base + file.plt_addr;
+	sections->plt_size = file.plt_size;
+	sections->got_addr = base + file.got_addr;
+	sections->got_size = file.got_size;
+	return 0;
+}
+
+static void usage(void)
+{
+	errx(1, "usage: gen_snapshot -o raw [-R record] [-f db] [-m vm entries] [-P pages per entry] "
+	    "[-t %% of pages with capabilities] [-c capabilities per page] [-x ro:rw:rx:rwx] "
+	    "[-C compartments] [-s symbols per library] [-S seed] [-j workers]");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *raw_path = NULL;
+	const char *record_path = NULL;
+	const char *db_path = NULL;
+	int workers = 4;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:R:f:m:P:t:c:x:C:s:S:j:")) != -1) {
+		switch (opt) {
+		case 'o': raw_path = optarg; break;
+		case 'R': record_path = optarg; break;
+		case 'f': db_path = optarg; break;
+		case 'm': nvm = atoi(optarg); break;
+		case 'P': pages_per_vm = strtoul(optarg, NULL, 10); break;
+		case 't': tagged_percent = atoi(optarg); break;
+		case 'c': caps_per_page = atoi(optarg); break;
+		case 'x':
+			if (sscanf(optarg, "%d:%d:%d:%d", &mix_weights[0], &mix_weights[1], &mix_weights[2],
+			    &mix_weights[3]) != 4) {
+				usage();
+			}
+			break;
+		case 'C': ncomparts = atoi(optarg); break;
+		case 's': syms_per_lib = atoi(optarg); break;
+		case 'S': seed = strtoull(optarg, NULL, 10); break;
+		case 'j': workers = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (raw_path == NULL || nvm < 1 || pages_per_vm < 1 || tagged_percent < 0 || tagged_percent > 100 ||
+	    caps_per_page < 1 || caps_per_page > TAG_SCAN_TAGS_PER_PAGE || ncomparts < 1 || syms_per_lib < 1 ||
+	    workers < 1 || workers > SCAN_POOL_MAX_WORKERS ||
+	    mix_weights[0] + mix_weights[1] + mix_weights[2] + mix_weights[3] < 1) {
+		usage();
+	}
+	set_print_level(NOPRINT);
+	make_vm_map();
+
+	// Scan the synthetic target into the raw snapshot, recording its reads
+	double start = now();
+	gen_output out = {};
+	raw_writer record;
+	target_recorder recorder;
+	scan_target target = { read_synthetic_tags, read_synthetic_caps, read_synthetic_data, NULL };
+
+	open_output(&out.raw, raw_path);
+	write_rtld_records(&out.raw);
+	if (record_path != NULL) {
+		scan_target live = target;
+		open_output(&record, record_path);
+		write_rtld_records(&record);
+		target_recorder_init(&recorder, &live, &record, &target);
+	}
+
+	cap_scan_stats scan_stats = {};
+	scan_pool *pool = scan_pool_create(&target, NULL, workers);
+	scan_pool_set_page_sink(pool, write_page, &out);
+	for (int i=0; i<nvm; i++) {
+		if (!vm_has_caps(i)) {
+			continue;
+		}
+		scan_pool_add(pool, vms[i].start, vms[i].end, vms[i].path);
+		if (record_path != NULL) {
+			target_recorder_range(&recorder, vms[i].start, vms[i].end);
+		}
+	}
+	scan_pool_run(pool, &scan_stats);
+	scan_pool_free(pool);
+
+	close_output(&out.raw, raw_path, out.pages, out.caps);
+	if (record_path != NULL) {
+		target_recorder_destroy(&recorder);
+		close_output(&record, record_path, 0, 0);
+	}
+	printf("%s: %d vm entries, %lu pages with %lu capabilities in %.3fs\n", raw_path, nvm, out.pages, out.caps,
+	    now() - start);
+	if (record_path != NULL) {
+		printf("%s: %lu reads recorded\n", record_path, recorder.reads);
+	}
+
+	if (db_path != NULL) {
+		sqlite3 *db;
+		ingest_stats stats;
+
+		start = now();
+		unlink(db_path);
+		dbname = (char *)db_path;
+		if (open_db((char *)db_path, &db) != 0 ||
+		    ingest_snapshot(db, raw_path, workers, synthetic_elf, &stats) != 0) {
+			errx(1, "Unable to ingest %s into %s", raw_path, db_path);
+		}
+		sqlite3_close(db);
+		printf("%s: %lu capabilities, %lu libraries with %d symbols each in %.3fs\n", db_path, stats.caps,
+		    stats.elf_files, syms_per_lib, now() - start);
+	}
+
+	free(vms);
+	free(paths);
+	return 0;
+}
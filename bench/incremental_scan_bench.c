@@ -0,0 +1,234 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Measures the incremental scan (-I) against a full scan of the same target,
+ * replayed from a fixture of pages held in memory rather than read from a
+ * traced process. Between two generations of the fixture a given percentage
+ * of the pages have one of their capabilities changed, and a few pages come
+ * and go.
+ *
+ * Each scan takes a new snapshot. A full scan decodes and writes all the
+ * capabilities again, the incremental scan goes through scan_delta, as -I
+ * does, and copies the capabilities of the unchanged pages from the previous
+ * snapshot. Both write to the same kind of database inside a transaction,
+ * the time of reading the target is left out.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o incremental_scan_bench \
+ *     incremental_scan_bench.c ../src/scan_delta.c ../src/scan_pool.c \
+ *     ../src/mpmc_ring.c ../src/tag_scan.c ../src/cap_decode.c ../src/db_process.c \
+ *     ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3 -lpthread
+ * ./incremental_scan_bench [pages] [caps per page] [generations]
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+#include "scan_delta.h"
+#include "scan_pool.h"
+#include "synthetic_cap.h"
+#include "tag_scan.h"
+
+#define VM_BASE		0x40000000UL
+
+static u_long npages = 16384;
+static int caps_per_page = 32;
+static int generations = 4;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_page(raw_page *raw, u_long page)
+{
+	memset(raw->tags, 0, sizeof(raw->tags));
+	raw->page = page;
+	raw->path = "Heap(others)";
+	raw->first_slot = 0;
+
+	int stride = TAG_SCAN_TAGS_PER_PAGE / caps_per_page;
+	for (int i=0; i<caps_per_page; i++) {
+		int slot = i*stride;
+		unsigned char *bytes = &raw->slots[slot*CAP_DECODE_SLOT_SIZE];
+		raw->tags[slot/8] |= 1 << (slot%8);
+		bytes[0] = 1;
+		synthetic_cap(&bytes[1], page + 0x2000 + i*0x40, i);
+	}
+}
+
+/*
+ * next_generation
+ * Changes the first capability of churn percent of the pages, and swaps the
+ * presence of one page in a hundred of those.
+ */
+static void next_generation(raw_page *pages, int *present, int churn, unsigned int *seed)
+{
+	for (u_long p=0; p<npages; p++) {
+		if (rand_r(seed) % 100 >= churn) {
+			continue;
+		}
+		if (rand_r(seed) % 100 == 0) {
+			present[p] = !present[p];
+		}
+		synthetic_cap(&pages[p].slots[1], pages[p].page + (rand_r(seed) % 0x1000), rand_r(seed));
+	}
+}
+
+static void write_capability(void *arg, u_long cap_loc_addr, const cap_decoded *cap)
+{
+	cap_writer_insert(arg, cap_loc_addr, "Heap(others)", cap->addr, cap->perms, cap->base, cap->top);
+}
+
+static double full_scan(sqlite3 *db, raw_page *pages, int *present)
+{
+	double start = now();
+	cap_writer writer;
+
+	begin_transaction(db);
+	int64_t snapshot_id = snapshot_begin(db, 1000, 0);
+	assert(snapshot_id != 0);
+	int rc = cap_writer_open(db, &writer);
+	assert(rc == 0);
+	for (u_long p=0; p<npages; p++) {
+		if (present[p]) {
+			decode_page_caps(&pages[p], write_capability, &writer);
+		}
+	}
+	cap_writer_close(&writer);
+	commit_transaction(db);
+	return now() - start;
+}
+
+static double incremental_scan(sqlite3 *db, raw_page *pages, int *present, scan_delta *delta)
+{
+	double start = now();
+
+	begin_transaction(db);
+	int64_t previous_id = scan_delta_previous(db, 1000);
+	int64_t snapshot_id = snapshot_begin(db, 1000, 0);
+	assert(snapshot_id != 0);
+	int rc = scan_delta_open(db, delta, 1000, previous_id);
+	assert(rc == 0);
+	for (u_long p=0; p<npages; p++) {
+		if (present[p]) {
+			scan_delta_page(delta, &pages[p]);
+		}
+	}
+	scan_delta_close(delta);
+	commit_transaction(db);
+	return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+
+	static const int churns[] = { 0, 1, 10, 50, 100 };
+
+	if (argc > 1) {
+		npages = strtoul(argv[1], NULL, 10);
+	}
+	if (argc > 2) {
+		caps_per_page = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		generations = atoi(argv[3]);
+	}
+	if (caps_per_page < 1 || caps_per_page > TAG_SCAN_TAGS_PER_PAGE) {
+		caps_per_page = 32;
+	}
+	set_print_level(NOPRINT);
+
+	raw_page *pages = malloc(npages * sizeof(raw_page));
+	int *present = malloc(npages * sizeof(int));
+	assert(pages != NULL && present != NULL);
+
+	printf("%lu pages of %d capabilities, %d generations\n", npages, caps_per_page, generations);
+	printf("%8s %10s %14s %10s %10s\n", "CHURN%", "FULL_S", "INCREMENTAL_S", "SPEEDUP", "CHANGED");
+
+	for (size_t c=0; c<sizeof(churns)/sizeof(churns[0]); c++) {
+		sqlite3 *full_db, *delta_db;
+		scan_delta delta;
+		unsigned int seed = 1;
+		double full_time = 0, delta_time = 0;
+		u_long changed = 0;
+
+		for (u_long p=0; p<npages; p++) {
+			fill_page(&pages[p], VM_BASE + p*TAG_SCAN_PAGE_SIZE);
+			present[p] = 1;
+		}
+		rc = sqlite3_open(":memory:", &full_db);
+		assert(rc == SQLITE_OK);
+		rc = sqlite3_open(":memory:", &delta_db);
+		assert(rc == SQLITE_OK);
+		rc = migrate_db(full_db);
+		assert(rc == 0);
+		rc = migrate_db(delta_db);
+		assert(rc == 0);
+		create_vm_cap_db(full_db);
+		create_vm_cap_db(delta_db);
+
+		// The first generation is written in full by both
+		full_scan(full_db, pages, present);
+		incremental_scan(delta_db, pages, present, &delta);
+
+		for (int g=0; g<generations; g++) {
+			next_generation(pages, present, churns[c], &seed);
+			full_time += full_scan(full_db, pages, present);
+			delta_time += incremental_scan(delta_db, pages, present, &delta);
+			changed += delta.changed + delta.removed;
+		}
+		assert(cap_info_count(full_db) == cap_info_count(delta_db));
+
+		printf("%8d %10.3f %14.3f %9.2fx %10lu\n", churns[c], full_time, delta_time,
+		    full_time / delta_time, changed / generations);
+		sqlite3_close(full_db);
+		sqlite3_close(delta_db);
+	}
+	free(pages);
+	free(present);
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Measures the ingest of raw snapshots in MB/s of snapshot input, for an
+ * increasing number of decoding workers. A synthetic snapshot is written
+ * first: vm entries whose pages hold a fixed number of capabilities each,
+ * which is then ingested into a fresh in-memory database for each run.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o ingest_bench ingest_bench.c \
+ *     ../src/snapshot_ingest.c ../src/raw_snapshot.c ../src/target_log.c \
+ *     ../src/scan_pool.c ../src/mpmc_ring.c ../src/tag_scan.c ../src/cap_decode.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3 \
+ *     -lpthread
+ * ./ingest_bench [max workers] [pages] [caps per page]
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_process.h"
+#include "raw_snapshot.h"
+#include "scan_pool.h"
+#include "snapshot_ingest.h"
+#include "synthetic_cap.h"
+
+#define VM_BASE		0x40000000ULL
+#define VM_PAGES	1024
+
+static u_long pages = 65536;
+static int caps_per_page = 32;
+
+static void write_snapshot(const char *path)
+{
+	raw_writer writer;
+	raw_snapshot_header header = { .page_size = 4096, .cap_size = 16, .machine = RAW_MACHINE_AARCH64 };
+	unsigned char tags[RAW_TAG_BYTES_PER_PAGE];
+	unsigned char *caps = malloc(RAW_TAGS_PER_PAGE*RAW_CAP_SIZE);
+	int rc;
+
+	assert(caps != NULL);
+	rc = raw_writer_open(&writer, path, &header);
+	assert(rc == 0);
+	for (u_long p=0; p<pages; p+=VM_PAGES) {
+		uint64_t start = VM_BASE + p*0x1000;
+		raw_vm_entry vm = { start, start + VM_PAGES*0x1000ULL, start, 3, 0, 1, "" };
+		rc = raw_write_vm_entry(&writer, &vm);
+		assert(rc == 0);
+	}
+
+	// The capabilities are spread evenly over the slots of each page
+	memset(tags, 0, sizeof(tags));
+	int stride = RAW_TAGS_PER_PAGE / caps_per_page;
+	for (int i=0; i<caps_per_page; i++) {
+		tags[(i*stride)/8] |= 1 << ((i*stride)%8);
+	}
+	for (u_long p=0; p<pages; p++) {
+		uint64_t page = VM_BASE + p*0x1000;
+		for (int i=0; i<caps_per_page; i++) {
+			synthetic_cap(&caps[i*RAW_CAP_SIZE], page + 0x2000 + i*0x40, i);
+		}
+		raw_page_caps raw = { page, tags, caps, caps_per_page };
+		rc = raw_write_page(&writer, &raw);
+		assert(rc == 0);
+	}
+	raw_snapshot_end end = { pages, pages*caps_per_page, 0 };
+	rc = raw_write_end(&writer, &end);
+	assert(rc == 0);
+	rc = raw_writer_close(&writer);
+	assert(rc == 0);
+	free(caps);
+}
+
+int main(int argc, char *argv[])
+{
+	int max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	char path[] = "/tmp/ingest_benchXXXXXX";
+	int rc;
+
+	if (argc > 1) {
+		max_workers = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		pages = strtoul(argv[2], NULL, 10);
+	}
+	if (argc > 3) {
+		caps_per_page = atoi(argv[3]);
+	}
+	if (max_workers < 1 || max_workers > SCAN_POOL_MAX_WORKERS) {
+		max_workers = 1;
+	}
+	if (caps_per_page < 1 || caps_per_page > RAW_TAGS_PER_PAGE) {
+		caps_per_page = 32;
+	}
+	set_print_level(NOPRINT);
+
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+	write_snapshot(path);
+
+	printf("%lu pages of %d capabilities, %ld CPUs\n", pages, caps_per_page, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%8s %10s %10s %10s %12s %8s\n", "WORKERS", "MB", "SECONDS", "MB/S", "CAPS/S", "SPEEDUP");
+
+	double first_time = 0;
+	for (int workers=1; ; workers = workers*2 > max_workers ? max_workers : workers*2) {
+		sqlite3 *db;
+		ingest_stats stats;
+
+		rc = sqlite3_open(":memory:", &db);
+		assert(rc == SQLITE_OK);
+		rc = migrate_db(db);
+		assert(rc == 0);
+		rc = ingest_snapshot(db, path, workers, NULL, &stats);
+		assert(rc == 0);
+		assert(stats.caps == pages*caps_per_page);
+		sqlite3_close(db);
+
+		double mb = stats.bytes / (1024.0*1024.0);
+		if (workers == 1) {
+			first_time = stats.seconds;
+		}
+		printf("%8d %10.1f %10.3f %10.1f %12.0f %7.2fx\n", workers, mb, stats.seconds,
+		    mb / stats.seconds, stats.caps / stats.seconds, first_time / stats.seconds);
+		if (workers == max_workers) {
+			break;
+		}
+	}
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,122 @@
+#!/bin/sh
+#-
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (c) 2023 Jessica Man
+#
+# This software was developed by the University of Cambridge Computer
+# Laboratory (Department of Computer Science and Technology) as part of the
+# CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+# EPSRC grant EP/V000292/1.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+#
+
+#
+# Times chericat on synthetic snapshots made by gen_snapshot, one row per
+# size, and prints the seconds taken by each step as a table:
+#
+#   gen      gen_snapshot writing the raw snapshot, record file and database
+#   ingest   "ingest" of the raw snapshot into a new database
+#   replay   "ingest" of the record file, replaying the scan
+#   vm_lib   -v show lib      vm_comp  -v show comp
+#   caps_lib -i <lib> show lib
+#   graph    the compartment graphs of python/comparts_graph.py, without
+#            rendering them, if the graphviz module is there
+#
+# A size is <vm entries>:<pages per entry>, the other gen_snapshot options
+# can be given in GEN_FLAGS. This is run by "make bench".
+#
+# usage: run_bench.sh <chericat> [size ...]
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: run_bench.sh <chericat> [size ...]" >&2
+	exit 1
+fi
+chericat=$(realpath "$1")
+shift
+sizes=${*:-"1000:16 10000:16 100000:16"}
+
+benchdir=$(dirname $(realpath "$0"))
+workdir=${BENCH_DIR:-$(mktemp -d /tmp/chericat_bench.XXXXXX)}
+jobs=${BENCH_JOBS:-4}
+gen=$workdir/gen_snapshot
+
+${CC:-cc} -O2 -D_GNU_SOURCE -I$benchdir/../includes -o $gen $benchdir/gen_snapshot.c \
+    $benchdir/../src/target_log.c $benchdir/../src/snapshot_ingest.c $benchdir/../src/raw_snapshot.c \
+    $benchdir/../src/scan_pool.c $benchdir/../src/mpmc_ring.c $benchdir/../src/tag_scan.c \
+    $benchdir/../src/cap_decode.c $benchdir/../src/db_process.c $benchdir/../src/arena.c $benchdir/../src/common.c \
+    $benchdir/../src/run_stats.c -lsqlite3 -lpthread
+
+# Seconds taken by a command, its output is discarded. GNU date is used where
+# there is no time(1), as on some Linux hosts.
+timed() {
+	if [ -x /usr/bin/time ]; then
+		/usr/bin/time -p -o $workdir/time "$@" >/dev/null 2>&1 || echo "$* failed" >&2
+		awk '/^real/ { print $2 }' $workdir/time
+	else
+		start=$(date +%s.%N)
+		"$@" >/dev/null 2>&1 || echo "$* failed" >&2
+		echo "$start $(date +%s.%N)" | awk '{ printf "%.2f\n", $2 - $1 }'
+	fi
+}
+
+timed_graph() {
+	if [ "${BENCH_GRAPHS:-1}" = 0 ] || ! python3 -c "import graphviz" 2>/dev/null; then
+		echo "-"
+		return
+	fi
+	PYTHONPATH=$benchdir/../python python3 -c "
+import sys, time, graphviz, comparts_graph, db_utils
+start = time.perf_counter()
+snapshot = db_utils.latest_snapshot(sys.argv[1])
+comparts_graph.show_comparts(sys.argv[1], snapshot, graphviz.Digraph('G'))
+comparts_graph.show_comparts_has_caps(sys.argv[1], snapshot, graphviz.Digraph('G'))
+print('%.2f' % (time.perf_counter() - start))" "$1" 2>/dev/null || echo "failed"
+}
+
+printf "%8s %6s %10s %8s %8s %8s %8s %8s %8s %8s\n" \
+    vm pages caps gen ingest replay vm_lib vm_comp caps_lib graph
+for size in $sizes; do
+	nvm=${size%%:*}
+	pages=${size##*:}
+	base=$workdir/synth_$nvm
+
+	rm -f $base.db $base.ingest.db $base.replay.db
+	t_gen=$(timed $gen -o $base.raw -R $base.rec -f $base.db -m $nvm -P $pages -j $jobs $GEN_FLAGS)
+	caps=$(sqlite3 $base.db "SELECT COUNT(*) FROM cap_info;" 2>/dev/null || echo "?")
+	t_ingest=$(timed $chericat -f $base.ingest.db -j $jobs ingest $base.raw)
+	t_replay=$(timed $chericat -f $base.replay.db -j $jobs ingest $base.rec)
+	t_vm_lib=$(timed $chericat -f $base.db -v show lib)
+	t_vm_comp=$(timed $chericat -f $base.db -v show comp)
+	t_caps_lib=$(timed $chericat -f $base.db -i libsynth0.so.1 show lib)
+	t_graph=$(timed_graph $base.db)
+
+	printf "%8s %6s %10s %8s %8s %8s %8s %8s %8s %8s\n" \
+	    $nvm $pages $caps $t_gen $t_ingest $t_replay $t_vm_lib $t_vm_comp $t_caps_lib $t_graph
+done
+
+if [ -z "$BENCH_DIR" ]; then
+	rm -rf $workdir
+fi
@@ -0,0 +1,227 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Measures how the capability scan scales with the number of scan_pool
+ * workers, against a synthetic target instead of a traced process: a number
+ * of vm entries whose pages have a fixed pattern of tags, and capabilities
+ * made up from their own address. Every tag or capability read request costs
+ * a fixed time, which stands for the cost of a PT_IO request. The cost is
+ * spent on the CPU by default, as ptrace copies in the kernel on the calling
+ * thread, or asleep with -s.
+ *
+ * READS is the time until the last read from the target, which is how long a
+ * traced process stays stopped, and SECONDS the time until the last
+ * capability is written. The counters of the pipeline stages are printed
+ * after each run.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o scan_pool_bench scan_pool_bench.c \
+ *     ../src/scan_pool.c ../src/mpmc_ring.c ../src/tag_scan.c ../src/cap_decode.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3 \
+ *     -lpthread
+ * ./scan_pool_bench [-s] [max workers] [vm entries] [pages per entry] [request us]
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+#include "scan_pool.h"
+#include "synthetic_cap.h"
+#include "tag_scan.h"
+
+#define VM_BASE		0x40000000UL
+#define VM_GAP		0x100000UL
+
+static int nvm = 64;
+static u_long pages_per_vm = 2048;
+static long request_ns = 5000;
+static int sleep_requests;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void request_cost(void)
+{
+	if (request_ns == 0) {
+		return;
+	}
+	if (sleep_requests) {
+		struct timespec ts = { 0, request_ns };
+		nanosleep(&ts, NULL);
+		return;
+	}
+	double until = now() + request_ns / 1e9;
+	while (now() < until) {
+	}
+}
+
+/* One page in four has tags, with 1 to 16 capabilities */
+static void page_tags(u_long page, unsigned char *tags)
+{
+	u_long n = page / TAG_SCAN_PAGE_SIZE;
+
+	memset(tags, 0, TAG_SCAN_BYTES_PER_PAGE);
+	if (n % 4 != 0) {
+		return;
+	}
+	for (u_long i=0; i<=(n/4)%16; i++) {
+		int slot = (n*7 + i*37) % TAG_SCAN_TAGS_PER_PAGE;
+		tags[slot/8] |= 1 << (slot%8);
+	}
+}
+
+static ssize_t read_synthetic_tags(void *arg, u_long start, unsigned char *tagsbuf, size_t len)
+{
+	request_cost();
+	for (size_t i=0; i<len/TAG_SCAN_BYTES_PER_PAGE; i++) {
+		page_tags(start + i*TAG_SCAN_PAGE_SIZE, &tagsbuf[i*TAG_SCAN_BYTES_PER_PAGE]);
+	}
+	return len;
+}
+
+static int read_synthetic_caps(void *arg, u_long addr, unsigned char *capbuf, int nslots)
+{
+	request_cost();
+	for (int i=0; i<nslots; i++) {
+		unsigned char *slot = &capbuf[i*CAP_DECODE_SLOT_SIZE];
+		slot[0] = 1;
+		synthetic_cap(&slot[1], addr + i*TAG_SCAN_GRANULE_SIZE + 0x1000, (addr >> 4) % 4);
+	}
+	return 0;
+}
+
+static double run(int workers, u_long *caps, double *reads, cap_scan_stats *stats)
+{
+	sqlite3 *db;
+	cap_writer writer;
+	scan_target target = { read_synthetic_tags, read_synthetic_caps, NULL, NULL };
+	int rc;
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	create_vm_cap_db(db);
+
+	double start = now();
+	begin_transaction(db);
+	rc = cap_writer_open(db, &writer);
+	assert(rc == 0);
+	scan_pool *pool = scan_pool_create(&target, &writer, workers);
+	for (int i=0; i<nvm; i++) {
+		u_long vm_start = VM_BASE + i*(pages_per_vm*TAG_SCAN_PAGE_SIZE + VM_GAP);
+		scan_pool_add(pool, vm_start, vm_start + pages_per_vm*TAG_SCAN_PAGE_SIZE, "/usr/lib/libsynthetic.so");
+	}
+	scan_pool_start(pool);
+	scan_pool_wait_reads(pool);
+	*reads = now() - start;
+	*caps = scan_pool_finish(pool, stats);
+	scan_pool_free(pool);
+	cap_writer_close(&writer);
+	commit_transaction(db);
+	double elapsed = now() - start;
+
+	assert(*caps == stats->caps);
+	assert(stats->write.items == stats->caps);
+	assert(cap_info_count(db) == (int)*caps);
+	sqlite3_close(db);
+	return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+		sleep_requests = 1;
+		argc--;
+		argv++;
+	}
+	if (argc > 1) {
+		max_workers = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		nvm = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		pages_per_vm = strtoul(argv[3], NULL, 10);
+	}
+	if (argc > 4) {
+		request_ns = atol(argv[4]) * 1000;
+	}
+	if (max_workers < 1 || max_workers > SCAN_POOL_MAX_WORKERS) {
+		max_workers = 1;
+	}
+	set_print_level(NOPRINT);
+
+	printf("%d vm entries of %lu pages, %ld us per request (%s), %ld CPUs\n",
+	    nvm, pages_per_vm, request_ns / 1000, sleep_requests ? "asleep" : "on the CPU",
+	    sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%8s %8s %10s %12s %8s\n", "WORKERS", "READS", "SECONDS", "CAPS/S", "SPEEDUP");
+
+	u_long first_caps = 0;
+	double first_time = 0;
+	for (int workers=1; ; workers = workers*2 > max_workers ? max_workers : workers*2) {
+		u_long caps;
+		double reads;
+		cap_scan_stats stats = {};
+		double elapsed = run(workers, &caps, &reads, &stats);
+		if (workers == 1) {
+			first_caps = caps;
+			first_time = elapsed;
+		}
+		// Every run finds the same capabilities
+		assert(caps == first_caps);
+		printf("%8d %8.3f %10.3f %12.0f %7.2fx\n", workers, reads, elapsed, caps / elapsed, first_time / elapsed);
+		printf("%8s read %lu pages (%lu stalls), decode %lu caps (%lu stalls, %lu idle), write %lu idle\n", "",
+		    stats.read.items, stats.read.stalls, stats.decode.items, stats.decode.stalls,
+		    stats.decode.idle, stats.write.idle);
+		if (workers == max_workers) {
+			break;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Times snapshot_diff_run on pairs of synthetic snapshots of growing size,
+ * the second one with 1% of the capabilities modified, 0.5% removed and
+ * 0.5% added. The time per capability must stay flat as the snapshots grow:
+ * both are read once, in address order, from the cap_info index.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o snapshot_diff_bench snapshot_diff_bench.c \
+ *     ../src/snapshot_diff.c ../src/compart_index.c ../src/db_process.c \
+ *     ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3
+ * ./snapshot_diff_bench [max caps] [db file]
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+#include "snapshot_diff.h"
+
+#define DEFAULT_MAX_CAPS	1000000
+#define STEPS			4
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *paths[] = {
+	"/usr/lib/libc.so.7", "/usr/lib/libthr.so.3", "/libexec/ld-elf.so.1", "Heap(others)", "Stack",
+};
+
+static void write_snapshot(sqlite3 *db, long ncaps, int changed)
+{
+	cap_writer writer;
+	int64_t snapshot_id;
+	int rc;
+
+	snapshot_id = snapshot_begin(db, 100, changed);
+	assert(snapshot_id != 0);
+	begin_transaction(db);
+	rc = cap_writer_open(db, &writer);
+	assert(rc == 0);
+	for (long i=0; i<ncaps; i++) {
+		u_long loc = 0x40000000UL + i*32;
+		u_long base = 0x50000000UL + (i % 1024)*0x1000;
+		uint32_t perms = CAP_PERM_LOAD | CAP_PERM_STORE;
+
+		if (changed) {
+			if (i % 200 == 0) {
+				continue;		// removed
+			}
+			if (i % 200 == 1) {
+				// added in between
+				cap_writer_insert(&writer, loc + 16, paths[(i / 4096) % 5], base, perms,
+				    base, base + 0x1000);
+			}
+			if (i % 100 == 2) {
+				perms = CAP_PERM_LOAD;	// modified
+			}
+		}
+		cap_writer_insert(&writer, loc, paths[(i / 4096) % 5], base + (i % 256)*16, perms,
+		    base, base + 0x1000);
+	}
+	cap_writer_close(&writer);
+	rc = snapshot_end(db, 0);
+	assert(rc == 0);
+	commit_transaction(db);
+}
+
+int main(int argc, char *argv[])
+{
+	long max_caps = argc > 1 ? atol(argv[1]) : DEFAULT_MAX_CAPS;
+	const char *file = argc > 2 ? argv[2] : "snapshot_diff_bench.db";
+	int rc;
+
+	set_print_level(NOPRINT);
+
+	printf("%10s %10s %10s %10s %10s %12s\n", "CAPS", "ADDED", "REMOVED", "MODIFIED", "SECONDS", "NS/CAP");
+	for (int step=STEPS-1; step>=0; step--) {
+		long ncaps = max_caps >> step;
+		sqlite3 *db;
+		snapshot_diff diff;
+
+		unlink(file);
+		rc = open_db((char *)file, &db);
+		assert(rc == 0);
+		create_vm_cap_db(db);
+		write_snapshot(db, ncaps, 0);
+		write_snapshot(db, ncaps, 1);
+
+		double start = now();
+		rc = snapshot_diff_run(db, 1, 2, NULL, NULL, &diff);
+		assert(rc == 0);
+		double elapsed = now() - start;
+
+		printf("%10ld %10lu %10lu %10lu %10.3f %12.1f\n", ncaps, diff.total.added, diff.total.removed,
+		    diff.total.modified, elapsed, elapsed * 1e9 / ncaps);
+		snapshot_diff_free(&diff);
+		sqlite3_close(db);
+	}
+
+	unlink(file);
+	return 0;
+}
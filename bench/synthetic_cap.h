@@ -0,0 +1,64 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Synthetic Morello capabilities for the benchmarks: a capability to the 256
+ * bytes around target, with one of four mixes of r, w and x permissions, as
+ * cap_decode_morello expects to find it in memory.
+ */
+
+#ifndef SYNTHETIC_CAP_H_
+#define SYNTHETIC_CAP_H_
+
+#include <stdint.h>
+
+#include "cap_decode.h"
+
+static inline void synthetic_cap(unsigned char *bytes, uint64_t target, int mix)
+{
+	// Load, store and execute are bits 63, 62 and 61 of the upper half
+	static const uint64_t perms[] = {
+		1ULL << 63, (1ULL << 63) | (1ULL << 62),
+		(1ULL << 63) | (1ULL << 61), (1ULL << 63) | (1ULL << 62) | (1ULL << 61),
+	};
+	uint64_t base = target & ~0xffULL;
+	uint64_t top = base + 0x100;
+	// Bit 94 set: the exponent is 0 and the bounds are stored as they are
+	uint64_t pesbt = perms[mix % 4] | (1ULL << 30) | ((top & 0x3fff) << 16) | (base & 0xffff);
+
+	for (int i=0; i<8; i++) {
+		bytes[i] = target >> (8*i);
+		bytes[8+i] = pesbt >> (8*i);
+	}
+}
+
+#endif //SYNTHETIC_CAP_H_
@@ -0,0 +1,138 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Times the per vm entry capability counts of the library overview (-v show
+ * lib) on a fixture database made by gen_fixture_db.py: the indexed range
+ * join of get_all_vm_cap_stats against the nested loop over every vm entry
+ * and every capability that it replaced. Both must give the same counts.
+ *
+ * cc -O2 -D_GNU_SOURCE -I../includes -o vm_caps_bench vm_caps_bench.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3
+ * ./gen_fixture_db.py fixture.db 1000 1000000 && ./vm_caps_bench fixture.db
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void nested_loop_stats(sqlite3 *db, vm_cap_stats *stats)
+{
+	arena strings_arena;
+	str_table strings;
+	vm_info *vms;
+	cap_info *caps;
+
+	arena_init(&strings_arena, 0);
+	str_table_init(&strings, &strings_arena);
+	int vm_count = get_all_vm_info(db, &strings, &vms);
+	int cap_count = get_all_cap_info(db, &strings, &caps);
+
+	for (int i=0; i<vm_count; i++) {
+		for (int j=0; j<cap_count; j++) {
+			if (caps[j].cap_loc_addr >= vms[i].start_addr && caps[j].cap_loc_addr < vms[i].end_addr) {
+				uint32_t rwx = caps[j].perms & (CAP_PERM_LOAD | CAP_PERM_STORE | CAP_PERM_EXECUTE);
+				stats[i].total++;
+				stats[i].ro += rwx == CAP_PERM_LOAD;
+				stats[i].rw += rwx == (CAP_PERM_LOAD | CAP_PERM_STORE);
+				stats[i].rx += rwx == (CAP_PERM_LOAD | CAP_PERM_EXECUTE);
+				stats[i].rwx += rwx == (CAP_PERM_LOAD | CAP_PERM_STORE | CAP_PERM_EXECUTE);
+			}
+		}
+	}
+	free(vms);
+	free(caps);
+	str_table_free(&strings);
+	arena_free(&strings_arena);
+}
+
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	int rc;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: vm_caps_bench <fixture db>\n");
+		return 1;
+	}
+	set_print_level(NOPRINT);
+	dbname = argv[1];
+	rc = open_db(dbname, &db);
+	assert(rc == 0);
+
+	int vm_count = vm_info_count(db);
+	int cap_count = cap_info_count(db);
+	printf("%s: %d vm entries, %d capabilities\n", dbname, vm_count, cap_count);
+
+	vm_cap_stats *joined;
+	double start = now();
+	rc = get_all_vm_cap_stats(db, &joined);
+	assert(rc == vm_count);
+	double t_join = now() - start;
+	printf("indexed range join: %.3fs\n", t_join);
+
+	vm_cap_stats *looped = calloc(vm_count, sizeof(vm_cap_stats));
+	start = now();
+	nested_loop_stats(db, looped);
+	double t_loop = now() - start;
+	printf("nested loop:        %.3fs (%.1fx)\n", t_loop, t_loop / t_join);
+
+	for (int i=0; i<vm_count; i++) {
+		assert(joined[i].total == looped[i].total);
+		assert(joined[i].ro == looped[i].ro);
+		assert(joined[i].rw == looped[i].rw);
+		assert(joined[i].rx == looped[i].rx);
+		assert(joined[i].rwx == looped[i].rwx);
+	}
+
+	free(joined);
+	free(looped);
+	sqlite3_close(db);
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/* Size of the blocks of an arena, unless given to arena_init */
+#define ARENA_DEFAULT_BLOCK_SIZE	(64*1024)
+
+typedef struct arena_block arena_block;
+
+/*
+ * Allocates the strings and records of a snapshot out of large blocks, which
+ * are all freed at once by arena_free rather than one by one. Nothing
+ * allocated from an arena can be freed or grown on its own. An arena is used
+ * by one thread at a time.
+ */
+typedef struct arena {
+	arena_block *blocks;	/* The block being filled first */
+	size_t block_size;
+	size_t used;		/* Bytes handed out */
+	size_t reserved;	/* Bytes of all the blocks */
+	u_long block_count;
+} arena;
+
+/*
+ * Interns strings into an arena: each distinct string is copied once, and
+ * every str_intern of an equal string returns the same copy, so that the
+ * paths and names repeated across the rows of a snapshot are stored once and
+ * can be compared by pointer. The copies live until their arena is freed.
+ */
+typedef struct str_table {
+	arena *arena;
+	char **slots;		/* Open addressing, a power of two */
+	u_long capacity;
+	u_long count;
+	u_long lookups;
+} str_table;
+
+void arena_init(arena *a, size_t block_size);
+void *arena_alloc(arena *a, size_t size);
+void *arena_calloc(arena *a, size_t count, size_t size);
+char *arena_strdup(arena *a, const char *s);
+void arena_free(arena *a);
+
+void str_table_init(str_table *table, arena *a);
+char *str_intern(str_table *table, const char *s);
+void str_table_free(str_table *table);
+
+#endif //ARENA_H_
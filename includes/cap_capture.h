@@ -33,6 +33,8 @@
 #ifndef CAP_CAPTURE_H_
 #define CAP_CAPTURE_H_
 
+#include "scan_pool.h"
+
 typedef struct cap_capture_struct {
 	uintcap_t cap_loc_addr;
 	char *cap_path;
@@ -50,7 +52,6 @@ typedef struct vm_capture_struct {
 	int cap_count;
 } Vm_capture_struct;
 
-void get_capability(int pid, void* addr, int current_cap_count, char *path, char **query_vals);
-int get_tags(sqlite3 *db, int pid, u_long start, char *path);
+void ptrace_scan_target(scan_target *target, int *pid);
 
 #endif //CAP_CAPTURE_H_
@@ -0,0 +1,90 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CAP_DECODE_H_
+#define CAP_DECODE_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Size of a capability in memory, and of a slot returned by PIOD_READ_CHERI_CAP
+ * which is the tag byte followed by the capability.
+ */
+#define CAP_DECODE_CAP_SIZE	16
+#define CAP_DECODE_SLOT_SIZE	(CAP_DECODE_CAP_SIZE+1)
+
+/*
+ * Architecture independent permission bits, so that the permissions stored in
+ * the database mean the same thing whichever CHERI target they were read from.
+ */
+#define CAP_PERM_LOAD		(1 << 0)	/* r */
+#define CAP_PERM_STORE		(1 << 1)	/* w */
+#define CAP_PERM_EXECUTE	(1 << 2)	/* x */
+#define CAP_PERM_LOAD_CAP	(1 << 3)	/* R */
+#define CAP_PERM_STORE_CAP	(1 << 4)	/* W */
+#define CAP_PERM_EXECUTIVE	(1 << 5)	/* E */
+#define CAP_PERM_GLOBAL		(1 << 6)
+#define CAP_PERM_STORE_LOCAL_CAP (1 << 7)
+#define CAP_PERM_SEAL		(1 << 8)
+#define CAP_PERM_UNSEAL		(1 << 9)
+#define CAP_PERM_SYSTEM_REGS	(1 << 10)
+#define CAP_PERM_MUTABLE_LOAD	(1 << 11)
+
+/* Long enough for every permission letter printed by cap_perms_str */
+#define CAP_PERMS_STR_SIZE	8
+
+/*
+ * The fields of a capability, decoded straight from its in-memory
+ * representation. top is base+length, saturated at the end of the address
+ * space.
+ */
+typedef struct cap_decoded {
+	uint64_t addr;
+	uint64_t base;
+	uint64_t length;
+	uint64_t top;
+	int64_t otype;
+	uint32_t perms;		/* CAP_PERM_* bits */
+	uint8_t tag;
+	uint8_t sealed;
+	uint8_t flags;
+} cap_decoded;
+
+void cap_decode_bytes(const void *cap_bytes, int tag, cap_decoded *out);
+void cap_decode_slot(const void *slot, cap_decoded *out);
+void cap_decode_morello(const void *cap_bytes, int tag, cap_decoded *out);
+uint32_t cap_perms_from_hw(uint64_t hw_perms);
+char *cap_perms_str(uint32_t perms, char *buf, size_t len);
+
+#endif //CAP_DECODE_H_
@@ -6,5 +6,10 @@
 #define CHERICAT_PID           0x0004
 #define CHERICAT_SUMMARY_VIEW  0x0008
 #define CHERICAT_CAP_INFO      0x0010
+#define CHERICAT_RAW_OUT       0x0020
+#define CHERICAT_INCREMENTAL   0x0040
+#define CHERICAT_SNAPSHOT      0x0080
+#define CHERICAT_RECORD        0x0100
+#define CHERICAT_STATS         0x0200
 
 #endif /* !__CHERICAT__ */
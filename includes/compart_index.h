@@ -0,0 +1,66 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef COMPART_INDEX_H_
+#define COMPART_INDEX_H_
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "db_process.h"
+
+/*
+ * A compartment covers [start, end). Sub-compartments sit inside the range of
+ * their library's default compartment, so the ranges are flattened into
+ * disjoint segments, each attributed to the innermost compartment covering
+ * it, and sorted by address so that lookups are a binary search.
+ */
+typedef struct compart_segment {
+	uint64_t start;
+	uint64_t end;
+	int compart_id;
+} compart_segment;
+
+typedef struct compart_index {
+	compart_segment *segments;
+	int count;
+} compart_index;
+
+#define COMPART_ID_NONE	-1
+
+int compart_index_build(compart_index *index, const comp_info *comparts, int comp_count);
+int compart_index_lookup(const compart_index *index, uint64_t addr);
+void compart_index_free(compart_index *index);
+
+int build_cap_compart(sqlite3 *db);
+
+#endif //COMPART_INDEX_H_
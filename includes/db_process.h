@@ -30,76 +30,257 @@
  * SUCH DAMAGE.
  */
 
+#include <stdint.h>
 #include <sqlite3.h>
 
+#include "arena.h"
+
 #ifndef DB_PROCESS_H_
 #define DB_PROCESS_H_
 
 extern char *dbname;
 
+/*
+ * Version of the database schema, stored in PRAGMA user_version. Databases
+ * written by older versions are upgraded by migrate_db when they are opened.
+ *  0 - addresses, sizes and permissions stored as text
+ *  1 - addresses, sizes and permissions stored as INTEGER
+ *  2 - index on cap_info(cap_loc_addr, perms) for the range joins with vm
+ *  3 - st_size column in elf_sym
+ *  4 - snapshot table, snapshot_id column in vm, cap_info and comparts, and
+ *      the symbols of an ELF file shared between snapshots through elf_file
+ *  5 - ELF files identified by device, inode, mtime and size, with their
+ *      symbols and sections stored relative to the base they are loaded at
+ *  6 - paths stored once in the paths table, vm, cap_info and elf_sym refer
+ *      to them by path_id
+ */
+#define DB_SCHEMA_VERSION 8
+
+/*
+ * Addresses, sizes and permissions are stored as INTEGER columns. Values are
+ * kept as their 64-bit pattern, so a top of 2^64-1 reads back as -1 in SQL.
+ */
 typedef struct vm_info_struct { 
-        char *start_addr;       
-        char *end_addr; 
+        uint64_t start_addr;       
+        uint64_t end_addr; 
         char *mmap_path;
 	int compart_id;
 	int kve_protection;
         int mmap_flags;         
         int vnode_type;   
-  	char *bss_addr;
-	char *bss_size;
-	char *plt_addr;
-	char *plt_size;
-	char *got_addr;
-	char *got_size;	
+	uint64_t plt_addr;
+	uint64_t plt_size;
+	uint64_t got_addr;
+	uint64_t got_size;	
 } vm_info;                      
                         
 typedef struct cap_info_struct {
-        char *cap_loc_addr;
+        uint64_t cap_loc_addr;
         char *cap_loc_path;
-        char *cap_addr; 
-        char *perms;    
-        char *base;     
-        char *top;      
+        uint64_t cap_addr; 
+        uint32_t perms;		/* CAP_PERM_* bits */
+        uint64_t base;     
+        uint64_t top;      
 } cap_info;
                         
 typedef struct sym_info_struct {
         char *source_path;
         char *sym_name; 
-        char *sym_offset;
+        uint64_t sym_offset;
         char *shndx;    
         char *type;     
         char *bind;
-        char *addr; 
+        uint64_t addr; 
+        uint64_t size;		/* st_size, 0 if unknown */
 } sym_info;
 
+/*
+ * Number of capabilities stored in a vm entry, in total and by their
+ * read/write/execute permissions.
+ */
+typedef struct vm_cap_stats_struct {
+	int total;
+	int ro;
+	int rw;
+	int rx;
+	int rwx;
+} vm_cap_stats;
+
+/*
+ * Number of capabilities stored in compartment src_compart_id that point into
+ * compartment dest_compart_id, from the cap_compart table.
+ */
+typedef struct compart_pair_stats_struct {
+	int src_compart_id;
+	int dest_compart_id;
+	char *src_compart_name;
+	char *dest_compart_name;
+	vm_cap_stats caps;
+} compart_pair_stats;
+
 typedef struct comp_info_struct {
     int compart_id;
     char *compart_name;
     char *library_path;
-    char *start_addr;
-    char *end_addr;
+    uint64_t start_addr;
+    uint64_t end_addr;
     int is_default;
     int parent_id;
 } comp_info;
 
+/*
+ * A scan or ingest stored in the database. The rows of the vm, cap_info and
+ * comparts tables belong to a snapshot through their snapshot_id.
+ */
+typedef struct snapshot_info_struct {
+	int64_t snapshot_id;
+	int64_t pid;
+	int64_t started;	/* Seconds since the Epoch */
+	char *command;
+	double duration;	/* Seconds, 0 if unknown */
+	int vm_count;
+	int cap_count;
+} snapshot_info;
+
+/*
+ * An ELF file in the symbol cache of the database, see elf_file_find. The
+ * file is identified by its stat(2) fields, so that it is parsed once
+ * whichever process maps it and wherever. The special sections are relative
+ * to the base the file is loaded at, 0 if it has none.
+ */
+typedef struct elf_file_info_struct {
+	int64_t elf_id;
+	const char *source_path;
+	int64_t dev;
+	int64_t ino;
+	int64_t mtime;
+	int64_t size;
+	uint64_t plt_addr;
+	uint64_t plt_size;
+	uint64_t got_addr;
+	uint64_t got_size;
+} elf_file_info;
+
+/*
+ * Looks up the path_id of a path in the paths table, adding the path the
+ * first time it is seen. The rows of a writer mostly come in runs of the same
+ * path, so the last path looked up is kept and its path_id reused without a
+ * query. The paths are interned in strings, so that the last one is kept
+ * without a copy of its own and compared by pointer.
+ */
+typedef struct path_cache {
+	sqlite3 *db;
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *select_stmt;
+	arena path_arena;
+	str_table strings;
+	const char *last_path;	/* Interned in strings */
+	int64_t last_id;
+	unsigned long lookups;	/* Paths looked up in the paths table */
+} path_cache;
+
+/*
+ * Inserts rows into cap_info through a single prepared statement, the rows
+ * are expected to be written inside the snapshot transaction
+ * (begin_transaction/commit_transaction).
+ */
+typedef struct cap_writer {
+	sqlite3 *db;
+	sqlite3_stmt *insert_stmt;
+	path_cache paths;
+	int64_t snapshot_id;
+	unsigned long rows;
+} cap_writer;
+
+/*
+ * Inserts the symbols of the ELF file elf_id into elf_sym through a single
+ * prepared statement, in the same way as cap_writer.
+ */
+typedef struct sym_writer {
+	sqlite3 *db;
+	sqlite3_stmt *insert_stmt;
+	path_cache paths;
+	int64_t elf_id;
+	unsigned long rows;
+} sym_writer;
+
+/*
+ * A cursor steps through the rows of a query one at a time, see
+ * vm_cursor_open and friends. The strings of a row point into the statement,
+ * they are only valid until the next row is read or the cursor is closed.
+ */
+typedef struct db_cursor {
+	sqlite3_stmt *stmt;
+	unsigned long rows;
+} db_cursor;
+
 char *get_dbname(); 
+int db_table_exists(sqlite3 *db, char *tname);
+int open_db(char *name, sqlite3 **db);
+int migrate_db(sqlite3 *db);
+int create_paths_table(sqlite3 *db);
 int create_vm_cap_db(sqlite3 *db);
 int create_elf_sym_db(sqlite3 *db);
 int create_comparts_table(sqlite3 *db);
+int create_cap_compart_table(sqlite3 *db);
+int create_page_hash_table(sqlite3 *db);
+int create_snapshot_table(sqlite3 *db);
 int sql_query_exec(sqlite3 *db, char* query, int (*callback)(void*,int,char**,char**), void *data); 
 int begin_transaction(sqlite3 *db);
 int commit_transaction(sqlite3 *db);
 
+void set_snapshot_command(int argc, char **argv);
+int snapshot_exists(sqlite3 *db, int64_t snapshot_id);
+int select_snapshot(sqlite3 *db, int64_t snapshot_id);
+int64_t get_snapshot_id(sqlite3 *db);
+int64_t snapshot_begin(sqlite3 *db, int64_t pid, int64_t started);
+int snapshot_end(sqlite3 *db, double duration);
+int64_t elf_file_find(sqlite3 *db, elf_file_info *file);
+int64_t elf_file_insert(sqlite3 *db, elf_file_info *file);
+int elf_file_set_sections(sqlite3 *db, const elf_file_info *file);
+int snapshot_elf_add(sqlite3 *db, int64_t elf_id, uint64_t base);
+
+int path_cache_open(sqlite3 *db, path_cache *cache);
+int64_t path_cache_id(path_cache *cache, const char *path);
+void path_cache_close(path_cache *cache);
+int cap_writer_open(sqlite3 *db, cap_writer *writer);
+int cap_writer_insert(cap_writer *writer, unsigned long cap_loc_addr, const char *cap_loc_path,
+    unsigned long cap_addr, uint32_t perms, unsigned long base, unsigned long top);
+void cap_writer_close(cap_writer *writer);
+int sym_writer_open(sqlite3 *db, sym_writer *writer, int64_t elf_id);
+int sym_writer_insert(sym_writer *writer, const char *source_path, const char *sym_name,
+    uint64_t st_value, const char *shndx, const char *type, const char *bind, uint64_t addr, uint64_t size);
+void sym_writer_close(sym_writer *writer);
+int insert_vm_info(sqlite3 *db, int64_t snapshot_id, const vm_info *vms, int count);
+
 int vm_info_count(sqlite3 *db);
 int cap_info_count(sqlite3 *db);
 int sym_info_count(sqlite3 *db);
 int comp_info_count(sqlite3 *db);
 int cap_info_for_lib_count(sqlite3 *db, char *lib);
 
-int get_all_vm_info(sqlite3 *db, vm_info **all_vm_info);
-int get_all_cap_info(sqlite3 *db, cap_info **all_cap_info);
-int get_all_sym_info(sqlite3 *db, sym_info **all_sym_info);
-int get_all_comp_info(sqlite3 *db, comp_info **all_comp_info);
-int get_cap_info_for_lib(sqlite3 *db, cap_info **cap_info_captured_ptr, char *lib);
+int vm_cursor_open(sqlite3 *db, db_cursor *cursor);
+int vm_cursor_next(db_cursor *cursor, vm_info *vm);
+int cap_cursor_open(sqlite3 *db, db_cursor *cursor, const char *lib);
+int cap_cursor_next(db_cursor *cursor, cap_info *cap);
+int cap_loc_cursor_open(sqlite3 *db, db_cursor *cursor, int64_t snapshot_id);
+int sym_cursor_open(sqlite3 *db, db_cursor *cursor);
+int sym_cursor_next(db_cursor *cursor, sym_info *sym);
+int comp_cursor_open(sqlite3 *db, db_cursor *cursor);
+int comp_cursor_next(db_cursor *cursor, comp_info *comp);
+int vm_cap_stats_cursor_open(sqlite3 *db, db_cursor *cursor);
+int vm_cap_stats_cursor_next(db_cursor *cursor, vm_info *vm, vm_cap_stats *stats);
+int compart_pair_cursor_open(sqlite3 *db, db_cursor *cursor);
+int compart_pair_cursor_next(db_cursor *cursor, compart_pair_stats *pair);
+int snapshot_cursor_open(sqlite3 *db, db_cursor *cursor);
+int snapshot_cursor_next(db_cursor *cursor, snapshot_info *snapshot);
+void db_cursor_close(db_cursor *cursor);
+
+int get_all_vm_info(sqlite3 *db, str_table *strings, vm_info **all_vm_info);
+int get_all_cap_info(sqlite3 *db, str_table *strings, cap_info **all_cap_info);
+int get_all_sym_info(sqlite3 *db, str_table *strings, sym_info **all_sym_info);
+int get_all_comp_info(sqlite3 *db, str_table *strings, comp_info **all_comp_info);
+int get_snapshot_comp_info(sqlite3 *db, int64_t snapshot_id, str_table *strings, comp_info **all_comp_info);
+int get_all_vm_cap_stats(sqlite3 *db, vm_cap_stats **all_vm_cap_stats);
 
 #endif //DB_PROCESS_H_
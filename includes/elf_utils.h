@@ -32,6 +32,8 @@
 
 #include <libelf.h>
 
+#include "snapshot_ingest.h"
+
 #ifndef ELF_UTILS_H_
 #define ELF_UTILS_H_
 
@@ -45,7 +47,12 @@ typedef struct special_sections_struct {
 	char *mmap_path;
 } special_sections;
 
-Elf *read_elf(char *path);
-void get_elf_info(sqlite3 *db, Elf *elfFile, char *source, u_long source_base, special_sections **ssect, int ssect_index);
+Elf *read_elf(const char *path, int *fd);
+void close_elf(Elf *elfFile, int fd);
+void get_elf_info(sqlite3 *db, Elf *elfFile, elf_file_info *file);
+int load_elf_file(sqlite3 *db, const char *path, u_long base, special_sections *sections);
+int load_elf_files(sqlite3 *db, int count, const char **paths, const u_long *bases,
+    special_sections *sections, int workers);
+int ingest_elf_file(sqlite3 *db, const char *path, uint64_t base, ingest_elf_sections *sections);
 
 #endif //ELF_UTILS_H_
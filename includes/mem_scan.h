@@ -51,6 +51,9 @@ struct stk_bottom {
 	void *top;
 };
 
+void set_scan_mem_incremental(int incremental);
+void set_scan_mem_record(const char *path);
 void scan_mem(sqlite3 *db, int pid);
+void scan_mem_raw(int pid, const char *raw_path);
 
 #endif //MEM_SCAN_H_
@@ -0,0 +1,60 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MPMC_RING_H_
+#define MPMC_RING_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Bounded lock-free queue of fixed-size elements, for any number of
+ * producer and consumer threads. Each cell carries a sequence number that
+ * tells whether it is free for the producer at a position or holds the
+ * element for the consumer at that position, so neither side takes a lock
+ * and a full or empty ring is reported rather than waited on.
+ */
+typedef struct mpmc_ring {
+	_Alignas(64) atomic_size_t head;	/* Next position to push to */
+	_Alignas(64) atomic_size_t tail;	/* Next position to pop from */
+	atomic_size_t *seqs;
+	unsigned char *elems;
+	size_t elem_size;
+	size_t mask;
+} mpmc_ring;
+
+int mpmc_ring_init(mpmc_ring *ring, size_t capacity, size_t elem_size);
+int mpmc_ring_push(mpmc_ring *ring, const void *elem);
+int mpmc_ring_pop(mpmc_ring *ring, void *elem);
+void mpmc_ring_free(mpmc_ring *ring);
+
+#endif //MPMC_RING_H_
@@ -33,20 +33,32 @@
 #ifndef PTRACE_UTILS_H_
 #define PTRACE_UTILS_H_
 
+#include <time.h>
+
+#include "scan_pool.h"
+
 #define	PTRACE_READ_STRING_MAXSIZE 4096
 
 typedef uint64_t psaddr_t;	/* An address in the target process. */
 
-typedef struct lwpthrs {
-    int nlwps;
-    lwpid_t *lwps;
-} lwpthrs_t;
+/*
+ * A ptrace session keeps the target stopped from ptrace_session_begin()
+ * until ptrace_session_end(), so that every read in between sees the same
+ * consistent state. The time the target was held is recorded.
+ */
+typedef struct ptrace_session {
+    int pid;
+    int attached;
+    struct timespec stopped_at;
+    uint64_t stopped_ns;
+} ptrace_session;
 
-void ptrace_attach(int pid);
+int ptrace_attach(int pid);
 void ptrace_detach(int pid);
-void read_data(int pid, void *addr, void* vptr, int len);
-lwpthrs_t get_lwps_list(int pid); 
-void piod_read(int pid, int op, void *remote, void *local, size_t len);
-char *get_string(pid_t pid, psaddr_t addr, int max);
+int ptrace_session_begin(ptrace_session *session, int pid);
+void ptrace_session_end(ptrace_session *session);
+void print_ptrace_session(ptrace_session *session);
+void target_read(const scan_target *target, void *remote, void *local, size_t len);
+char *get_string(const scan_target *target, psaddr_t addr, int max);
 
 #endif //PTRACE_UTILS_H_
@@ -0,0 +1,219 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef RAW_SNAPSHOT_H_
+#define RAW_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A raw snapshot holds what chericat reads from a target - its vm map, the
+ * rtld data, and the tags and capabilities of its pages - without decoding
+ * or resolving any of it, so that it can be captured quickly with -o and
+ * turned into a database later, on any host. See docs/raw_snapshot.md for
+ * the format.
+ *
+ * All the integers are little-endian. The file is a header followed by
+ * records, each one a type, the length of its payload and the payload padded
+ * to 8 bytes. A complete snapshot ends with a RAW_REC_END record.
+ */
+#define RAW_SNAPSHOT_MAGIC		"CHERICAT"
+#define RAW_SNAPSHOT_MAGIC_SIZE		8
+#define RAW_SNAPSHOT_VERSION		1
+#define RAW_SNAPSHOT_HEADER_SIZE	48
+#define RAW_SNAPSHOT_MIN_HEADER_SIZE	40	/* Before the machine was added */
+#define RAW_RECORD_HEADER_SIZE		8
+
+/* Bytes of a capability in a RAW_REC_PAGE record, without its tag */
+#define RAW_CAP_SIZE			16
+#define RAW_TAGS_PER_PAGE		256
+#define RAW_TAG_BYTES_PER_PAGE		(RAW_TAGS_PER_PAGE/8)
+
+enum raw_record_type {
+	RAW_REC_VM_ENTRY = 1,		/* A vm entry, in vm map order */
+	RAW_REC_AUXV = 2,		/* The Elf_Auxinfo array of the target */
+	RAW_REC_R_DEBUG = 3,		/* The struct r_debug of the target */
+	RAW_REC_LINKMAP_OBJ = 4,	/* An object of the rtld linkmap */
+	RAW_REC_COMPART = 5,		/* A row of the comparts table */
+	RAW_REC_PAGE = 6,		/* The tagged capabilities of a page */
+	RAW_REC_END = 7,		/* Last record of a complete snapshot */
+	RAW_REC_TARGET_READ = 8,	/* A read from the target and its result, see -R */
+	RAW_REC_SCAN_RANGE = 9,		/* A range whose capabilities were scanned */
+};
+
+/* The reads of a RAW_REC_TARGET_READ record, as made through a scan_target */
+enum raw_target_op {
+	RAW_TARGET_TAGS = 1,		/* Tags of a run of pages, length in bytes of tags */
+	RAW_TARGET_CAPS = 2,		/* Capability slots, length in slots */
+	RAW_TARGET_DATA = 3,		/* Ordinary data, length in bytes */
+};
+
+/*
+ * The kve_type and kve_flags values, from <sys/user.h>, that ingest uses to
+ * name the anonymous vm entries as scan_mem does.
+ */
+#define RAW_KVME_TYPE_GUARD		9
+#define RAW_KVME_FLAG_GROWS_DOWN	0x00000020
+
+/* ELF e_machine of the target, whose format its capabilities are in */
+#define RAW_MACHINE_UNKNOWN		0
+#define RAW_MACHINE_AARCH64		183	/* EM_AARCH64, Morello */
+#define RAW_MACHINE_RISCV		243	/* EM_RISCV */
+
+#if defined(__aarch64__)
+#define RAW_MACHINE_HOST		RAW_MACHINE_AARCH64
+#elif defined(__riscv)
+#define RAW_MACHINE_HOST		RAW_MACHINE_RISCV
+#else
+#define RAW_MACHINE_HOST		RAW_MACHINE_UNKNOWN
+#endif
+
+typedef struct raw_snapshot_header {
+	uint32_t version;
+	uint32_t page_size;
+	uint32_t cap_size;
+	uint32_t machine;		/* RAW_MACHINE_* */
+	uint64_t pid;
+	uint64_t timestamp;		/* Seconds since the Epoch at the capture */
+} raw_snapshot_header;
+
+typedef struct raw_vm_entry {
+	uint64_t start;
+	uint64_t end;
+	uint64_t reservation;
+	uint32_t protection;		/* kve_protection */
+	uint32_t flags;			/* kve_flags */
+	uint32_t type;			/* kve_type */
+	const char *path;		/* kve_path, empty for anonymous memory */
+} raw_vm_entry;
+
+/* An object loaded by rtld and the id of its default compartment */
+typedef struct raw_linkmap_obj {
+	int32_t compart_id;
+	uint64_t start;
+	uint64_t end;
+	const char *path;
+} raw_linkmap_obj;
+
+typedef struct raw_compart {
+	int32_t compart_id;
+	int32_t parent_id;		/* Unused by default compartments */
+	uint32_t is_default;
+	uint64_t start;
+	uint64_t end;
+	const char *name;		/* NULL if there is none */
+	const char *library_path;	/* NULL if there is none */
+} raw_compart;
+
+/*
+ * The capabilities of the page at page, one for each tag set in tags in
+ * increasing address order, RAW_CAP_SIZE bytes each as stored in memory.
+ */
+typedef struct raw_page_caps {
+	uint64_t page;
+	const unsigned char *tags;
+	const unsigned char *caps;
+	int ncaps;
+} raw_page_caps;
+
+/*
+ * A read request made to the target, and its result: what the scan_target
+ * function returned and the data it read, data_size bytes of it.
+ */
+typedef struct raw_target_read {
+	uint32_t op;			/* RAW_TARGET_* */
+	int32_t result;
+	uint64_t addr;
+	uint64_t length;
+	const unsigned char *data;
+	uint32_t data_size;
+} raw_target_read;
+
+typedef struct raw_scan_range {
+	uint64_t start;
+	uint64_t end;
+} raw_scan_range;
+
+typedef struct raw_snapshot_end {
+	uint64_t pages;			/* RAW_REC_PAGE records written */
+	uint64_t caps;
+	uint64_t stopped_ns;		/* Time the target was held stopped */
+} raw_snapshot_end;
+
+typedef struct raw_writer {
+	FILE *file;
+	char *buf;
+	unsigned long records;
+	uint64_t bytes;
+	int failed;
+} raw_writer;
+
+/* A record of a raw snapshot, the payload points into the mapped file */
+typedef struct raw_record {
+	uint32_t type;
+	uint32_t length;
+	const unsigned char *payload;
+} raw_record;
+
+typedef struct raw_reader {
+	const unsigned char *map;
+	size_t size;
+	size_t off;
+	raw_snapshot_header header;
+} raw_reader;
+
+int raw_writer_open(raw_writer *writer, const char *path, const raw_snapshot_header *header);
+int raw_write_record(raw_writer *writer, uint32_t type, const void *payload, size_t length);
+int raw_write_vm_entry(raw_writer *writer, const raw_vm_entry *vm);
+int raw_write_linkmap_obj(raw_writer *writer, const raw_linkmap_obj *obj);
+int raw_write_compart(raw_writer *writer, const raw_compart *compart);
+int raw_write_page(raw_writer *writer, const raw_page_caps *page);
+int raw_write_end(raw_writer *writer, const raw_snapshot_end *end);
+int raw_write_target_read(raw_writer *writer, const raw_target_read *read);
+int raw_write_scan_range(raw_writer *writer, const raw_scan_range *range);
+int raw_writer_close(raw_writer *writer);
+
+int raw_reader_open(raw_reader *reader, const char *path);
+int raw_reader_next(raw_reader *reader, raw_record *record);
+void raw_reader_close(raw_reader *reader);
+
+int raw_record_vm_entry(const raw_record *record, raw_vm_entry *vm);
+int raw_record_linkmap_obj(const raw_record *record, raw_linkmap_obj *obj);
+int raw_record_compart(const raw_record *record, raw_compart *compart);
+int raw_record_page(const raw_record *record, raw_page_caps *page);
+int raw_record_end(const raw_record *record, raw_snapshot_end *end);
+int raw_record_target_read(const raw_record *record, raw_target_read *read);
+int raw_record_scan_range(const raw_record *record, raw_scan_range *range);
+
+#endif //RAW_SNAPSHOT_H_
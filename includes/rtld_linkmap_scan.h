@@ -42,6 +42,9 @@
 #include <sys/sysctl.h>
 #include <libprocstat.h>
 
+#include "arena.h"
+#include "scan_pool.h"
+
 typedef struct struct_compart_data {
     int id;
     int names_array_size;
@@ -57,9 +60,9 @@ typedef struct struct_compart_data_list {
 	struct struct_compart_data_list *next;
 } compart_data_list;
 
-struct r_debug get_r_debug(int pid, struct procstat *psp, struct kinfo_proc *kipp);
+struct r_debug get_r_debug(int pid, const scan_target *target, struct procstat *psp, struct kinfo_proc *kipp);
 void getprocs_with_procstat_sysctl(sqlite3 *db, int pid);
-compart_data_list *scan_rtld_linkmap(int pid, sqlite3 *db, struct r_debug target_debug);
-char **scan_r_comparts(int pid, sqlite3 *db, struct r_debug target_debug);
+compart_data_list *scan_rtld_linkmap(const scan_target *target, sqlite3 *db, struct r_debug target_debug, arena *a);
+char **scan_r_comparts(const scan_target *target, sqlite3 *db, struct r_debug target_debug, arena *a);
 
 #endif //RTLD_LINKMAP_SCAN_H_
@@ -0,0 +1,100 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef RUN_STATS_H_
+#define RUN_STATS_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * The phases of a run timed with --stats. A phase run by several threads at
+ * once, such as the tag and capability reads of the scan_pool workers, adds
+ * up the time of each thread. The SQL inserts are timed a batch of rows at a
+ * time, so that reading the clock does not add to them, and the statements
+ * run through sql_query_exec, such as DDL, are not timed.
+ */
+typedef enum run_phase {
+	RUN_PHASE_PROCSTAT,
+	RUN_PHASE_R_DEBUG,
+	RUN_PHASE_LINKMAP,
+	RUN_PHASE_R_COMPARTS,
+	RUN_PHASE_ELF_PARSE,
+	RUN_PHASE_TAG_READ,
+	RUN_PHASE_CAP_READ,
+	RUN_PHASE_SQL_INSERT,
+	RUN_PHASE_VIEW,
+	RUN_PHASES
+} run_phase;
+
+typedef enum run_counter {
+	RUN_PTRACE_CALLS,	/* ptrace(2) requests made */
+	RUN_BYTES_READ,		/* Bytes read from the target by PT_IO and PT_READ_D */
+	RUN_CAPS_FOUND,		/* Capabilities read from the target or a snapshot */
+	RUN_ROWS_WRITTEN,	/* Rows inserted, updated or deleted in the database */
+	RUN_COUNTERS
+} run_counter;
+
+/*
+ * A phase being timed by a thread, between run_phase_begin and run_phase_end.
+ * Nothing is timed unless the stats are enabled.
+ */
+typedef struct run_timer {
+	run_phase phase;
+	int active;
+	struct timespec wall;
+	struct timespec cpu;
+} run_timer;
+
+typedef struct run_phase_stats {
+	u_long calls;		/* Times the phase was timed */
+	double wall;		/* Seconds */
+	double cpu;		/* CPU seconds of the threads that ran it */
+} run_phase_stats;
+
+/* What has been counted since the stats were enabled, see get_run_stats */
+typedef struct run_stats {
+	double wall;		/* Seconds since the stats were enabled */
+	double cpu;		/* CPU seconds of the whole process */
+	run_phase_stats phases[RUN_PHASES];
+	u_long counters[RUN_COUNTERS];
+} run_stats;
+
+void set_run_stats(int enabled);
+int run_stats_enabled(void);
+void run_phase_begin(run_timer *timer, run_phase phase);
+void run_phase_end(run_timer *timer);
+void run_count(run_counter counter, u_long n);
+const char *run_phase_name(run_phase phase);
+void get_run_stats(run_stats *stats);
+
+#endif //RUN_STATS_H_
@@ -0,0 +1,90 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SCAN_DELTA_H_
+#define SCAN_DELTA_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "db_process.h"
+#include "scan_pool.h"
+
+/* A page with capabilities as of the previous incremental scan of the process */
+typedef struct page_hash_entry {
+	uint64_t page;
+	uint64_t tags_hash;
+	uint64_t caps_hash;
+	int used;
+	int seen;		/* Still has capabilities in this scan */
+} page_hash_entry;
+
+/*
+ * An incremental scan, see -I. Only the pages whose tags or capabilities
+ * have changed since the previous incremental scan of the same process are
+ * decoded, the capabilities of the other pages are copied from the snapshot
+ * of that scan into the new one. It takes the pages read by a scan pool as
+ * its page sink, so the database is only used from the decoder thread of the
+ * pool until scan_delta_close.
+ */
+typedef struct scan_delta {
+	sqlite3 *db;
+	cap_writer writer;
+	int64_t pid;		/* Whose page hashes are compared and updated */
+	int64_t previous_id;	/* Snapshot of the previous scan, 0 if none */
+	sqlite3_stmt *copy_caps_stmt;
+	sqlite3_stmt *upsert_hash_stmt;
+	sqlite3_stmt *delete_hash_stmt;
+
+	page_hash_entry *previous;
+	size_t previous_count;
+	size_t mask;
+
+	const char *path;	/* Of the page being written */
+	u_long unchanged;
+	u_long changed;		/* Pages that are new or have changed */
+	u_long removed;		/* Pages that no longer have capabilities */
+	u_long caps;		/* Capabilities written */
+	u_long copied;		/* Capabilities copied from the previous snapshot */
+} scan_delta;
+
+uint64_t page_tags_hash(const raw_page *raw);
+uint64_t page_caps_hash(const raw_page *raw);
+
+int64_t scan_delta_previous(sqlite3 *db, int64_t pid);
+int scan_delta_open(sqlite3 *db, scan_delta *delta, int64_t pid, int64_t previous_id);
+void scan_delta_page(void *arg, const raw_page *raw);
+void scan_delta_close(scan_delta *delta);
+void print_scan_delta_stats(scan_delta *delta);
+
+#endif //SCAN_DELTA_H_
@@ -0,0 +1,147 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SCAN_POOL_H_
+#define SCAN_POOL_H_
+
+#include <sys/types.h>
+
+#include "cap_decode.h"
+#include "db_process.h"
+#include "tag_scan.h"
+
+/*
+ * Reads nslots consecutive capability slots starting at addr into capbuf,
+ * CAP_DECODE_SLOT_SIZE bytes each as returned by PIOD_READ_CHERI_CAP.
+ * Returns 0 if all the slots have been read.
+ */
+typedef int (*cap_read_fn)(void *arg, u_long addr, unsigned char *capbuf, int nslots);
+
+/*
+ * Reads len bytes of ordinary data at addr into buf, as PIOD_READ_D does.
+ * Returns 0 if all of them have been read.
+ */
+typedef int (*data_read_fn)(void *arg, u_long addr, void *buf, size_t len);
+
+/*
+ * The memory of the scanned process. Every read chericat makes from a target
+ * goes through one of these functions, whether the target is a traced
+ * process (ptrace_scan_target) or a recording of one (target_replay). The
+ * functions are called from several workers at the same time, arg is shared
+ * by all of them.
+ */
+typedef struct scan_target {
+	tag_read_fn read_tags;
+	cap_read_fn read_caps;
+	data_read_fn read_data;
+	void *arg;
+} scan_target;
+
+/*
+ * Counters of a stage of the scan pipeline. A stall is a wait for room in
+ * the queue to the next stage, idle is a wait for work from the previous one.
+ * A thread that waits spins for a short while, then sleeps until woken.
+ * seconds is the time from the start of the scan to the end of the stage.
+ */
+typedef struct scan_stage_stats {
+	u_long items;		/* Pages or capabilities passed on */
+	u_long stalls;
+	u_long idle;
+	double seconds;
+} scan_stage_stats;
+
+typedef struct cap_scan_stats {
+	tag_scan_stats tags;
+	u_long caps;		/* Capabilities found */
+	u_long cap_requests;	/* Capability read requests issued */
+	scan_stage_stats read;
+	scan_stage_stats decode;
+	scan_stage_stats write;
+} cap_scan_stats;
+
+/* Called for every capability found, with the address it is stored at */
+typedef void (*cap_found_fn)(void *arg, u_long cap_loc_addr, const cap_decoded *cap);
+
+/* Workers used by a scan, unless set by -j */
+#define SCAN_POOL_DEFAULT_WORKERS	1
+#define SCAN_POOL_MAX_WORKERS		64
+
+/* vm entries larger than this many pages are split between workers */
+#define SCAN_POOL_TASK_PAGES		1024
+
+/*
+ * Pages queued between the readers and the decoder, and capabilities queued
+ * between the decoder and the writer. A stage waits when its queue is full.
+ */
+#define SCAN_POOL_PAGE_QUEUE_SIZE	256
+#define SCAN_POOL_QUEUE_SIZE		8192
+
+/*
+ * The scan is a pipeline: the workers read the tags and capability slots of
+ * the target, a decoder thread decodes the capabilities and a writer thread
+ * stores them.
+ */
+typedef struct scan_pool scan_pool;
+
+/*
+ * The capability slots of a page as read from the target, from the first to
+ * the last tagged slot. The tags of the slots that could not be read are
+ * cleared.
+ */
+typedef struct raw_page {
+	u_long page;
+	const char *path;
+	int first_slot;
+	unsigned char tags[TAG_SCAN_BYTES_PER_PAGE];
+	unsigned char slots[TAG_SCAN_TAGS_PER_PAGE*CAP_DECODE_SLOT_SIZE];
+} raw_page;
+
+/* Takes the pages read by a pool instead of its decoder, see -o */
+typedef void (*raw_page_fn)(void *arg, const raw_page *raw);
+
+int read_page_caps(const scan_target *target, u_long page, const unsigned char *page_tags,
+    raw_page *raw, cap_scan_stats *stats);
+void decode_page_caps(const raw_page *raw, cap_found_fn found, void *found_arg);
+
+void set_scan_pool_workers(int workers);
+int get_scan_pool_workers(void);
+scan_pool *scan_pool_create(const scan_target *target, cap_writer *writer, int workers);
+void scan_pool_set_page_sink(scan_pool *pool, raw_page_fn sink, void *arg);
+void scan_pool_add(scan_pool *pool, u_long start, u_long end, const char *path);
+void scan_pool_start(scan_pool *pool);
+void scan_pool_wait_reads(scan_pool *pool);
+u_long scan_pool_finish(scan_pool *pool, cap_scan_stats *stats);
+u_long scan_pool_run(scan_pool *pool, cap_scan_stats *stats);
+void scan_pool_free(scan_pool *pool);
+void print_cap_scan_stats(cap_scan_stats *stats);
+
+#endif //SCAN_POOL_H_
@@ -0,0 +1,95 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SNAPSHOT_DIFF_H_
+#define SNAPSHOT_DIFF_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "db_process.h"
+
+typedef enum cap_diff_kind {
+	CAP_DIFF_ADDED,
+	CAP_DIFF_REMOVED,
+	CAP_DIFF_MODIFIED,	/* Same location, other address, bounds or permissions */
+} cap_diff_kind;
+
+typedef struct cap_diff_counts {
+	u_long added;
+	u_long removed;
+	u_long modified;
+} cap_diff_counts;
+
+/* The changes found in one mapping path or one compartment */
+typedef struct cap_diff_rollup {
+	char *name;
+	cap_diff_counts counts;
+} cap_diff_rollup;
+
+/* Rollups kept sorted by name */
+typedef struct cap_diff_rollups {
+	cap_diff_rollup *entries;
+	int count;
+	int capacity;
+} cap_diff_rollups;
+
+/*
+ * Called for each capability that differs between the two snapshots, in the
+ * order of cap_loc_addr. before is NULL for an added capability and after is
+ * NULL for a removed one. compart_name is the compartment holding the
+ * capability, NULL if none does. The strings are only valid during the call.
+ */
+typedef void (*cap_diff_fn)(void *arg, cap_diff_kind kind, const cap_info *before,
+    const cap_info *after, const char *compart_name);
+
+/*
+ * The differences between the capabilities of two snapshots of a database,
+ * see snapshot_diff. Added and modified capabilities are counted against the
+ * mapping and compartment they are in in the after snapshot, removed ones
+ * against those of the before snapshot.
+ */
+typedef struct snapshot_diff {
+	int64_t before_id;
+	int64_t after_id;
+	cap_diff_counts total;
+	u_long unchanged;
+	cap_diff_rollups mappings;
+	cap_diff_rollups comparts;
+} snapshot_diff;
+
+int snapshot_diff_run(sqlite3 *db, int64_t before_id, int64_t after_id, cap_diff_fn fn, void *arg,
+    snapshot_diff *diff);
+void snapshot_diff_free(snapshot_diff *diff);
+
+#endif //SNAPSHOT_DIFF_H_
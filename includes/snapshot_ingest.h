@@ -0,0 +1,80 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SNAPSHOT_INGEST_H_
+#define SNAPSHOT_INGEST_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+/* Pages decoded by an ingest worker in one go */
+#define INGEST_CHUNK_PAGES	256
+
+/* Chunks each worker can decode ahead of the ones written to the database */
+#define INGEST_CHUNKS_AHEAD	4
+
+/* The .plt and .got of an ELF file, at their address in the target */
+typedef struct ingest_elf_sections {
+	uint64_t plt_addr;
+	uint64_t plt_size;
+	uint64_t got_addr;
+	uint64_t got_size;
+} ingest_elf_sections;
+
+/*
+ * Stores the symbols of the ELF file at path, mapped at base in the target,
+ * into elf_sym and fills in its sections. Returns 0 if the file has been
+ * parsed, -1 if it is not available on this host.
+ */
+typedef int (*ingest_elf_fn)(sqlite3 *db, const char *path, uint64_t base, ingest_elf_sections *sections);
+
+typedef struct ingest_stats {
+	int64_t snapshot_id;	/* The snapshot the ingest was stored as */
+	uint64_t bytes;		/* Size of the snapshot */
+	u_long vm_entries;
+	u_long comparts;
+	u_long elf_files;	/* ELF files parsed */
+	u_long pages;
+	u_long caps;
+	u_long skipped;		/* Records that are unknown or malformed */
+	u_long replayed_reads;	/* Reads of a -R record served by the replay */
+	u_long missed_reads;	/* Reads made by the replay that were not recorded */
+	int complete;		/* The snapshot ends with its end record */
+	double seconds;
+} ingest_stats;
+
+int ingest_snapshot(sqlite3 *db, const char *path, int workers, ingest_elf_fn parse_elf,
+    ingest_stats *stats);
+void print_ingest_stats(const char *path, ingest_stats *stats);
+
+#endif //SNAPSHOT_INGEST_H_
@@ -0,0 +1,70 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SYM_INDEX_H_
+#define SYM_INDEX_H_
+
+#include <stdint.h>
+
+#include "db_process.h"
+
+/*
+ * The defined symbols of a database sorted by address. Their ranges are
+ * flattened into disjoint segments, each attributed to the closest symbol
+ * covering it, so that a lookup is a binary search whatever the sizes of the
+ * symbols.
+ */
+typedef struct sym_index_entry {
+	uint64_t start;
+	uint64_t end;
+	int sym;
+} sym_index_entry;
+
+typedef struct sym_segment {
+	uint64_t start;
+	uint64_t end;
+	int entry;	/* Index in entries of the symbol covering the segment */
+} sym_segment;
+
+typedef struct sym_index {
+	const sym_info *syms;
+	sym_index_entry *entries;
+	sym_segment *segments;
+	int count;
+	int segment_count;
+} sym_index;
+
+int sym_index_build(sym_index *index, const sym_info *syms, int sym_count);
+const sym_info *sym_index_lookup(const sym_index *index, uint64_t addr, uint64_t *offset);
+void sym_index_free(sym_index *index);
+
+#endif //SYM_INDEX_H_
@@ -0,0 +1,77 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef TAG_SCAN_H_
+#define TAG_SCAN_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/*
+ * Every 16-byte granule of memory has one tag bit, PIOD_READ_CHERI_TAGS packs
+ * the 256 tags of a 4k page into 32 bytes, one bit per capability.
+ */
+#define TAG_SCAN_PAGE_SIZE	4096
+#define TAG_SCAN_GRANULE_SIZE	16
+#define TAG_SCAN_TAGS_PER_PAGE	(TAG_SCAN_PAGE_SIZE / TAG_SCAN_GRANULE_SIZE)
+#define TAG_SCAN_BYTES_PER_PAGE	(TAG_SCAN_TAGS_PER_PAGE / 8)
+
+/* Number of pages covered by a single tag read request, unless set by -t */
+#define TAG_SCAN_DEFAULT_CHUNK_PAGES	256
+#define TAG_SCAN_MAX_CHUNK_PAGES	65536
+
+typedef struct tag_scan_stats {
+	u_long pages;		/* Pages covered by the scan */
+	u_long tagged_pages;	/* Pages with at least one tag set */
+	u_long requests;	/* Tag read requests issued */
+} tag_scan_stats;
+
+/*
+ * Reads the tags of the pages starting at "start" into tagsbuf, len is a
+ * multiple of TAG_SCAN_BYTES_PER_PAGE. Returns the number of bytes read, which
+ * can be short, or -1 if nothing could be read.
+ */
+typedef ssize_t (*tag_read_fn)(void *arg, u_long start, unsigned char *tagsbuf, size_t len);
+
+/*
+ * Called for every page with at least one tag set, page_tags points to the
+ * TAG_SCAN_BYTES_PER_PAGE bytes of tags of that page.
+ */
+typedef void (*tag_page_fn)(void *arg, u_long page, const unsigned char *page_tags);
+
+void set_tag_scan_chunk_pages(size_t pages);
+size_t get_tag_scan_chunk_pages(void);
+int tag_scan_range(u_long start, u_long end, tag_read_fn read_tags, void *read_arg,
+    tag_page_fn page_fn, void *page_arg, tag_scan_stats *stats);
+void print_tag_scan_stats(tag_scan_stats *stats);
+
+#endif //TAG_SCAN_H_
@@ -0,0 +1,80 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef TARGET_LOG_H_
+#define TARGET_LOG_H_
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "raw_snapshot.h"
+#include "scan_pool.h"
+
+/*
+ * Records every read made through a scan_target, and its result, as a
+ * RAW_REC_TARGET_READ record of a raw snapshot (see -R). The reads are passed
+ * on to the inner target, the records are written under lock as the workers
+ * of a scan_pool make them. Nothing else may write to the snapshot while
+ * reads are being made.
+ */
+typedef struct target_recorder {
+	scan_target inner;
+	raw_writer *writer;
+	pthread_mutex_t lock;
+	u_long reads;
+} target_recorder;
+
+/*
+ * Serves the reads of a recorded target back, with the results they had when
+ * they were recorded. A read that was not recorded fails and is counted as a
+ * miss. The data of the reads points into the raw snapshot, which has to stay
+ * open while the replay is in use.
+ */
+typedef struct target_replay {
+	raw_target_read *reads;
+	u_long count;
+	u_long capacity;
+	atomic_ulong hits;
+	atomic_ulong misses;
+} target_replay;
+
+void target_recorder_init(target_recorder *recorder, const scan_target *inner, raw_writer *writer,
+    scan_target *target);
+void target_recorder_range(target_recorder *recorder, u_long start, u_long end);
+void target_recorder_destroy(target_recorder *recorder);
+
+int target_replay_add(target_replay *replay, const raw_record *record);
+void target_replay_start(target_replay *replay, scan_target *target);
+void target_replay_free(target_replay *replay);
+
+#endif //TARGET_LOG_H_
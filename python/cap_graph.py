@@ -36,14 +36,14 @@ import math
 import db_utils
 import gv_utils
 
-def show_caps_to_bin(db, path, graph):
-    get_caps_q = "SELECT * FROM cap_info"
-    caps = db_utils.run_sql_query(db, get_caps_q)
+def show_caps_to_bin(db, snapshot, path, graph):
+    get_caps_q = "SELECT * FROM cap_info_with_path WHERE snapshot_id = ?"
+    caps = db_utils.run_sql_query(db, get_caps_q, (snapshot,))
     
-    lib_start_q = "SELECT start_addr FROM vm WHERE mmap_path LIKE '%" + str(path) + "%'"
-    lib_end_q = "SELECT end_addr FROM vm WHERE mmap_path LIKE '%" + str(path) + "%'"
-    lib_start_addrs = db_utils.run_sql_query(db, lib_start_q)
-    lib_end_addrs = db_utils.run_sql_query(db, lib_end_q)
+    lib_start_q = "SELECT start_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+    lib_end_q = "SELECT end_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+    lib_start_addrs = db_utils.run_sql_query(db, lib_start_q, (snapshot, str(path)))
+    lib_end_addrs = db_utils.run_sql_query(db, lib_end_q, (snapshot, str(path)))
     
     # node showing the loaded library, with cap records pointing into it
     # We have all the information here at this point, just need to graph it
@@ -58,33 +58,33 @@ def show_caps_to_bin(db, path, graph):
         cap_loc_addr = cap[0] 
         cap_path = cap[1]
         cap_addr = cap[2]
-        cap_perms = cap[3]
+        cap_perms = db_utils.perms_str(cap[3])
         cap_base = cap[4]
         cap_top = cap[5]
         
         if path in cap_path:
-            node_label = cap_addr
-            cap_node = gv_utils.gen_node(cap_addr, cap_addr +"|"+cap_perms+"|"+cap_base+"-"+cap_top, "pink", "same")
+            node_label = db_utils.hex_addr(cap_addr)
+            cap_node = gv_utils.gen_node(node_label, node_label +"|"+cap_perms+"|"+db_utils.hex_addr(cap_base)+"-"+db_utils.hex_addr(cap_top), "pink", "same")
             nodes.append(cap_node)
 
     gv_utils.gen_records(graph, nodes, edges)
 
-def show_caps_between_two_libs(db, lib1, lib2, graph):
-    lib1_caps_q = "SELECT * FROM cap_info WHERE cap_loc_path LIKE '%" + str(lib1) + "%'"
-    lib1_caps = db_utils.run_sql_query(db, lib1_caps_q)
+def show_caps_between_two_libs(db, snapshot, lib1, lib2, graph):
+    lib1_caps_q = "SELECT * FROM cap_info_with_path WHERE snapshot_id = ? AND cap_loc_path LIKE '%' || ? || '%'"
+    lib1_caps = db_utils.run_sql_query(db, lib1_caps_q, (snapshot, str(lib1)))
     
-    lib2_caps_q = "SELECT * FROM cap_info WHERE cap_loc_path LIKE '%" + str(lib2) + "%'"
-    lib2_caps = db_utils.run_sql_query(db, lib2_caps_q)
+    lib2_caps_q = "SELECT * FROM cap_info_with_path WHERE snapshot_id = ? AND cap_loc_path LIKE '%' || ? || '%'"
+    lib2_caps = db_utils.run_sql_query(db, lib2_caps_q, (snapshot, str(lib2)))
     
-    lib1_start_q = "SELECT start_addr FROM vm WHERE mmap_path LIKE '%" + str(lib1) + "%'"
-    lib1_end_q = "SELECT end_addr FROM vm WHERE mmap_path LIKE '%" + str(lib1) + "%'"
-    lib1_start_addrs = db_utils.run_sql_query(db, lib1_start_q)
-    lib1_end_addrs = db_utils.run_sql_query(db, lib1_end_q)
+    lib1_start_q = "SELECT start_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+    lib1_end_q = "SELECT end_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+    lib1_start_addrs = db_utils.run_sql_query(db, lib1_start_q, (snapshot, str(lib1)))
+    lib1_end_addrs = db_utils.run_sql_query(db, lib1_end_q, (snapshot, str(lib1)))
     
-    lib2_start_q = "SELECT start_addr FROM vm WHERE mmap_path LIKE '%" + str(lib2) + "%'"
-    lib2_end_q = "SELECT end_addr FROM vm WHERE mmap_path LIKE '%" + str(lib2) + "%'"
-    lib2_start_addrs = db_utils.run_sql_query(db, lib2_start_q)
-    lib2_end_addrs = db_utils.run_sql_query(db, lib2_end_q)
+    lib2_start_q = "SELECT start_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+    lib2_end_q = "SELECT end_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+    lib2_start_addrs = db_utils.run_sql_query(db, lib2_start_q, (snapshot, str(lib2)))
+    lib2_end_addrs = db_utils.run_sql_query(db, lib2_end_q, (snapshot, str(lib2)))
     
     # node showing the loaded libraries, with cap records pointing into it
     # We have all the information here at this point, just need to graph it
@@ -100,7 +100,7 @@ def show_caps_between_two_libs(db, lib1, lib2, graph):
         cap_loc_addr = cap1[0] 
         cap_path = cap1[1]
         cap_addr = cap1[2]
-        cap_perms = cap1[3]
+        cap_perms = db_utils.perms_str(cap1[3])
         cap_base = cap1[4]
         cap_top = cap1[5]
         
@@ -123,7 +123,7 @@ def show_caps_between_two_libs(db, lib1, lib2, graph):
         cap_loc_addr = cap2[0] 
         cap_path = cap2[1]
         cap_addr = cap2[2]
-        cap_perms = cap2[3]
+        cap_perms = db_utils.perms_str(cap2[3])
         cap_base = cap2[4]
         cap_top = cap2[5]
         
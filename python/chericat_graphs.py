@@ -47,6 +47,12 @@ parser.add_argument(
     required=True,
 )
 
+parser.add_argument(
+	'--snapshot',
+	help='The snapshot_id of the snapshot to graph, the latest one by default',
+	type=int,
+)
+
 parser.add_argument(
 	'-g', 
 	help='Generate full capability relationship in mmap graph', 
@@ -82,10 +88,13 @@ args = parser.parse_args()
 if args.d:
 	db = args.d
 	dbname = os.path.basename(db)
+	snapshot = args.snapshot
+	if snapshot is None:
+		snapshot = db_utils.latest_snapshot(db)
 
 if args.g:
 	digraph = graphviz.Digraph('G', filename=dbname+'.graph_overview.gv')
-	full_graph.gen_full_graph(db, digraph)
+	full_graph.gen_full_graph(db, snapshot, digraph)
 	digraph.render(directory='graph-output', view=True)  
 
 if args.r:
@@ -93,13 +102,13 @@ if args.r:
 
 if args.c:
 	digraph = graphviz.Digraph('G', filename=args.c[0]+'_vs_'+args.c[1]+'.gv')
-	cap_graph.show_caps_between_two_libs(db, args.c[0], args.c[1], digraph)
+	cap_graph.show_caps_between_two_libs(db, snapshot, args.c[0], args.c[1], digraph)
 	digraph.render(directory='graph-output', view=True)
 
 if args.comp:
     start = time.perf_counter()
     digraph = graphviz.Digraph('G', filename=dbname+'.comparts_graph.gv')
-    comparts_graph.show_comparts(db, digraph)
+    comparts_graph.show_comparts(db, snapshot, digraph)
     end = time.perf_counter()
     print("Comparts graph generation time taken: " + str(end-start) + "s")
 
@@ -108,7 +117,7 @@ if args.comp:
 if args.compc:
     start = time.perf_counter()
     digraph = graphviz.Digraph('G', filename=dbname+'.cc_graph.gv')
-    comparts_graph.show_comparts_has_caps(db, digraph)
+    comparts_graph.show_comparts_has_caps(db, snapshot, digraph)
     end = time.perf_counter()
     print("Capability comparts graph generation time taken: " + str(end-start) + "s")
     digraph.render(directory='graph-output', view=True)
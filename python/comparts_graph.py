@@ -37,20 +37,20 @@ import os
 import db_utils
 import gv_utils
 
-def show_comparts(db, graph):
-    get_compart_id_q = "SELECT DISTINCT compart_id FROM vm"
-    compart_ids = db_utils.run_sql_query(db, get_compart_id_q)
+def show_comparts(db, snapshot, graph):
+    get_compart_id_q = "SELECT DISTINCT compart_id FROM vm_with_path WHERE snapshot_id = ?"
+    compart_ids = db_utils.run_sql_query(db, get_compart_id_q, (snapshot,))
     
-    get_caps_q = "SELECT * FROM cap_info"
-    caps = db_utils.run_sql_query(db, get_caps_q)
+    get_caps_q = "SELECT * FROM cap_info_with_path WHERE snapshot_id = ?"
+    caps = db_utils.run_sql_query(db, get_caps_q, (snapshot,))
 
     nodes = []
     edges = []
 
     for compart_id in compart_ids:
         single_compart_id = compart_id[0]
-        get_path_for_id_q = "SELECT DISTINCT mmap_path FROM vm WHERE compart_id=" + str(single_compart_id)
-        paths = db_utils.run_sql_query(db, get_path_for_id_q)
+        get_path_for_id_q = "SELECT DISTINCT mmap_path FROM vm_with_path WHERE snapshot_id = ? AND compart_id = ?"
+        paths = db_utils.run_sql_query(db, get_path_for_id_q, (snapshot, single_compart_id))
 
         path = ""
         count = 0
@@ -75,16 +75,16 @@ def show_comparts(db, graph):
         for path_list in paths:
             path_label = path_list[0]
 
-            lib_start_q = "SELECT start_addr FROM vm WHERE mmap_path LIKE '%" + str(path_list[0]) + "%'"
-            lib_end_q = "SELECT end_addr FROM vm WHERE mmap_path LIKE '%" + str(path_list[0]) + "%'"
-            lib_start_addrs = db_utils.run_sql_query(db, lib_start_q)
-            lib_end_addrs = db_utils.run_sql_query(db, lib_end_q)             
+            lib_start_q = "SELECT start_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+            lib_end_q = "SELECT end_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+            lib_start_addrs = db_utils.run_sql_query(db, lib_start_q, (snapshot, str(path_list[0])))
+            lib_end_addrs = db_utils.run_sql_query(db, lib_end_q, (snapshot, str(path_list[0])))             
 
             for cap in caps:
                 cap_loc_addr = cap[0]
                 cap_path = cap[1]
                 cap_addr = cap[2]
-                cap_perms = cap[3]
+                cap_perms = db_utils.perms_str(cap[3])
                 cap_base = cap[4]
                 cap_top = cap[5]
 
@@ -101,8 +101,8 @@ def show_comparts(db, graph):
                         cap_path != path_list[0][:-6] and \
                         cap_path[:-6] != path_list[0] and \
                         cap_path[:-6] != path_list[0][:-6]:
-                        find_compart_id_q = "SELECT DISTINCT compart_id FROM vm WHERE mmap_path LIKE '%" + cap_path + "%'"
-                        cap_path_compart_id_json = db_utils.run_sql_query(db, find_compart_id_q)
+                        find_compart_id_q = "SELECT DISTINCT compart_id FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+                        cap_path_compart_id_json = db_utils.run_sql_query(db, find_compart_id_q, (snapshot, cap_path))
                         # only need the first compart_id as they should be all the same 
                         cap_compart_id = cap_path_compart_id_json[0][0]
                         
@@ -117,11 +117,11 @@ def show_comparts(db, graph):
 
     gv_utils.gen_records(graph, nodes, edges)
 
-def show_comparts_has_caps(db, graph):
-    get_compart_id_q = "SELECT distinct compart_id, mmap_path FROM vm"
-    compart_ids = db_utils.run_sql_query(db, get_compart_id_q) # returns an array of arrays, each with 2 elements: compart_id and mmap_path
-    get_caps_q = "SELECT * FROM cap_info"
-    caps = db_utils.run_sql_query(db, get_caps_q)
+def show_comparts_has_caps(db, snapshot, graph):
+    get_compart_id_q = "SELECT distinct compart_id, mmap_path FROM vm_with_path WHERE snapshot_id = ?"
+    compart_ids = db_utils.run_sql_query(db, get_compart_id_q, (snapshot,)) # returns an array of arrays, each with 2 elements: compart_id and mmap_path
+    get_caps_q = "SELECT * FROM cap_info_with_path WHERE snapshot_id = ?"
+    caps = db_utils.run_sql_query(db, get_caps_q, (snapshot,))
     
     nodes = []
     edges = []
@@ -145,16 +145,16 @@ def show_comparts_has_caps(db, graph):
                         fillcolor,
                         rank))
 
-        lib_start_q = "SELECT start_addr FROM vm WHERE mmap_path LIKE '%" + mmap_path + "%'"
-        lib_end_q = "SELECT end_addr FROM vm WHERE mmap_path LIKE '%" + mmap_path + "%'"
-        lib_start_addrs = db_utils.run_sql_query(db, lib_start_q)
-        lib_end_addrs = db_utils.run_sql_query(db, lib_end_q)    
+        lib_start_q = "SELECT start_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+        lib_end_q = "SELECT end_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+        lib_start_addrs = db_utils.run_sql_query(db, lib_start_q, (snapshot, mmap_path))
+        lib_end_addrs = db_utils.run_sql_query(db, lib_end_q, (snapshot, mmap_path))    
 
         for cap in caps:
             cap_loc_addr = cap[0]
             cap_path = cap[1]
             cap_addr = cap[2]
-            cap_perms = cap[3]
+            cap_perms = db_utils.perms_str(cap[3])
             cap_base = cap[4]
             cap_top = cap[5]
  
@@ -170,8 +170,8 @@ def show_comparts_has_caps(db, graph):
                     cap_path[:-6] != mmap_path and \
                     cap_path[:-6] != mmap_path[:-6]:
 
-                    find_compart_id_q = "SELECT DISTINCT compart_id FROM vm WHERE mmap_path LIKE '%" + cap_path + "%'"
-                    cap_path_compart_id_json = db_utils.run_sql_query(db, find_compart_id_q)
+                    find_compart_id_q = "SELECT DISTINCT compart_id FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+                    cap_path_compart_id_json = db_utils.run_sql_query(db, find_compart_id_q, (snapshot, cap_path))
                     # only need the first compart_id as they should be all the same 
                     cap_compart_id = cap_path_compart_id_json[0][0]
 #                   print("cap_path_label: " + str(cap_compart_id) + " single_compart_id: " + str(single_compart_id) + " compart path: " + path)
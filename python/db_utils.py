@@ -35,10 +35,26 @@ import graphviz
 import json
 import sqlite3
 
-def run_sql_query(db, query):
+def run_sql_query(db, query, params=()):
     conn = sqlite3.connect(db)
     cur = conn.cursor()
-    cur.execute(query)
+    cur.execute(query, params)
     result_data = json.dumps(cur.fetchall())
     result_json = json.loads(result_data)
     return result_json
+
+# The snapshot the graphs show when none is given, as chericat -v does
+def latest_snapshot(db):
+    return run_sql_query(db, "SELECT MAX(snapshot_id) FROM snapshot")[0][0]
+
+# Letters of the CAP_PERM_* bits stored in cap_info.perms (see cap_decode.h),
+# in the order strfcap prints them.
+CAP_PERM_LETTERS = [(1 << 0, 'r'), (1 << 1, 'w'), (1 << 2, 'x'),
+                    (1 << 3, 'R'), (1 << 4, 'W'), (1 << 5, 'E')]
+
+def perms_str(perms):
+    return "".join(letter for bit, letter in CAP_PERM_LETTERS if perms & bit)
+
+# Addresses are stored as 64-bit INTEGERs, which sqlite hands back signed
+def hex_addr(addr):
+    return hex(addr & 0xffffffffffffffff)
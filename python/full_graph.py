@@ -38,27 +38,27 @@ import sqlite3
 import db_utils
 import gv_utils
 
-def gen_full_graph(db, graph):
-    get_bin_paths_q = "SELECT DISTINCT mmap_path FROM vm"
-    path_list_json = db_utils.run_sql_query(db, get_bin_paths_q)
+def gen_full_graph(db, snapshot, graph):
+    get_bin_paths_q = "SELECT DISTINCT mmap_path FROM vm_with_path WHERE snapshot_id = ?"
+    path_list_json = db_utils.run_sql_query(db, get_bin_paths_q, (snapshot,))
     
-    get_caps_q = "SELECT * FROM cap_info"
-    caps = db_utils.run_sql_query(db, get_caps_q)
+    get_caps_q = "SELECT * FROM cap_info_with_path WHERE snapshot_id = ?"
+    caps = db_utils.run_sql_query(db, get_caps_q, (snapshot,))
                 
     nodes = []
     edges = []
     
     for path_list in path_list_json:
-        lib_start_q = "SELECT start_addr FROM vm WHERE mmap_path LIKE '%" + str(path_list[0]) + "%'"
-        lib_end_q = "SELECT end_addr FROM vm WHERE mmap_path LIKE '%" + str(path_list[0]) + "%'"
-        lib_start_addrs = db_utils.run_sql_query(db, lib_start_q)
-        lib_end_addrs = db_utils.run_sql_query(db, lib_end_q)
+        lib_start_q = "SELECT start_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+        lib_end_q = "SELECT end_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path LIKE '%' || ? || '%'"
+        lib_start_addrs = db_utils.run_sql_query(db, lib_start_q, (snapshot, str(path_list[0])))
+        lib_end_addrs = db_utils.run_sql_query(db, lib_end_q, (snapshot, str(path_list[0])))
         
         if (path_list[0] == "unknown" or 
             path_list[0] == "Stack" or 
             path_list[0] == "Guard"):
             
-            path_label = path_list[0] + " (" + lib_start_addrs[0][0] + ")"
+            path_label = path_list[0] + " (" + db_utils.hex_addr(lib_start_addrs[0][0]) + ")"
             fillcolor = "lightgrey"
             rank = "source"
         else:
@@ -72,7 +72,7 @@ def gen_full_graph(db, graph):
             cap_loc_addr = cap[0] 
             cap_path = cap[1]
             cap_addr = cap[2]
-            cap_perms = cap[3]
+            cap_perms = db_utils.perms_str(cap[3])
             cap_base = cap[4]
             cap_top = cap[5]
             
@@ -94,10 +94,10 @@ def gen_full_graph(db, graph):
                         cap_path == "Stack" or 
                         cap_path == "Guard"):
                         
-                        get_start_addr_q = "SELECT start_addr FROM vm WHERE mmap_path=\"" + cap_path + "\""
+                        get_start_addr_q = "SELECT start_addr FROM vm_with_path WHERE snapshot_id = ? AND mmap_path = ?"
                         # Only interested in the first result?
-                        start_addr_list_json = db_utils.run_sql_query(db, get_start_addr_q)
-                        cap_path_label = cap_path + " (" + start_addr_list_json[0][0] + ")"
+                        start_addr_list_json = db_utils.run_sql_query(db, get_start_addr_q, (snapshot, cap_path))
+                        cap_path_label = cap_path + " (" + db_utils.hex_addr(start_addr_list_json[0][0]) + ")"
                     else:
                         cap_path_label = cap_path
                     
@@ -0,0 +1,235 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <err.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN		alignof(max_align_t)
+#define STR_TABLE_MIN_SLOTS	256
+
+struct arena_block {
+	arena_block *next;
+	size_t size;
+	size_t used;
+	alignas(max_align_t) unsigned char data[];
+};
+
+static arena_block *new_block(arena *a, size_t size)
+{
+	arena_block *block = malloc(sizeof(arena_block) + size);
+
+	if (block == NULL) {
+		errx(1, "Cannot allocate an arena block of %zu bytes", size);
+	}
+	block->size = size;
+	block->used = 0;
+	a->reserved += size;
+	a->block_count++;
+	return block;
+}
+
+/*
+ * arena_init(a, block_size)
+ * Makes an empty arena, whose blocks are block_size bytes, or
+ * ARENA_DEFAULT_BLOCK_SIZE if it is 0. No block is allocated until the
+ * first allocation.
+ */
+void arena_init(arena *a, size_t block_size)
+{
+	memset(a, 0, sizeof(arena));
+	a->block_size = block_size != 0 ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+/*
+ * arena_alloc(a, size)
+ * Returns size bytes aligned for any type, valid until arena_free. A request
+ * larger than a quarter of a block gets a block of its own, behind the one
+ * being filled, so that the rest of that one is not wasted.
+ */
+void *arena_alloc(arena *a, size_t size)
+{
+	arena_block *block = a->blocks;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size > a->block_size / 4) {
+		arena_block *large = new_block(a, size);
+		large->used = size;
+		if (block != NULL) {
+			large->next = block->next;
+			block->next = large;
+		} else {
+			large->next = NULL;
+			a->blocks = large;
+		}
+		a->used += size;
+		return large->data;
+	}
+	if (block == NULL || block->size - block->used < size) {
+		block = new_block(a, a->block_size);
+		block->next = a->blocks;
+		a->blocks = block;
+	}
+	void *p = &block->data[block->used];
+	block->used += size;
+	a->used += size;
+	return p;
+}
+
+void *arena_calloc(arena *a, size_t count, size_t size)
+{
+	if (size != 0 && count > SIZE_MAX / size) {
+		errx(1, "Cannot allocate %zu elements of %zu bytes from an arena", count, size);
+	}
+	void *p = arena_alloc(a, count*size);
+	memset(p, 0, count*size);
+	return p;
+}
+
+char *arena_strdup(arena *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *copy = arena_alloc(a, len);
+
+	memcpy(copy, s, len);
+	return copy;
+}
+
+/*
+ * arena_free(a)
+ * Frees every block of the arena, and with them everything allocated from
+ * it. The arena is left empty and can be used again.
+ */
+void arena_free(arena *a)
+{
+	arena_block *block = a->blocks;
+
+	while (block != NULL) {
+		arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena_init(a, a->block_size);
+}
+
+/* FNV-1a */
+static uint64_t hash_string(const char *s)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *s != '\0'; s++) {
+		h ^= (unsigned char)*s;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static void grow_slots(str_table *table)
+{
+	u_long capacity = table->capacity == 0 ? STR_TABLE_MIN_SLOTS : table->capacity*2;
+	char **slots = calloc(capacity, sizeof(char *));
+
+	if (slots == NULL) {
+		errx(1, "Cannot grow the string table to %lu strings", capacity);
+	}
+	for (u_long i=0; i<table->capacity; i++) {
+		char *s = table->slots[i];
+		if (s == NULL) {
+			continue;
+		}
+		u_long slot = hash_string(s) & (capacity - 1);
+		while (slots[slot] != NULL) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		slots[slot] = s;
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->capacity = capacity;
+}
+
+/*
+ * str_table_init(table, a)
+ * Makes an empty string table, whose strings are copied into a.
+ */
+void str_table_init(str_table *table, arena *a)
+{
+	memset(table, 0, sizeof(str_table));
+	table->arena = a;
+}
+
+/*
+ * str_intern(table, s)
+ * Returns the copy of s in table, adding it if there is none yet. The copy
+ * must not be modified. NULL is returned as it is.
+ */
+char *str_intern(str_table *table, const char *s)
+{
+	if (s == NULL) {
+		return NULL;
+	}
+	table->lookups++;
+	// Kept at most half full
+	if (2*(table->count + 1) > table->capacity) {
+		grow_slots(table);
+	}
+
+	u_long slot = hash_string(s) & (table->capacity - 1);
+	while (table->slots[slot] != NULL) {
+		if (strcmp(table->slots[slot], s) == 0) {
+			return table->slots[slot];
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+	table->slots[slot] = arena_strdup(table->arena, s);
+	table->count++;
+	return table->slots[slot];
+}
+
+/*
+ * str_table_free(table)
+ * Frees the index of the table, the strings themselves are freed with its
+ * arena.
+ */
+void str_table_free(str_table *table)
+{
+	free(table->slots);
+	str_table_init(table, table->arena);
+}
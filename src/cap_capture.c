@@ -48,142 +48,99 @@
 #include "common.h"
 #include "db_process.h"
 #include "cap_capture.h"
+#include "cap_decode.h"
 #include "ptrace_utils.h"
-
-void get_capability(int pid, void* addr, int current_cap_count, char *path, char **query_vals)
+#include "run_stats.h"
+#include "scan_pool.h"
+#include "tag_scan.h"
+
+/* read_capabilities
+ * Reads nslots consecutive capability slots starting at addr with a single
+ * PIOD_READ_CHERI_CAP request, each slot is returned as CAP_DECODE_SLOT_SIZE
+ * bytes in capbuf. Returns 0 if all the slots have been read.
+ */
+static int read_capabilities(void *arg, u_long addr, unsigned char *capbuf, int nslots)
 {
+	int pid = *(int *)arg;
 	struct ptrace_io_desc piod;
-	char capbuf[sizeof(uintcap_t)+1];
-	
+	size_t len = nslots*CAP_DECODE_SLOT_SIZE;
+
 	piod.piod_op = PIOD_READ_CHERI_CAP;
-        piod.piod_offs = addr;
-        piod.piod_addr = capbuf;
-        piod.piod_len = sizeof(capbuf);
-	
-        // Sending IO trace request and obtain the capability
-	int retno = ptrace(PT_IO, pid, (caddr_t)&piod, 0);
+	piod.piod_offs = (void*)(uintptr_t)addr;
+	piod.piod_addr = capbuf;
+	piod.piod_len = len;
 
-	if (DEBUG) {
-		for (int i=0; i<sizeof(uintcap_t)+1; i++) {
-        		debug_print(VERBOSE, "%02x ", capbuf[i]);
-		}
-		debug_print(VERBOSE, "\n", NULL);
+	int retno = ptrace(PT_IO, pid, (caddr_t)&piod, 0);
+	run_count(RUN_PTRACE_CALLS, 1);
+	run_count(RUN_BYTES_READ, piod.piod_len);
+	if (retno != 0 || piod.piod_len != len) {
+		debug_print(TROUBLESHOOT, "ptrace(PT_IO) for PIOD_READ_CHERI_CAP of %d slots at 0x%lx returned %d (%zu bytes)\n",
+		    nslots, addr, retno, piod.piod_len);
+		return -1;
 	}
+	return 0;
+}
 
-	// Getting a copy of the capability and store it to the vm_cap_info struct
-	uintcap_t copy;
-
-	memcpy(&copy, &capbuf[1], sizeof(copy));
-	debug_print(VERBOSE, "Address of the copied capability: %#p\n", (void*)copy);
-
-	// Getting permissions of the obtained capability
-	char str[128];
-	char permsread[16] = {};
-	int tokens;
-	unsigned long addrread, base, top;
-	char attrread[32];
-
-	strfcap(str, sizeof(str), "%C", copy);
-	tokens = sscanf(str, "%lx [%15[^,],%lx-%lx] %31s", &addrread, permsread, &base, &top, attrread);
-
-	debug_print(VERBOSE, "Using strfcap API to parse the cap, tokens: %d permsread: %s base: 0x%lx top: 0x%lx attrread: %31s\n", 
-			tokens, permsread, base, top, attrread);
+/* 
+ * read_tags_ptrace
+ * Reads the tags of a run of pages with a single PIOD_READ_CHERI_TAGS request.
+ */
+static ssize_t read_tags_ptrace(void *arg, u_long start, unsigned char *tagsbuf, size_t len)
+{
+	int pid = *(int *)arg;
+	struct ptrace_io_desc piod;
 
-	// Return the captured caps into multiple values to be inserted using a single sql statement
-	int query_size = asprintf(query_vals, "(\"%p\", \"%s\", \"%p\", \"%s\", \"%p\", \"%p\")", 
-					addr, path, (void*)copy, permsread, (void*)(uintptr_t)base, (void*)(uintptr_t)top);
-	assert(query_size != -1);
+	piod.piod_op = PIOD_READ_CHERI_TAGS;
+	piod.piod_offs = (void*)(uintptr_t)start;
+	piod.piod_addr = tagsbuf;
+	piod.piod_len = len;
 
-        if (retno != 0) {
-                fprintf(stderr, "ptrace(PT_IO) for PIOD_READ_CHERI_CAP hasn't ended gracefully: %s %d\n", strerror(retno), retno); 
+	int retno = ptrace(PT_IO, pid, (caddr_t)&piod, 0);
+	run_count(RUN_PTRACE_CALLS, 1);
+	if (retno != 0) {
+		// This generates a lot of noise, useful for troubleshooting when needed
+		debug_print(TROUBLESHOOT, "ptrace(PT_IO) for PIOD_READ_CHERI_TAGS returned %d\n", retno);
+		return -1;
 	}
+	run_count(RUN_BYTES_READ, piod.piod_len);
+	return piod.piod_len;
 }
 
-/* get_tags
- * By using the ptrace PIOD_READ_CHERI_TAGS API, this function scans each provided
- * capability - u_long start - and find all the marked tags. It stores the found tags'
- * capabilities to the vm_cap_info struct. 
+/*
+ * read_data_ptrace
+ * Reads len bytes of ordinary data at addr with a single PIOD_READ_D request.
  */
-int get_tags(sqlite3 *db, int pid, u_long start, char *path)
+static int read_data_ptrace(void *arg, u_long addr, void *buf, size_t len)
 {
-        struct ptrace_io_desc piod;
-        char tagsbuf[32] = {};
-	int cap_count = 0;
-        
-	piod.piod_op = PIOD_READ_CHERI_TAGS;
-        piod.piod_offs = (void*)(uintptr_t)start;
-        piod.piod_addr = tagsbuf;
-        piod.piod_len = sizeof(tagsbuf);
-
-        int retno = ptrace(PT_IO, pid, (caddr_t)&piod, 0);
-
-	// retno is 0 is the capability has a cheri tag
-	// "start" is the capability pointing to a page of capabilities, each capability is 64bits (8bytes)
-	// and there are 256 capabilities on a 4k-byte page
-	//
-	// pTrace scans the capabilities per page, and stores their corresponding tag bit in the tagsbuf array,
-	// packing each 8 bits into a char, hence there are 32 bytes in the tagsbuf char array.
-        if (retno == 0) {
-		char *insert_cap_query_values = NULL;
-
-        	for (int i=0; i<32; i++) {
-			char tags = tagsbuf[i];
-			
-			// Each "char tags" contains 8 tags with 1 bit each
-			uintptr_t tags_addr[8];
-
-			if ('0' != tags) { 
-				for (int j=0; j<8; j++) {
-					// Checking each tag bit, if it corresponds to a capability (1) or not (0)
-					int bit = tags & 1;
-
-					// The corresponding capabilty of each tag is offset by 8x16 from the 256 capabilities we have reached 
-					// so far in this loop, because each tags in tagsbuf has 8 bits, each bit correspond to a 16-byte capability.
-					// We need to calculate the offset from start, hence the i*8*16 to get the starting capability in each 
-					// inner iteration.
-					u_long address = start + i*8*16 + j*16;
-					tags_addr[j] = (uintptr_t)address;
+	int pid = *(int *)arg;
+	struct ptrace_io_desc piod;
 
-					tags = tags >> 1;
-					if (bit) {
-						debug_print(VERBOSE, "Addresses referenced by tags[%d] (cap_count %d): %p\n", j, cap_count, (void*)tags_addr[j]);
-						// Now we have enough information to go through each capability to obtain further information about them.
-						char *val;
-						get_capability(pid, (void*)tags_addr[j], cap_count, path, &val);
-						debug_print(VERBOSE, "Obtained cap values: %s\n", val);
+	piod.piod_op = PIOD_READ_D;
+	piod.piod_offs = (void*)(uintptr_t)addr;
+	piod.piod_addr = buf;
+	piod.piod_len = len;
 
-						if (insert_cap_query_values == NULL) {
-							insert_cap_query_values = (char*)malloc(sizeof(val));
-							assert(insert_cap_query_values != NULL);
-							insert_cap_query_values = strdup(val);
-						} else {
-							char *temp;
-							asprintf(&temp, "%s,%s", insert_cap_query_values, val);
-							insert_cap_query_values = strdup(temp);
-							
-							free(temp);
-						}
-						free(val);
-						// Maintain a count for each vm block.
-						cap_count++;
-					}	
-				}
-			}
-        	}
-		if (insert_cap_query_values != NULL && insert_cap_query_values[0] != '\0') {
-			char query_hdr[] = "INSERT INTO cap_info VALUES";
-			char *query;
-			asprintf(&query, "%s %s;", query_hdr, insert_cap_query_values);
-	
-			int db_rc = sql_query_exec(db, query, NULL, NULL);
-			debug_print(TROUBLESHOOT, "Key Stage: Inserted vm entry info to the database (rc=%d)\n", db_rc);
-			free(query);
-			free(insert_cap_query_values);
-		}
-	} else { 
-		// This generates a lot of noise, useful for troubleshooting when needed
-		debug_print(TROUBLESHOOT, "ptrace(PT_IO) for PIOD_READ_CHERI_TAGS returned %d\n", retno);
+	int retno = ptrace(PT_IO, pid, (caddr_t)&piod, 0);
+	run_count(RUN_PTRACE_CALLS, 1);
+	run_count(RUN_BYTES_READ, piod.piod_len);
+	if (retno != 0 || piod.piod_len != len) {
+		debug_print(TROUBLESHOOT, "ptrace(PT_IO) for PIOD_READ_D of %zu bytes at 0x%lx returned %d (%zu bytes)\n",
+		    len, addr, retno, piod.piod_len);
+		return -1;
 	}
-	return cap_count;
+	return 0;
 }
 
+/* ptrace_scan_target
+ * Sets target to read the memory of the traced process *pid,
+ * which has to stay valid while the target is in use. ptrace requests are
+ * accepted from any thread of the tracing process, so the target can be
+ * shared by the workers of a scan_pool.
+ */
+void ptrace_scan_target(scan_target *target, int *pid)
+{
+	target->read_tags = read_tags_ptrace;
+	target->read_caps = read_capabilities;
+	target->read_data = read_data_ptrace;
+	target->arg = pid;
+}
@@ -0,0 +1,297 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __CHERI__
+#include <cheri/cheric.h>
+#endif
+
+#include "cap_decode.h"
+
+/*
+ * The Morello capability format, as laid out in the upper half of a
+ * capability (bits 127:64), see the Arm Morello architecture reference
+ * manual. The exponent and whether it is internal are stored inverted, so
+ * that a capability of all zeros has the bounds of the whole address space.
+ */
+#define MORELLO_PERMS_SHIFT	46	/* Bits 127:110 */
+#define MORELLO_PERMS_MASK	0x3ffff
+#define MORELLO_OTYPE_SHIFT	31	/* Bits 109:95 */
+#define MORELLO_OTYPE_MASK	0x7fff
+#define MORELLO_IE_SHIFT	30	/* Bit 94 */
+#define MORELLO_LIMIT_SHIFT	16	/* Bits 93:80 */
+#define MORELLO_LIMIT_MASK	0x3fff
+#define MORELLO_BASE_MASK	0xffff	/* Bits 79:64 */
+#define MORELLO_MW		16
+#define MORELLO_MAX_EXPONENT	50
+#define MORELLO_FLAGS_SHIFT	56	/* The top byte of the address */
+
+#define MORELLO_PERM_GLOBAL		(1 << 0)
+#define MORELLO_PERM_EXECUTIVE		(1 << 1)
+#define MORELLO_PERM_MUTABLE_LOAD	(1 << 6)
+#define MORELLO_PERM_SYSTEM		(1 << 9)
+#define MORELLO_PERM_UNSEAL		(1 << 10)
+#define MORELLO_PERM_SEAL		(1 << 11)
+#define MORELLO_PERM_STORE_LOCAL_CAP	(1 << 12)
+#define MORELLO_PERM_STORE_CAP		(1 << 13)
+#define MORELLO_PERM_LOAD_CAP		(1 << 14)
+#define MORELLO_PERM_EXECUTE		(1 << 15)
+#define MORELLO_PERM_STORE		(1 << 16)
+#define MORELLO_PERM_LOAD		(1 << 17)
+
+typedef unsigned __int128 bound_t;	/* Bounds are computed on 66 bits */
+
+#define BOUND_MASK	(((bound_t)1 << 66) - 1)
+
+static uint32_t morello_perms(uint64_t hw_perms)
+{
+	uint32_t perms = 0;
+
+#define CAP_DECODE_PERM(HW, PERM) if (hw_perms & (HW)) perms |= (PERM)
+	CAP_DECODE_PERM(MORELLO_PERM_LOAD, CAP_PERM_LOAD);
+	CAP_DECODE_PERM(MORELLO_PERM_STORE, CAP_PERM_STORE);
+	CAP_DECODE_PERM(MORELLO_PERM_EXECUTE, CAP_PERM_EXECUTE);
+	CAP_DECODE_PERM(MORELLO_PERM_LOAD_CAP, CAP_PERM_LOAD_CAP);
+	CAP_DECODE_PERM(MORELLO_PERM_STORE_CAP, CAP_PERM_STORE_CAP);
+	CAP_DECODE_PERM(MORELLO_PERM_EXECUTIVE, CAP_PERM_EXECUTIVE);
+	CAP_DECODE_PERM(MORELLO_PERM_GLOBAL, CAP_PERM_GLOBAL);
+	CAP_DECODE_PERM(MORELLO_PERM_STORE_LOCAL_CAP, CAP_PERM_STORE_LOCAL_CAP);
+	CAP_DECODE_PERM(MORELLO_PERM_SEAL, CAP_PERM_SEAL);
+	CAP_DECODE_PERM(MORELLO_PERM_UNSEAL, CAP_PERM_UNSEAL);
+	CAP_DECODE_PERM(MORELLO_PERM_SYSTEM, CAP_PERM_SYSTEM_REGS);
+	CAP_DECODE_PERM(MORELLO_PERM_MUTABLE_LOAD, CAP_PERM_MUTABLE_LOAD);
+#undef CAP_DECODE_PERM
+
+	return perms;
+}
+
+static uint64_t load_le64(const unsigned char *p)
+{
+	uint64_t v = 0;
+
+	for (int i=0; i<8; i++) {
+		v |= (uint64_t)p[i] << (8*i);
+	}
+	return v;
+}
+
+/* cap_decode_morello
+ * Decodes the CAP_DECODE_CAP_SIZE bytes of a Morello capability in software,
+ * following CapGetBounds of the architecture, so that capabilities read from
+ * a Morello target can be decoded on any host.
+ */
+void cap_decode_morello(const void *cap_bytes, int tag, cap_decoded *out)
+{
+	const unsigned char *bytes = cap_bytes;
+	uint64_t value = load_le64(&bytes[0]);
+	uint64_t pesbt = load_le64(&bytes[8]);
+
+	uint32_t limit = (pesbt >> MORELLO_LIMIT_SHIFT) & MORELLO_LIMIT_MASK;
+	uint32_t bottom = pesbt & MORELLO_BASE_MASK;
+	int internal_exp = ((pesbt >> MORELLO_IE_SHIFT) & 1) == 0;
+	int exp = 0;
+	if (internal_exp) {
+		exp = ~(((limit & 7) << 3) | (bottom & 7)) & 0x3f;
+		limit &= ~7;
+		bottom &= ~7;
+	}
+
+	bound_t base, top;
+	if (exp > MORELLO_MAX_EXPONENT) {
+		// The whole address space, or bounds that cannot be encoded
+		base = 0;
+		top = (bound_t)1 << 64;
+	} else {
+		// The two top bits of the limit are implied by the base and the length
+		uint32_t carry = (limit & MORELLO_LIMIT_MASK) < (bottom & MORELLO_LIMIT_MASK);
+		uint32_t t = limit | ((((bottom >> (MORELLO_MW-2)) + internal_exp + carry) & 3) << (MORELLO_MW-2));
+
+		// The bounds address ignores the flags and is sign extended from bit 55
+		int64_t bounds_addr = (int64_t)(value << (64-MORELLO_FLAGS_SHIFT)) >> (64-MORELLO_FLAGS_SHIFT);
+		bound_t a = (bound_t)(__int128)bounds_addr & BOUND_MASK;
+
+		uint32_t a3 = (a >> (exp+MORELLO_MW-3)) & 7;
+		uint32_t b3 = (bottom >> (MORELLO_MW-3)) & 7;
+		uint32_t t3 = (t >> (MORELLO_MW-3)) & 7;
+		uint32_t r3 = (b3 - 1) & 7;
+		int a_hi = a3 < r3;
+		int correction_base = (b3 < r3) - a_hi;
+		int correction_top = (t3 < r3) - a_hi;
+
+		base = (bound_t)bottom << exp;
+		top = (bound_t)t << exp;
+		if (exp < MORELLO_MAX_EXPONENT) {
+			bound_t a_top = a >> (exp+MORELLO_MW);
+			base |= (a_top + (bound_t)(__int128)correction_base) << (exp+MORELLO_MW);
+			top |= (a_top + (bound_t)(__int128)correction_top) << (exp+MORELLO_MW);
+		}
+		base &= BOUND_MASK;
+		top &= BOUND_MASK;
+
+		uint32_t l2 = (top >> 63) & 3;
+		uint32_t b2 = (base >> 63) & 1;
+		if (exp < MORELLO_MAX_EXPONENT-1 && ((l2 - b2) & 3) > 1) {
+			top ^= (bound_t)1 << 64;
+		}
+		base &= UINT64_MAX;
+		top &= ((bound_t)1 << 65) - 1;
+	}
+
+	out->addr = value;
+	out->base = base;
+	out->top = top > UINT64_MAX ? UINT64_MAX : (uint64_t)top;
+	out->length = top < base ? 0 : (top - base > UINT64_MAX ? UINT64_MAX : (uint64_t)(top - base));
+	out->otype = (pesbt >> MORELLO_OTYPE_SHIFT) & MORELLO_OTYPE_MASK;
+	out->perms = morello_perms((pesbt >> MORELLO_PERMS_SHIFT) & MORELLO_PERMS_MASK);
+	out->tag = tag != 0;
+	out->sealed = out->otype != 0;
+	out->flags = value >> MORELLO_FLAGS_SHIFT;
+}
+
+/*
+ * Decoding a capability of the host architecture uses the cheric accessors.
+ * Elsewhere, as when a raw snapshot is ingested on another host, the
+ * capabilities are decoded as Morello ones by cap_decode_morello.
+ */
+#ifdef __CHERI__
+
+/* cap_perms_from_hw
+ * Converts the permission bits of the CHERI architecture this tool is built
+ * for into CAP_PERM_* bits.
+ */
+uint32_t cap_perms_from_hw(uint64_t hw_perms)
+{
+	uint32_t perms = 0;
+
+#define CAP_DECODE_PERM(HW, PERM) if (hw_perms & (HW)) perms |= (PERM)
+	CAP_DECODE_PERM(CHERI_PERM_LOAD, CAP_PERM_LOAD);
+	CAP_DECODE_PERM(CHERI_PERM_STORE, CAP_PERM_STORE);
+	CAP_DECODE_PERM(CHERI_PERM_EXECUTE, CAP_PERM_EXECUTE);
+	CAP_DECODE_PERM(CHERI_PERM_LOAD_CAP, CAP_PERM_LOAD_CAP);
+	CAP_DECODE_PERM(CHERI_PERM_STORE_CAP, CAP_PERM_STORE_CAP);
+	CAP_DECODE_PERM(CHERI_PERM_GLOBAL, CAP_PERM_GLOBAL);
+	CAP_DECODE_PERM(CHERI_PERM_STORE_LOCAL_CAP, CAP_PERM_STORE_LOCAL_CAP);
+	CAP_DECODE_PERM(CHERI_PERM_SEAL, CAP_PERM_SEAL);
+	CAP_DECODE_PERM(CHERI_PERM_UNSEAL, CAP_PERM_UNSEAL);
+	CAP_DECODE_PERM(CHERI_PERM_SYSTEM_REGS, CAP_PERM_SYSTEM_REGS);
+#ifdef CHERI_PERM_EXECUTIVE
+	CAP_DECODE_PERM(CHERI_PERM_EXECUTIVE, CAP_PERM_EXECUTIVE);
+#endif
+#ifdef CHERI_PERM_MUTABLE_LOAD
+	CAP_DECODE_PERM(CHERI_PERM_MUTABLE_LOAD, CAP_PERM_MUTABLE_LOAD);
+#endif
+#undef CAP_DECODE_PERM
+
+	return perms;
+}
+
+/* cap_decode_bytes
+ * Decodes the CAP_DECODE_CAP_SIZE bytes of a capability, as it is laid out in
+ * memory, using the cheric accessors. The bytes carry no tag, which is given
+ * separately, but the accessors only depend on the capability bits.
+ */
+void cap_decode_bytes(const void *cap_bytes, int tag, cap_decoded *out)
+{
+	uintcap_t cap;
+
+	memcpy(&cap, cap_bytes, sizeof(cap));
+
+	out->addr = cheri_getaddress(cap);
+	out->base = cheri_getbase(cap);
+	out->length = cheri_getlen(cap);
+	out->top = out->length > UINT64_MAX - out->base ? UINT64_MAX : out->base + out->length;
+	out->otype = cheri_gettype(cap);
+	out->perms = cap_perms_from_hw(cheri_getperm(cap));
+	out->tag = tag != 0;
+	out->sealed = cheri_getsealed(cap) != 0;
+	out->flags = cheri_getflags(cap);
+}
+
+#else // __CHERI__
+
+uint32_t cap_perms_from_hw(uint64_t hw_perms)
+{
+	return morello_perms(hw_perms);
+}
+
+void cap_decode_bytes(const void *cap_bytes, int tag, cap_decoded *out)
+{
+	cap_decode_morello(cap_bytes, tag, out);
+}
+
+#endif // __CHERI__
+
+/* cap_decode_slot
+ * Decodes a CAP_DECODE_SLOT_SIZE slot returned by PIOD_READ_CHERI_CAP.
+ */
+void cap_decode_slot(const void *slot, cap_decoded *out)
+{
+	const unsigned char *bytes = slot;
+
+	cap_decode_bytes(&bytes[1], bytes[0], out);
+}
+
+/* cap_perms_str
+ * Writes the permission letters of perms to buf, in the same form as the
+ * permissions printed by strfcap: r, w, x for data and instruction access,
+ * R and W for loading and storing capabilities, and E for executive.
+ */
+char *cap_perms_str(uint32_t perms, char *buf, size_t len)
+{
+	static const struct {
+		uint32_t perm;
+		char letter;
+	} letters[] = {
+		{ CAP_PERM_LOAD, 'r' },
+		{ CAP_PERM_STORE, 'w' },
+		{ CAP_PERM_EXECUTE, 'x' },
+		{ CAP_PERM_LOAD_CAP, 'R' },
+		{ CAP_PERM_STORE_CAP, 'W' },
+		{ CAP_PERM_EXECUTIVE, 'E' },
+	};
+	size_t n = 0;
+
+	if (len == 0) {
+		return buf;
+	}
+	for (size_t i=0; i<sizeof(letters)/sizeof(letters[0]) && n+1<len; i++) {
+		if (perms & letters[i].perm) {
+			buf[n++] = letters[i].letter;
+		}
+	}
+	buf[n] = '\0';
+	return buf;
+}
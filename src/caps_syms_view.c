@@ -43,7 +43,31 @@
 
 #include <libxo/xo.h>
 
+#include "arena.h"
 #include "db_process.h"
+#include "cap_decode.h"
+#include "sym_index.h"
+
+/*
+ * format_sym
+ * Returns "name (TYPE)" for the symbol covering addr, with "+0x.." appended
+ * when addr points into the middle of it, or "- (-)" if there is none.
+ */
+static char *format_sym(const sym_index *index, uint64_t addr)
+{
+	char *formatted = NULL;
+	uint64_t offset;
+	const sym_info *sym = sym_index_lookup(index, addr, &offset);
+
+	if (sym == NULL) {
+		asprintf(&formatted, "%s (%s)", "-", "-");
+	} else if (offset == 0) {
+		asprintf(&formatted, "%s (%s)", sym->sym_name, sym->type);
+	} else {
+		asprintf(&formatted, "%s+%#lx (%s)", sym->sym_name, offset, sym->type);
+	}
+	return formatted;
+}
 
 /*
  * cap_sym_view
@@ -55,16 +79,25 @@
  * 2. "SELECT COuNT(*) FROM elf_sym;"
  *
  * 3. "SELECT * FROM elf_sym;"
- * 
+ *
+ * The symbols are indexed by address once, the capabilities are then read
+ * one at a time and their location and target are resolved to the symbol at
+ * or containing them.
  */
 void caps_syms_view(sqlite3 *db, char *lib) 
 {
-	cap_info *cap_info_captured;
-	//int cap_count = get_all_cap_info(db, &cap_info_captured);
-	int cap_count = get_cap_info_for_lib(db, &cap_info_captured, lib);
+	int cap_count = cap_info_for_lib_count(db, lib);
+
+	// The symbols and their strings are freed at once with the arena
+	arena sym_arena;
+	str_table sym_strings;
+	arena_init(&sym_arena, 0);
+	str_table_init(&sym_strings, &sym_arena);
 
 	sym_info *sym_info_captured;
-	int sym_count = get_all_sym_info(db, &sym_info_captured);
+	int sym_count = get_all_sym_info(db, &sym_strings, &sym_info_captured);
+	sym_index index;
+	sym_index_build(&index, sym_info_captured, sym_count);
 
 	xo_open_list("cap_sym_output");
 
@@ -80,74 +113,48 @@ void caps_syms_view(sqlite3 *db, char *lib)
 	xo_emit("{T:/\n%12s %43-s %45-s %s}\n",
 		"CAP_LOC", " CAP_LOC_SYM (TYPE)", "CAP_INFO", "CAP_SYM (TYPE)");
 		
-	for (int i=0; i<cap_count; i++) {
-		char *formatted_sym_info_for_loc = NULL;
+	db_cursor cursor;
+	cap_info cap;
+	int rc = cap_cursor_open(db, &cursor, lib);
+	assert(rc == 0);
+
+	while ((rc = cap_cursor_next(&cursor, &cap)) == 1) {
+		char *formatted_sym_info_for_loc;
 		char *formatted_cap_info = NULL;
-		char *formatted_sym_info_for_cap = NULL;
-		int s;
+		char *formatted_sym_info_for_cap;
 
 		xo_open_instance("cap_sym_output");
 
 		/* Capability location information. */
-		xo_emit("{:/%12s}", cap_info_captured[i].cap_loc_addr);
-		for (s=0; s<sym_count; s++) {
-			if (strcmp(cap_info_captured[i].cap_loc_addr, sym_info_captured[s].addr) == 0) {
-				asprintf(&formatted_sym_info_for_loc, "%s (%s)",
-				    sym_info_captured[s].sym_name,
-				    sym_info_captured[s].type);
-				break;
-			}
-		}
-		if (s == sym_count)
-			asprintf(&formatted_sym_info_for_loc, "%s (%s)", "-", "-");
+		xo_emit("{:/%#12lx}", cap.cap_loc_addr);
+		formatted_sym_info_for_loc = format_sym(&index, cap.cap_loc_addr);
 		xo_emit("{:/  %43-s}", formatted_sym_info_for_loc);
 		free(formatted_sym_info_for_loc);
 
 		/* Capability range and permissions. */
-		asprintf(&formatted_cap_info, "%s[%s,-%s]",
-		    cap_info_captured[i].cap_addr,
-		    cap_info_captured[i].perms,
-		    cap_info_captured[i].top);
+		char perms[CAP_PERMS_STR_SIZE];
+		asprintf(&formatted_cap_info, "%#lx[%s,-%#lx]",
+		    cap.cap_addr,
+		    cap_perms_str(cap.perms, perms, sizeof(perms)),
+		    cap.top);
 		xo_emit("{:capinfo/% 45-s}", formatted_cap_info);
 		free(formatted_cap_info);
 
 		/* Capability target information. */
-		for (s=0; s<sym_count; s++) {
-			if (strcmp(cap_info_captured[i].cap_addr, sym_info_captured[s].addr) == 0) {
-				asprintf(&formatted_sym_info_for_cap, "%s (%s)",
-				    sym_info_captured[s].sym_name,
-				    sym_info_captured[s].type);
-				break;
-			}
-		}
-		if (s == sym_count)
-			asprintf(&formatted_sym_info_for_cap, "%s (%s)",
-			    "-", "-");
+		formatted_sym_info_for_cap = format_sym(&index, cap.cap_addr);
 		xo_emit("{:/ %43-s}\n", formatted_sym_info_for_cap);
 		free(formatted_sym_info_for_cap);
 
 		xo_close_instance("cap_sym_output");
-
-		free(cap_info_captured[i].cap_loc_addr);
-		free(cap_info_captured[i].cap_loc_path);
-		free(cap_info_captured[i].cap_addr);
-		free(cap_info_captured[i].perms);
-		free(cap_info_captured[i].base);
-		free(cap_info_captured[i].top);
 	}
+	assert(rc == 0);
+	db_cursor_close(&cursor);
 
-	for (int k=0; k<sym_count; k++) {
-		free(sym_info_captured[k].source_path);
-		free(sym_info_captured[k].sym_name);
-		free(sym_info_captured[k].sym_offset);
-		free(sym_info_captured[k].shndx);
-		free(sym_info_captured[k].type);
-		free(sym_info_captured[k].bind);
-		free(sym_info_captured[k].addr);
-	}
+	sym_index_free(&index);
 
 	xo_close_list("cap_sym_output");
-	free(cap_info_captured);
 	free(sym_info_captured);
+	str_table_free(&sym_strings);
+	arena_free(&sym_arena);
 }
 
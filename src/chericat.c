@@ -45,9 +45,17 @@
 #include "db_process.h"
 
 #include "caps_syms_view.h"
+#include "elf_utils.h"
 #include "mem_scan.h"
 #include "ptrace_utils.h"
 #include "rtld_linkmap_scan.h"
+#include "run_stats.h"
+#include "run_stats_view.h"
+#include "scan_pool.h"
+#include "snapshot_diff_view.h"
+#include "snapshot_ingest.h"
+#include "snapshots_view.h"
+#include "tag_scan.h"
 #include "vm_caps_view.h"
 #include "comp_caps_view.h"
 
@@ -64,11 +72,24 @@ static int exit_usage(const char *msg)
             "[-p|--attach <pid>]\n\t"
             "[-v|--overview]\n\t"
             "[-i|--caps_info <library or compartment name>]\n\t"
+            "[-t|--tag_chunk <pages>]\n\t"
+            "[-j|--jobs <workers>]\n\t"
+            "[-o|--raw-out <snapshot file>]\n\t"
+            "[-I|--incremental]\n\t"
+            "[-s|--snapshot <snapshot id>]\n\t"
+            "[-R|--record <record file>]\n\t"
+            "[-S|--stats]\n\t"
 	    "<command> ...\n"
             "    database name    - name of the database to store data captured by chericat\n"
             "    pid              - pid of the target process\n"
             "    library name     - name of the library for which show the capabilities info\n"
             "    compartment name - name of the compartment for which show the capabilities info\n"
+            "    pages            - number of 4k pages whose tags are read with a single request\n"
+            "    workers          - number of threads reading the capabilities of the target,\n"
+            "                       or decoding the capabilities of an ingested snapshot\n"
+            "    snapshot file    - name of the raw snapshot written instead of the database\n"
+            "    snapshot id      - id of a snapshot stored in the database, see \"snapshots\"\n"
+            "    record file      - name of the file the reads of the scan are recorded to\n"
             "Options:\n"
             "    -d Enable debugging output. Repeated -d's (up to 3) increase verbosity.\n"
             "    -f Provide the database name to capture the data collected.\n"
@@ -76,9 +97,22 @@ static int exit_usage(const char *msg)
             "    -p Scan the vm blocks and persist the data to the provided database.\n"
             "    -v Show the vm info, arranged in either library- or compartment-centric view\n"
             "    -i Show capabalities found in the provided library or compartment\n"
+            "    -t Read the tags of up to this many pages in one go when scanning with -p (default 256)\n"
+            "    -j Read the capabilities with this many threads when scanning with -p (default 1)\n"
+            "    -o Write what -p reads to a raw snapshot file, to be ingested into a database later\n"
+            "    -I Only write the capabilities of the pages that -p finds changed since the previous\n"
+            "       -I scan into the same database, updating its latest snapshot\n"
+            "    -s Show the data of this snapshot with -v or -i (default the latest one)\n"
+            "    -R Record every read -p makes from the target to a file, which \"ingest\" replays\n"
+            "    -S Show the time taken by each phase of the run, and what it read and wrote\n"
 	    "Commands:\n"
 	    "    show lib  - if used with -v or -i, shows data in library-centric view\n"
-	    "    show comp - if used with -v or -i, show data in compartment-centric view\n");
+	    "    show comp - if used with -v or -i, show data in compartment-centric view\n"
+	    "    ingest <snapshot file> - load a raw snapshot written with -o, or replay a scan\n"
+	    "                             recorded with -R, into the database\n"
+	    "    snapshots - list the snapshots stored in the database\n"
+	    "    diff <snapshot id> <snapshot id> - show the capabilities added, removed and modified\n"
+	    "                                       between the two snapshots\n");
     exit(1);
 }
 
@@ -89,6 +123,13 @@ static struct option long_options[] =
     {"attach", required_argument, 0, 'p'},
     {"overview", no_argument, 0, 'v'},
     {"caps_info", required_argument, 0, 'i'},
+    {"tag_chunk", required_argument, 0, 't'},
+    {"jobs", required_argument, 0, 'j'},
+    {"raw-out", required_argument, 0, 'o'},
+    {"incremental", no_argument, 0, 'I'},
+    {"snapshot", required_argument, 0, 's'},
+    {"record", required_argument, 0, 'R'},
+    {"stats", no_argument, 0, 'S'},
     {0,0,0,0}
 };
 
@@ -108,13 +149,20 @@ int main(int argc, char **argv)
     // libxo API to parse the libxo command line arguments. They are removed once parsed and stored,
     // the program arguments would then be handled as intended without the libxo arguments.
     argc = xo_parse_args(argc, argv);
+    set_snapshot_command(argc, argv);
   
     long int pid=-1;
+    long int tag_chunk;
+    long int workers;
     char *pEnd;
     char *caps_info_param;
+    char *raw_out_path;
+    char *record_path;
+    long int snapshot_id;
+    run_timer view_timer;
     
     int optindex;
-    int opt = getopt_long(argc, argv, "df:p:vi:", long_options, &optindex);
+    int opt = getopt_long(argc, argv, "df:p:vi:t:j:o:Is:R:S", long_options, &optindex);
     
     if (opt == -1) {
         exit_usage(NULL);
@@ -158,13 +206,57 @@ int main(int argc, char **argv)
 		}
 		chericat_selected_opts |= CHERICAT_CAP_INFO;
 		break;
+	    case 't':
+		tag_chunk = strtol(optarg, &pEnd, 10);
+		if (*pEnd != '\0' || tag_chunk < 1 || tag_chunk > TAG_SCAN_MAX_CHUNK_PAGES) {
+		    errx(1, "%s is not a valid number of pages, expecting 1 to %d", optarg, TAG_SCAN_MAX_CHUNK_PAGES);
+		}
+		set_tag_scan_chunk_pages(tag_chunk);
+		break;
+	    case 'j':
+		workers = strtol(optarg, &pEnd, 10);
+		if (*pEnd != '\0' || workers < 1 || workers > SCAN_POOL_MAX_WORKERS) {
+		    errx(1, "%s is not a valid number of workers, expecting 1 to %d", optarg, SCAN_POOL_MAX_WORKERS);
+		}
+		set_scan_pool_workers(workers);
+		break;
+	    case 'o':
+		raw_out_path = optarg;
+		if (raw_out_path[0] == '-') {
+		    exit_usage("-o requires a snapshot file name, and it cannot start with '-'");
+		}
+		chericat_selected_opts |= CHERICAT_RAW_OUT;
+		break;
+	    case 'I':
+		set_scan_mem_incremental(1);
+		chericat_selected_opts |= CHERICAT_INCREMENTAL;
+		break;
+	    case 's':
+		snapshot_id = strtol(optarg, &pEnd, 10);
+		if (*pEnd != '\0' || snapshot_id < 1) {
+		    errx(1, "%s is not a valid snapshot id", optarg);
+		}
+		chericat_selected_opts |= CHERICAT_SNAPSHOT;
+		break;
+	    case 'R':
+		record_path = optarg;
+		if (record_path[0] == '-') {
+		    exit_usage("-R requires a record file name, and it cannot start with '-'");
+		}
+		set_scan_mem_record(record_path);
+		chericat_selected_opts |= CHERICAT_RECORD;
+		break;
+	    case 'S':
+		set_run_stats(1);
+		chericat_selected_opts |= CHERICAT_STATS;
+		break;
             case '?':
                 exit_usage(NULL);
                 break;
             default:
                 exit_usage(NULL);
         }
-        opt = getopt_long(argc, argv, "df:p:vi:", long_options, &optindex);
+        opt = getopt_long(argc, argv, "df:p:vi:t:j:o:Is:R:S", long_options, &optindex);
     }
 
     // We have dealt with the options and now deal with commands. The current supported commands,
@@ -182,51 +274,131 @@ int main(int argc, char **argv)
 	}
     }
 
-    if ((chericat_selected_opts & CHERICAT_PID) != 0) {
-	if (db == NULL) {
-	    int rc = sqlite3_open(get_dbname(), &db);
-	    if (rc) {
-		fprintf(stderr, "Error open DB %s", sqlite3_errmsg(db));
-		sqlite3_close(db);
-		return (1);
-	    }
+    if ((chericat_selected_opts & CHERICAT_SNAPSHOT) != 0) {
+	if ((chericat_selected_opts & (CHERICAT_PID | CHERICAT_RAW_OUT)) != 0 ||
+	    (argv[0] != NULL && strcmp(argv[0], "ingest") == 0)) {
+	    exit_usage("-s selects a stored snapshot to show, a scan or ingest always takes a new one");
+	}
+    }
+
+    if (argv[0] != NULL && strcmp(argv[0], "ingest") == 0) {
+	if (argv[1] == NULL) {
+	    exit_usage("Expecting the snapshot file after the \"ingest\" command");
+	}
+	if (db == NULL && open_db(get_dbname(), &db) != 0) {
+	    return (1);
+	}
+	ingest_stats stats;
+	if (ingest_snapshot(db, argv[1], get_scan_pool_workers(), ingest_elf_file, &stats) != 0) {
+	    errx(1, "Unable to ingest the raw snapshot %s", argv[1]);
+	}
+	print_ingest_stats(argv[1], &stats);
+    }
+
+    if ((chericat_selected_opts & CHERICAT_INCREMENTAL) != 0 &&
+	(chericat_selected_opts & CHERICAT_PID) == 0) {
+	exit_usage("-I applies to the scan taken with -p, expecting -p <pid>");
+    }
+
+    if ((chericat_selected_opts & CHERICAT_RECORD) != 0) {
+	if ((chericat_selected_opts & CHERICAT_PID) == 0) {
+	    exit_usage("-R records the scan taken with -p, expecting -p <pid>");
+	}
+	if ((chericat_selected_opts & CHERICAT_RAW_OUT) != 0) {
+	    exit_usage("-R records the scan into a database, it cannot be used with -o");
+	}
+    }
+
+    if ((chericat_selected_opts & CHERICAT_RAW_OUT) != 0) {
+	if ((chericat_selected_opts & CHERICAT_PID) == 0) {
+	    exit_usage("-o writes the snapshot taken with -p, expecting -p <pid>");
+	}
+	if ((chericat_selected_opts & CHERICAT_INCREMENTAL) != 0) {
+	    exit_usage("-I updates a database, it cannot be used with -o");
+	}
+	scan_mem_raw(pid, raw_out_path);
+    } else if ((chericat_selected_opts & CHERICAT_PID) != 0) {
+	if (db == NULL && open_db(get_dbname(), &db) != 0) {
+	    return (1);
 	}
 	scan_mem(db, pid);
     }
 
-    if ((chericat_selected_opts & CHERICAT_SUMMARY_VIEW) != 0) {
-	if (db == NULL) {
-	    int rc = sqlite3_open(get_dbname(), &db);
-	    if (rc) {
-		fprintf(stderr, "Error open DB %s", sqlite3_errmsg(db));
-		sqlite3_close(db);
-		return (1);
+    if ((chericat_selected_opts & CHERICAT_SNAPSHOT) != 0) {
+	if (db == NULL && open_db(get_dbname(), &db) != 0) {
+	    return (1);
+	}
+	if (select_snapshot(db, snapshot_id) != 0) {
+	    errx(1, "Snapshot %ld is not in the database %s", snapshot_id, get_dbname());
+	}
+    }
+
+    if (argv[0] != NULL && strcmp(argv[0], "snapshots") == 0) {
+	if (db == NULL && open_db(get_dbname(), &db) != 0) {
+	    return (1);
+	}
+	xo_open_container("snapshots_view");
+	run_phase_begin(&view_timer, RUN_PHASE_VIEW);
+	snapshots_view(db);
+	run_phase_end(&view_timer);
+	xo_close_container("snapshots_view");
+    }
+
+    if (argv[0] != NULL && strcmp(argv[0], "diff") == 0) {
+	long int diff_ids[2];
+	if (argv[1] == NULL || argv[2] == NULL) {
+	    exit_usage("Expecting two snapshot ids after the \"diff\" command");
+	}
+	for (int i=0; i<2; i++) {
+	    diff_ids[i] = strtol(argv[i+1], &pEnd, 10);
+	    if (*pEnd != '\0' || diff_ids[i] < 1) {
+		errx(1, "%s is not a valid snapshot id", argv[i+1]);
+	    }
+	}
+	if (db == NULL && open_db(get_dbname(), &db) != 0) {
+	    return (1);
+	}
+	for (int i=0; i<2; i++) {
+	    if (!snapshot_exists(db, diff_ids[i])) {
+		errx(1, "Snapshot %ld is not in the database %s", diff_ids[i], get_dbname());
 	    }
 	}
+	xo_open_container("diff_view");
+	run_phase_begin(&view_timer, RUN_PHASE_VIEW);
+	snapshot_diff_view(db, diff_ids[0], diff_ids[1]);
+	run_phase_end(&view_timer);
+	xo_close_container("diff_view");
+    }
+
+    if ((chericat_selected_opts & CHERICAT_SUMMARY_VIEW) != 0) {
+	if (db == NULL && open_db(get_dbname(), &db) != 0) {
+	    return (1);
+	}
 	// Library view
 	if (strcmp(argv[1], "lib") == 0) {
 	    xo_open_container("vm_view");
+	    run_phase_begin(&view_timer, RUN_PHASE_VIEW);
 	    vm_caps_view(db);
+	    run_phase_end(&view_timer);
 	    xo_close_container("vm_view");
 	} else if (strcmp(argv[1], "comp") == 0) {
 	    xo_open_container("compart_view");
+	    run_phase_begin(&view_timer, RUN_PHASE_VIEW);
 	    comp_caps_view(db);
+	    run_phase_end(&view_timer);
 	    xo_close_container("compart_view");
 	}
     }
     if ((chericat_selected_opts & CHERICAT_CAP_INFO) != 0) {
-	if (db == NULL) {
-	    int rc = sqlite3_open(get_dbname(), &db);
-	    if (rc) {
-		fprintf(stderr, "Error open DB %s", sqlite3_errmsg(db));
-		sqlite3_close(db);
-		return (1);
-	    }
+	if (db == NULL && open_db(get_dbname(), &db) != 0) {
+	    return (1);
 	}
 	// Library view
 	if (strcmp(argv[1], "lib") == 0) {
 	    xo_open_container("caps_info_lib");
+	    run_phase_begin(&view_timer, RUN_PHASE_VIEW);
 	    caps_syms_view(db, caps_info_param);
+	    run_phase_end(&view_timer);
 	    xo_close_container("caps_info_lib");
 	} else if (strcmp(argv[1], "comp") == 0) {
 	    xo_open_container("caps_info_compart");
@@ -235,5 +407,14 @@ int main(int argc, char **argv)
 	}
 
     }
+
+    if ((chericat_selected_opts & CHERICAT_STATS) != 0) {
+	if (db != NULL) {
+	    run_count(RUN_ROWS_WRITTEN, sqlite3_total_changes(db));
+	}
+	xo_open_container("stats");
+	run_stats_view();
+	xo_close_container("stats");
+    }
     terminate_chericat(0);
 }
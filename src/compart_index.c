@@ -0,0 +1,332 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "compart_index.h"
+#include "db_process.h"
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * The range of a compartment, as swept by compart_index_build. Of the
+ * compartments containing a segment, the smallest one is taken, and of those
+ * of the same size the first one in the comparts array.
+ */
+typedef struct compart_range {
+	uint64_t start;
+	uint64_t end;
+	uint64_t size;
+	int order;
+	int compart_id;
+} compart_range;
+
+static int compare_range_start(const void *a, const void *b)
+{
+	const compart_range *x = a;
+	const compart_range *y = b;
+
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+static int range_is_inner(const compart_range *x, const compart_range *y)
+{
+	return x->size < y->size || (x->size == y->size && x->order < y->order);
+}
+
+/*
+ * The compartments whose range has started, kept in a binary heap with the
+ * innermost one on top. Those that have ended are only removed once they
+ * come to the top.
+ */
+static void active_push(compart_range *heap, int *count, compart_range range)
+{
+	int i = (*count)++;
+
+	while (i > 0 && range_is_inner(&range, &heap[(i-1)/2])) {
+		heap[i] = heap[(i-1)/2];
+		i = (i-1)/2;
+	}
+	heap[i] = range;
+}
+
+static void active_pop(compart_range *heap, int *count)
+{
+	compart_range last = heap[--(*count)];
+	int i = 0;
+
+	for (;;) {
+		int child = 2*i + 1;
+		if (child >= *count) {
+			break;
+		}
+		if (child+1 < *count && range_is_inner(&heap[child+1], &heap[child])) {
+			child++;
+		}
+		if (!range_is_inner(&heap[child], &last)) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+}
+
+/*
+ * compart_index_build
+ * Flattens the address ranges of the compartments into sorted disjoint
+ * segments. Every range boundary starts a new elementary segment, which is
+ * given to the smallest compartment containing it. The boundaries are swept
+ * once in address order, along with the compartments sorted by start, so the
+ * build takes O(n log n). Neighbouring segments of the same compartment are
+ * merged. Compartments without a range are skipped. Returns the number of
+ * segments.
+ */
+int compart_index_build(compart_index *index, const comp_info *comparts, int comp_count)
+{
+	uint64_t *bounds = calloc(2*comp_count + 1, sizeof(uint64_t));
+	compart_range *ranges = calloc(comp_count + 1, sizeof(compart_range));
+	compart_range *active = calloc(comp_count + 1, sizeof(compart_range));
+	index->segments = calloc(2*comp_count + 1, sizeof(compart_segment));
+	index->count = 0;
+	if (bounds == NULL || ranges == NULL || active == NULL || index->segments == NULL) {
+		errx(1, "Cannot allocate the compartment index for %d compartments", comp_count);
+	}
+
+	int nbounds = 0;
+	int nranges = 0;
+	for (int i=0; i<comp_count; i++) {
+		if (comparts[i].start_addr < comparts[i].end_addr) {
+			bounds[nbounds++] = comparts[i].start_addr;
+			bounds[nbounds++] = comparts[i].end_addr;
+			ranges[nranges].start = comparts[i].start_addr;
+			ranges[nranges].end = comparts[i].end_addr;
+			ranges[nranges].size = comparts[i].end_addr - comparts[i].start_addr;
+			ranges[nranges].order = i;
+			ranges[nranges].compart_id = comparts[i].compart_id;
+			nranges++;
+		}
+	}
+	qsort(bounds, nbounds, sizeof(uint64_t), compare_u64);
+	qsort(ranges, nranges, sizeof(compart_range), compare_range_start);
+
+	int next = 0;
+	int nactive = 0;
+	for (int b=0; b+1<nbounds; b++) {
+		uint64_t start = bounds[b];
+		uint64_t end = bounds[b+1];
+		if (start == end) {
+			continue;
+		}
+
+		while (next < nranges && ranges[next].start <= start) {
+			active_push(active, &nactive, ranges[next++]);
+		}
+		// A range still active ends at a later boundary, so covers the segment
+		while (nactive > 0 && active[0].end <= start) {
+			active_pop(active, &nactive);
+		}
+		if (nactive == 0) {
+			continue;
+		}
+		int compart_id = active[0].compart_id;
+
+		compart_segment *last = index->count > 0 ? &index->segments[index->count-1] : NULL;
+		if (last != NULL && last->end == start && last->compart_id == compart_id) {
+			last->end = end;
+		} else {
+			index->segments[index->count].start = start;
+			index->segments[index->count].end = end;
+			index->segments[index->count].compart_id = compart_id;
+			index->count++;
+		}
+	}
+
+	free(bounds);
+	free(ranges);
+	free(active);
+	return index->count;
+}
+
+/*
+ * compart_index_lookup
+ * Returns the id of the innermost compartment containing addr, or
+ * COMPART_ID_NONE if it is outside of all of them.
+ */
+int compart_index_lookup(const compart_index *index, uint64_t addr)
+{
+	int lo = 0;
+	int hi = index->count;
+
+	// Find the first segment ending after addr
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (index->segments[mid].end <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < index->count && index->segments[lo].start <= addr) {
+		return index->segments[lo].compart_id;
+	}
+	return COMPART_ID_NONE;
+}
+
+void compart_index_free(compart_index *index)
+{
+	free(index->segments);
+	index->segments = NULL;
+	index->count = 0;
+}
+
+/*
+ * cap_compart_is_current
+ * The capabilities of a snapshot are mapped once they are all written, the
+ * snapshot is then listed in cap_compart_snapshot.
+ */
+static int cap_compart_is_current(sqlite3 *db, int64_t snapshot_id)
+{
+	if (!db_table_exists(db, "cap_compart_snapshot")) {
+		return 0;
+	}
+
+	sqlite3_stmt *stmt;
+	int current = 0;
+
+	if (sqlite3_prepare_v2(db, "SELECT 1 FROM cap_compart_snapshot WHERE snapshot_id = ?1;",
+		-1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_int64(stmt, 1, snapshot_id);
+	current = sqlite3_step(stmt) == SQLITE_ROW;
+	sqlite3_finalize(stmt);
+	return current;
+}
+
+/*
+ * build_cap_compart
+ * Resolves the compartment holding each capability of the snapshot
+ * (src_compart_id) and the compartment its address points into
+ * (dest_compart_id), and stores them in the cap_compart table, keyed by the
+ * rowid of the capability in cap_info. The rows are kept for later views of
+ * the same snapshot, which is recorded in cap_compart_snapshot. Returns the
+ * number of capabilities mapped.
+ */
+int build_cap_compart(sqlite3 *db)
+{
+	int64_t snapshot_id = get_snapshot_id(db);
+
+	if (cap_compart_is_current(db, snapshot_id)) {
+		debug_print(TROUBLESHOOT, "Key Stage: cap_compart is up to date\n", NULL);
+		return cap_info_count(db);
+	}
+
+	arena comp_arena;
+	str_table comp_strings;
+	arena_init(&comp_arena, 0);
+	str_table_init(&comp_strings, &comp_arena);
+
+	comp_info *comparts;
+	int comp_count = get_all_comp_info(db, &comp_strings, &comparts);
+	assert(comp_count != -1);
+
+	compart_index index;
+	compart_index_build(&index, comparts, comp_count);
+	debug_print(TROUBLESHOOT, "Key Stage: Built compartment index of %d segments from %d compartments\n",
+	    index.count, comp_count);
+
+	free(comparts);
+	str_table_free(&comp_strings);
+	arena_free(&comp_arena);
+
+	begin_transaction(db);
+	create_cap_compart_table(db);
+
+	sqlite3_stmt *delete_stmt, *select_stmt, *insert_stmt, *done_stmt;
+	if (sqlite3_prepare_v2(db, "DELETE FROM cap_compart WHERE cap_id IN "
+		"(SELECT rowid FROM cap_info WHERE snapshot_id = ?);", -1, &delete_stmt, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO cap_compart_snapshot(snapshot_id) VALUES(?);",
+		-1, &done_stmt, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "SELECT rowid, cap_loc_addr, cap_addr FROM cap_info WHERE snapshot_id = ?;",
+		-1, &select_stmt, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO cap_compart(cap_id, src_compart_id, dest_compart_id) "
+		"VALUES(?, ?, ?);", -1, &insert_stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_int64(delete_stmt, 1, snapshot_id);
+	sqlite3_step(delete_stmt);
+	sqlite3_finalize(delete_stmt);
+	sqlite3_bind_int64(select_stmt, 1, snapshot_id);
+
+	int mapped = 0;
+	while (sqlite3_step(select_stmt) == SQLITE_ROW) {
+		uint64_t cap_loc_addr = (uint64_t)sqlite3_column_int64(select_stmt, 1);
+		uint64_t cap_addr = (uint64_t)sqlite3_column_int64(select_stmt, 2);
+
+		sqlite3_bind_int64(insert_stmt, 1, sqlite3_column_int64(select_stmt, 0));
+		sqlite3_bind_int(insert_stmt, 2, compart_index_lookup(&index, cap_loc_addr));
+		sqlite3_bind_int(insert_stmt, 3, compart_index_lookup(&index, cap_addr));
+		if (sqlite3_step(insert_stmt) != SQLITE_DONE) {
+			errx(1, "SQL error inserting into cap_compart: %s", sqlite3_errmsg(db));
+		}
+		sqlite3_reset(insert_stmt);
+		mapped++;
+	}
+	sqlite3_finalize(select_stmt);
+	sqlite3_finalize(insert_stmt);
+	sqlite3_bind_int64(done_stmt, 1, snapshot_id);
+	if (sqlite3_step(done_stmt) != SQLITE_DONE) {
+		errx(1, "SQL error inserting into cap_compart_snapshot: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(done_stmt);
+	commit_transaction(db);
+
+	compart_index_free(&index);
+	debug_print(TROUBLESHOOT, "Key Stage: Mapped %d capabilities to their compartments\n", mapped);
+	return mapped;
+}
@@ -30,7 +30,6 @@
  * SUCH DAMAGE.
  */
 
-#include <sys/ptrace.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -42,13 +41,18 @@
 #include <string.h>
 #include <sqlite3.h>
 
-#include <cheri/cheric.h>
-
 #include "db_process.h"
 #include "common.h"
+#include "run_stats.h"
 
 char *dbname;
 
+/* The command line stored with the snapshots taken by this run */
+static char *snapshot_command;
+
+/* The snapshot written by the scans and read by the views, 0 for the latest one */
+static int64_t current_snapshot_id;
+
 char *get_dbname() {
 	if (dbname == NULL) {
 		dbname = strdup(":memory:");
@@ -95,6 +99,26 @@ int db_table_exists(sqlite3 *db, char *tname)
 	return exists;
 }
 
+/*
+ * db_column_exists(db, tname, cname)
+ * Returns 1 if the table tname of database db has a column called cname.
+ */
+static int db_column_exists(sqlite3 *db, char *tname, char *cname)
+{
+	int exists = 0;
+	sqlite3_stmt *stmt;
+	const char *check_column_q = "SELECT 1 FROM pragma_table_info(?) WHERE name=?";
+
+	if (sqlite3_prepare_v2(db, check_column_q, -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_text(stmt, 1, tname, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 2, cname, -1, SQLITE_TRANSIENT);
+	exists = sqlite3_step(stmt) == SQLITE_ROW;
+	sqlite3_finalize(stmt);
+	return exists;
+}
+
 	
 #define assert_db_table_exists(db, tname) {\
 	if (0 == db_table_exists(db, tname)) {\
@@ -102,6 +126,133 @@ int db_table_exists(sqlite3 *db, char *tname)
 	}\
 }
 
+/*
+ * SQL expressions to show the INTEGER columns the way they were shown when they
+ * were stored as text: addresses as hex strings and permissions as letters.
+ */
+#define HEX_TEXT_SQL(col) \
+	"CASE WHEN " col " IS NULL THEN NULL ELSE printf('0x%x', " col ") END AS " col
+#define PERMS_TEXT_SQL(col) \
+	"(CASE WHEN " col " & 1 THEN 'r' ELSE '' END || " \
+	"CASE WHEN " col " & 2 THEN 'w' ELSE '' END || " \
+	"CASE WHEN " col " & 4 THEN 'x' ELSE '' END || " \
+	"CASE WHEN " col " & 8 THEN 'R' ELSE '' END || " \
+	"CASE WHEN " col " & 16 THEN 'W' ELSE '' END || " \
+	"CASE WHEN " col " & 32 THEN 'E' ELSE '' END) AS " col
+
+/*
+ * create_text_view
+ * Creates a view for humans on top of a table with INTEGER addresses.
+ */
+static int create_text_view(sqlite3 *db, const char *view)
+{
+	int rc;
+	char* messageError;
+
+	rc = sqlite3_exec(db, view, NULL, 0, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL %s error: %s\n", view, messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * path_names(path, basename, basename_len)
+ * Splits path the way the paths table stores it: basename is the file name,
+ * without its directory nor the (.plt) and (.got) suffixes given to the vm
+ * entries holding those sections, and the suffixes are returned.
+ */
+static const char *path_names(const char *path, const char **basename, int *basename_len)
+{
+	static const char *suffixes[] = { "(.plt)", "(.got)" };
+	const size_t suffix_len = 6;
+	size_t end = strlen(path);
+	int found;
+
+	do {
+		found = 0;
+		for (int i=0; i<2; i++) {
+			if (end >= suffix_len && strncmp(path + end - suffix_len, suffixes[i], suffix_len) == 0) {
+				end -= suffix_len;
+				found = 1;
+			}
+		}
+	} while (found);
+
+	size_t start = end;
+	while (start > 0 && path[start-1] != '/') {
+		start--;
+	}
+	*basename = path + start;
+	*basename_len = (int)(end - start);
+	return path + end;
+}
+
+/*
+ * chericat_path_basename(path) and chericat_path_suffix(path)
+ * SQL functions used by migrate_to_6 to fill in the paths table, see
+ * path_names.
+ */
+static void sql_path_basename(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	const char *path = (const char *)sqlite3_value_text(argv[0]);
+	const char *basename;
+	int len;
+
+	(void)argc;
+	if (path == NULL) {
+		sqlite3_result_null(ctx);
+		return;
+	}
+	path_names(path, &basename, &len);
+	sqlite3_result_text(ctx, basename, len, SQLITE_TRANSIENT);
+}
+
+static void sql_path_suffix(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	const char *path = (const char *)sqlite3_value_text(argv[0]);
+	const char *basename;
+	int len;
+
+	(void)argc;
+	if (path == NULL) {
+		sqlite3_result_null(ctx);
+		return;
+	}
+	sqlite3_result_text(ctx, path_names(path, &basename, &len), -1, SQLITE_TRANSIENT);
+}
+
+/*
+ * create_paths_table
+ * The paths of the vm entries, capabilities and ELF files are stored once in
+ * paths and referred to by their path_id from vm, cap_info and elf_sym. Each
+ * path is split into its basename and suffix, see path_names.
+ */
+int create_paths_table(sqlite3 *db)
+{
+	char *paths_table =
+		"CREATE TABLE IF NOT EXISTS paths("
+		"path_id INTEGER PRIMARY KEY, "
+		"path VARCHAR NOT NULL UNIQUE, "
+		"basename VARCHAR NOT NULL, "
+		"suffix VARCHAR NOT NULL);"
+		"CREATE INDEX IF NOT EXISTS paths_basename ON paths(basename);";
+
+	int rc;
+	char* messageError;
+
+	rc = sqlite3_exec(db, paths_table, NULL, 0, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+	debug_print(TROUBLESHOOT, "Database table paths created successfully\n", NULL);
+	return (0);
+}
+
 /*
  * create_vm_cap_db
  * Creates two tables, one for the VM entries and the other one contains all the 
@@ -112,30 +263,45 @@ int create_vm_cap_db(sqlite3 *db)
 {
 	char *vm_table = 
 		"CREATE TABLE IF NOT EXISTS vm("
-		"start_addr VARCHAR NOT NULL, "
-		"end_addr VARCHAR NOT NULL, "
-		"mmap_path VARCHAR NOT NULL, "
+		"start_addr INTEGER NOT NULL, "
+		"end_addr INTEGER NOT NULL, "
+		"mmap_path_id INTEGER NOT NULL, "
 		"compart_id INTEGER NOT NULL, "
 		"kve_protection INTEGER NOT NULL, "
 		"mmap_flags INTEGER NOT NULL, "
 		"vnode_type INTEGER NOT NULL, "
-		"plt_addr VARCHAR, "
-		"plt_size VARCHAR, "
-		"got_addr VARCHAR, "
-		"got_size VARCHAR);";
+		"plt_addr INTEGER, "
+		"plt_size INTEGER, "
+		"got_addr INTEGER, "
+		"got_size INTEGER, "
+		"snapshot_id INTEGER NOT NULL REFERENCES snapshot(snapshot_id));";
 	
 	char *cap_info_table =
 		"CREATE TABLE IF NOT EXISTS cap_info("
-		"cap_loc_addr VARCHAR NOT NULL, "
-		"cap_loc_path VARCHAR NOT NULL, "
-		"cap_addr VARCHAR NOT NULL, "
-		"perms VARCHAR NOT NULL, "
-		"base VARCHAR NOT NULL, "
-		"top VARCHAR NOT NULL);";
+		"cap_loc_addr INTEGER NOT NULL, "
+		"cap_loc_path_id INTEGER NOT NULL, "
+		"cap_addr INTEGER NOT NULL, "
+		"perms INTEGER NOT NULL, "
+		"base INTEGER NOT NULL, "
+		"top INTEGER NOT NULL, "
+		"snapshot_id INTEGER NOT NULL REFERENCES snapshot(snapshot_id));";
+
+	// The capabilities of a vm entry are counted with a range join on cap_loc_addr
+	// within its snapshot, perms is part of the index so that the join never reads the table rows
+	char *cap_info_loc_index =
+		"CREATE INDEX IF NOT EXISTS cap_info_snapshot_loc ON cap_info(snapshot_id, cap_loc_addr, perms);";
+
+	// The capabilities of a library (-i) are found by the path_id of its paths
+	char *cap_info_path_index =
+		"CREATE INDEX IF NOT EXISTS cap_info_snapshot_path ON cap_info(snapshot_id, cap_loc_path_id);";
 
 	int rc;
 	char* messageError;
 
+	if (create_paths_table(db) != 0 || create_snapshot_table(db) != 0) {
+		return (1);
+	}
+
 	rc = sqlite3_exec(db, cap_info_table, NULL, 0, &messageError);
 	
 	if (rc != SQLITE_OK) {
@@ -156,27 +322,104 @@ int create_vm_cap_db(sqlite3 *db)
 		debug_print(TROUBLESHOOT, "Database table vm_table created successfully\n", NULL);
 	}
 	
+	rc = sqlite3_exec(db, cap_info_loc_index, NULL, 0, &messageError);
+
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+
+	// The tables of a database being migrated still hold their paths as text,
+	// they get the rest from migrate_to_6
+	if (db_column_exists(db, "vm", "mmap_path") || db_column_exists(db, "cap_info", "cap_loc_path")) {
+		return (0);
+	}
+
+	rc = sqlite3_exec(db, cap_info_path_index, NULL, 0, &messageError);
+
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+
+	// vm_with_path and cap_info_with_path have the columns of the tables before the
+	// paths were moved to the paths table, for the scripts reading them
+	if (create_text_view(db,
+		"CREATE VIEW IF NOT EXISTS vm_with_path AS SELECT "
+		"v.start_addr, v.end_addr, p.path AS mmap_path, v.compart_id, v.kve_protection, "
+		"v.mmap_flags, v.vnode_type, v.plt_addr, v.plt_size, v.got_addr, v.got_size, v.snapshot_id "
+		"FROM vm v JOIN paths p ON p.path_id = v.mmap_path_id;") != 0 ||
+	    create_text_view(db,
+		"CREATE VIEW IF NOT EXISTS cap_info_with_path AS SELECT "
+		"c.cap_loc_addr, p.path AS cap_loc_path, c.cap_addr, c.perms, c.base, c.top, c.snapshot_id "
+		"FROM cap_info c JOIN paths p ON p.path_id = c.cap_loc_path_id;") != 0 ||
+	    create_text_view(db,
+		"CREATE VIEW IF NOT EXISTS vm_text AS SELECT "
+		HEX_TEXT_SQL("start_addr") ", " HEX_TEXT_SQL("end_addr") ", "
+		"mmap_path, compart_id, kve_protection, mmap_flags, vnode_type, "
+		HEX_TEXT_SQL("plt_addr") ", " HEX_TEXT_SQL("plt_size") ", "
+		HEX_TEXT_SQL("got_addr") ", " HEX_TEXT_SQL("got_size") ", snapshot_id "
+		"FROM vm_with_path;") != 0 ||
+	    create_text_view(db,
+		"CREATE VIEW IF NOT EXISTS cap_info_text AS SELECT "
+		HEX_TEXT_SQL("cap_loc_addr") ", cap_loc_path, " HEX_TEXT_SQL("cap_addr") ", "
+		PERMS_TEXT_SQL("perms") ", " HEX_TEXT_SQL("base") ", " HEX_TEXT_SQL("top") ", snapshot_id "
+		"FROM cap_info_with_path;") != 0) {
+		return (1);
+	}
+
 	return (0);
 }
 
 /*
  * create_elf_sym_db
+ * The symbols of an ELF file are stored once, under the elf_id of the file in
+ * elf_file, and shared by all the snapshots that list that elf_id in
+ * snapshot_elf. The addresses of elf_sym and of the special sections of
+ * elf_file are relative to the base the file is loaded at, which is kept in
+ * snapshot_elf.
  */
 int create_elf_sym_db(sqlite3 *db)
 {
 	char *elf_sym_table = 
 		"CREATE TABLE IF NOT EXISTS elf_sym("
-		"source_path VARCHAR NOT NULL, "
+		"source_path_id INTEGER NOT NULL, "
 		"st_name VARCHAR NOT NULL, "
-		"st_value VARCHAR NOT NULL, "
+		"st_value INTEGER NOT NULL, "
 		"st_shndx VARCHAR NOT NULL, "
 		"type VARCHAR NOT NULL, "
 		"bind VARCHAR NOT NULL, "
-		"addr VARCHAR NOT NULL);";
+		"addr INTEGER NOT NULL, "
+		"st_size INTEGER, "
+		"elf_id INTEGER);"
+		"CREATE INDEX IF NOT EXISTS elf_sym_elf_id ON elf_sym(elf_id);"
+		"CREATE TABLE IF NOT EXISTS elf_file("
+		"elf_id INTEGER PRIMARY KEY, "
+		"source_path VARCHAR NOT NULL, "
+		"dev INTEGER, "
+		"ino INTEGER, "
+		"mtime INTEGER, "
+		"size INTEGER, "
+		"plt_addr INTEGER, "
+		"plt_size INTEGER, "
+		"got_addr INTEGER, "
+		"got_size INTEGER);"
+		"CREATE UNIQUE INDEX IF NOT EXISTS elf_file_identity ON elf_file(dev, ino, mtime, size);"
+		"CREATE TABLE IF NOT EXISTS snapshot_elf("
+		"snapshot_id INTEGER NOT NULL REFERENCES snapshot(snapshot_id), "
+		"elf_id INTEGER NOT NULL, "
+		"base_addr INTEGER NOT NULL DEFAULT 0, "
+		"PRIMARY KEY(snapshot_id, elf_id));";
 	
 	int rc;
 	char* messageError;
 
+	if (create_paths_table(db) != 0 || create_snapshot_table(db) != 0) {
+		return (1);
+	}
+
 	rc = sqlite3_exec(db, elf_sym_table, NULL, 0, &messageError);
 	
 	if (rc != SQLITE_OK) {
@@ -187,23 +430,43 @@ int create_elf_sym_db(sqlite3 *db)
 		debug_print(TROUBLESHOOT, "Database table elf_sym_table created successfully\n", NULL);
 	}
 
-	return (0);
+	// As in create_vm_cap_db, left to migrate_to_6
+	if (db_column_exists(db, "elf_sym", "source_path")) {
+		return (0);
+	}
+
+	if (create_text_view(db,
+		"CREATE VIEW IF NOT EXISTS elf_sym_with_path AS SELECT "
+		"p.path AS source_path, e.st_name, e.st_value, e.st_shndx, e.type, e.bind, e.addr, e.st_size, e.elf_id "
+		"FROM elf_sym e JOIN paths p ON p.path_id = e.source_path_id;") != 0) {
+		return (1);
+	}
+	return create_text_view(db,
+		"CREATE VIEW IF NOT EXISTS elf_sym_text AS SELECT "
+		"source_path, st_name, " HEX_TEXT_SQL("st_value") ", st_shndx, type, bind, "
+		HEX_TEXT_SQL("addr") ", " HEX_TEXT_SQL("st_size") ", elf_id FROM elf_sym_with_path;");
 }
 
 int create_comparts_table(sqlite3 *db)
 {
     char *comparts_table =
 	"CREATE TABLE IF NOT EXISTS comparts("
-	"compart_id INTEGER PRIMARY KEY, "
+	"compart_id INTEGER NOT NULL, "
 	"compart_name VARCHAR, "
         "library_path VARCHAR, "
-        "start_addr VARCHAR, "
-        "end_addr VARCHAR, "
+        "start_addr INTEGER, "
+        "end_addr INTEGER, "
         "is_default INTEGER, "
-	"parent_id INTEGER);";
+	"parent_id INTEGER, "
+	"snapshot_id INTEGER NOT NULL REFERENCES snapshot(snapshot_id), "
+	"PRIMARY KEY(snapshot_id, compart_id));";
 
     int rc;
     char* messageError;
+
+    if (create_snapshot_table(db) != 0) {
+	return(1);
+    }
     
     rc = sqlite3_exec(db, comparts_table, NULL, 0, &messageError);
 
@@ -214,405 +477,1936 @@ int create_comparts_table(sqlite3 *db)
     } else {
 	debug_print(TROUBLESHOOT, "Database table comparts has been created successfully\n", NULL);
     }
-    return(0);
+    return create_text_view(db,
+	"CREATE VIEW IF NOT EXISTS comparts_text AS SELECT "
+	"compart_id, compart_name, library_path, "
+	HEX_TEXT_SQL("start_addr") ", " HEX_TEXT_SQL("end_addr") ", is_default, parent_id, snapshot_id "
+	"FROM comparts;");
 }
 
-int begin_transaction(sqlite3 *db)
+static int get_user_version(sqlite3 *db)
 {
-	int rc;
-	char *messageError;
+	sqlite3_stmt *stmt;
+	int version = -1;
 
-	rc = sqlite3_exec(db, "BEGIN", 0, 0, &messageError);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "SQL error: %s\n", messageError);
-		sqlite3_free(messageError);
-		return (1);
+	if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
 	}
-
-	return (0);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return version;
 }
 
-int commit_transaction(sqlite3 *db)
+static int set_user_version(sqlite3 *db, int version)
 {
-	int rc;
-	char *messageError;
+	char *query;
 
-	rc = sqlite3_exec(db, "COMMIT", 0, 0, &messageError);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "SQL error: %s\n", messageError);
-		sqlite3_free(messageError);
-		return (1);
+	asprintf(&query, "PRAGMA user_version = %d;", version);
+	int rc = sql_query_exec(db, query, NULL, NULL);
+	free(query);
+	return rc;
+}
+
+/*
+ * chericat_hex(text)
+ * SQL function used by the migrations to turn the hex strings written by
+ * older versions, e.g. "0x4012a0", into integers.
+ */
+static void sql_hex_to_int(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	(void)argc;
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		sqlite3_result_null(ctx);
+		return;
 	}
+	const char *text = (const char *)sqlite3_value_text(argv[0]);
+	sqlite3_result_int64(ctx, (sqlite3_int64)strtoull(text, NULL, 0));
+}
 
-	return (0);
-}	
+/*
+ * chericat_perms(text)
+ * SQL function used by the migrations to turn the permission letters printed
+ * by strfcap into CAP_PERM_* bits.
+ */
+static void sql_perms_to_int(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	const char *text = (const char *)sqlite3_value_text(argv[0]);
+	const char *letters = "rwxRWE";
+	int perms = 0;
+
+	(void)argc;
+	for (; text != NULL && *text != '\0'; text++) {
+		const char *letter = strchr(letters, *text);
+		if (letter != NULL) {
+			perms |= 1 << (letter - letters);
+		}
+	}
+	sqlite3_result_int(ctx, perms);
+}
 
-int sql_query_exec(sqlite3 *db, char* query, int (*callback)(void*,int,char**,char**), void *data)
+/*
+ * migrate_to_1
+ * Version 0 stored addresses, sizes and permissions as text. Each table is
+ * renamed, created again with the INTEGER schema and its rows copied over.
+ * The tables are created as they were in version 5, the last one to store
+ * the paths as text and without a snapshot key, columns added by later
+ * versions are left empty and the later migrations find them in place.
+ */
+static int migrate_to_1(sqlite3 *db)
 {
-	int rc;
-	char* messageError;
+	static const struct {
+		const char *table;
+		const char *create;
+		const char *copy;
+	} tables[] = {
+		{ "vm",
+		  "CREATE TABLE vm(start_addr INTEGER NOT NULL, end_addr INTEGER NOT NULL, "
+		  "mmap_path VARCHAR NOT NULL, compart_id INTEGER NOT NULL, kve_protection INTEGER NOT NULL, "
+		  "mmap_flags INTEGER NOT NULL, vnode_type INTEGER NOT NULL, plt_addr INTEGER, "
+		  "plt_size INTEGER, got_addr INTEGER, got_size INTEGER, snapshot_id INTEGER);",
+		  "INSERT INTO vm(start_addr, end_addr, mmap_path, compart_id, kve_protection, mmap_flags, "
+		  "vnode_type, plt_addr, plt_size, got_addr, got_size) "
+		  "SELECT chericat_hex(start_addr), chericat_hex(end_addr), mmap_path, "
+		  "compart_id, kve_protection, mmap_flags, vnode_type, chericat_hex(plt_addr), "
+		  "chericat_hex(plt_size), chericat_hex(got_addr), chericat_hex(got_size) FROM vm_v0;" },
+		{ "cap_info",
+		  "CREATE TABLE cap_info(cap_loc_addr INTEGER NOT NULL, cap_loc_path VARCHAR NOT NULL, "
+		  "cap_addr INTEGER NOT NULL, perms INTEGER NOT NULL, base INTEGER NOT NULL, "
+		  "top INTEGER NOT NULL, snapshot_id INTEGER);",
+		  "INSERT INTO cap_info(cap_loc_addr, cap_loc_path, cap_addr, perms, base, top) "
+		  "SELECT chericat_hex(cap_loc_addr), cap_loc_path, "
+		  "chericat_hex(cap_addr), chericat_perms(perms), chericat_hex(base), chericat_hex(top) "
+		  "FROM cap_info_v0;" },
+		{ "elf_sym",
+		  "CREATE TABLE elf_sym(source_path VARCHAR NOT NULL, st_name VARCHAR NOT NULL, "
+		  "st_value INTEGER NOT NULL, st_shndx VARCHAR NOT NULL, type VARCHAR NOT NULL, "
+		  "bind VARCHAR NOT NULL, addr INTEGER NOT NULL, st_size INTEGER, elf_id INTEGER);",
+		  "INSERT INTO elf_sym(source_path, st_name, st_value, st_shndx, type, bind, addr) "
+		  "SELECT source_path, st_name, chericat_hex(st_value), st_shndx, "
+		  "type, bind, chericat_hex(addr) FROM elf_sym_v0;" },
+		{ "comparts",
+		  "CREATE TABLE comparts(compart_id INTEGER NOT NULL, compart_name VARCHAR, "
+		  "library_path VARCHAR, start_addr INTEGER, end_addr INTEGER, is_default INTEGER, "
+		  "parent_id INTEGER, snapshot_id INTEGER, PRIMARY KEY(snapshot_id, compart_id));",
+		  "INSERT INTO comparts(compart_id, compart_name, library_path, start_addr, end_addr, "
+		  "is_default, parent_id) "
+		  "SELECT compart_id, compart_name, library_path, "
+		  "chericat_hex(start_addr), chericat_hex(end_addr), is_default, parent_id FROM comparts_v0;" },
+	};
+	int present[4];
+
+	sqlite3_create_function(db, "chericat_hex", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+	    sql_hex_to_int, NULL, NULL);
+	sqlite3_create_function(db, "chericat_perms", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+	    sql_perms_to_int, NULL, NULL);
+
+	for (int i=0; i<4; i++) {
+		present[i] = db_table_exists(db, (char *)tables[i].table);
+		if (present[i]) {
+			char *query;
+			asprintf(&query, "ALTER TABLE %s RENAME TO %s_v0;", tables[i].table, tables[i].table);
+			int rc = sql_query_exec(db, query, NULL, NULL);
+			free(query);
+			if (rc != 0) {
+				return (1);
+			}
+		}
+	}
 
-	rc = sqlite3_exec(db, query, callback, data, &messageError);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "SQL %s error: %s (db: %s)\n", query, messageError, get_dbname());
-		sqlite3_free(messageError);
-		return (1);
-	} else {
-		debug_print(TROUBLESHOOT, "Query %s, executed successfully (rc=%d) \n", query, rc);
+	for (int i=0; i<4; i++) {
+		if (present[i] && sql_query_exec(db, (char *)tables[i].create, NULL, NULL) != 0) {
+			return (1);
+		}
+	}
+
+	for (int i=0; i<4; i++) {
+		if (present[i]) {
+			char *query;
+			asprintf(&query, "%s DROP TABLE %s_v0;", tables[i].copy, tables[i].table);
+			int rc = sql_query_exec(db, query, NULL, NULL);
+			free(query);
+			if (rc != 0) {
+				return (1);
+			}
+		}
 	}
-	
-	sqlite3_int64 pCurrent=0, pHighwater=0;
-	sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &pCurrent, &pHighwater, 0);
-	debug_print(TROUBLESHOOT, "sqlite mem used, current: %lld high water: %lld\n", pCurrent, pHighwater);
-	
 	return (0);
 }
 
-vm_info *all_vm_info;   
-cap_info *all_cap_info;
-sym_info *all_sym_info;
-comp_info *all_comp_info;
-
-int all_vm_info_index, all_cap_info_index, all_sym_info_index, all_comp_info_index;
-
 /*
- * convert_str_to_int
- * A convenient function to check if we can convert the 
- * provided string to a long integer, and exit the program 
- * early when an invalid value is detected.
+ * migrate_to_2
+ * Adds the index used by the range joins between vm and cap_info.
  */
-static int convert_str_to_int(char *str, char *err_msg)
+static int migrate_to_2(sqlite3 *db)
 {
-	char *pEnd;
-	if (str == NULL) {
-	    return 0;
+	if (!db_table_exists(db, "cap_info")) {
+		return (0);
 	}
-	int int_val = strtol(str, &pEnd, 10);
-	if (*pEnd != '\0') {
-		fprintf(stderr, "DB processing - Expected an integer, got: %s\n", str);
-		errx(1, "%s", err_msg);
+	return sql_query_exec(db, "CREATE INDEX IF NOT EXISTS cap_info_loc_addr ON cap_info(cap_loc_addr, perms);", NULL, NULL);
+}
+
+/*
+ * migrate_to_3
+ * Adds the size of the symbols, so that addresses inside a symbol can be
+ * resolved. Symbols captured before have no size. The elf_sym_text view is
+ * created again by migrate_to_4.
+ */
+static int migrate_to_3(sqlite3 *db)
+{
+	if (!db_table_exists(db, "elf_sym") || db_column_exists(db, "elf_sym", "st_size")) {
+		return (0);
 	}
-	return int_val;
+	return sql_query_exec(db, "ALTER TABLE elf_sym ADD COLUMN st_size INTEGER; DROP VIEW IF EXISTS elf_sym_text;", NULL, NULL);
 }
 
-static char* _strdup_or_null(char* arg)
+/*
+ * add_snapshot_column(db, table)
+ * Gives the rows of table that were stored before snapshots to snapshot 1.
+ * A column added to a table cannot be NOT NULL without a default, that is
+ * left to migrate_to_7.
+ */
+static int add_snapshot_column(sqlite3 *db, char *table)
 {
-	if (arg == NULL) {
-		return NULL;
+	char *query;
+	int rc;
+
+	if (db_column_exists(db, table, "snapshot_id")) {
+		asprintf(&query, "UPDATE %s SET snapshot_id = 1 WHERE snapshot_id IS NULL;", table);
 	} else {
-		return strdup(arg);
+		asprintf(&query, "ALTER TABLE %s ADD COLUMN snapshot_id INTEGER REFERENCES snapshot(snapshot_id); "
+		    "UPDATE %s SET snapshot_id = 1;", table, table);
 	}
+	rc = sql_query_exec(db, query, NULL, NULL);
+	free(query);
+	return rc;
 }
 
 /*
- * vm_query_callback
- * SQLite callback routine to traverse results from sqlite_exec()
- * using: "SELECT * FROM vm;"
- * Results are formatted into: start_addr, end_addr, mmap_path
- * 
- * argc - number of columns
- * argv - pointer to the data that is stored in each column
- * azColName - pointer to the colunmn names
+ * migrate_to_4
+ * Adds the snapshots. The rows stored before all belong to snapshot 1, and
+ * each ELF file of elf_sym becomes an elf_file of that snapshot. The primary
+ * key of comparts now includes the snapshot, so the table is created again.
  */
-static int vm_info_query_callback(void *all_vm_info_ptr, int argc, char **argv, char **azColName)
+static int migrate_to_4(sqlite3 *db)
 {
-        /* Database schema for vm has 11 columns */
-        assert(argc == 11);
- 
-        vm_info vm_info_captured;
-	int i=0;
+	int has_vm = db_table_exists(db, "vm");
+	int has_cap_info = db_table_exists(db, "cap_info");
+	int has_elf_sym = db_table_exists(db, "elf_sym");
+	int has_comparts = db_table_exists(db, "comparts");
+
+	if (sql_query_exec(db,
+	    "DROP VIEW IF EXISTS vm_text; DROP VIEW IF EXISTS cap_info_text; "
+	    "DROP VIEW IF EXISTS elf_sym_text; DROP VIEW IF EXISTS comparts_text; "
+	    "DROP INDEX IF EXISTS cap_info_loc_addr;", NULL, NULL) != 0 ||
+	    create_snapshot_table(db) != 0) {
+		return (1);
+	}
+	if (!has_vm && !has_cap_info && !has_elf_sym && !has_comparts) {
+		return (0);
+	}
+	if (sql_query_exec(db, "INSERT OR IGNORE INTO snapshot(snapshot_id) VALUES(1);", NULL, NULL) != 0) {
+		return (1);
+	}
+
+	if ((has_vm && add_snapshot_column(db, "vm") != 0) ||
+	    (has_cap_info && add_snapshot_column(db, "cap_info") != 0) ||
+	    ((has_vm || has_cap_info) && create_vm_cap_db(db) != 0)) {
+		return (1);
+	}
 
- 	vm_info_captured.start_addr = strdup(argv[i++]);
-        vm_info_captured.end_addr = strdup(argv[i++]);
-        vm_info_captured.mmap_path = strdup(argv[i++]);
-	vm_info_captured.compart_id = convert_str_to_int(argv[i++], "compart_id is invalid");
+	if (has_comparts && !db_column_exists(db, "comparts", "snapshot_id")) {
+		if (sql_query_exec(db, "ALTER TABLE comparts RENAME TO comparts_v3;", NULL, NULL) != 0 ||
+		    create_comparts_table(db) != 0 ||
+		    sql_query_exec(db,
+			"INSERT INTO comparts(compart_id, compart_name, library_path, start_addr, end_addr, "
+			"is_default, parent_id, snapshot_id) "
+			"SELECT compart_id, compart_name, library_path, start_addr, end_addr, "
+			"is_default, parent_id, 1 FROM comparts_v3; DROP TABLE comparts_v3;", NULL, NULL) != 0) {
+			return (1);
+		}
+	} else if (has_comparts && (add_snapshot_column(db, "comparts") != 0 || create_comparts_table(db) != 0)) {
+		return (1);
+	}
 
-	// Checking that the received values are valid integers
-	// as expected from the vm_info_captured data structure. 
-	// If the check fails, it means the data is invalid. Without
-	// a more sophisticated logic in place to handle invalid data, 
-	// we will just quit the program and let users to examine 
-	// and fix the data before running this function again.
-	vm_info_captured.kve_protection = convert_str_to_int(argv[i++], "kve_protection is invalid");
-     	vm_info_captured.mmap_flags = convert_str_to_int(argv[i++], "mmap_flags is invalid"); 
-        vm_info_captured.vnode_type = convert_str_to_int(argv[i++], "vnode_type is invalid");
+	if (has_elf_sym) {
+		if (!db_column_exists(db, "elf_sym", "elf_id") &&
+		    sql_query_exec(db, "ALTER TABLE elf_sym ADD COLUMN elf_id INTEGER;", NULL, NULL) != 0) {
+			return (1);
+		}
+		// The files have no identity, so they are never shared. elf_file is new, as
+		// it was added by this version, all its rows are the files of elf_sym.
+		if (create_elf_sym_db(db) != 0 ||
+		    sql_query_exec(db,
+			"INSERT INTO elf_file(source_path) "
+			"SELECT DISTINCT source_path FROM elf_sym WHERE elf_id IS NULL; "
+			"UPDATE elf_sym SET elf_id = (SELECT f.elf_id FROM elf_file f "
+			"WHERE f.source_path = elf_sym.source_path) "
+			"WHERE elf_id IS NULL; "
+			"INSERT OR IGNORE INTO snapshot_elf(snapshot_id, elf_id) "
+			"SELECT 1, elf_id FROM elf_file;", NULL, NULL) != 0) {
+			return (1);
+		}
+	}
+	return (0);
+}
 
-        vm_info_captured.plt_addr = _strdup_or_null(argv[i++]);
-        vm_info_captured.plt_size = _strdup_or_null(argv[i++]);
-        vm_info_captured.got_addr = _strdup_or_null(argv[i++]);
-        vm_info_captured.got_size = _strdup_or_null(argv[i++]);
+/*
+ * migrate_to_5
+ * ELF files are identified by their device, inode, modification time and
+ * size, whatever base they are mapped at, and the symbols are stored relative
+ * to the base. The files of earlier snapshots have no identity, they keep
+ * their absolute addresses with a base of 0.
+ */
+static int migrate_to_5(sqlite3 *db)
+{
+	if (!db_table_exists(db, "elf_file")) {
+		return (0);
+	}
+	if (sql_query_exec(db, "DROP VIEW IF EXISTS elf_sym_text;", NULL, NULL) != 0) {
+		return (1);
+	}
+	if (!db_column_exists(db, "elf_file", "dev") &&
+	    sql_query_exec(db,
+		"ALTER TABLE elf_file RENAME TO elf_file_v4; "
+		"CREATE TABLE elf_file(elf_id INTEGER PRIMARY KEY, source_path VARCHAR NOT NULL, "
+		"dev INTEGER, ino INTEGER, mtime INTEGER, size INTEGER, plt_addr INTEGER, "
+		"plt_size INTEGER, got_addr INTEGER, got_size INTEGER); "
+		"INSERT INTO elf_file(elf_id, source_path, mtime) "
+		"SELECT elf_id, source_path, mtime FROM elf_file_v4; "
+		"DROP TABLE elf_file_v4;", NULL, NULL) != 0) {
+		return (1);
+	}
+	if (db_table_exists(db, "snapshot_elf") && !db_column_exists(db, "snapshot_elf", "base_addr") &&
+	    sql_query_exec(db, "ALTER TABLE snapshot_elf ADD COLUMN base_addr INTEGER NOT NULL DEFAULT 0;",
+		NULL, NULL) != 0) {
+		return (1);
+	}
+	return create_elf_sym_db(db);
+}
 
-	vm_info **result_ptr = (vm_info **)all_vm_info_ptr;
-       	(*result_ptr)[all_vm_info_index++] = vm_info_captured;
+/*
+ * migrate_path_table(db, table, path_column)
+ * Adds the paths of table, which still holds them as text in path_column, to
+ * the paths table and moves it out of the way as <table>_v5, for the caller
+ * to create it again and copy its rows over. Returns 1 if there was such a
+ * table, 0 if there was none and -1 on error.
+ */
+static int migrate_path_table(sqlite3 *db, char *table, char *path_column)
+{
+	char *query;
+	int rc;
 
-        return 0;
+	if (!db_table_exists(db, table) || !db_column_exists(db, table, path_column)) {
+		return (0);
+	}
+	asprintf(&query,
+	    "INSERT OR IGNORE INTO paths(path, basename, suffix) "
+	    "SELECT DISTINCT %s, chericat_path_basename(%s), chericat_path_suffix(%s) FROM %s; "
+	    "ALTER TABLE %s RENAME TO %s_v5;",
+	    path_column, path_column, path_column, table, table, table);
+	rc = sql_query_exec(db, query, NULL, NULL);
+	free(query);
+	return (rc == 0 ? 1 : -1);
 }
 
 /*
- * cap_info_query_callback
- * SQLite callback routine to traverse results from sqlite_exec()
- * using: "SELECT * FROM cap_info;"
- * Results are formatted into: cap_loc_addr, cap_addr, perms, base, top
- *
- * argc - number of columns
- * argv - pointer to the data that is stored in each column
- * azColName - pointer to the colunmn names
+ * migrate_to_6
+ * The paths of vm, cap_info and elf_sym are stored once in the paths table
+ * and referred to by their path_id. The tables are created again and their
+ * rows copied over with their rowid, which cap_compart refers to.
  */
-static int cap_info_query_callback(void *all_cap_info_ptr, int argc, char **argv, char **azColName)
+static int migrate_to_6(sqlite3 *db)
 {
-        assert(argc == 6);
+	sqlite3_create_function(db, "chericat_path_basename", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+	    sql_path_basename, NULL, NULL);
+	sqlite3_create_function(db, "chericat_path_suffix", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+	    sql_path_suffix, NULL, NULL);
+
+	// The indexes keep their names when their table is renamed
+	if (sql_query_exec(db,
+	    "DROP VIEW IF EXISTS vm_text; DROP VIEW IF EXISTS cap_info_text; "
+	    "DROP VIEW IF EXISTS elf_sym_text; "
+	    "DROP INDEX IF EXISTS cap_info_snapshot_loc; DROP INDEX IF EXISTS elf_sym_elf_id;", NULL, NULL) != 0 ||
+	    create_paths_table(db) != 0) {
+		return (1);
+	}
 
-        cap_info cap_info_captured;
-        cap_info_captured.cap_loc_addr = strdup(argv[0]);
-        cap_info_captured.cap_loc_path = strdup(argv[1]);
-        cap_info_captured.cap_addr = strdup(argv[2]);
-        cap_info_captured.perms = strdup(argv[3]);
-        cap_info_captured.base = strdup(argv[4]);
-        cap_info_captured.top = strdup(argv[5]);
+	int has_vm = migrate_path_table(db, "vm", "mmap_path");
+	int has_cap_info = migrate_path_table(db, "cap_info", "cap_loc_path");
+	int has_elf_sym = migrate_path_table(db, "elf_sym", "source_path");
+	if (has_vm < 0 || has_cap_info < 0 || has_elf_sym < 0) {
+		return (1);
+	}
 
-	cap_info **result_ptr = (cap_info **)all_cap_info_ptr;
-	(*result_ptr)[all_cap_info_index++] = cap_info_captured;
+	if ((db_table_exists(db, "vm") || db_table_exists(db, "cap_info") || has_vm || has_cap_info) &&
+	    create_vm_cap_db(db) != 0) {
+		return (1);
+	}
+	if ((db_table_exists(db, "elf_sym") || has_elf_sym) && create_elf_sym_db(db) != 0) {
+		return (1);
+	}
 
-        return 0;
+	if (has_vm && sql_query_exec(db,
+	    "INSERT INTO vm(rowid, start_addr, end_addr, mmap_path_id, compart_id, kve_protection, mmap_flags, "
+	    "vnode_type, plt_addr, plt_size, got_addr, got_size, snapshot_id) "
+	    "SELECT v.rowid, v.start_addr, v.end_addr, p.path_id, v.compart_id, v.kve_protection, v.mmap_flags, "
+	    "v.vnode_type, v.plt_addr, v.plt_size, v.got_addr, v.got_size, v.snapshot_id "
+	    "FROM vm_v5 v JOIN paths p ON p.path = v.mmap_path; DROP TABLE vm_v5;", NULL, NULL) != 0) {
+		return (1);
+	}
+	if (has_cap_info && sql_query_exec(db,
+	    "INSERT INTO cap_info(rowid, cap_loc_addr, cap_loc_path_id, cap_addr, perms, base, top, snapshot_id) "
+	    "SELECT c.rowid, c.cap_loc_addr, p.path_id, c.cap_addr, c.perms, c.base, c.top, c.snapshot_id "
+	    "FROM cap_info_v5 c JOIN paths p ON p.path = c.cap_loc_path; DROP TABLE cap_info_v5;", NULL, NULL) != 0) {
+		return (1);
+	}
+	if (has_elf_sym && sql_query_exec(db,
+	    "INSERT INTO elf_sym(rowid, source_path_id, st_name, st_value, st_shndx, type, bind, addr, "
+	    "st_size, elf_id) "
+	    "SELECT e.rowid, p.path_id, e.st_name, e.st_value, e.st_shndx, e.type, e.bind, e.addr, "
+	    "e.st_size, e.elf_id "
+	    "FROM elf_sym_v5 e JOIN paths p ON p.path = e.source_path; DROP TABLE elf_sym_v5;", NULL, NULL) != 0) {
+		return (1);
+	}
+	return (0);
 }
 
-static int sym_info_query_callback(void *all_sym_info_ptr, int argc, char **argv, char **azColName)
+/*
+ * migrate_snapshot_table(db, table)
+ * Moves table out of the way as <table>_v6 if its snapshot_id does not refer
+ * to the snapshot table yet, for the caller to create it again and copy its
+ * rows over. A snapshot the rows refer to but that has no row of its own is
+ * added, so that none of them is lost. Returns 1 if table was moved, 0 if
+ * there was nothing to do and -1 on error.
+ */
+static int migrate_snapshot_table(sqlite3 *db, char *table)
 {
-        assert(argc == 7);
-
-	sym_info sym_info_captured;
-        sym_info_captured.source_path = strdup(argv[0]);
-        sym_info_captured.sym_name = strdup(argv[1]);
-        sym_info_captured.sym_offset = strdup(argv[2]);
-        sym_info_captured.shndx = strdup(argv[3]);
-        sym_info_captured.type = strdup(argv[4]);
-        sym_info_captured.bind = strdup(argv[5]);
-        sym_info_captured.addr = strdup(argv[6]);
+	sqlite3_stmt *stmt;
+	char *query;
+	int rc;
 
-	sym_info **result_ptr = (sym_info **)all_sym_info_ptr;
-	(*result_ptr)[all_sym_info_index++] = sym_info_captured;
+	if (!db_table_exists(db, table)) {
+		return (0);
+	}
+	if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_foreign_key_list(?) WHERE \"table\" = 'snapshot';",
+	    -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		return (-1);
+	}
+	sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (rc == SQLITE_ROW) {
+		return (0);
+	}
 
-	return 0;
+	asprintf(&query,
+	    "INSERT OR IGNORE INTO snapshot(snapshot_id) "
+	    "SELECT DISTINCT snapshot_id FROM %s WHERE snapshot_id IS NOT NULL; "
+	    "ALTER TABLE %s RENAME TO %s_v6;",
+	    table, table, table);
+	rc = sql_query_exec(db, query, NULL, NULL);
+	free(query);
+	return (rc == 0 ? 1 : -1);
 }
 
-static int comp_info_query_callback(void *all_comp_info_ptr, int argc, char **argv, char **azColName)
+/*
+ * migrate_to_7
+ * The snapshot_id of each table refers to the snapshot table, so that a row
+ * cannot be left without its snapshot. The tables are created again and their
+ * rows copied over with their rowid. The compartments of the capabilities and
+ * the page hashes are worked out again, by the next view and the next
+ * incremental scan.
+ */
+static int migrate_to_7(sqlite3 *db)
 {
-    assert(argc == 7);
+	static const struct {
+		char *table;
+		const char *columns;
+	} tables[] = {
+		{ "vm", "start_addr, end_addr, mmap_path_id, compart_id, kve_protection, mmap_flags, "
+		    "vnode_type, plt_addr, plt_size, got_addr, got_size, snapshot_id" },
+		{ "cap_info", "cap_loc_addr, cap_loc_path_id, cap_addr, perms, base, top, snapshot_id" },
+		{ "comparts", "compart_id, compart_name, library_path, start_addr, end_addr, "
+		    "is_default, parent_id, snapshot_id" },
+		{ "snapshot_elf", "snapshot_id, elf_id, base_addr" },
+	};
+	int moved[4];
+
+	// The views would follow their tables to the new names, and the indexes
+	// keep their names when their table is renamed
+	if (sql_query_exec(db,
+	    "DROP VIEW IF EXISTS vm_with_path; DROP VIEW IF EXISTS cap_info_with_path; "
+	    "DROP VIEW IF EXISTS vm_text; DROP VIEW IF EXISTS cap_info_text; DROP VIEW IF EXISTS comparts_text; "
+	    "DROP INDEX IF EXISTS cap_info_snapshot_loc; DROP INDEX IF EXISTS cap_info_snapshot_path; "
+	    "DROP TABLE IF EXISTS cap_compart; DROP TABLE IF EXISTS cap_compart_snapshot; "
+	    "DROP TABLE IF EXISTS page_hash; DROP TABLE IF EXISTS page_hash_snapshot;", NULL, NULL) != 0 ||
+	    create_snapshot_table(db) != 0) {
+		return (1);
+	}
 
-    comp_info comp_info_captured;
-    int i=0;
-    comp_info_captured.compart_id   = convert_str_to_int(argv[i++], "compart_id type is invalid");
-    comp_info_captured.compart_name = _strdup_or_null(argv[i++]);
-    comp_info_captured.library_path = _strdup_or_null(argv[i++]);
-    comp_info_captured.start_addr   = _strdup_or_null(argv[i++]);
-    comp_info_captured.end_addr     = _strdup_or_null(argv[i++]);
-    comp_info_captured.is_default   = convert_str_to_int(argv[i++], "is_default type is invalid");
-    comp_info_captured.parent_id    = convert_str_to_int(argv[i++], "parent_id type is invalid");
+	for (int i=0; i<4; i++) {
+		moved[i] = migrate_snapshot_table(db, tables[i].table);
+		if (moved[i] < 0) {
+			return (1);
+		}
+	}
 
-    comp_info **result_ptr = (comp_info **)all_comp_info_ptr;
-    (*result_ptr)[all_comp_info_index++] = comp_info_captured;
+	if ((db_table_exists(db, "vm") || db_table_exists(db, "cap_info") || moved[0] || moved[1]) &&
+	    create_vm_cap_db(db) != 0) {
+		return (1);
+	}
+	if ((db_table_exists(db, "comparts") || moved[2]) && create_comparts_table(db) != 0) {
+		return (1);
+	}
+	if (moved[3] && create_elf_sym_db(db) != 0) {
+		return (1);
+	}
 
-    return 0;
+	for (int i=0; i<4; i++) {
+		if (moved[i]) {
+			char *query;
+			asprintf(&query, "INSERT INTO %s(rowid, %s) SELECT rowid, %s FROM %s_v6; DROP TABLE %s_v6;",
+			    tables[i].table, tables[i].columns, tables[i].columns, tables[i].table, tables[i].table);
+			int rc = sql_query_exec(db, query, NULL, NULL);
+			free(query);
+			if (rc != 0) {
+				return (1);
+			}
+		}
+	}
+	return (0);
 }
 
-static int info_count_query_callback(void *count, int argc, char **argv, char **azColName)
-{
-	assert(argc > 0);
-	char **result_ptr = (char **)count;
-	*result_ptr = strdup(argv[0]);
-    	return 0;
-}
 /*
-static int cap_info_count_query_callback(void *count, int argc, char **argv, char **azColName)
+ * migrate_to_8
+ * The page hashes are kept for each process rather than for the latest
+ * snapshot only. Those of the earlier schema are dropped, the next
+ * incremental scan of each process writes all its pages.
+ */
+static int migrate_to_8(sqlite3 *db)
 {
-	assert(argc > 0);
-	char **result_ptr = (char **)count;
-	*result_ptr = strdup(argv[0]);
-	return 0;
+	return sql_query_exec(db, "DROP TABLE IF EXISTS page_hash; DROP TABLE IF EXISTS page_hash_snapshot;",
+	    NULL, NULL);
 }
 
-static int sym_info_count_query_callback(void *count, int argc, char **argv, char **azColName)
-{
-	assert(argc > 0);
-	char **result_ptr = (char **)count;
-	*result_ptr = strdup(argv[0]);
-	return 0;
-}
-*/
+/*
+ * The migrations from each schema version to the next one, migrations[i]
+ * upgrades a database from version i to version i+1.
+ */
+static int (*migrations[DB_SCHEMA_VERSION])(sqlite3 *db) = {
+	migrate_to_1,
+	migrate_to_2,
+	migrate_to_3,
+	migrate_to_4,
+	migrate_to_5,
+	migrate_to_6,
+	migrate_to_7,
+	migrate_to_8,
+};
 
-int vm_info_count(sqlite3 *db) 
+/*
+ * migrate_db(db)
+ * Brings the schema of db up to DB_SCHEMA_VERSION, one version at a time, each
+ * step in its own transaction. A database without any table is simply marked
+ * with the current version, its tables are created with the current schema.
+ */
+int migrate_db(sqlite3 *db)
 {
+	int version = get_user_version(db);
 
-	assert_db_table_exists(db, "vm");
+	// A newly opened database is read at its latest snapshot
+	current_snapshot_id = 0;
 
-        /* Obtain how many vm items from the database first, we can then use it to
-         * determine the size of the struct array for holding all the vm entries */
-        char *count;
-        sql_query_exec(db, "SELECT COUNT(*) FROM vm;", info_count_query_callback, &count);
-	int result_count = convert_str_to_int(count, "Query to get count from vm returned an invalid value");
-	debug_print(INFO, "vm_info_count_query returned %d\n", result_count);
+	if (version > DB_SCHEMA_VERSION) {
+		errx(1, "Database %s has schema version %d, this chericat only knows up to version %d",
+		    get_dbname(), version, DB_SCHEMA_VERSION);
+	}
+
+	if (version == 0 && !db_table_exists(db, "vm") && !db_table_exists(db, "cap_info") &&
+	    !db_table_exists(db, "elf_sym") && !db_table_exists(db, "comparts")) {
+		return set_user_version(db, DB_SCHEMA_VERSION);
+	}
+
+	while (version < DB_SCHEMA_VERSION) {
+		debug_print(INFO, "Migrating database %s from schema version %d to %d\n", get_dbname(), version, version+1);
+
+		begin_transaction(db);
+		if (migrations[version](db) != 0) {
+			sql_query_exec(db, "ROLLBACK;", NULL, NULL);
+			errx(1, "Unable to migrate database %s to schema version %d", get_dbname(), version+1);
+		}
+		version++;
+		set_user_version(db, version);
+		commit_transaction(db);
+	}
+
+	return (0);
+}
+
+/*
+ * open_db(name, db)
+ * Opens the database called name, upgrading its schema if it was written by an
+ * older version of chericat. The snapshot_id of the rows is checked against the
+ * snapshot table from then on.
+ */
+int open_db(char *name, sqlite3 **db)
+{
+	int rc = sqlite3_open(name, db);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "Error open DB %s", sqlite3_errmsg(*db));
+		sqlite3_close(*db);
+		*db = NULL;
+		return (1);
+	}
+	if (migrate_db(*db) != 0) {
+		return (1);
+	}
+	// Not enforced by the migrations, which move the tables around
+	return sql_query_exec(*db, "PRAGMA foreign_keys = ON;", NULL, NULL);
+}
+
+/*
+ * create_cap_compart_table
+ * The compartments each capability of cap_info is stored in and points into,
+ * and the snapshots whose capabilities have all been mapped, see
+ * build_cap_compart.
+ */
+int create_cap_compart_table(sqlite3 *db)
+{
+	char *cap_compart_table =
+		"CREATE TABLE IF NOT EXISTS cap_compart("
+		"cap_id INTEGER PRIMARY KEY, "
+		"src_compart_id INTEGER NOT NULL, "
+		"dest_compart_id INTEGER NOT NULL);"
+		"CREATE TABLE IF NOT EXISTS cap_compart_snapshot("
+		"snapshot_id INTEGER PRIMARY KEY REFERENCES snapshot(snapshot_id));";
+
+	int rc;
+	char* messageError;
+
+	if (create_snapshot_table(db) != 0) {
+		return (1);
+	}
+
+	rc = sqlite3_exec(db, cap_compart_table, NULL, 0, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+	debug_print(TROUBLESHOOT, "Database table cap_compart created successfully\n", NULL);
+	return (0);
+}
+
+/*
+ * create_page_hash_table
+ * The hashes of the tags and capabilities of each page holding capabilities,
+ * as of the last incremental scan of each process, and the snapshot that scan
+ * was taken into in page_hash_snapshot, see scan_delta_open.
+ */
+int create_page_hash_table(sqlite3 *db)
+{
+	char *page_hash_table =
+		"CREATE TABLE IF NOT EXISTS page_hash("
+		"pid INTEGER NOT NULL, "
+		"page_addr INTEGER NOT NULL, "
+		"tags_hash INTEGER NOT NULL, "
+		"caps_hash INTEGER NOT NULL, "
+		"PRIMARY KEY(pid, page_addr));"
+		"CREATE TABLE IF NOT EXISTS page_hash_snapshot("
+		"pid INTEGER PRIMARY KEY, "
+		"snapshot_id INTEGER NOT NULL REFERENCES snapshot(snapshot_id));";
+
+	int rc;
+	char* messageError;
+
+	if (create_snapshot_table(db) != 0) {
+		return (1);
+	}
+
+	rc = sqlite3_exec(db, page_hash_table, NULL, 0, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+	debug_print(TROUBLESHOOT, "Database table page_hash created successfully\n", NULL);
+	return (0);
+}
+
+/*
+ * create_snapshot_table
+ * One row for each scan or ingest stored in the database.
+ */
+int create_snapshot_table(sqlite3 *db)
+{
+	char *snapshot_table =
+		"CREATE TABLE IF NOT EXISTS snapshot("
+		"snapshot_id INTEGER PRIMARY KEY, "
+		"pid INTEGER, "
+		"started INTEGER, "
+		"command VARCHAR, "
+		"duration REAL);";
+
+	int rc;
+	char* messageError;
+
+	rc = sqlite3_exec(db, snapshot_table, NULL, 0, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+	debug_print(TROUBLESHOOT, "Database table snapshot created successfully\n", NULL);
+	return (0);
+}
+
+/*
+ * set_snapshot_command(argc, argv)
+ * Keeps the command line of chericat, to be stored with its snapshots.
+ */
+void set_snapshot_command(int argc, char **argv)
+{
+	size_t len = 1;
+
+	for (int i=0; i<argc; i++) {
+		len += strlen(argv[i]) + 1;
+	}
+	free(snapshot_command);
+	snapshot_command = calloc(1, len);
+	assert(snapshot_command != NULL);
+	for (int i=0; i<argc; i++) {
+		if (i > 0) {
+			strcat(snapshot_command, " ");
+		}
+		strcat(snapshot_command, argv[i]);
+	}
+}
+
+/*
+ * snapshot_exists(db, snapshot_id)
+ * Returns 1 if db holds the snapshot snapshot_id, 0 otherwise.
+ */
+int snapshot_exists(sqlite3 *db, int64_t snapshot_id)
+{
+	sqlite3_stmt *stmt;
+	int found;
+
+	if (!db_table_exists(db, "snapshot")) {
+		return (0);
+	}
+	if (sqlite3_prepare_v2(db, "SELECT 1 FROM snapshot WHERE snapshot_id = ?;", -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_int64(stmt, 1, snapshot_id);
+	found = sqlite3_step(stmt) == SQLITE_ROW;
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+/*
+ * select_snapshot(db, snapshot_id)
+ * Makes the views read snapshot_id, see --snapshot. Returns 1 if db has no
+ * such snapshot.
+ */
+int select_snapshot(sqlite3 *db, int64_t snapshot_id)
+{
+	if (!snapshot_exists(db, snapshot_id)) {
+		return (1);
+	}
+	current_snapshot_id = snapshot_id;
+	return (0);
+}
+
+/*
+ * get_snapshot_id(db)
+ * The snapshot being taken or selected, otherwise the latest one of db.
+ * Returns 0 if db has no snapshot.
+ */
+int64_t get_snapshot_id(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	int64_t snapshot_id = 0;
+
+	if (current_snapshot_id != 0 || !db_table_exists(db, "snapshot")) {
+		return current_snapshot_id;
+	}
+	if (sqlite3_prepare_v2(db, "SELECT MAX(snapshot_id) FROM snapshot;", -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		snapshot_id = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return snapshot_id;
+}
+
+/*
+ * snapshot_begin(db, pid, started)
+ * Adds a snapshot of process pid taken at started, and writes the following
+ * rows to it. Returns the snapshot_id, or 0 on error.
+ */
+int64_t snapshot_begin(sqlite3 *db, int64_t pid, int64_t started)
+{
+	sqlite3_stmt *stmt;
+
+	if (create_snapshot_table(db) != 0 ||
+	    sqlite3_prepare_v2(db, "INSERT INTO snapshot(pid, started, command) VALUES(?, ?, ?);",
+		-1, &stmt, NULL) != SQLITE_OK) {
+		return (0);
+	}
+	sqlite3_bind_int64(stmt, 1, pid);
+	sqlite3_bind_int64(stmt, 2, started);
+	if (snapshot_command != NULL) {
+		sqlite3_bind_text(stmt, 3, snapshot_command, -1, SQLITE_STATIC);
+	}
+	int rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "SQL error adding the snapshot: %s (db: %s)\n", sqlite3_errmsg(db), get_dbname());
+		return (0);
+	}
+	current_snapshot_id = sqlite3_last_insert_rowid(db);
+	debug_print(TROUBLESHOOT, "Key Stage: Taking snapshot %ld of process %ld\n", current_snapshot_id, pid);
+	return current_snapshot_id;
+}
+
+/*
+ * snapshot_end(db, duration)
+ * Stores how long the snapshot being taken took, in seconds.
+ */
+int snapshot_end(sqlite3 *db, double duration)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, "UPDATE snapshot SET duration = ? WHERE snapshot_id = ?;",
+	    -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s (db: %s)\n", sqlite3_errmsg(db), get_dbname());
+		return (1);
+	}
+	sqlite3_bind_double(stmt, 1, duration);
+	sqlite3_bind_int64(stmt, 2, current_snapshot_id);
+	int rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	return rc == SQLITE_DONE ? 0 : 1;
+}
+
+/*
+ * elf_file_find(db, file)
+ * Looks up the ELF file with the identity of file in the symbol cache. If its
+ * symbols are stored, fills in the elf_id and the special sections of file
+ * and returns the elf_id, otherwise returns 0.
+ */
+int64_t elf_file_find(sqlite3 *db, elf_file_info *file)
+{
+	sqlite3_stmt *stmt;
+
+	file->elf_id = 0;
+	if (sqlite3_prepare_v2(db, "SELECT elf_id, plt_addr, plt_size, got_addr, got_size FROM elf_file "
+	    "WHERE dev = ? AND ino = ? AND mtime = ? AND size = ?;", -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_int64(stmt, 1, file->dev);
+	sqlite3_bind_int64(stmt, 2, file->ino);
+	sqlite3_bind_int64(stmt, 3, file->mtime);
+	sqlite3_bind_int64(stmt, 4, file->size);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		file->elf_id = sqlite3_column_int64(stmt, 0);
+		file->plt_addr = (uint64_t)sqlite3_column_int64(stmt, 1);
+		file->plt_size = (uint64_t)sqlite3_column_int64(stmt, 2);
+		file->got_addr = (uint64_t)sqlite3_column_int64(stmt, 3);
+		file->got_size = (uint64_t)sqlite3_column_int64(stmt, 4);
+	}
+	sqlite3_finalize(stmt);
+
+	debug_print(TROUBLESHOOT, "Key Stage: ELF file %s is %s\n", file->source_path,
+	    file->elf_id != 0 ? "in the symbol cache" : "not in the symbol cache, parsing it");
+	return file->elf_id;
+}
+
+/*
+ * elf_file_insert(db, file)
+ * Adds file to the symbol cache, its symbols are then to be inserted under
+ * the returned elf_id and its sections set by elf_file_set_sections.
+ */
+int64_t elf_file_insert(sqlite3 *db, elf_file_info *file)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, "INSERT INTO elf_file(source_path, dev, ino, mtime, size) VALUES(?, ?, ?, ?, ?);",
+	    -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_text(stmt, 1, file->source_path, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, file->dev);
+	sqlite3_bind_int64(stmt, 3, file->ino);
+	sqlite3_bind_int64(stmt, 4, file->mtime);
+	sqlite3_bind_int64(stmt, 5, file->size);
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		errx(1, "SQL error adding the ELF file %s: %s", file->source_path, sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+
+	file->elf_id = sqlite3_last_insert_rowid(db);
+	return file->elf_id;
+}
+
+/*
+ * elf_file_set_sections(db, file)
+ * Stores the special sections of file, once it has been parsed.
+ */
+int elf_file_set_sections(sqlite3 *db, const elf_file_info *file)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, "UPDATE elf_file SET plt_addr = ?, plt_size = ?, got_addr = ?, got_size = ? "
+	    "WHERE elf_id = ?;", -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)file->plt_addr);
+	sqlite3_bind_int64(stmt, 2, (sqlite3_int64)file->plt_size);
+	sqlite3_bind_int64(stmt, 3, (sqlite3_int64)file->got_addr);
+	sqlite3_bind_int64(stmt, 4, (sqlite3_int64)file->got_size);
+	sqlite3_bind_int64(stmt, 5, file->elf_id);
+	int rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	return rc == SQLITE_DONE ? 0 : 1;
+}
+
+/*
+ * snapshot_elf_add(db, elf_id, base)
+ * Adds the ELF file elf_id, loaded at base, to the snapshot being taken.
+ */
+int snapshot_elf_add(sqlite3 *db, int64_t elf_id, uint64_t base)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO snapshot_elf(snapshot_id, elf_id, base_addr) "
+	    "VALUES(?, ?, ?);", -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_int64(stmt, 1, get_snapshot_id(db));
+	sqlite3_bind_int64(stmt, 2, elf_id);
+	sqlite3_bind_int64(stmt, 3, (sqlite3_int64)base);
+	int rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	return rc == SQLITE_DONE ? 0 : 1;
+}
+
+int begin_transaction(sqlite3 *db)
+{
+	int rc;
+	char *messageError;
+
+	rc = sqlite3_exec(db, "BEGIN", 0, 0, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+
+	return (0);
+}
+
+int commit_transaction(sqlite3 *db)
+{
+	int rc;
+	char *messageError;
+
+	rc = sqlite3_exec(db, "COMMIT", 0, 0, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", messageError);
+		sqlite3_free(messageError);
+		return (1);
+	}
+
+	return (0);
+}	
+
+/*
+ * path_cache_open(db, cache)
+ * Prepares the statements used to look up and add paths to the paths table,
+ * which must exist already.
+ */
+int path_cache_open(sqlite3 *db, path_cache *cache)
+{
+	memset(cache, 0, sizeof(path_cache));
+	cache->db = db;
+	arena_init(&cache->path_arena, 0);
+	str_table_init(&cache->strings, &cache->path_arena);
+
+	if (sqlite3_prepare_v2(db, "SELECT path_id FROM paths WHERE path = ?;", -1,
+	    &cache->select_stmt, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT INTO paths(path, basename, suffix) VALUES(?, ?, ?);", -1,
+	    &cache->insert_stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		path_cache_close(cache);
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * path_cache_id(cache, path)
+ * Returns the path_id of path, adding it to the paths table if it is not
+ * there yet, or 0 on error.
+ */
+int64_t path_cache_id(path_cache *cache, const char *path)
+{
+	if (path == NULL) {
+		return (0);
+	}
+	const char *interned = str_intern(&cache->strings, path);
+	if (interned == cache->last_path) {
+		return (cache->last_id);
+	}
+
+	int64_t path_id = 0;
+	sqlite3_bind_text(cache->select_stmt, 1, path, -1, SQLITE_STATIC);
+	if (sqlite3_step(cache->select_stmt) == SQLITE_ROW) {
+		path_id = sqlite3_column_int64(cache->select_stmt, 0);
+	}
+	sqlite3_reset(cache->select_stmt);
+
+	if (path_id == 0) {
+		const char *basename;
+		int basename_len;
+		const char *suffix = path_names(path, &basename, &basename_len);
+
+		sqlite3_bind_text(cache->insert_stmt, 1, path, -1, SQLITE_STATIC);
+		sqlite3_bind_text(cache->insert_stmt, 2, basename, basename_len, SQLITE_STATIC);
+		sqlite3_bind_text(cache->insert_stmt, 3, suffix, -1, SQLITE_STATIC);
+		int rc = sqlite3_step(cache->insert_stmt);
+		sqlite3_reset(cache->insert_stmt);
+		if (rc != SQLITE_DONE) {
+			fprintf(stderr, "SQL error inserting into paths: %s (db: %s)\n", sqlite3_errmsg(cache->db), get_dbname());
+			return (0);
+		}
+		path_id = sqlite3_last_insert_rowid(cache->db);
+	}
+	cache->lookups++;
+
+	cache->last_path = interned;
+	cache->last_id = path_id;
+	return (path_id);
+}
+
+/*
+ * path_cache_close(cache)
+ * Releases the prepared statements and the interned paths of the cache.
+ */
+void path_cache_close(path_cache *cache)
+{
+	sqlite3_finalize(cache->select_stmt);
+	sqlite3_finalize(cache->insert_stmt);
+	cache->select_stmt = NULL;
+	cache->insert_stmt = NULL;
+	str_table_free(&cache->strings);
+	arena_free(&cache->path_arena);
+	cache->last_path = NULL;
+}
+
+/*
+ * cap_writer_open(db, writer)
+ * Prepares the statement used to insert the captured capabilities into the
+ * cap_info table, which must exist already, for the snapshot being taken.
+ */
+int cap_writer_open(sqlite3 *db, cap_writer *writer)
+{
+	const char *insert_cap_q = 
+		"INSERT INTO cap_info(cap_loc_addr, cap_loc_path_id, cap_addr, perms, base, top, snapshot_id) "
+		"VALUES(?, ?, ?, ?, ?, ?, ?);";
+
+	writer->db = db;
+	writer->snapshot_id = get_snapshot_id(db);
+	writer->rows = 0;
+
+	if (path_cache_open(db, &writer->paths) != 0) {
+		writer->insert_stmt = NULL;
+		return (1);
+	}
+	int rc = sqlite3_prepare_v2(db, insert_cap_q, -1, &writer->insert_stmt, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		writer->insert_stmt = NULL;
+		path_cache_close(&writer->paths);
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * cap_writer_insert(writer, ...)
+ * Binds the values of one capability to the prepared insert statement and
+ * executes it. The caller times a batch of rows as RUN_PHASE_SQL_INSERT.
+ */
+int cap_writer_insert(cap_writer *writer, unsigned long cap_loc_addr, const char *cap_loc_path,
+    unsigned long cap_addr, uint32_t perms, unsigned long base, unsigned long top)
+{
+	sqlite3_stmt *stmt = writer->insert_stmt;
+
+	int64_t path_id = path_cache_id(&writer->paths, cap_loc_path);
+	if (path_id == 0) {
+		return (1);
+	}
+
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)cap_loc_addr);
+	sqlite3_bind_int64(stmt, 2, path_id);
+	sqlite3_bind_int64(stmt, 3, (sqlite3_int64)cap_addr);
+	sqlite3_bind_int(stmt, 4, perms);
+	sqlite3_bind_int64(stmt, 5, (sqlite3_int64)base);
+	sqlite3_bind_int64(stmt, 6, (sqlite3_int64)top);
+	sqlite3_bind_int64(stmt, 7, writer->snapshot_id);
+
+	int rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "SQL error inserting into cap_info: %s (db: %s)\n", sqlite3_errmsg(writer->db), get_dbname());
+		return (1);
+	}
+	writer->rows++;
+
+	return (0);
+}
+
+/*
+ * cap_writer_close(writer)
+ * Releases the prepared statements of the writer.
+ */
+void cap_writer_close(cap_writer *writer)
+{
+	sqlite3_finalize(writer->insert_stmt);
+	writer->insert_stmt = NULL;
+	path_cache_close(&writer->paths);
+	debug_print(TROUBLESHOOT, "Key Stage: Inserted %lu capabilities to the database\n", writer->rows);
+}
+
+/*
+ * sym_writer_open(db, writer, elf_id)
+ * Prepares the statement used to insert the symbols of the ELF file elf_id
+ * into the elf_sym table, which must exist already.
+ */
+int sym_writer_open(sqlite3 *db, sym_writer *writer, int64_t elf_id)
+{
+	const char *insert_sym_q =
+		"INSERT INTO elf_sym(source_path_id, st_name, st_value, st_shndx, type, bind, addr, st_size, elf_id) "
+		"VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+	writer->db = db;
+	writer->elf_id = elf_id;
+	writer->rows = 0;
+
+	if (path_cache_open(db, &writer->paths) != 0) {
+		writer->insert_stmt = NULL;
+		return (1);
+	}
+	int rc = sqlite3_prepare_v2(db, insert_sym_q, -1, &writer->insert_stmt, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		writer->insert_stmt = NULL;
+		path_cache_close(&writer->paths);
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * sym_writer_insert(writer, ...)
+ * Binds the values of one symbol to the prepared insert statement and
+ * executes it. The strings are only used for the duration of the call. The
+ * caller times a batch of rows as RUN_PHASE_SQL_INSERT.
+ */
+int sym_writer_insert(sym_writer *writer, const char *source_path, const char *sym_name,
+    uint64_t st_value, const char *shndx, const char *type, const char *bind, uint64_t addr, uint64_t size)
+{
+	sqlite3_stmt *stmt = writer->insert_stmt;
+
+	int64_t path_id = path_cache_id(&writer->paths, source_path);
+	if (path_id == 0) {
+		return (1);
+	}
+
+	sqlite3_bind_int64(stmt, 1, path_id);
+	sqlite3_bind_text(stmt, 2, sym_name, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 3, (sqlite3_int64)st_value);
+	sqlite3_bind_text(stmt, 4, shndx, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 5, type, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 6, bind, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 7, (sqlite3_int64)addr);
+	sqlite3_bind_int64(stmt, 8, (sqlite3_int64)size);
+	sqlite3_bind_int64(stmt, 9, writer->elf_id);
+
+	int rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "SQL error inserting into elf_sym: %s (db: %s)\n", sqlite3_errmsg(writer->db), get_dbname());
+		return (1);
+	}
+	writer->rows++;
+
+	return (0);
+}
+
+/*
+ * sym_writer_close(writer)
+ * Releases the prepared statements of the writer.
+ */
+void sym_writer_close(sym_writer *writer)
+{
+	sqlite3_finalize(writer->insert_stmt);
+	writer->insert_stmt = NULL;
+	path_cache_close(&writer->paths);
+	debug_print(TROUBLESHOOT, "Key Stage: Inserted %lu symbols of elf_id %ld to the database\n", writer->rows, (long)writer->elf_id);
+}
+
+/*
+ * insert_vm_info(db, snapshot_id, vms, count)
+ * Inserts count vm entries into the vm table for the snapshot through a
+ * single prepared statement, their plt and got are left for the caller to
+ * fill in. Returns the number of rows inserted, or -1 on error.
+ */
+int insert_vm_info(sqlite3 *db, int64_t snapshot_id, const vm_info *vms, int count)
+{
+	const char *insert_vm_q =
+		"INSERT INTO vm(start_addr, end_addr, mmap_path_id, compart_id, kve_protection, mmap_flags, "
+		"vnode_type, snapshot_id) VALUES(?, ?, ?, ?, ?, ?, ?, ?);";
+	sqlite3_stmt *stmt;
+	path_cache paths;
+	int rows = 0;
+
+	if (path_cache_open(db, &paths) != 0) {
+		return (-1);
+	}
+	if (sqlite3_prepare_v2(db, insert_vm_q, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		path_cache_close(&paths);
+		return (-1);
+	}
+
+	run_timer timer;
+	run_phase_begin(&timer, RUN_PHASE_SQL_INSERT);
+	for (int i=0; i<count; i++) {
+		int64_t path_id = path_cache_id(&paths, vms[i].mmap_path);
+		if (path_id == 0) {
+			rows = -1;
+			break;
+		}
+		sqlite3_bind_int64(stmt, 1, (sqlite3_int64)vms[i].start_addr);
+		sqlite3_bind_int64(stmt, 2, (sqlite3_int64)vms[i].end_addr);
+		sqlite3_bind_int64(stmt, 3, path_id);
+		sqlite3_bind_int(stmt, 4, vms[i].compart_id);
+		sqlite3_bind_int(stmt, 5, vms[i].kve_protection);
+		sqlite3_bind_int(stmt, 6, vms[i].mmap_flags);
+		sqlite3_bind_int(stmt, 7, vms[i].vnode_type);
+		sqlite3_bind_int64(stmt, 8, snapshot_id);
+
+		int rc = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (rc != SQLITE_DONE) {
+			fprintf(stderr, "SQL error inserting into vm: %s (db: %s)\n", sqlite3_errmsg(db), get_dbname());
+			rows = -1;
+			break;
+		}
+		rows++;
+	}
+	run_phase_end(&timer);
+	sqlite3_finalize(stmt);
+	path_cache_close(&paths);
+
+	return (rows);
+}
+
+int sql_query_exec(sqlite3 *db, char* query, int (*callback)(void*,int,char**,char**), void *data)
+{
+	int rc;
+	char* messageError;
 
-	free(count);
-	return result_count;
+	rc = sqlite3_exec(db, query, callback, data, &messageError);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "SQL %s error: %s (db: %s)\n", query, messageError, get_dbname());
+		sqlite3_free(messageError);
+		return (1);
+	} else {
+		debug_print(TROUBLESHOOT, "Query %s, executed successfully (rc=%d) \n", query, rc);
+	}
+	
+	sqlite3_int64 pCurrent=0, pHighwater=0;
+	sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &pCurrent, &pHighwater, 0);
+	debug_print(TROUBLESHOOT, "sqlite mem used, current: %lld high water: %lld\n", pCurrent, pHighwater);
+	
+	return (0);
 }
 
-int cap_info_count(sqlite3 *db)
+/*
+ * cursor_open(db, cursor, query, ncols)
+ * Prepares query for a cursor, the query must return ncols columns.
+ * Returns 0 on success, 1 if the query cannot be prepared.
+ */
+static int cursor_open(sqlite3 *db, db_cursor *cursor, const char *query, int ncols)
+{
+	cursor->rows = 0;
+	if (sqlite3_prepare_v2(db, query, -1, &cursor->stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQL %s error: %s (db: %s)\n", query, sqlite3_errmsg(db), get_dbname());
+		cursor->stmt = NULL;
+		return (1);
+	}
+	assert(sqlite3_column_count(cursor->stmt) == ncols);
+	return (0);
+}
+
+/*
+ * cursor_step(cursor)
+ * Moves the cursor to the next row. Returns 1 if there is a row, 0 when the
+ * rows are exhausted and -1 on error.
+ */
+static int cursor_step(db_cursor *cursor)
+{
+	if (cursor->stmt == NULL) {
+		return -1;
+	}
+	int rc = sqlite3_step(cursor->stmt);
+	if (rc == SQLITE_ROW) {
+		cursor->rows++;
+		return 1;
+	}
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "SQL error: %s (db: %s)\n",
+		    sqlite3_errmsg(sqlite3_db_handle(cursor->stmt)), get_dbname());
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * snapshot_id_cursor_prepare(db, cursor, query, ncols, snapshot_id)
+ * Like cursor_open, with ?1 of query bound to snapshot_id.
+ */
+static int snapshot_id_cursor_prepare(sqlite3 *db, db_cursor *cursor, const char *query, int ncols,
+    int64_t snapshot_id)
+{
+	if (cursor_open(db, cursor, query, ncols) != 0) {
+		return (1);
+	}
+	sqlite3_bind_int64(cursor->stmt, 1, snapshot_id);
+	return (0);
+}
+
+/*
+ * snapshot_cursor_prepare(db, cursor, query, ncols)
+ * Like cursor_open, with ?1 of query bound to the snapshot of the views.
+ */
+static int snapshot_cursor_prepare(sqlite3 *db, db_cursor *cursor, const char *query, int ncols)
+{
+	return snapshot_id_cursor_prepare(db, cursor, query, ncols, get_snapshot_id(db));
+}
+
+/*
+ * The paths are joined by their path_id. CROSS JOIN keeps vm and cap_info as
+ * the outer tables, so that their rows are read in the order of their own
+ * indexes and each path is a lookup by primary key.
+ */
+#define VM_COLUMNS	"v.start_addr, v.end_addr, p.path, v.compart_id, v.kve_protection, v.mmap_flags, " \
+			"v.vnode_type, v.plt_addr, v.plt_size, v.got_addr, v.got_size"
+#define VM_FROM		"vm v CROSS JOIN paths p ON p.path_id = v.mmap_path_id"
+#define CAP_COLUMNS	"c.cap_loc_addr, p.path, c.cap_addr, c.perms, c.base, c.top"
+#define CAP_FROM	"cap_info c CROSS JOIN paths p ON p.path_id = c.cap_loc_path_id"
+
+/*
+ * The capabilities stored in the mappings of the library ?2: the path_id of
+ * the matching paths are found first, then their capabilities through the
+ * index on cap_info(snapshot_id, cap_loc_path_id). A library named by its
+ * basename is looked up through paths_basename, a part of a path has to be
+ * searched for in every path, see lib_is_basename.
+ */
+#define CAP_LIB_BASENAME_FILTER	"c.cap_loc_path_id IN (SELECT path_id FROM paths WHERE basename = ?2)"
+#define CAP_LIB_PATH_FILTER	"c.cap_loc_path_id IN (SELECT path_id FROM paths WHERE path LIKE '%' || ?2 || '%')"
+
+#define column_u64(stmt, i)	((uint64_t)sqlite3_column_int64((stmt), (i)))
+#define column_str(stmt, i)	((char *)sqlite3_column_text((stmt), (i)))
+
+/*
+ * db_cursor_close(cursor)
+ * Releases the statement of the cursor, the strings of the last row it
+ * returned are no longer valid.
+ */
+void db_cursor_close(db_cursor *cursor)
+{
+	sqlite3_finalize(cursor->stmt);
+	cursor->stmt = NULL;
+	debug_print(TROUBLESHOOT, "Cursor closed after %lu rows\n", cursor->rows);
+}
+
+/*
+ * vm_cursor_open(db, cursor)
+ * Opens a cursor over the vm entries of the snapshot in the order they were
+ * scanned.
+ */
+int vm_cursor_open(sqlite3 *db, db_cursor *cursor)
+{
+	assert_db_table_exists(db, "vm");
+
+	return snapshot_cursor_prepare(db, cursor,
+	    "SELECT " VM_COLUMNS " FROM " VM_FROM " WHERE v.snapshot_id = ?1 ORDER BY v.rowid;", 11);
+}
+
+/*
+ * read_vm_row
+ * Fills vm from the 11 columns of a vm row, starting at column col.
+ */
+static void read_vm_row(sqlite3_stmt *stmt, int col, vm_info *vm)
+{
+	vm->start_addr = column_u64(stmt, col++);
+	vm->end_addr = column_u64(stmt, col++);
+	vm->mmap_path = column_str(stmt, col++);
+	vm->compart_id = sqlite3_column_int(stmt, col++);
+	vm->kve_protection = sqlite3_column_int(stmt, col++);
+	vm->mmap_flags = sqlite3_column_int(stmt, col++);
+	vm->vnode_type = sqlite3_column_int(stmt, col++);
+	vm->plt_addr = column_u64(stmt, col++);
+	vm->plt_size = column_u64(stmt, col++);
+	vm->got_addr = column_u64(stmt, col++);
+	vm->got_size = column_u64(stmt, col++);
+}
+
+/*
+ * vm_cursor_next(cursor, vm)
+ * Reads the next vm entry into vm. Returns 1 if there was one, 0 at the end
+ * and -1 on error.
+ */
+int vm_cursor_next(db_cursor *cursor, vm_info *vm)
+{
+	int rc = cursor_step(cursor);
+	if (rc == 1) {
+		read_vm_row(cursor->stmt, 0, vm);
+	}
+	return rc;
+}
+
+/*
+ * lib_is_basename(db, lib)
+ * Returns 1 if lib is the basename of a path of db, so that CAP_LIB_BASENAME_FILTER
+ * can be used, 0 if it can only be part of a path.
+ */
+static int lib_is_basename(sqlite3 *db, const char *lib)
+{
+	sqlite3_stmt *stmt;
+	int found = 0;
+
+	if (sqlite3_prepare_v2(db, "SELECT 1 FROM paths WHERE basename = ?1 LIMIT 1;", -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_text(stmt, 1, lib, -1, SQLITE_STATIC);
+	found = sqlite3_step(stmt) == SQLITE_ROW;
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+/*
+ * cap_cursor_open(db, cursor, lib)
+ * Opens a cursor over the capabilities of the snapshot stored in the mappings
+ * of the library lib, named by its basename or by a part of its path, or over
+ * all of them if lib is NULL.
+ */
+int cap_cursor_open(sqlite3 *db, db_cursor *cursor, const char *lib)
 {
 	assert_db_table_exists(db, "cap_info");
 
-        /* Obtain how many vm items from the database first, we can then use it to
-         * determine the size of the struct array for holding all the vm entries */
-        char *count;
-	sql_query_exec(db, "SELECT COUNT(*) FROM cap_info;", info_count_query_callback, &count);
-	int result_count = convert_str_to_int(count, "Query to get count from cap_info returned an invalid value");
-	free(count);
-	return result_count;
+	if (lib == NULL) {
+		return snapshot_cursor_prepare(db, cursor,
+		    "SELECT " CAP_COLUMNS " FROM " CAP_FROM " WHERE c.snapshot_id = ?1;", 6);
+	}
+	const char *query = lib_is_basename(db, lib) ?
+	    "SELECT " CAP_COLUMNS " FROM " CAP_FROM " WHERE c.snapshot_id = ?1 AND " CAP_LIB_BASENAME_FILTER ";" :
+	    "SELECT " CAP_COLUMNS " FROM " CAP_FROM " WHERE c.snapshot_id = ?1 AND " CAP_LIB_PATH_FILTER ";";
+	if (snapshot_cursor_prepare(db, cursor, query, 6) != 0) {
+		return (1);
+	}
+	sqlite3_bind_text(cursor->stmt, 2, lib, -1, SQLITE_TRANSIENT);
+	return (0);
 }
 
-int sym_info_count(sqlite3 *db)
+/*
+ * cap_loc_cursor_open(db, cursor, snapshot_id)
+ * Opens a cursor over the capabilities of snapshot_id in the order of
+ * cap_loc_addr, read straight from the cap_info_snapshot_loc index without
+ * sorting. The addresses are ordered as the signed integers they are stored
+ * as.
+ */
+int cap_loc_cursor_open(sqlite3 *db, db_cursor *cursor, int64_t snapshot_id)
+{
+	assert_db_table_exists(db, "cap_info");
+
+	return snapshot_id_cursor_prepare(db, cursor, "SELECT " CAP_COLUMNS " FROM " CAP_FROM " "
+	    "WHERE c.snapshot_id = ?1 ORDER BY c.cap_loc_addr;", 6, snapshot_id);
+}
+
+/*
+ * cap_cursor_next(cursor, cap)
+ * Reads the next capability into cap. Returns 1 if there was one, 0 at the
+ * end and -1 on error.
+ */
+int cap_cursor_next(db_cursor *cursor, cap_info *cap)
+{
+	int rc = cursor_step(cursor);
+	if (rc == 1) {
+		sqlite3_stmt *stmt = cursor->stmt;
+		cap->cap_loc_addr = column_u64(stmt, 0);
+		cap->cap_loc_path = column_str(stmt, 1);
+		cap->cap_addr = column_u64(stmt, 2);
+		cap->perms = (uint32_t)sqlite3_column_int64(stmt, 3);
+		cap->base = column_u64(stmt, 4);
+		cap->top = column_u64(stmt, 5);
+	}
+	return rc;
+}
+
+/*
+ * sym_cursor_open(db, cursor)
+ * Opens a cursor over the symbols of the ELF files of the snapshot, at the
+ * addresses they are loaded at.
+ */
+int sym_cursor_open(sqlite3 *db, db_cursor *cursor)
 {
 	assert_db_table_exists(db, "elf_sym");
 
-        /* Obtain how many vm items from the database first, we can then use it to
-         * determine the size of the struct array for holding all the vm entries */
-        char *count;
-	sql_query_exec(db, "SELECT COUNT(*) FROM elf_sym;", info_count_query_callback, &count);
-	int result_count = convert_str_to_int(count, "Query to get count from elf_sym returned an invalid value");
-	free(count);
-	return result_count;
+	return snapshot_cursor_prepare(db, cursor,
+	    "SELECT p.path, e.st_name, e.st_value, e.st_shndx, e.type, e.bind, s.base_addr + e.addr, "
+	    "e.st_size FROM snapshot_elf s JOIN elf_sym e ON e.elf_id = s.elf_id "
+	    "CROSS JOIN paths p ON p.path_id = e.source_path_id WHERE s.snapshot_id = ?1;", 8);
 }
 
-int comp_info_count(sqlite3 *db)
+/*
+ * sym_cursor_next(cursor, sym)
+ * Reads the next symbol into sym. Returns 1 if there was one, 0 at the end
+ * and -1 on error.
+ */
+int sym_cursor_next(db_cursor *cursor, sym_info *sym)
+{
+	int rc = cursor_step(cursor);
+	if (rc == 1) {
+		sqlite3_stmt *stmt = cursor->stmt;
+		sym->source_path = column_str(stmt, 0);
+		sym->sym_name = column_str(stmt, 1);
+		sym->sym_offset = column_u64(stmt, 2);
+		sym->shndx = column_str(stmt, 3);
+		sym->type = column_str(stmt, 4);
+		sym->bind = column_str(stmt, 5);
+		sym->addr = column_u64(stmt, 6);
+		sym->size = column_u64(stmt, 7);
+	}
+	return rc;
+}
+
+/*
+ * comp_cursor_open_snapshot(db, cursor, snapshot_id)
+ * Opens a cursor over the compartments of snapshot_id.
+ */
+static int comp_cursor_open_snapshot(sqlite3 *db, db_cursor *cursor, int64_t snapshot_id)
 {
 	assert_db_table_exists(db, "comparts");
 
-        /* Obtain how many vm items from the database first, we can then use it to
-         * determine the size of the struct array for holding all the vm entries */
-        char *count;
-	sql_query_exec(db, "SELECT COUNT(*) FROM comparts;", info_count_query_callback, &count);
-	int result_count = convert_str_to_int(count, "Query to get count from comparts returned an invalid value");
-	free(count);
-	return result_count;
+	return snapshot_id_cursor_prepare(db, cursor,
+	    "SELECT compart_id, compart_name, library_path, start_addr, end_addr, is_default, parent_id "
+	    "FROM comparts WHERE snapshot_id = ?1;", 7, snapshot_id);
 }
 
-int cap_info_for_lib_count(sqlite3 *db, char *lib)
-{      
+/*
+ * comp_cursor_open(db, cursor)
+ * Opens a cursor over the compartments of the snapshot.
+ */
+int comp_cursor_open(sqlite3 *db, db_cursor *cursor)
+{
+	return comp_cursor_open_snapshot(db, cursor, get_snapshot_id(db));
+}
+
+/*
+ * comp_cursor_next(cursor, comp)
+ * Reads the next compartment into comp. Returns 1 if there was one, 0 at the
+ * end and -1 on error.
+ */
+int comp_cursor_next(db_cursor *cursor, comp_info *comp)
+{
+	int rc = cursor_step(cursor);
+	if (rc == 1) {
+		sqlite3_stmt *stmt = cursor->stmt;
+		comp->compart_id = sqlite3_column_int(stmt, 0);
+		comp->compart_name = column_str(stmt, 1);
+		comp->library_path = column_str(stmt, 2);
+		comp->start_addr = column_u64(stmt, 3);
+		comp->end_addr = column_u64(stmt, 4);
+		comp->is_default = sqlite3_column_int(stmt, 5);
+		comp->parent_id = sqlite3_column_int(stmt, 6);
+	}
+	return rc;
+}
+
+/*
+ * vm_cap_stats_cursor_open(db, cursor)
+ * Opens a cursor over the vm entries, in the same order as vm_cursor_open,
+ * together with the capabilities stored in each of them. They are counted
+ * with a single range join, using the index on cap_info(snapshot_id,
+ * cap_loc_addr, perms). A vm entry covers [start_addr, end_addr).
+ */
+int vm_cap_stats_cursor_open(sqlite3 *db, db_cursor *cursor)
+{
+	assert_db_table_exists(db, "vm");
 	assert_db_table_exists(db, "cap_info");
 
-        /* Obtain how many vm items from the database first, we can then use it to
-         * determine the size of the struct array for holding all the vm entries */
-        char *count;
+	// perms & 7 keeps CAP_PERM_LOAD, CAP_PERM_STORE and CAP_PERM_EXECUTE
+	const char *vm_cap_stats_q =
+		"SELECT " VM_COLUMNS ", COUNT(c.perms), "
+		"SUM((c.perms & 7) = 1), "
+		"SUM((c.perms & 7) = 3), "
+		"SUM((c.perms & 7) = 5), "
+		"SUM((c.perms & 7) = 7) "
+		"FROM " VM_FROM " LEFT JOIN cap_info c ON c.snapshot_id = v.snapshot_id "
+		"AND c.cap_loc_addr >= v.start_addr AND c.cap_loc_addr < v.end_addr "
+		"WHERE v.snapshot_id = ?1 "
+		"GROUP BY v.rowid ORDER BY v.rowid;";
+
+	return snapshot_cursor_prepare(db, cursor, vm_cap_stats_q, 16);
+}
 
-	char *query;
-	asprintf(&query, "SELECT COUNT(*) FROM cap_info WHERE cap_loc_path LIKE \"%%%s%%\";", lib);
-        sql_query_exec(db, query, info_count_query_callback, &count);
-	int result_count = convert_str_to_int(count, "Query to get count from cap_info returned an invalid value");
-        free(query);
-	free(count);
-        return result_count;
+static void read_cap_stats(sqlite3_stmt *stmt, int col, vm_cap_stats *stats)
+{
+	stats->total = sqlite3_column_int(stmt, col++);
+	stats->ro = sqlite3_column_int(stmt, col++);
+	stats->rw = sqlite3_column_int(stmt, col++);
+	stats->rx = sqlite3_column_int(stmt, col++);
+	stats->rwx = sqlite3_column_int(stmt, col++);
 }
 
-int get_all_vm_info(sqlite3 *db, vm_info **all_vm_info_ptr)
+/*
+ * vm_cap_stats_cursor_next(cursor, vm, stats)
+ * Reads the next vm entry into vm and its capability counts into stats.
+ * Returns 1 if there was one, 0 at the end and -1 on error.
+ */
+int vm_cap_stats_cursor_next(db_cursor *cursor, vm_info *vm, vm_cap_stats *stats)
 {
-	assert_db_table_exists(db, "vm");
+	int rc = cursor_step(cursor);
+	if (rc == 1) {
+		read_vm_row(cursor->stmt, 0, vm);
+		read_cap_stats(cursor->stmt, 11, stats);
+	}
+	return rc;
+}
 
-	int vm_count = vm_info_count(db);
-        *all_vm_info_ptr = (vm_info *)calloc(vm_count, sizeof(vm_info));
-        assert (*all_vm_info_ptr != NULL);
-        
-        int rc = sql_query_exec(db, "SELECT * FROM vm;", vm_info_query_callback, all_vm_info_ptr);
+/*
+ * compart_pair_cursor_open(db, cursor)
+ * Opens a cursor over the capability counts of every pair of source and
+ * destination compartments of the snapshot in cap_compart, ordered by source
+ * then destination.
+ */
+int compart_pair_cursor_open(sqlite3 *db, db_cursor *cursor)
+{
+	assert_db_table_exists(db, "cap_compart");
+	assert_db_table_exists(db, "comparts");
 
-	// reset all_vm_info_index
-	all_vm_info_index = 0;
+	const char *pair_stats_q =
+		"SELECT m.src_compart_id, m.dest_compart_id, "
+		"(SELECT compart_name FROM comparts WHERE snapshot_id = ?1 AND compart_id = m.src_compart_id "
+		"AND compart_name IS NOT NULL LIMIT 1), "
+		"(SELECT compart_name FROM comparts WHERE snapshot_id = ?1 AND compart_id = m.dest_compart_id "
+		"AND compart_name IS NOT NULL LIMIT 1), "
+		"COUNT(*), "
+		"SUM((c.perms & 7) = 1), "
+		"SUM((c.perms & 7) = 3), "
+		"SUM((c.perms & 7) = 5), "
+		"SUM((c.perms & 7) = 7) "
+		"FROM cap_compart m JOIN cap_info c ON c.rowid = m.cap_id "
+		"WHERE c.snapshot_id = ?1 "
+		"GROUP BY m.src_compart_id, m.dest_compart_id "
+		"ORDER BY m.src_compart_id, m.dest_compart_id;";
+
+	return snapshot_cursor_prepare(db, cursor, pair_stats_q, 9);
+}
 
-	if (rc == 0) {
-		return vm_count;
-	} else {
-		return -1;
+/*
+ * compart_pair_cursor_next(cursor, pair)
+ * Reads the counts of the next pair of compartments into pair, the names
+ * are NULL for addresses outside of any compartment. Returns 1 if there was
+ * one, 0 at the end and -1 on error.
+ */
+int compart_pair_cursor_next(db_cursor *cursor, compart_pair_stats *pair)
+{
+	int rc = cursor_step(cursor);
+	if (rc == 1) {
+		sqlite3_stmt *stmt = cursor->stmt;
+		pair->src_compart_id = sqlite3_column_int(stmt, 0);
+		pair->dest_compart_id = sqlite3_column_int(stmt, 1);
+		pair->src_compart_name = column_str(stmt, 2);
+		pair->dest_compart_name = column_str(stmt, 3);
+		read_cap_stats(stmt, 4, &pair->caps);
 	}
+	return rc;
 }
 
-int get_all_cap_info(sqlite3 *db, cap_info **all_cap_info_ptr)
+/*
+ * snapshot_cursor_open(db, cursor)
+ * Opens a cursor over the snapshots of db, with the number of vm entries and
+ * capabilities stored in each of them.
+ */
+int snapshot_cursor_open(sqlite3 *db, db_cursor *cursor)
 {
+	assert_db_table_exists(db, "snapshot");
+	assert_db_table_exists(db, "vm");
 	assert_db_table_exists(db, "cap_info");
 
-	int cap_count = cap_info_count(db);
-        *all_cap_info_ptr = (cap_info *)calloc(cap_count, sizeof(cap_info));
-        assert (*all_cap_info_ptr != NULL);
-        
-        int rc = sql_query_exec(db, "SELECT * FROM cap_info;", cap_info_query_callback, all_cap_info_ptr);
+	return cursor_open(db, cursor,
+	    "SELECT s.snapshot_id, s.pid, s.started, s.command, s.duration, "
+	    "(SELECT COUNT(*) FROM vm v WHERE v.snapshot_id = s.snapshot_id), "
+	    "(SELECT COUNT(*) FROM cap_info c WHERE c.snapshot_id = s.snapshot_id) "
+	    "FROM snapshot s ORDER BY s.snapshot_id;", 7);
+}
 
-	// reset the all_cap_info_index
-	all_cap_info_index = 0;
-	
-	if (rc == 0) {
-		return cap_count;
-	} else {
-		return -1;
+/*
+ * snapshot_cursor_next(cursor, snapshot)
+ * Reads the next snapshot into snapshot. Returns 1 if there was one, 0 at the
+ * end and -1 on error.
+ */
+int snapshot_cursor_next(db_cursor *cursor, snapshot_info *snapshot)
+{
+	int rc = cursor_step(cursor);
+	if (rc == 1) {
+		sqlite3_stmt *stmt = cursor->stmt;
+		snapshot->snapshot_id = sqlite3_column_int64(stmt, 0);
+		snapshot->pid = sqlite3_column_int64(stmt, 1);
+		snapshot->started = sqlite3_column_int64(stmt, 2);
+		snapshot->command = column_str(stmt, 3);
+		snapshot->duration = sqlite3_column_double(stmt, 4);
+		snapshot->vm_count = sqlite3_column_int(stmt, 5);
+		snapshot->cap_count = sqlite3_column_int(stmt, 6);
+	}
+	return rc;
+}
+
+/*
+ * snapshot_count(db, query, lib)
+ * Runs a COUNT query with ?1 bound to the snapshot of the views and ?2 to lib
+ * if it is not NULL.
+ */
+static int snapshot_count(sqlite3 *db, const char *query, const char *lib)
+{
+	sqlite3_stmt *stmt;
+	int result_count = 0;
+
+	if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	sqlite3_bind_int64(stmt, 1, get_snapshot_id(db));
+	if (lib != NULL) {
+		sqlite3_bind_text(stmt, 2, lib, -1, SQLITE_TRANSIENT);
 	}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		result_count = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return result_count;
+}
+
+int vm_info_count(sqlite3 *db) 
+{
+	assert_db_table_exists(db, "vm");
+
+	int result_count = snapshot_count(db, "SELECT COUNT(*) FROM vm WHERE snapshot_id = ?1;", NULL);
+	debug_print(INFO, "vm_info_count_query returned %d\n", result_count);
+	return result_count;
+}
+
+int cap_info_count(sqlite3 *db)
+{
+	assert_db_table_exists(db, "cap_info");
+
+	return snapshot_count(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = ?1;", NULL);
 }
 
-int get_all_sym_info(sqlite3 *db, sym_info **all_sym_info_ptr)
+int sym_info_count(sqlite3 *db)
 {
 	assert_db_table_exists(db, "elf_sym");
 
-	int sym_count = sym_info_count(db);
-        *all_sym_info_ptr = (sym_info *)calloc(sym_count, sizeof(sym_info));
-        assert (*all_sym_info_ptr != NULL);
-        
-        int rc = sql_query_exec(db, "SELECT * FROM elf_sym;", sym_info_query_callback, all_sym_info_ptr);
-	
-	// reset all_sym_info_index
-	all_sym_info_index = 0;
+	// Same symbols as sym_cursor_open
+	return snapshot_count(db, "SELECT COUNT(*) FROM snapshot_elf s JOIN elf_sym e ON e.elf_id = s.elf_id "
+	    "WHERE s.snapshot_id = ?1;", NULL);
+}
 
-	if (rc == 0) {
-		return sym_count;
-	} else {
+int comp_info_count(sqlite3 *db)
+{
+	assert_db_table_exists(db, "comparts");
+
+	return snapshot_count(db, "SELECT COUNT(*) FROM comparts WHERE snapshot_id = ?1;", NULL);
+}
+
+int cap_info_for_lib_count(sqlite3 *db, char *lib)
+{      
+	assert_db_table_exists(db, "cap_info");
+
+	// Same filter as cap_cursor_open
+	return snapshot_count(db, lib_is_basename(db, lib) ?
+	    "SELECT COUNT(*) FROM cap_info c WHERE c.snapshot_id = ?1 AND " CAP_LIB_BASENAME_FILTER ";" :
+	    "SELECT COUNT(*) FROM cap_info c WHERE c.snapshot_id = ?1 AND " CAP_LIB_PATH_FILTER ";", lib);
+}
+
+/*
+ * grow_array
+ * Makes room for one more element of size elem_size at index count of the
+ * array, doubling its capacity when it is full.
+ */
+static void *grow_array(void *array, int count, int *capacity, size_t elem_size)
+{
+	if (count < *capacity) {
+		return array;
+	}
+	*capacity = *capacity == 0 ? 64 : *capacity * 2;
+	array = realloc(array, *capacity * elem_size);
+	assert(array != NULL);
+	return array;
+}
+
+/*
+ * get_all_vm_info(db, strings, all_vm_info)
+ * Copies all the vm entries into an array, the strings of each entry are
+ * interned into strings and live as long as its arena, the array is owned
+ * by the caller. Prefer vm_cursor_open to step through them without
+ * loading them all. Returns the number of entries, or -1 on error.
+ */
+int get_all_vm_info(sqlite3 *db, str_table *strings, vm_info **all_vm_info_ptr)
+{
+	db_cursor cursor;
+	vm_info vm;
+	int count = 0, capacity = 0, rc;
+
+	*all_vm_info_ptr = NULL;
+	if (vm_cursor_open(db, &cursor) != 0) {
 		return -1;
 	}
+	while ((rc = vm_cursor_next(&cursor, &vm)) == 1) {
+		*all_vm_info_ptr = grow_array(*all_vm_info_ptr, count, &capacity, sizeof(vm_info));
+		vm.mmap_path = str_intern(strings, vm.mmap_path);
+		(*all_vm_info_ptr)[count++] = vm;
+	}
+	db_cursor_close(&cursor);
+	return rc == 0 ? count : -1;
 }
 
-int get_all_comp_info(sqlite3 *db, comp_info **all_comp_info_ptr)
+/*
+ * get_all_cap_info(db, strings, all_cap_info)
+ * Copies all the capabilities into an array, see get_all_vm_info.
+ */
+int get_all_cap_info(sqlite3 *db, str_table *strings, cap_info **all_cap_info_ptr)
 {
-	assert_db_table_exists(db, "comparts");
+	db_cursor cursor;
+	cap_info cap;
+	int count = 0, capacity = 0, rc;
 
-	int comp_count = comp_info_count(db);
-        *all_comp_info_ptr = (comp_info *)calloc(comp_count, sizeof(comp_info));
-        assert (*all_comp_info_ptr != NULL);
-        
-        int rc = sql_query_exec(db, "SELECT * FROM comparts;", comp_info_query_callback, all_comp_info_ptr);
-	
-	// reset all_comp_info_index
-	all_comp_info_index = 0;
+	*all_cap_info_ptr = NULL;
+	if (cap_cursor_open(db, &cursor, NULL) != 0) {
+		return -1;
+	}
+	while ((rc = cap_cursor_next(&cursor, &cap)) == 1) {
+		*all_cap_info_ptr = grow_array(*all_cap_info_ptr, count, &capacity, sizeof(cap_info));
+		cap.cap_loc_path = str_intern(strings, cap.cap_loc_path);
+		(*all_cap_info_ptr)[count++] = cap;
+	}
+	db_cursor_close(&cursor);
+	return rc == 0 ? count : -1;
+}
 
-	if (rc == 0) {
-		return comp_count;
-	} else {
+/*
+ * get_all_sym_info(db, strings, all_sym_info)
+ * Copies all the symbols into an array, see get_all_vm_info. Their paths,
+ * section indexes, types and binds take a handful of values, which are
+ * stored once.
+ */
+int get_all_sym_info(sqlite3 *db, str_table *strings, sym_info **all_sym_info_ptr)
+{
+	db_cursor cursor;
+	sym_info sym;
+	int count = 0, capacity = 0, rc;
+
+	*all_sym_info_ptr = NULL;
+	if (sym_cursor_open(db, &cursor) != 0) {
 		return -1;
 	}
+	while ((rc = sym_cursor_next(&cursor, &sym)) == 1) {
+		*all_sym_info_ptr = grow_array(*all_sym_info_ptr, count, &capacity, sizeof(sym_info));
+		sym.source_path = str_intern(strings, sym.source_path);
+		sym.sym_name = str_intern(strings, sym.sym_name);
+		sym.shndx = str_intern(strings, sym.shndx);
+		sym.type = str_intern(strings, sym.type);
+		sym.bind = str_intern(strings, sym.bind);
+		(*all_sym_info_ptr)[count++] = sym;
+	}
+	db_cursor_close(&cursor);
+	return rc == 0 ? count : -1;
 }
 
-int get_cap_info_for_lib(sqlite3 *db, cap_info **cap_info_captured_ptr, char *lib)
+/*
+ * get_snapshot_comp_info(db, snapshot_id, strings, all_comp_info)
+ * Copies all the compartments of snapshot_id into an array, see
+ * get_all_vm_info.
+ */
+int get_snapshot_comp_info(sqlite3 *db, int64_t snapshot_id, str_table *strings, comp_info **all_comp_info_ptr)
 {
-	assert_db_table_exists(db, "cap_info");
+	db_cursor cursor;
+	comp_info comp;
+	int count = 0, capacity = 0, rc;
 
-	int cap_count = cap_info_for_lib_count(db, lib);
-	*cap_info_captured_ptr = (cap_info *)calloc(cap_count, sizeof(cap_info));
-	assert (*cap_info_captured_ptr != NULL);
+	*all_comp_info_ptr = NULL;
+	if (comp_cursor_open_snapshot(db, &cursor, snapshot_id) != 0) {
+		return -1;
+	}
+	while ((rc = comp_cursor_next(&cursor, &comp)) == 1) {
+		*all_comp_info_ptr = grow_array(*all_comp_info_ptr, count, &capacity, sizeof(comp_info));
+		comp.compart_name = str_intern(strings, comp.compart_name);
+		comp.library_path = str_intern(strings, comp.library_path);
+		(*all_comp_info_ptr)[count++] = comp;
+	}
+	db_cursor_close(&cursor);
+	return rc == 0 ? count : -1;
+}
 
-	char *query;
-	asprintf(&query, "SELECT * FROM cap_info WHERE cap_loc_path LIKE \"%%%s%%\";", lib);
-	int rc = sql_query_exec(db, query, cap_info_query_callback, cap_info_captured_ptr);
+/*
+ * get_all_comp_info(db, strings, all_comp_info)
+ * Copies all the compartments of the snapshot into an array.
+ */
+int get_all_comp_info(sqlite3 *db, str_table *strings, comp_info **all_comp_info_ptr)
+{
+	return get_snapshot_comp_info(db, get_snapshot_id(db), strings, all_comp_info_ptr);
+}
 
-	free(query);
-	// reset all_cap_info_index
-	all_cap_info_index = 0;
+/*
+ * get_all_vm_cap_stats(db, all_vm_cap_stats)
+ * Copies the capability counts of every vm entry into an array, in the same
+ * order as get_all_vm_info. See vm_cap_stats_cursor_open.
+ * Returns the number of vm entries, or -1 on error.
+ */
+int get_all_vm_cap_stats(sqlite3 *db, vm_cap_stats **all_vm_cap_stats_ptr)
+{
+	db_cursor cursor;
+	vm_info vm;
+	vm_cap_stats stats;
+	int count = 0, capacity = 0, rc;
 
-	if (rc == 0) {
-		return cap_count;
-	} else {
+	*all_vm_cap_stats_ptr = NULL;
+	if (vm_cap_stats_cursor_open(db, &cursor) != 0) {
 		return -1;
 	}
+	while ((rc = vm_cap_stats_cursor_next(&cursor, &vm, &stats)) == 1) {
+		*all_vm_cap_stats_ptr = grow_array(*all_vm_cap_stats_ptr, count, &capacity, sizeof(vm_cap_stats));
+		(*all_vm_cap_stats_ptr)[count++] = stats;
+	}
+	db_cursor_close(&cursor);
+	return rc == 0 ? count : -1;
 }
 
 void db_info_capture_test()
@@ -633,49 +2427,61 @@ void db_info_capture_test()
 	printf("sym_info_count obtained: %d\n", sym_info_count(db));
 	printf("comp_info_count obtained: %d\n", comp_info_count(db));
 
+	arena strings_arena;
+	str_table strings;
+	arena_init(&strings_arena, 0);
+	str_table_init(&strings, &strings_arena);
+
 	vm_info *vm_info_captured;
-	int vm_count = get_all_vm_info(db, &vm_info_captured);
+	int vm_count = get_all_vm_info(db, &strings, &vm_info_captured);
 	assert(vm_count != -1);
 
 	for (int i=0; i<vm_count; i++) {
 		printf("vm_info_captured[%d]:\n", i); 
-		printf("     %s\n", vm_info_captured[i].start_addr);
-		printf("     %s\n", vm_info_captured[i].end_addr);
+		printf("     0x%lx\n", vm_info_captured[i].start_addr);
+		printf("     0x%lx\n", vm_info_captured[i].end_addr);
 		printf("     %s\n", vm_info_captured[i].mmap_path);
 		printf("     %d\n", vm_info_captured[i].kve_protection);
 	}
 	
 	cap_info *cap_info_captured;
-	int cap_count = get_all_cap_info(db, &cap_info_captured);
+	int cap_count = get_all_cap_info(db, &strings, &cap_info_captured);
 	assert(cap_count != -1);
 
 	for (int i=0; i<10; i++) {
 		printf("cap_info_captured[%d]:\n", i); 
-		printf("     %s\n", cap_info_captured[i].cap_loc_addr);
+		printf("     0x%lx\n", cap_info_captured[i].cap_loc_addr);
 		printf("     %s\n", cap_info_captured[i].cap_loc_path);
-		printf("     %s\n", cap_info_captured[i].cap_addr);
+		printf("     0x%lx\n", cap_info_captured[i].cap_addr);
 	}
 	
 	sym_info *sym_info_captured;
-	int sym_count = get_all_sym_info(db, &sym_info_captured);
+	int sym_count = get_all_sym_info(db, &strings, &sym_info_captured);
 	assert(sym_count != -1);
 
 	for (int i=0; i<10; i++) {
 		printf("sym_info_captured[%d]:\n", i); 
 		printf("     %s\n", sym_info_captured[i].source_path);
 		printf("     %s\n", sym_info_captured[i].sym_name);
-		printf("     %s\n", sym_info_captured[i].addr);
+		printf("     0x%lx\n", sym_info_captured[i].addr);
 	}
 
 	comp_info *comp_info_captured;
-	int comp_count = get_all_comp_info(db, &comp_info_captured);
+	int comp_count = get_all_comp_info(db, &strings, &comp_info_captured);
 	assert(comp_count != -1);
 
 	for (int i=0; i<5; i++) {
 		printf("comp_info_captured[%d]:\n", i); 
 		printf("     %d\n", comp_info_captured[i].compart_id);
 		printf("     %s\n", comp_info_captured[i].compart_name);
-		printf("     %s\n", comp_info_captured[i].start_addr);
+		printf("     0x%lx\n", comp_info_captured[i].start_addr);
 	}
+
+	free(vm_info_captured);
+	free(cap_info_captured);
+	free(sym_info_captured);
+	free(comp_info_captured);
+	str_table_free(&strings);
+	arena_free(&strings_arena);
 }
 
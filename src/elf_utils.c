@@ -42,7 +42,11 @@
 #include <link.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
+#include <sys/param.h>
+#include <sys/stat.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <sys/time.h>
@@ -50,6 +54,7 @@
 #include "common.h"
 #include "db_process.h"
 #include "elf_utils.h"
+#include "run_stats.h"
 
 static const char *
 st_bind(unsigned int sbind)
@@ -125,174 +130,460 @@ st_shndx(unsigned int shndx)
 	}
 }
 
-Elf *read_elf(char *path) {
+static void init_elf_library(void)
+{
 	if (elf_version(EV_CURRENT) == EV_NONE) {
-		fprintf(stderr, "ELF library initialisation failed %s\n", elf_errmsg(-1));
-		exit(1);
+		errx(1, "ELF library initialisation failed %s", elf_errmsg(-1));
 	}
-		
-	int fd;
-	if ((fd = open(path, O_RDONLY, 0)) < 0) {
+}
+
+/*
+ * open_elf(path, fd)
+ * Opens the ELF file path. It is mapped rather than read into memory, so only
+ * the headers and the sections that are looked at are paged in, not the debug
+ * info of large binaries. The descriptor of the file is returned in fd, both
+ * are released by close_elf. Returns NULL if the file cannot be read. The
+ * library must have been initialised, this can be called from any thread.
+ */
+static Elf *open_elf(const char *path, int *fd)
+{
+	if ((*fd = open(path, O_RDONLY | O_CLOEXEC, 0)) < 0) {
 		fprintf(stderr, "Error getting the ELF file from %s\n", path);
-		exit(1);
+		return NULL;
 	}
-			
+
 	Elf *elfFile;
 
-	if ((elfFile = elf_begin(fd, ELF_C_READ, NULL)) == NULL) {
-		fprintf(stderr, "Error reading ELF file %s\n", elf_errmsg(-1));
-		exit(1);
+	if ((elfFile = elf_begin(*fd, ELF_C_READ_MMAP, NULL)) == NULL) {
+		fprintf(stderr, "Error reading ELF file %s: %s\n", path, elf_errmsg(-1));
+		close(*fd);
+		*fd = -1;
+		return NULL;
 	}
-				
+
 	return elfFile;
 }
 
-void get_elf_info(sqlite3 *db, Elf *elfFile, char *source, u_long source_base, special_sections **ssect, int ssect_index) 
+/*
+ * read_elf(path, fd)
+ * Opens the ELF file path as open_elf does.
+ */
+Elf *read_elf(const char *path, int *fd)
 {
-	debug_print(TROUBLESHOOT, "Key Stage: Create database and tables to store symbols obtained from ELF of the loaded binaries\n", NULL);
-	create_elf_sym_db(db);
+	init_elf_library();
+	return open_elf(path, fd);
+}
+
+void close_elf(Elf *elfFile, int fd)
+{
+	elf_end(elfFile);
+	close(fd);
+}
+
+/*
+ * find_sections(elfFile, shstrndx, file, symtabs)
+ * Goes through the section headers only, for the symbol tables, by type, and
+ * .plt and .got, the loaded PROGBITS sections whose names are compared. It
+ * stops as soon as all four are found. symtabs[0] is set to .dynsym and
+ * symtabs[1] to .symtab, NULL if the file does not have it.
+ */
+static void find_sections(Elf *elfFile, size_t shstrndx, elf_file_info *file, Elf_Scn **symtabs)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	bool seen_plt = 0, seen_got = 0;
+	const char *section_name;
+
+	symtabs[0] = symtabs[1] = NULL;
+	while ((scn = elf_nextscn(elfFile, scn)) != NULL) {
+		if (gelf_getshdr(scn, &shdr) == NULL) {
+			continue;
+		}
+
+		switch (shdr.sh_type) {
+		case SHT_DYNSYM:
+			symtabs[0] = scn;
+			break;
+		case SHT_SYMTAB:
+			symtabs[1] = scn;
+			break;
+		case SHT_PROGBITS:
+			if ((shdr.sh_flags & SHF_ALLOC) == 0 || (seen_plt && seen_got)) {
+				break;
+			}
+			if ((section_name = elf_strptr(elfFile, shstrndx, shdr.sh_name)) == NULL) {
+				fprintf(stderr, "elf_strptr() failed: %s\n", elf_errmsg(-1));
+				break;
+			}
+			if (!seen_plt && strcmp(section_name, ".plt") == 0) {
+				file->plt_addr = shdr.sh_addr;
+				file->plt_size = shdr.sh_size;
+				seen_plt = 1;
+			} else if (!seen_got && strcmp(section_name, ".got") == 0) {
+				file->got_addr = shdr.sh_addr;
+				file->got_size = shdr.sh_size;
+				seen_got = 1;
+			}
+			break;
+		}
 
+		if (symtabs[0] != NULL && symtabs[1] != NULL && seen_plt && seen_got) {
+			break;
+		}
+	}
+}
+
+/* A symbol of a symbol table, its name points into the mapped file */
+typedef struct elf_parsed_sym {
+	const char *name;
+	GElf_Sym sym;
+} elf_parsed_sym;
+
+/*
+ * The symbols of an ELF file read by parse_elf, to be stored by
+ * store_symbols. The names point into the mapping of the file, which is kept
+ * until the symbols are stored.
+ */
+typedef struct elf_parsed {
+	elf_file_info *file;
+	Elf *elfFile;
+	int fd;
 	GElf_Ehdr ehdr;
+	elf_parsed_sym *syms;
+	size_t count;
+	size_t capacity;
+} elf_parsed;
+
+/*
+ * collect_symbols(parsed, scn)
+ * Appends the symbols of the symbol table scn to parsed.
+ */
+static void collect_symbols(elf_parsed *parsed, Elf_Scn *scn)
+{
 	GElf_Shdr shdr;
 	GElf_Sym sym;
 	Elf_Data *data;
-	Elf_Scn *scn;
 	const char *symname;
-	Elf_Word strscnidx;
-	size_t shstrndx;
 
-	if (gelf_getehdr(elfFile, &ehdr) == NULL) {
-		fprintf(stderr, "Can't read ELF header for %s\n", source);
-		elf_end(elfFile);
+	if (gelf_getshdr(scn, &shdr) == NULL || shdr.sh_entsize == 0) {
 		return;
 	}
+	data = elf_getdata(scn, NULL);
+	assert(data != NULL);
+
+	size_t nsyms = shdr.sh_size / shdr.sh_entsize;
+	if (parsed->count + nsyms > parsed->capacity) {
+		parsed->capacity = parsed->count + nsyms;
+		parsed->syms = realloc(parsed->syms, parsed->capacity * sizeof(elf_parsed_sym));
+		if (parsed->syms == NULL) {
+			errx(1, "Cannot allocate the symbols of %s", parsed->file->source_path);
+		}
+	}
 
-	if (elf_getshdrstrndx(elfFile, &shstrndx) != 0) {
+	for (size_t i=0; i<nsyms && gelf_getsym(data, i, &sym) != NULL; i++) {
+		symname = elf_strptr(parsed->elfFile, shdr.sh_link, sym.st_name);
+		if (symname == NULL) {
+			continue;
+		}
+		parsed->syms[parsed->count].name = symname;
+		parsed->syms[parsed->count].sym = sym;
+		parsed->count++;
+	}
+}
+
+/*
+ * parse_elf(parsed)
+ * Reads the special sections and the symbols of parsed->elfFile, without
+ * touching the database, so that files can be parsed by several threads.
+ * Returns 0 on success.
+ */
+static int parse_elf(elf_parsed *parsed)
+{
+	size_t shstrndx;
+	Elf_Scn *symtabs[2];
+
+	if (gelf_getehdr(parsed->elfFile, &parsed->ehdr) == NULL) {
+		fprintf(stderr, "Can't read ELF header for %s\n", parsed->file->source_path);
+		return (1);
+	}
+
+	if (elf_getshdrstrndx(parsed->elfFile, &shstrndx) != 0) {
 		fprintf(stderr, "elf_getshdrstrndx() failed: %s\n", elf_errmsg(-1));
-		elf_end(elfFile);
-		return;
+		return (1);
 	}
 
-	scn = NULL;
-	bool seen_dynsym=0, seen_symtab=0;
+	find_sections(parsed->elfFile, shstrndx, parsed->file, symtabs);
+	for (int i=0; i<2; i++) {
+		if (symtabs[i] != NULL) {
+			collect_symbols(parsed, symtabs[i]);
+		}
+	}
+	return (0);
+}
 
-	char *insert_syms_query_values;
-	int query_values_index=0;
+/*
+ * store_symbols(db, parsed)
+ * Inserts the symbols of parsed into elf_sym under parsed->file->elf_id,
+ * through a prepared statement. They are written in a transaction of their
+ * own unless one is open already, as it is when a snapshot is taken.
+ */
+static int store_symbols(sqlite3 *db, elf_parsed *parsed)
+{
+	const elf_file_info *file = parsed->file;
+	sym_writer writer;
+	char shndx[32];
+	int rc = 0;
 
-	special_sections **ssect_cast = (special_sections **)ssect;
+	if (sym_writer_open(db, &writer, file->elf_id) != 0) {
+		return (1);
+	}
 
-	while ((scn = elf_nextscn(elfFile, scn)) != NULL) {
-		gelf_getshdr(scn, &shdr);
+	int own_transaction = sqlite3_get_autocommit(db);
+	if (own_transaction) {
+		begin_transaction(db);
+	}
+
+	run_timer timer;
+	run_phase_begin(&timer, RUN_PHASE_SQL_INSERT);
+	for (size_t i=0; i<parsed->count && rc == 0; i++) {
+		const GElf_Sym *sym = &parsed->syms[i].sym;
+
+		// Store the address of the symbol relative to the base of the file.
+		// For function symbols, Morello sets their LSB to indicate that those functions
+		// run in capability mode. Therefore we need to clear the bit before persisting 
+		// the symbol addresses.	
+		u_long offset = sym->st_value;
+		if (GELF_ST_TYPE(sym->st_info) == STT_FUNC) {
+			offset &= ~1;
+		}
+
+		snprintf(shndx, sizeof(shndx), "%3s", st_shndx(sym->st_shndx));
+		rc = sym_writer_insert(&writer, file->source_path, parsed->syms[i].name, sym->st_value, shndx,
+		    st_type(parsed->ehdr.e_machine, parsed->ehdr.e_ident[EI_OSABI], GELF_ST_TYPE(sym->st_info)),
+		    st_bind(GELF_ST_BIND(sym->st_info)), offset, sym->st_size);
+	}
+	run_phase_end(&timer);
+
+	if (own_transaction) {
+		commit_transaction(db);
+	}
+	sym_writer_close(&writer);
+	return rc;
+}
+
+static void free_parsed(elf_parsed *parsed)
+{
+	free(parsed->syms);
+	parsed->syms = NULL;
+	parsed->count = parsed->capacity = 0;
+}
+
+/*
+ * get_elf_info(db, elfFile, file)
+ * Parses the ELF file, stores its symbols under file->elf_id and fills in its
+ * special sections. The addresses are relative to the base the file is
+ * loaded at.
+ */
+void get_elf_info(sqlite3 *db, Elf *elfFile, elf_file_info *file)
+{
+	elf_parsed parsed;
+
+	memset(&parsed, 0, sizeof(elf_parsed));
+	parsed.file = file;
+	parsed.elfFile = elfFile;
+	if (parse_elf(&parsed) == 0 && store_symbols(db, &parsed) != 0) {
+		errx(1, "Unable to store the symbols of %s in db %s", file->source_path, get_dbname());
+	}
+	free_parsed(&parsed);
+}
+
+/*
+ * The files of load_elf_files that are not in the symbol cache, handed out
+ * to the parsing threads with an atomic counter.
+ */
+typedef struct elf_parse_batch {
+	elf_parsed *parsed;
+	int count;
+	atomic_int next;
+} elf_parse_batch;
+
+static void *parse_elf_main(void *arg)
+{
+	elf_parse_batch *batch = arg;
+	run_timer timer;
+	int p;
+
+	while ((p = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+		elf_parsed *parsed = &batch->parsed[p];
+		run_phase_begin(&timer, RUN_PHASE_ELF_PARSE);
+		parsed->elfFile = open_elf(parsed->file->source_path, &parsed->fd);
+		if (parsed->elfFile != NULL && parse_elf(parsed) != 0) {
+			free_parsed(parsed);
+			close_elf(parsed->elfFile, parsed->fd);
+			parsed->elfFile = NULL;
+		}
+		run_phase_end(&timer);
+	}
+	return NULL;
+}
+
+/*
+ * parse_elf_files(batch, workers)
+ * Parses the files of batch with up to workers threads, this one included.
+ * A file that cannot be opened or parsed is left with a NULL elfFile.
+ */
+static void parse_elf_files(elf_parse_batch *batch, int workers)
+{
+	init_elf_library();
+	atomic_init(&batch->next, 0);
+
+	int threads = MIN(workers, batch->count) - 1;
+	pthread_t *tids = NULL;
+	if (threads > 0 && (tids = calloc(threads, sizeof(pthread_t))) == NULL) {
+		threads = 0;
+	}
+	for (int t=0; t<threads; t++) {
+		if (pthread_create(&tids[t], NULL, parse_elf_main, batch) != 0) {
+			threads = t;
+			break;
+		}
+	}
+	parse_elf_main(batch);
+	for (int t=0; t<threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+	free(tids);
+}
+
+static int stat_elf_file(const char *path, elf_file_info *file)
+{
+	struct stat sb;
+
+	if (stat(path, &sb) != 0) {
+		return (1);
+	}
+
+	memset(file, 0, sizeof(elf_file_info));
+	file->source_path = path;
+	file->dev = sb.st_dev;
+	file->ino = sb.st_ino;
+	file->mtime = sb.st_mtime;
+	file->size = sb.st_size;
+	return (0);
+}
+
+/*
+ * load_elf_files(db, count, paths, bases, sections, workers)
+ * Adds the ELF files paths, loaded at bases, to the snapshot being taken and
+ * fills in the addresses of their special sections. Only the files that are
+ * not in the symbol cache yet are parsed: a file already seen by an earlier
+ * snapshot, of this process or another one, is shared whatever base it is
+ * loaded at. They are parsed by up to workers threads, while their symbols
+ * are all written to db by this one. A file that cannot be read is left out
+ * of the snapshot and of the cache, with no special sections, the others are
+ * still added. Returns the number of files parsed, -1 if one of them cannot
+ * be read.
+ */
+int load_elf_files(sqlite3 *db, int count, const char **paths, const u_long *bases,
+    special_sections *sections, int workers)
+{
+	elf_file_info *files = calloc(count, sizeof(elf_file_info));
+	elf_parse_batch batch;
+	int parsed_count = 0;
+	int failed = 0;
+
+	memset(&batch, 0, sizeof(elf_parse_batch));
+	batch.parsed = calloc(count, sizeof(elf_parsed));
+	if (count > 0 && (files == NULL || batch.parsed == NULL)) {
+		errx(1, "Cannot allocate the ELF files to load");
+	}
 
-		char *section_name;
-		if ((section_name = elf_strptr(elfFile, shstrndx, shdr.sh_name)) == NULL) {
-			fprintf(stderr, "elf_strptr() failed: %s\n", elf_errmsg(-1));
+	create_elf_sym_db(db);
+	for (int i=0; i<count; i++) {
+		if (stat_elf_file(paths[i], &files[i]) != 0) {
+			fprintf(stderr, "Error getting the ELF file from %s\n", paths[i]);
+			failed = 1;
+			continue;
 		}
+		if (elf_file_find(db, &files[i]) == 0) {
+			batch.parsed[batch.count++].file = &files[i];
+		}
+	}
 
-		special_sections ssect_captured;
-		/*
-		if (strcmp(section_name, ".bss") == 0) {
-			ssect_captured.bss_addr = shdr.sh_addr+source_base;
-			ssect_captured.bss_size = shdr.sh_size;
+	parse_elf_files(&batch, workers);
 
+	for (int p=0; p<batch.count; p++) {
+		elf_parsed *parsed = &batch.parsed[p];
+		if (parsed->elfFile == NULL) {
+			failed = 1;
+			continue;
 		}
-		*/
-                if (strcmp(section_name, ".plt") == 0) {
-                        ssect_captured.plt_addr = shdr.sh_addr+source_base;
-			ssect_captured.plt_size = shdr.sh_size;
-                }
-                if (strcmp(section_name, ".got") == 0) {
-                        ssect_captured.got_addr = shdr.sh_addr+source_base;
-			ssect_captured.got_size = shdr.sh_size;
-                }
-
-		ssect_captured.mmap_path = strdup(source);
-		(*ssect_cast)[ssect_index] = ssect_captured;
-
-		if (shdr.sh_type == SHT_DYNSYM || shdr.sh_type == SHT_SYMTAB) {
-			if (shdr.sh_type == SHT_DYNSYM) {
-				seen_dynsym = 1;
+		// Another path of the batch may be the same file
+		if (elf_file_find(db, parsed->file) == 0) {
+			elf_file_insert(db, parsed->file);
+			if (store_symbols(db, parsed) != 0) {
+				errx(1, "Unable to store the symbols of %s in db %s", parsed->file->source_path, get_dbname());
 			}
-			if (shdr.sh_type == SHT_SYMTAB) {
-				seen_symtab = 1;
+			if (elf_file_set_sections(db, parsed->file) != 0) {
+				errx(1, "Unable to store the sections of %s in db %s", parsed->file->source_path, get_dbname());
 			}
-			assert(scn != NULL);		
-			strscnidx = shdr.sh_link;
-			data = elf_getdata(scn, NULL);
-			assert(data != NULL);
-
-			for (int i=0; gelf_getsym(data, i, &sym) != NULL; i++) {
-				symname = elf_strptr(elfFile, strscnidx, sym.st_name);
-				if (symname == NULL) {
-					continue;
-				} else {
-					// Calculate and store the address of the symbol using the base and offset
-					// For function symbols, Morello sets their LSB to indicate that those functions
-					// run in capability mode. Therefore we need to clear the bit before persisting 
-					// the symbol addresses.	
-					u_long offset = sym.st_value;
-					if (GELF_ST_TYPE(sym.st_info) == STT_FUNC) {
-						offset &= ~1;
-					}
-
-					char* query_value;
-					asprintf(&query_value, 
-						"(\"%s\", \"%s\", \"0x%lx\", \"%3s\", \"%s\", \"%s\", \"0x%lx\")", 
-							source,
-							symname,
-							sym.st_value,
-							st_shndx(sym.st_shndx),
-							st_type(ehdr.e_machine, ehdr.e_ident[EI_OSABI], GELF_ST_TYPE(sym.st_info)),
-							st_bind(GELF_ST_BIND(sym.st_info)),
-							(source_base+offset));
-					if (query_values_index == 0) {
-						insert_syms_query_values = strdup(query_value);
-					} else {
-						char *temp;
-						asprintf(&temp, "%s,%s",
-							insert_syms_query_values,
-							query_value);
-						insert_syms_query_values = strdup(temp);
-						free(temp);
-					}
-					free(query_value);
-					query_values_index++;
-					
-					if ((i % 200) == 0) {
-						if (insert_syms_query_values != NULL) {
-							char query_hdr[] = "INSERT INTO elf_sym VALUES ";
-							char* query;
-							asprintf(&query, "%s%s;", query_hdr, insert_syms_query_values);
-
-							int db_rc = sql_query_exec(db, query, NULL, NULL);
-							debug_print(TROUBLESHOOT, "Key Stage: Inserted sym info to the database (rc=%d)\n", db_rc);
-
-							insert_syms_query_values = NULL;
-							query_values_index = 0;
-							free(query);
-						}
-					}
-
-				}
-			}	
+			parsed_count++;
 		}
-		if (seen_dynsym && seen_symtab) {
-			break;
+		free_parsed(parsed);
+		close_elf(parsed->elfFile, parsed->fd);
+	}
+
+	for (int i=0; i<count; i++) {
+		elf_file_info *file = &files[i];
+		// Left with no elf_id if it, or another path to the same file, failed
+		if (file->elf_id == 0) {
+			memset(&sections[i], 0, sizeof(special_sections));
+			failed = 1;
+			continue;
+		}
+		if (snapshot_elf_add(db, file->elf_id, bases[i]) != 0) {
+			errx(1, "Unable to add %s to the snapshot in db %s", paths[i], get_dbname());
 		}
+		sections[i].plt_addr = file->plt_size != 0 ? bases[i] + file->plt_addr : 0;
+		sections[i].plt_size = file->plt_size;
+		sections[i].got_addr = file->got_size != 0 ? bases[i] + file->got_addr : 0;
+		sections[i].got_size = file->got_size;
 	}
-	
-	if (insert_syms_query_values != NULL) {
-		char query_hdr[] = "INSERT INTO elf_sym VALUES ";
-		char* query;
-		asprintf(&query, "%s%s;", query_hdr, insert_syms_query_values);
 
-		int db_rc = sql_query_exec(db, query, NULL, NULL);
-		debug_print(TROUBLESHOOT, "Key Stage: Inserted sym info to the database (rc=%d)\n", db_rc);
+	free(batch.parsed);
+	free(files);
+	return failed ? -1 : parsed_count;
+}
 
-		free(insert_syms_query_values);
-		free(query);
-	}
-	elf_end(elfFile);
-	
+/*
+ * load_elf_file(db, path, base, sections)
+ * Adds the ELF file path, loaded at base, to the snapshot being taken, see
+ * load_elf_files. Returns 1 if the file was parsed, 0 if it was in the cache
+ * and -1 if it cannot be read.
+ */
+int load_elf_file(sqlite3 *db, const char *path, u_long base, special_sections *sections)
+{
+	return load_elf_files(db, 1, &path, &base, sections, 1);
 }
 
+/*
+ * ingest_elf_file(db, path, base, sections)
+ * Stores the symbols of the ELF file path mapped at base, when a raw snapshot
+ * is ingested, provided the file can be read on this host.
+ */
+int ingest_elf_file(sqlite3 *db, const char *path, uint64_t base, ingest_elf_sections *sections)
+{
+	if (access(path, R_OK) != 0) {
+		return -1;
+	}
+	special_sections ssect;
+	if (load_elf_file(db, path, base, &ssect) < 0) {
+		return -1;
+	}
+
+	sections->plt_addr = ssect.plt_addr;
+	sections->plt_size = ssect.plt_size;
+	sections->got_addr = ssect.got_addr;
+	sections->got_size = ssect.got_size;
+	return 0;
+}
@@ -54,12 +54,44 @@
 #include <cheri/cheric.h>
 
 #include "mem_scan.h"
+#include "arena.h"
 #include "common.h"
 #include "ptrace_utils.h"
 #include "db_process.h"
 #include "cap_capture.h"
 #include "elf_utils.h"
+#include "raw_snapshot.h"
 #include "rtld_linkmap_scan.h"
+#include "run_stats.h"
+#include "scan_delta.h"
+#include "scan_pool.h"
+#include "tag_scan.h"
+#include "target_log.h"
+
+/* Set by -I, see set_scan_mem_incremental */
+static int scan_incremental = 0;
+
+/* set_scan_mem_incremental
+ * With incremental set, scan_mem only writes the capabilities of the pages
+ * that have changed since the previous incremental scan into the same db.
+ */
+void set_scan_mem_incremental(int incremental)
+{
+	scan_incremental = incremental;
+}
+
+/* Set by -R, see set_scan_mem_record */
+static const char *scan_record_path = NULL;
+
+/* set_scan_mem_record
+ * With a record path set, scan_mem also records every read it makes from the
+ * target into the raw snapshot path, together with the vm map and rtld data,
+ * so that ingest can replay the scan without the target.
+ */
+void set_scan_mem_record(const char *path)
+{
+	scan_record_path = path;
+}
 
 /* _is_substring_of
  * an internal routine to check if s1 is a substring of s2
@@ -81,10 +113,209 @@ int _is_substring_of(char* s1, char* s2)
 	return -1;
 }
 
+/*
+ * The ELF files that have already been parsed, so that we don't duplicate data or
+ * scan unnecessarily. The special sections of seen_kivp[i] are in ssect[i].
+ */
+typedef struct seen_elf_files {
+	struct kinfo_vmentry *seen_kivp;
+	special_sections *ssect;
+	int count;
+	int capacity;
+} seen_elf_files;
+
+static int find_seen_elf(struct kinfo_vmentry *kivp, seen_elf_files *seen)
+{
+	for (int j=0; j<seen->count; j++) {
+		if (strcmp(seen->seen_kivp[j].kve_path, kivp->kve_path) == 0) {
+			return j;
+		}
+	}
+	return -1;
+}
+
+/*
+ * add_seen_elf
+ * Adds the ELF file mapped by kivp to the seen list, with its special sections
+ * left empty until it is loaded. Returns its index.
+ */
+static int add_seen_elf(struct kinfo_vmentry *kivp, seen_elf_files *seen)
+{
+	if (seen->count == seen->capacity) {
+		seen->capacity *= 2;
+		seen->seen_kivp = realloc(seen->seen_kivp, seen->capacity*sizeof(struct kinfo_vmentry));
+		seen->ssect = realloc(seen->ssect, seen->capacity*sizeof(special_sections));
+		if (!seen->seen_kivp || !seen->ssect) {
+			errx(1, "Out of memory, cannot grow the size of the kivp array any more, current size is: %d", seen->count);
+		}
+	}
+	seen->seen_kivp[seen->count] = *kivp;
+	memset(&seen->ssect[seen->count], 0, sizeof(special_sections));
+	seen->ssect[seen->count].mmap_path = seen->seen_kivp[seen->count].kve_path;
+
+	return seen->count++;
+}
+
+/*
+ * load_seen_elf_files
+ * Adds the ELF files of the seen list to the snapshot. They are parsed by the workers of the scan pool (see -j) if no earlier
+ * snapshot has the same file, whatever its base.
+ */
+static void load_seen_elf_files(sqlite3 *db, seen_elf_files *seen)
+{
+	int count = seen->count;
+	const char **paths = calloc(count, sizeof(char *));
+	u_long *bases = calloc(count, sizeof(u_long));
+	if (count > 0 && (!paths || !bases)) {
+		errx(1, "Cannot allocate the list of %d ELF files", count);
+	}
+
+	for (int i=0; i<count; i++) {
+		paths[i] = seen->seen_kivp[i].kve_path;
+		bases[i] = seen->seen_kivp[i].kve_start;
+	}
+	// The symbols of the files that cannot be read are left out
+	if (load_elf_files(db, count, paths, bases, seen->ssect, get_scan_pool_workers()) < 0) {
+		debug_print(INFO, "Some ELF files of the vm map cannot be read\n");
+	}
+
+	free(paths);
+	free(bases);
+}
+
+/*
+ * parse_elf_once
+ * Adds the ELF file mapped by kivp to the snapshot, unless it has been seen
+ * already. Returns the index of the file in the seen list.
+ */
+static int parse_elf_once(sqlite3 *db, struct kinfo_vmentry *kivp, seen_elf_files *seen)
+{
+	int index = find_seen_elf(kivp, seen);
+
+	if (index >= 0) {
+		return index;
+	}
+	index = add_seen_elf(kivp, seen);
+
+	// Parsed only if no earlier snapshot has the same file, whatever its base
+	if (load_elf_file(db, kivp->kve_path, kivp->kve_start, &seen->ssect[index]) < 0) {
+		debug_print(INFO, "The symbols of %s are left out\n", kivp->kve_path);
+	}
+
+	return index;
+}
+
+_Static_assert(RAW_KVME_TYPE_GUARD == KVME_TYPE_GUARD, "kve_type of guard entries");
+_Static_assert(RAW_KVME_FLAG_GROWS_DOWN == KVME_FLAG_GROWS_DOWN, "kve_flags of stacks");
+
+static void open_raw_snapshot(raw_writer *writer, const char *raw_path, int pid)
+{
+	raw_snapshot_header header = {
+		.page_size = TAG_SCAN_PAGE_SIZE,
+		.cap_size = CAP_DECODE_CAP_SIZE,
+		.machine = RAW_MACHINE_HOST,
+		.pid = pid,
+		.timestamp = time(NULL),
+	};
+	if (raw_writer_open(writer, raw_path, &header) != 0) {
+		errx(1, "Unable to create the raw snapshot %s", raw_path);
+	}
+}
+
+static void write_raw_vm_entries(raw_writer *writer, struct kinfo_vmentry *freep, u_int vmcnt)
+{
+	for (u_int i=0; i<vmcnt; i++) {
+		struct kinfo_vmentry *kivp = &freep[i];
+		raw_vm_entry vm = {
+			.start = kivp->kve_start,
+			.end = kivp->kve_end,
+			.reservation = kivp->kve_reservation,
+			.protection = kivp->kve_protection,
+			.flags = kivp->kve_flags,
+			.type = kivp->kve_type,
+			.path = kivp->kve_path,
+		};
+		raw_write_vm_entry(writer, &vm);
+	}
+}
+
+/*
+ * write_raw_rtld
+ * Writes the auxv of the target, its r_debug and the objects of the rtld
+ * linkmap found from it to the raw snapshot.
+ */
+static void write_raw_rtld(raw_writer *writer, struct procstat *psp, struct kinfo_proc *kipp,
+    struct r_debug *obtained_r_debug, compart_data_list *scanned_comparts)
+{
+	Elf_Auxinfo *auxv;
+	uint auxvcnt;
+	run_timer timer;
+
+	run_phase_begin(&timer, RUN_PHASE_PROCSTAT);
+	auxv = procstat_getauxv(psp, kipp, &auxvcnt);
+	run_phase_end(&timer);
+	if (auxv != NULL) {
+		raw_write_record(writer, RAW_REC_AUXV, auxv, auxvcnt*sizeof(Elf_Auxinfo));
+		procstat_freeauxv(psp, auxv);
+	}
+
+	raw_write_record(writer, RAW_REC_R_DEBUG, obtained_r_debug, sizeof(*obtained_r_debug));
+
+	for (compart_data_list *head = scanned_comparts; head != NULL; head = head->next) {
+		raw_linkmap_obj obj = {
+			.compart_id = head->data.id,
+			.start = head->data.start_addr,
+			.end = head->data.end_addr,
+			.path = head->data.path,
+		};
+		raw_write_linkmap_obj(writer, &obj);
+	}
+}
+
+/* write_raw_comparts
+ * Writes the compartments of the snapshot of db to the raw snapshot.
+ */
+static void write_raw_comparts(raw_writer *writer, sqlite3 *db)
+{
+	db_cursor cursor;
+	comp_info comp;
+
+	if (comp_cursor_open(db, &cursor) != 0) {
+		return;
+	}
+	while (comp_cursor_next(&cursor, &comp) == 1) {
+		raw_compart compart = {
+			.compart_id = comp.compart_id,
+			.parent_id = comp.parent_id,
+			.is_default = comp.is_default,
+			.start = comp.start_addr,
+			.end = comp.end_addr,
+			.name = comp.compart_name,
+			.library_path = comp.library_path,
+		};
+		raw_write_compart(writer, &compart);
+	}
+	db_cursor_close(&cursor);
+}
+
 /*              
  * scan_mem
- * When the -s option is used to attach this tool to a running process.
+ * When the -p option is used to attach this tool to a running process.
  * Uses ptrace to trace the mapped memory and persis the data to a db
+ *
+ * The target is attached once and stays stopped while the rtld data and the
+ * capabilities of all vm entries are read. Parsing the ELF files of the mapped
+ * binaries does not need the target to be stopped, so it is done beforehand
+ * from a first copy of the vm map, and the database writes that do not depend
+ * on the target are done after it has been released.
+ *
+ * The capabilities of the vm entries are read by a pool of workers (see -j),
+ * large entries are split between them. The capabilities they find are
+ * decoded and written to the database by the later stages of the pool, which
+ * carry on after the target has been released.
+ *
+ * With -R, the reads are made through a target_recorder and logged to the
+ * record file along with the vm map, the rtld data and the ranges scanned.
  */
 void scan_mem(sqlite3 *db, int pid) 
 {
@@ -92,7 +323,12 @@ void scan_mem(sqlite3 *db, int pid)
 	struct kinfo_proc *kipp;
 	struct kinfo_vmentry *freep, *kivp;
 	uint pcnt, vmcnt;
+	struct timespec scan_start, scan_end;
+	run_timer timer;
+
+	clock_gettime(CLOCK_MONOTONIC, &scan_start);
 
+	run_phase_begin(&timer, RUN_PHASE_PROCSTAT);
 	psp = procstat_open_sysctl();
 	assert(psp != NULL);
 
@@ -108,83 +344,132 @@ void scan_mem(sqlite3 *db, int pid)
 	if (freep == NULL) {
 		errx(1, "Unable to obtain the vm map information from process %d, does chericat have the right privilege?", pid);
 	}
+	run_phase_end(&timer);
 
 	create_vm_cap_db(db);
+	create_elf_sym_db(db);
 	create_comparts_table(db);
 
-	debug_print(TROUBLESHOOT, "Key Stage: Attach process %d using ptrace\n", pid);
+	// All the rows of the snapshot are written in a single transaction
+	begin_transaction(db);
 
-	char *insert_vm_query_values;
+	// The compartments of the capabilities are worked out again by the next view
+	sql_query_exec(db, "DROP TABLE IF EXISTS cap_compart; DROP TABLE IF EXISTS cap_compart_snapshot;", NULL, NULL);
 
-	struct r_debug obtained_r_debug;
-	obtained_r_debug = get_r_debug(pid, psp, kipp);
-	compart_data_list *scanned_comparts = scan_rtld_linkmap(pid, db, obtained_r_debug);
-	scan_r_comparts(pid, db, obtained_r_debug);
-
-	/* Maintain the list of paths that have already been had their ELF parsed, so that
-	 * we don't duplicate data or scan unnecessarily.
-	 */
-	size_t seen_kivp_buffer_size;
-	size_t seen_kivp_buffer_capacity;
-	struct kinfo_vmentry *seen_kivp;
+	// Each scan adds a snapshot. An incremental one copies the capabilities of
+	// the unchanged pages from the snapshot of the previous incremental scan of
+	// pid, the vm map, symbols and compartments are small and taken again.
+	int64_t previous_id = 0;
+	if (scan_incremental) {
+		previous_id = scan_delta_previous(db, pid);
+	}
+	int64_t snapshot_id = snapshot_begin(db, pid, time(NULL));
+	if (snapshot_id == 0) {
+		errx(1, "Unable to add the snapshot of process %d to db %s", pid, get_dbname());
+	}
+
+	scan_delta delta;
+	if (scan_incremental && scan_delta_open(db, &delta, pid, previous_id) != 0) {
+		errx(1, "Unable to prepare the incremental scan on db %s", get_dbname());
+	}
+
+	cap_writer writer;
+	if (!scan_incremental && cap_writer_open(db, &writer) != 0) {
+		errx(1, "Unable to prepare the cap_info insert statement on db %s", get_dbname());
+	}
 
 	const int initial_size = 100;
-	seen_kivp_buffer_size = 0;
-	seen_kivp_buffer_capacity = initial_size;
-	seen_kivp = calloc(initial_size, sizeof(struct kinfo_vmentry));
-	if (!seen_kivp) {
+	seen_elf_files seen;
+	seen.count = 0;
+	seen.capacity = initial_size;
+	seen.seen_kivp = calloc(initial_size, sizeof(struct kinfo_vmentry));
+	seen.ssect = calloc(initial_size, sizeof(special_sections));
+	if (!seen.seen_kivp || !seen.ssect) {
 		errx(1, "Cannot allocate %lu bytes for the kivp wrapper", initial_size*sizeof(struct kinfo_vmentry));
 	}
 
+	for (u_int i=0; i<vmcnt; i++) {
+		if (strlen(freep[i].kve_path) > 0 && find_seen_elf(&freep[i], &seen) < 0) {
+			add_seen_elf(&freep[i], &seen);
+		}
+	}
+	load_seen_elf_files(db, &seen);
+	procstat_freevmmap(psp, freep);
+
+	scan_target target;
+	ptrace_scan_target(&target, &pid);
+
+	raw_writer record_writer;
+	target_recorder recorder;
+	if (scan_record_path != NULL) {
+		scan_target live = target;
+		open_raw_snapshot(&record_writer, scan_record_path, pid);
+		target_recorder_init(&recorder, &live, &record_writer, &target);
+	}
+
+	debug_print(TROUBLESHOOT, "Key Stage: Attach process %d using ptrace\n", pid);
+
+	ptrace_session session;
+	if (ptrace_session_begin(&session, pid) != 0) {
+		errx(1, "Unable to attach to process %d with ptrace, does chericat have the right privilege?", pid);
+	}
+
+	// Take the vm map again now that the target is stopped, so that it matches the
+	// capabilities that are read.
+	run_phase_begin(&timer, RUN_PHASE_PROCSTAT);
+	freep = procstat_getvmmap(psp, kipp, &vmcnt);
+	if (freep == NULL) {
+		errx(1, "Unable to obtain the vm map information from process %d, does chericat have the right privilege?", pid);
+	}
+	run_phase_end(&timer);
+
+	// The vm rows, their paths and the compartments of the snapshot are allocated
+	// from the arena, and freed with it once the snapshot is written. The paths
+	// are interned, as the entries of a library all share the same one.
+	arena snapshot_arena;
+	str_table paths;
+	arena_init(&snapshot_arena, 0);
+	str_table_init(&paths, &snapshot_arena);
+	vm_info *vms = arena_calloc(&snapshot_arena, vmcnt, sizeof(vm_info));
+
+	struct r_debug obtained_r_debug;
+	run_phase_begin(&timer, RUN_PHASE_R_DEBUG);
+	obtained_r_debug = get_r_debug(pid, &target, psp, kipp);
+	run_phase_end(&timer);
+	run_phase_begin(&timer, RUN_PHASE_LINKMAP);
+	compart_data_list *scanned_comparts = scan_rtld_linkmap(&target, db, obtained_r_debug, &snapshot_arena);
+	run_phase_end(&timer);
+	run_phase_begin(&timer, RUN_PHASE_R_COMPARTS);
+	scan_r_comparts(&target, db, obtained_r_debug, &snapshot_arena);
+	run_phase_end(&timer);
+	if (scan_record_path != NULL) {
+		write_raw_vm_entries(&record_writer, freep, vmcnt);
+		write_raw_rtld(&record_writer, psp, kipp, &obtained_r_debug, scanned_comparts);
+	}
 
-	special_sections *ssect = (special_sections *)calloc(vmcnt, sizeof(special_sections));
-	assert(ssect != NULL);
-	int ssect_index = 0;
+	int ssect_index = -1;
 
-	int seen_index = 0;
+	cap_scan_stats scan_stats = {};
+	scan_pool *pool = scan_pool_create(&target, scan_incremental ? NULL : &writer, get_scan_pool_workers());
+	if (scan_incremental) {
+		scan_pool_set_page_sink(pool, scan_delta_page, &delta);
+	}
 
 	for (u_int i=0; i<vmcnt; i++) {
 		kivp = &freep[i];
 
 		if (strlen(kivp->kve_path) > 0) {
-			bool seen=0;
-
-			for (int j=0; j<seen_index; j++) {
-				if (strcmp(seen_kivp[j].kve_path, kivp->kve_path) == 0) {
-					seen = 1;
-					break;
-				}
-			}
-
-			if (!seen) {
-				if (seen_kivp_buffer_size == seen_kivp_buffer_capacity) {
-					seen_kivp_buffer_capacity *= 2;
-					seen_kivp = realloc(seen_kivp, seen_kivp_buffer_capacity*sizeof(struct kinfo_vmentry));
-					if (!seen_kivp) {
-						errx(1, "Out of memory, cannot grow the size of the kivp array any more, current size is: %lu", seen_kivp_buffer_size);
-					}
-				}				
-				seen_kivp[seen_index] = *kivp;
-				seen_kivp_buffer_size++;
-				
-				get_elf_info(
-					db, 
-					read_elf(kivp->kve_path), 
-					kivp->kve_path,
-					kivp->kve_start,
-					&ssect,
-					ssect_index++);
-				seen_index++;
-			}
+			// Binaries mapped since the first copy of the vm map are parsed here
+			ssect_index = parse_elf_once(db, kivp, &seen);
 		}
-		char *mmap_path = NULL;
+		const char *name = NULL;
 
 		if (strlen(kivp->kve_path) == 0) {
 			int found=0;
-			for (int j=0; j<seen_index; j++) {
+			for (int j=0; j<seen.count; j++) {
 
-				if (seen_kivp[j].kve_start == kivp->kve_reservation) {
-					mmap_path = strdup(seen_kivp[j].kve_path);
+				if (seen.seen_kivp[j].kve_start == kivp->kve_reservation) {
+					name = seen.seen_kivp[j].kve_path;
 					found = 1;
 					break;
 				}
@@ -195,31 +480,28 @@ void scan_mem(sqlite3 *db, int pid)
 				// The mmap vm block is not within any of the loaded library range
 				// now try to "guess" where it belong by using the vnode information
 				if (kivp->kve_type == KVME_TYPE_GUARD) {
-					mmap_path = strdup("Guard");
+					name = "Guard";
 				} else if (kivp->kve_flags & KVME_FLAG_GROWS_DOWN) {
-					mmap_path = strdup("Stack");
+					name = "Stack";
 				} else {
-					mmap_path = strdup("Heap(others)");
+					name = "Heap(others)";
 				}
 			}
 		} else {
-			mmap_path = strdup(kivp->kve_path);
+			name = kivp->kve_path;
 		}
 
-		if (kivp->kve_start <= ssect[ssect_index-1].plt_addr &&
-			kivp->kve_end >= ssect[ssect_index-1].plt_addr+ssect[ssect_index-1].plt_size) {
-			char *new_path;
-			asprintf(&new_path, "%s(.plt)", mmap_path);
-			mmap_path = strdup(new_path);
-			free(new_path);
-		}
-		if (kivp->kve_start <= ssect[ssect_index-1].got_addr &&
-			kivp->kve_end >= ssect[ssect_index-1].got_addr+ssect[ssect_index-1].got_size) {
-			char *new_path;
-			asprintf(&new_path, "%s(.got)", mmap_path);
-			mmap_path = strdup(new_path);
-			free(new_path);
-		}
+		int has_plt = ssect_index >= 0 &&
+			kivp->kve_start <= seen.ssect[ssect_index].plt_addr &&
+			kivp->kve_end >= seen.ssect[ssect_index].plt_addr+seen.ssect[ssect_index].plt_size;
+		int has_got = ssect_index >= 0 &&
+			kivp->kve_start <= seen.ssect[ssect_index].got_addr &&
+			kivp->kve_end >= seen.ssect[ssect_index].got_addr+seen.ssect[ssect_index].got_size;
+
+		// kve_path is at most PATH_MAX, with room left for both suffixes
+		char path_buf[PATH_MAX + 16];
+		snprintf(path_buf, sizeof(path_buf), "%s%s%s", name, has_plt ? "(.plt)" : "", has_got ? "(.got)" : "");
+		char *mmap_path = str_intern(&paths, path_buf);
 
 		compart_data_list *comparts_head = scanned_comparts;
 
@@ -243,79 +525,242 @@ void scan_mem(sqlite3 *db, int pid)
 			kivp->kve_flags,
 			kivp->kve_type);
 
-		char *query_value;
-		asprintf(&query_value, "(\"0x%lx\", \"0x%lx\", \"%s\", %d, %d, %d, %d)", 
-				kivp->kve_start,
-				kivp->kve_end,
-				mmap_path,
-				compart_id,
-				kivp->kve_protection,
-				kivp->kve_flags,
-				kivp->kve_type);
-	
-		if (i == 0) {
-			insert_vm_query_values = (char*)malloc(sizeof(query_value));
-			assert(insert_vm_query_values != NULL);
-
-			insert_vm_query_values = strdup(query_value);
-		} else {
-			char *temp;
-			asprintf(&temp, "%s,%s", 
-				insert_vm_query_values,
-				query_value);
-			insert_vm_query_values = strdup(temp);
-			free(temp);
-		}
-		free(query_value);
+		vms[i].start_addr = kivp->kve_start;
+		vms[i].end_addr = kivp->kve_end;
+		vms[i].mmap_path = mmap_path;
+		vms[i].compart_id = compart_id;
+		vms[i].kve_protection = kivp->kve_protection;
+		vms[i].mmap_flags = kivp->kve_flags;
+		vms[i].vnode_type = kivp->kve_type;
 		
-		// Divide the vm block into 4k pages, and iterate each page to find the tags that reference each
-		// address within the same page.
-		ptrace_attach(pid);
+		// The tags of the vm block are read in chunks of 4k pages by the workers, and each page
+		// is iterated to find the tags that reference each address within the same page.
 		// If the vm block does not allow cap read or write, skip the capability scan
 		if (kivp->kve_flags & KVME_FLAG_HASCAP) { 
-			for (u_long start=kivp->kve_start; start<kivp->kve_end; start+=4096) {
-				get_tags(db, pid, start, mmap_path);
+			scan_pool_add(pool, kivp->kve_start, kivp->kve_end, mmap_path);
+			if (scan_record_path != NULL) {
+				target_recorder_range(&recorder, kivp->kve_start, kivp->kve_end);
 			}
 		}
-		ptrace_detach(pid);
 	}
-	
-	free(seen_kivp);
 
-	if (insert_vm_query_values != NULL) {
-		char query_hdr[] = "INSERT INTO vm(start_addr, end_addr, mmap_path, compart_id, kve_protection, mmap_flags, vnode_type) VALUES";
-		char *query;
-		asprintf(&query, "%s%s;", query_hdr, insert_vm_query_values);
-	
-		int db_rc = sql_query_exec(db, query, NULL, NULL);
-		debug_print(TROUBLESHOOT, "Key Stage: Inserted vm entry info to the database (rc=%d)\n", db_rc);
-		free(insert_vm_query_values);
-		free(query);
+	// The target is released as soon as everything has been read from it, the
+	// capabilities are still being decoded and written in the meantime.
+	scan_pool_start(pool);
+	scan_pool_wait_reads(pool);
+
+	ptrace_session_end(&session);
+	print_ptrace_session(&session);
+
+	if (scan_record_path != NULL) {
+		target_recorder_destroy(&recorder);
+	}
+
+	scan_pool_finish(pool, &scan_stats);
+	scan_pool_free(pool);
+	print_cap_scan_stats(&scan_stats);
+
+	// The comparts are read back from db, which the writer of the pool has
+	// been using until scan_pool_finish
+	if (scan_record_path != NULL) {
+		write_raw_comparts(&record_writer, db);
+		raw_snapshot_end end = { 0, 0, session.stopped_ns };
+		raw_write_end(&record_writer, &end);
+		if (raw_writer_close(&record_writer) != 0) {
+			errx(1, "Unable to write the record file %s", scan_record_path);
+		}
+	}
+	if (scan_incremental) {
+		scan_delta_close(&delta);
+		print_scan_delta_stats(&delta);
+	} else {
+		cap_writer_close(&writer);
 	}
 
+	int vm_rows = insert_vm_info(db, snapshot_id, vms, vmcnt);
+	debug_print(TROUBLESHOOT, "Key Stage: Inserted %d vm entries to the database\n", vm_rows);
+
 	// Also persist the bss, plt and got info for this source to the same elf_sym table
-	for (int i=0; i<ssect_index; i++) {
-		char *query;
-		asprintf(&query,	
-			"UPDATE vm SET "
-			"plt_addr=\"0x%lx\", "
-			"plt_size=\"0x%lx\", "
-			"got_addr=\"0x%lx\", "
-			"got_size=\"0x%lx\" " 
-			"WHERE mmap_path=\"%s\";",
-			ssect[i].plt_addr, 
-			ssect[i].plt_size,
-			ssect[i].got_addr, 
-			ssect[i].got_size, 
-			ssect[i].mmap_path);
-	
-		sql_query_exec(db, query, NULL, NULL);
-		free(query);
-	}
-
-	free(scanned_comparts);
+	special_sections *ssect = seen.ssect;
+	sqlite3_stmt *update_stmt;
+	if (sqlite3_prepare_v2(db,
+	    "UPDATE vm SET plt_addr = ?, plt_size = ?, got_addr = ?, got_size = ? "
+	    "WHERE mmap_path_id = (SELECT path_id FROM paths WHERE path = ?) AND snapshot_id = ?;",
+	    -1, &update_stmt, NULL) != SQLITE_OK) {
+		errx(1, "SQL error: %s", sqlite3_errmsg(db));
+	}
+	for (int i=0; i<seen.count; i++) {
+		sqlite3_bind_int64(update_stmt, 1, (sqlite3_int64)ssect[i].plt_addr);
+		sqlite3_bind_int64(update_stmt, 2, (sqlite3_int64)ssect[i].plt_size);
+		sqlite3_bind_int64(update_stmt, 3, (sqlite3_int64)ssect[i].got_addr);
+		sqlite3_bind_int64(update_stmt, 4, (sqlite3_int64)ssect[i].got_size);
+		sqlite3_bind_text(update_stmt, 5, ssect[i].mmap_path, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(update_stmt, 6, snapshot_id);
+		if (sqlite3_step(update_stmt) != SQLITE_DONE) {
+			fprintf(stderr, "SQL error updating vm: %s (db: %s)\n", sqlite3_errmsg(db), get_dbname());
+		}
+		sqlite3_reset(update_stmt);
+	}
+	sqlite3_finalize(update_stmt);
+
+	clock_gettime(CLOCK_MONOTONIC, &scan_end);
+	snapshot_end(db, (scan_end.tv_sec - scan_start.tv_sec) + (scan_end.tv_nsec - scan_start.tv_nsec) / 1e9);
+	commit_transaction(db);
+
+	debug_print(INFO, "Snapshot arena: %lu blocks, %zu of %zu bytes used, %lu distinct paths\n",
+	    snapshot_arena.block_count, snapshot_arena.used, snapshot_arena.reserved, paths.count);
+	str_table_free(&paths);
+	arena_free(&snapshot_arena);
+	free(seen.seen_kivp);
+	free(seen.ssect);
 	procstat_freevmmap(psp, freep);
 	procstat_freeprocs(psp, kipp);
 	procstat_close(psp);
 }
 
+/* The raw snapshot being written by scan_mem_raw */
+typedef struct raw_capture {
+	raw_writer writer;
+	u_long pages;
+	u_long caps;
+} raw_capture;
+
+/*
+ * write_raw_page
+ * The page sink of scan_mem_raw, writes the capabilities read from a page to
+ * the raw snapshot as they are in memory, without their tag byte.
+ */
+static void write_raw_page(void *arg, const raw_page *raw)
+{
+	raw_capture *capture = arg;
+	unsigned char caps[RAW_TAGS_PER_PAGE*RAW_CAP_SIZE];
+	int ncaps = 0;
+
+	for (int slot=raw->first_slot; slot<TAG_SCAN_TAGS_PER_PAGE; slot++) {
+		if ((raw->tags[slot/8] & (1 << (slot%8))) == 0) {
+			continue;
+		}
+		memcpy(&caps[ncaps*RAW_CAP_SIZE],
+		    &raw->slots[(slot-raw->first_slot)*CAP_DECODE_SLOT_SIZE + 1], RAW_CAP_SIZE);
+		ncaps++;
+	}
+
+	raw_page_caps page = { raw->page, raw->tags, caps, ncaps };
+	raw_write_page(&capture->writer, &page);
+	capture->pages++;
+	capture->caps += ncaps;
+}
+
+/*
+ * scan_mem_raw
+ * When the -o option is used together with -p. Captures the target into the
+ * raw snapshot raw_path rather than a database, see raw_snapshot.h.
+ *
+ * Only what has to be read while the target is stopped is done: the vm map,
+ * the auxv, r_debug and rtld linkmap, and the tags and capabilities of the
+ * vm entries. Nothing is decoded, no ELF file is parsed and no database is
+ * written, this is left to the ingest of the snapshot, which can be done on
+ * another host. The compartments found in the linkmap are kept in a scratch
+ * in-memory database until the target has been released.
+ */
+void scan_mem_raw(int pid, const char *raw_path)
+{
+	struct procstat *psp;
+	struct kinfo_proc *kipp;
+	struct kinfo_vmentry *freep, *kivp;
+	uint pcnt, vmcnt;
+	run_timer timer;
+
+	run_phase_begin(&timer, RUN_PHASE_PROCSTAT);
+	psp = procstat_open_sysctl();
+	assert(psp != NULL);
+
+	kipp = procstat_getprocs(psp, KERN_PROC_PID, pid, &pcnt);
+	if (kipp == NULL) {
+		errx(1, "Unable to attach to process with pid %d, does it exist?", pid);
+	}
+	if (pcnt != 1) {
+		errx(1, "procstat did not get expected result from process %d", pid);
+	}
+	run_phase_end(&timer);
+
+	raw_capture capture = {};
+	open_raw_snapshot(&capture.writer, raw_path, pid);
+
+	arena snapshot_arena;
+	arena_init(&snapshot_arena, 0);
+
+	sqlite3 *scratch_db;
+	if (sqlite3_open(":memory:", &scratch_db) != SQLITE_OK || create_comparts_table(scratch_db) != 0) {
+		errx(1, "Unable to open the scratch database for the compartments");
+	}
+
+	scan_target target;
+	ptrace_scan_target(&target, &pid);
+
+	debug_print(TROUBLESHOOT, "Key Stage: Attach process %d using ptrace\n", pid);
+
+	ptrace_session session;
+	if (ptrace_session_begin(&session, pid) != 0) {
+		errx(1, "Unable to attach to process %d with ptrace, does chericat have the right privilege?", pid);
+	}
+
+	run_phase_begin(&timer, RUN_PHASE_PROCSTAT);
+	freep = procstat_getvmmap(psp, kipp, &vmcnt);
+	if (freep == NULL) {
+		errx(1, "Unable to obtain the vm map information from process %d, does chericat have the right privilege?", pid);
+	}
+	run_phase_end(&timer);
+	write_raw_vm_entries(&capture.writer, freep, vmcnt);
+
+	struct r_debug obtained_r_debug;
+	run_phase_begin(&timer, RUN_PHASE_R_DEBUG);
+	obtained_r_debug = get_r_debug(pid, &target, psp, kipp);
+	run_phase_end(&timer);
+	run_phase_begin(&timer, RUN_PHASE_LINKMAP);
+	compart_data_list *scanned_comparts = scan_rtld_linkmap(&target, scratch_db, obtained_r_debug, &snapshot_arena);
+	run_phase_end(&timer);
+	run_phase_begin(&timer, RUN_PHASE_R_COMPARTS);
+	scan_r_comparts(&target, scratch_db, obtained_r_debug, &snapshot_arena);
+	run_phase_end(&timer);
+	write_raw_rtld(&capture.writer, psp, kipp, &obtained_r_debug, scanned_comparts);
+
+	cap_scan_stats scan_stats = {};
+	scan_pool *pool = scan_pool_create(&target, NULL, get_scan_pool_workers());
+	scan_pool_set_page_sink(pool, write_raw_page, &capture);
+
+	for (u_int i=0; i<vmcnt; i++) {
+		kivp = &freep[i];
+		if (kivp->kve_flags & KVME_FLAG_HASCAP) {
+			scan_pool_add(pool, kivp->kve_start, kivp->kve_end, kivp->kve_path);
+		}
+	}
+
+	scan_pool_start(pool);
+	scan_pool_wait_reads(pool);
+
+	ptrace_session_end(&session);
+	print_ptrace_session(&session);
+
+	scan_pool_finish(pool, &scan_stats);
+	scan_pool_free(pool);
+	print_cap_scan_stats(&scan_stats);
+
+	write_raw_comparts(&capture.writer, scratch_db);
+
+	raw_snapshot_end end = { capture.pages, capture.caps, session.stopped_ns };
+	raw_write_end(&capture.writer, &end);
+	unsigned long records = capture.writer.records;
+	uint64_t bytes = capture.writer.bytes;
+	if (raw_writer_close(&capture.writer) != 0) {
+		errx(1, "Unable to write the raw snapshot %s", raw_path);
+	}
+	debug_print(INFO, "Raw snapshot %s: %lu records, %lu pages, %lu capabilities, %lu bytes\n",
+	    raw_path, records, capture.pages, capture.caps, (u_long)bytes);
+
+	sqlite3_close(scratch_db);
+	arena_free(&snapshot_arena);
+	procstat_freevmmap(psp, freep);
+	procstat_freeprocs(psp, kipp);
+	procstat_close(psp);
+}
@@ -0,0 +1,136 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpmc_ring.h"
+
+/*
+ * mpmc_ring_init(ring, capacity, elem_size)
+ * Makes an empty ring of capacity elements of elem_size bytes, capacity is
+ * a power of two. Returns 0 on success, -1 if it cannot be allocated.
+ */
+int mpmc_ring_init(mpmc_ring *ring, size_t capacity, size_t elem_size)
+{
+	if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+		return -1;
+	}
+	ring->seqs = calloc(capacity, sizeof(atomic_size_t));
+	ring->elems = calloc(capacity, elem_size);
+	if (ring->seqs == NULL || ring->elems == NULL) {
+		free(ring->seqs);
+		free(ring->elems);
+		return -1;
+	}
+	for (size_t i=0; i<capacity; i++) {
+		atomic_init(&ring->seqs[i], i);
+	}
+	ring->elem_size = elem_size;
+	ring->mask = capacity - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return 0;
+}
+
+/*
+ * mpmc_ring_push(ring, elem)
+ * Copies elem to the ring. Returns 0 on success, -1 if the ring is full.
+ */
+int mpmc_ring_push(mpmc_ring *ring, const void *elem)
+{
+	size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	for (;;) {
+		size_t seq = atomic_load_explicit(&ring->seqs[pos & ring->mask], memory_order_acquire);
+		int64_t diff = (int64_t)(seq - pos);
+
+		if (diff == 0) {
+			// The cell is free, claim the position
+			if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+			    memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// The cell still holds the element of the previous lap
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		}
+	}
+
+	memcpy(&ring->elems[(pos & ring->mask) * ring->elem_size], elem, ring->elem_size);
+	atomic_store_explicit(&ring->seqs[pos & ring->mask], pos + 1, memory_order_release);
+	return 0;
+}
+
+/*
+ * mpmc_ring_pop(ring, elem)
+ * Moves the oldest element of the ring to elem. Returns 0 on success, -1 if
+ * the ring is empty.
+ */
+int mpmc_ring_pop(mpmc_ring *ring, void *elem)
+{
+	size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	for (;;) {
+		size_t seq = atomic_load_explicit(&ring->seqs[pos & ring->mask], memory_order_acquire);
+		int64_t diff = (int64_t)(seq - (pos + 1));
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+			    memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// Nothing has been pushed to the cell yet
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		}
+	}
+
+	memcpy(elem, &ring->elems[(pos & ring->mask) * ring->elem_size], ring->elem_size);
+	// Free the cell for the push one lap later
+	atomic_store_explicit(&ring->seqs[pos & ring->mask], pos + ring->mask + 1, memory_order_release);
+	return 0;
+}
+
+void mpmc_ring_free(mpmc_ring *ring)
+{
+	free(ring->seqs);
+	free(ring->elems);
+	ring->seqs = NULL;
+	ring->elems = NULL;
+}
@@ -49,12 +49,15 @@
 #include <link.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <libprocstat.h>
 
 #include "common.h"
 #include "db_process.h"
 #include "ptrace_utils.h"
+#include "run_stats.h"
+#include "scan_pool.h"
 
 /*
  * ptrace_attach(int pid)
@@ -62,13 +65,16 @@
  * the provided pid.
  * It waits for the attached process (the tracee) to stop via a call to 
  * waitpid(), so that it can carry out the tracing request(s).
+ * Returns 0 once the tracee is stopped, -1 if it could not be attached, in
+ * which case it is left running.
  */
-void ptrace_attach(int pid)
+int ptrace_attach(int pid)
 {
+        run_count(RUN_PTRACE_CALLS, 1);
         if (ptrace(PT_ATTACH, pid, 0, 0) == -1) {
                 int err = errno;
                 fprintf(stderr, "ptrace attach failed: %s %d\n", strerror(err), err);
-                return;
+                return (-1);
         }
 
         int status;
@@ -76,8 +82,10 @@ void ptrace_attach(int pid)
         if (waitpid(pid, &status, 0) == -1) {
                 int err_waitpid = errno;
                 fprintf(stderr, "ptrace waitpid failed: %s %d\n", strerror(err_waitpid), err_waitpid);
-                return;
+                ptrace_detach(pid);
+                return (-1);
         }
+        return (0);
 }
 
 /*
@@ -88,6 +96,7 @@ void ptrace_attach(int pid)
  */
 void ptrace_detach(int pid)
 {
+        run_count(RUN_PTRACE_CALLS, 1);
         if (ptrace(PT_DETACH, pid, 0, 0) == -1) {
                 int err_detach = errno;
                 fprintf(stderr, "ptrace detach failed: %s %d\n", strerror(err_detach), err_detach);
@@ -95,112 +104,100 @@ void ptrace_detach(int pid)
         }
 }
 
-void print_ptype(size_t pt) {
-	char *s;
-#define C(V) case PT_##V: s = #V; break 
-	switch (pt) {
-		C(NULL); C(INTERP); C(PHDR); 
-		C(SUNWBSS); C(SUNWCAP);
-		C(LOAD); C(DYNAMIC); C(NOTE); 
-		C(SHLIB); C(TLS); C(SUNW_UNWIND); 
-		C(SUNWSTACK); C(SUNWDTRACE);
-	default:
-		s = "unknown";
-		break; 
-	}
-	printf(" \"%s\"", s); 
-#undef C
-}
-
 /*
- * read_data(int pid, void *addr, void *vptr, int len)
- * Using ptrace to read data in the attached remote process's address space.
- * The ptrace request reads a single "int" of data in each call, from the provided
- * address "addr". This routine calls the request repeatedly until the full "len" 
- * has been read. The data is returned as the return value from the ptrace, 
- * and is subsequently stored using the passed-in pointer "vptr".
+ * ptrace_session_begin(ptrace_session *session, int pid)
+ * Attaches the process that has the provided pid and starts timing how
+ * long it is kept stopped. All the reads of a snapshot are expected to be
+ * done before the matching ptrace_session_end(). Returns 0 on success, -1
+ * if the process could not be attached.
  */
-void read_data(int pid, void *addr, void *vptr, int len)
+int ptrace_session_begin(ptrace_session *session, int pid)
 {
-	int i=0, count=0;
-	long word;
-	int *ptr = (int *)vptr;
-
-	while (count < len) {
-		word = ptrace(PT_READ_D, pid, ((caddr_t)addr)+count, 0);
-		count += sizeof(int);
-		ptr[i++] = word;
+	assert(session != NULL);
+
+	session->pid = pid;
+	session->stopped_ns = 0;
+	session->attached = 0;
+	clock_gettime(CLOCK_MONOTONIC, &session->stopped_at);
+	if (ptrace_attach(pid) != 0) {
+		return (-1);
 	}
+	session->attached = 1;
+	return (0);
 }
 
-/* 
- * read_lwps
- * Using ptrace to read info of kernel threads
+/*
+ * ptrace_session_end(ptrace_session *session)
+ * Detaches the process of the session, releasing it to resume execution,
+ * and records the time it was stopped for.
  */
-lwpthrs_t get_lwps_list(int pid) 
+void ptrace_session_end(ptrace_session *session)
 {
-	int nlwps;
-	lwpid_t *lwps;
-	
-	nlwps = ptrace(PT_GETNUMLWPS, pid, NULL, 0);
-	if (nlwps == -1) {
-		err(1, "Failed to get number of LWPs for process %d", pid);
-	}
-	assert(nlwps > 0);
+	assert(session != NULL);
 
-	lwps = calloc(nlwps, sizeof(*lwps));
-	nlwps = ptrace(PT_GETLWPLIST, pid, (caddr_t)lwps, nlwps);
-	if (nlwps == -1) {
-		err(1, "Failed to get LWP list for process %d", pid);
+	if (!session->attached) {
+		return;
 	}
-	assert(nlwps > 0);
-	debug_print(INFO, "Number of threads read: %d\n", nlwps);
 
-	lwpthrs_t lwpthrs;
-	lwpthrs.nlwps = nlwps;
-	lwpthrs.lwps = lwps;
+	ptrace_detach(session->pid);
+	session->attached = 0;
 
-	return lwpthrs;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	session->stopped_ns = (uint64_t)(now.tv_sec - session->stopped_at.tv_sec) * 1000000000ULL +
+		(uint64_t)now.tv_nsec - (uint64_t)session->stopped_at.tv_nsec;
 }
 
-struct ptrace_lwpinfo read_lwpinfo(int lwps_tid)
+/*
+ * print_ptrace_session(ptrace_session *session)
+ * Reports how long the target was kept stopped by the session.
+ */
+void print_ptrace_session(ptrace_session *session)
 {
-	struct ptrace_lwpinfo pl;
+	debug_print(INFO, "Process %d was stopped for %lu.%06lu seconds\n",
+		session->pid,
+		(u_long)(session->stopped_ns / 1000000000ULL),
+		(u_long)((session->stopped_ns % 1000000000ULL) / 1000));
+}
 
-	if (ptrace(PT_LWPINFO, lwps_tid, (caddr_t)&pl, sizeof(pl)) == -1) {
-		err(1, "Failed to get LWP info");
+void print_ptype(size_t pt) {
+	char *s;
+#define C(V) case PT_##V: s = #V; break 
+	switch (pt) {
+		C(NULL); C(INTERP); C(PHDR); 
+		C(SUNWBSS); C(SUNWCAP);
+		C(LOAD); C(DYNAMIC); C(NOTE); 
+		C(SHLIB); C(TLS); C(SUNW_UNWIND); 
+		C(SUNWSTACK); C(SUNWDTRACE);
+	default:
+		s = "unknown";
+		break; 
 	}
-	
-	debug_print(INFO, "Read thread %d: %s\n", pl.pl_lwpid, pl.pl_tdname);
-	return pl;
+	printf(" \"%s\"", s); 
+#undef C
 }
 
-void piod_read(int pid, int op, void *remote, void *local, size_t len)
+/*
+ * target_read(const scan_target *target, void *remote, void *local, size_t len)
+ * Reads len bytes at the address remote of the target into local through
+ * its read_data, so that the read is seen by a recorder or served by a
+ * replay, and exits if they cannot all be read.
+ */
+void target_read(const scan_target *target, void *remote, void *local, size_t len)
 {
-    struct ptrace_io_desc piod;
-    piod.piod_op = op;
-    piod.piod_offs = remote; 
-    piod.piod_addr = local;
-    piod.piod_len = len;
-
-    int retno = ptrace(PT_IO, pid, (caddr_t)&piod, 0);
-    if (retno == -1) {
-	errx(1, "ptrace(PT_IO) failed to scan process %d at remote address %p", pid, remote);
-    }
-    if (piod.piod_len != len) {
-	errx(1, "ptrace(PT_IO) short read: %zu vs %zu", piod.piod_len, len);
+    if (target->read_data(target->arg, (u_long)(uintptr_t)remote, local, len) != 0) {
+	errx(1, "Failed to read %zu bytes of the target at remote address %p", len, remote);
     }
 }
 
 /*
- * Copy a string from the process.  Note that it is
+ * Copy a string from the target.  Note that it is
  * expected to be a C string, but if max is set, it will
  * only get that much.
  */
 char *
-get_string(pid_t pid, psaddr_t addr, int max)
+get_string(const scan_target *target, psaddr_t addr, int max)
 {
-	struct ptrace_io_desc iorequest;
 	char *buf, *nbuf;
 	size_t offset, size, totalsize;
 
@@ -218,11 +215,7 @@ get_string(pid_t pid, psaddr_t addr, int max)
 	if (buf == NULL)
 		return (NULL);
 	for (;;) {
-		iorequest.piod_op = PIOD_READ_D;
-		iorequest.piod_offs = (void *)((uintptr_t)addr + offset);
-		iorequest.piod_addr = buf + offset;
-		iorequest.piod_len = size;
-		if (ptrace(PT_IO, pid, (caddr_t)&iorequest, 0) < 0) {
+		if (target->read_data(target->arg, addr + offset, buf + offset, size) != 0) {
 			free(buf);
 			return (NULL);
 		}
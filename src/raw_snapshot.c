@@ -0,0 +1,536 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "raw_snapshot.h"
+
+/* The snapshot is written through a large stdio buffer, records are small */
+#define RAW_WRITER_BUFFER_SIZE	(1 << 20)
+
+#define RAW_VM_ENTRY_SIZE	40
+#define RAW_LINKMAP_OBJ_SIZE	24
+#define RAW_COMPART_SIZE	40
+#define RAW_PAGE_SIZE		(8 + RAW_TAG_BYTES_PER_PAGE)
+#define RAW_END_SIZE		24
+#define RAW_TARGET_READ_SIZE	24
+#define RAW_SCAN_RANGE_SIZE	16
+
+static const unsigned char raw_padding[8];
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	for (int i=0; i<4; i++) {
+		p[i] = v >> (8*i);
+	}
+}
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+	for (int i=0; i<8; i++) {
+		p[i] = v >> (8*i);
+	}
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	uint32_t v = 0;
+	for (int i=0; i<4; i++) {
+		v |= (uint32_t)p[i] << (8*i);
+	}
+	return v;
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	for (int i=0; i<8; i++) {
+		v |= (uint64_t)p[i] << (8*i);
+	}
+	return v;
+}
+
+static size_t padded(size_t length)
+{
+	return (length + 7) & ~(size_t)7;
+}
+
+/* Size of a string in a record, with its NUL, 0 if there is none */
+static uint32_t string_size(const char *s)
+{
+	return s == NULL ? 0 : strlen(s) + 1;
+}
+
+/*
+ * raw_writer_open(writer, path, header)
+ * Creates the raw snapshot file path, or truncates it, and writes its header.
+ * Returns 0 on success, -1 if the file cannot be written.
+ */
+int raw_writer_open(raw_writer *writer, const char *path, const raw_snapshot_header *header)
+{
+	unsigned char hdr[RAW_SNAPSHOT_HEADER_SIZE];
+
+	memset(writer, 0, sizeof(raw_writer));
+	writer->file = fopen(path, "w");
+	if (writer->file == NULL) {
+		return -1;
+	}
+	writer->buf = malloc(RAW_WRITER_BUFFER_SIZE);
+	if (writer->buf != NULL) {
+		setvbuf(writer->file, writer->buf, _IOFBF, RAW_WRITER_BUFFER_SIZE);
+	}
+
+	memcpy(hdr, RAW_SNAPSHOT_MAGIC, RAW_SNAPSHOT_MAGIC_SIZE);
+	put_u32(&hdr[8], RAW_SNAPSHOT_VERSION);
+	put_u32(&hdr[12], RAW_SNAPSHOT_HEADER_SIZE);
+	put_u32(&hdr[16], header->page_size);
+	put_u32(&hdr[20], header->cap_size);
+	put_u64(&hdr[24], header->pid);
+	put_u64(&hdr[32], header->timestamp);
+	put_u32(&hdr[40], header->machine);
+	put_u32(&hdr[44], 0);
+	if (fwrite(hdr, sizeof(hdr), 1, writer->file) != 1) {
+		writer->failed = 1;
+		return -1;
+	}
+	writer->bytes = sizeof(hdr);
+	return 0;
+}
+
+/* A piece of the payload of a record */
+typedef struct raw_part {
+	const void *data;
+	size_t length;
+} raw_part;
+
+/*
+ * write_record_parts
+ * Writes a record of the given type whose payload is the concatenation of
+ * the nparts buffers in parts, followed by its padding.
+ */
+static int write_record_parts(raw_writer *writer, uint32_t type, const raw_part *parts, int nparts)
+{
+	unsigned char hdr[RAW_RECORD_HEADER_SIZE];
+	size_t length = 0;
+
+	for (int i=0; i<nparts; i++) {
+		length += parts[i].length;
+	}
+	if (writer->failed || length > UINT32_MAX) {
+		return -1;
+	}
+
+	put_u32(&hdr[0], type);
+	put_u32(&hdr[4], length);
+	int ok = fwrite(hdr, sizeof(hdr), 1, writer->file) == 1;
+	for (int i=0; ok && i<nparts; i++) {
+		if (parts[i].length > 0) {
+			ok = fwrite(parts[i].data, parts[i].length, 1, writer->file) == 1;
+		}
+	}
+	if (ok && padded(length) != length) {
+		ok = fwrite(raw_padding, padded(length) - length, 1, writer->file) == 1;
+	}
+	if (!ok) {
+		writer->failed = 1;
+		return -1;
+	}
+	writer->records++;
+	writer->bytes += sizeof(hdr) + padded(length);
+	return 0;
+}
+
+/*
+ * raw_write_record(writer, type, payload, length)
+ * Appends a record holding length bytes of payload as they are, for the
+ * records whose payload is a copy of the target's memory.
+ */
+int raw_write_record(raw_writer *writer, uint32_t type, const void *payload, size_t length)
+{
+	raw_part part = { payload, length };
+
+	return write_record_parts(writer, type, &part, 1);
+}
+
+int raw_write_vm_entry(raw_writer *writer, const raw_vm_entry *vm)
+{
+	unsigned char fixed[RAW_VM_ENTRY_SIZE];
+	uint32_t path_size = string_size(vm->path);
+
+	put_u64(&fixed[0], vm->start);
+	put_u64(&fixed[8], vm->end);
+	put_u64(&fixed[16], vm->reservation);
+	put_u32(&fixed[24], vm->protection);
+	put_u32(&fixed[28], vm->flags);
+	put_u32(&fixed[32], vm->type);
+	put_u32(&fixed[36], path_size);
+
+	raw_part parts[] = { { fixed, sizeof(fixed) }, { vm->path, path_size } };
+	return write_record_parts(writer, RAW_REC_VM_ENTRY, parts, 2);
+}
+
+int raw_write_linkmap_obj(raw_writer *writer, const raw_linkmap_obj *obj)
+{
+	unsigned char fixed[RAW_LINKMAP_OBJ_SIZE];
+	uint32_t path_size = string_size(obj->path);
+
+	put_u32(&fixed[0], obj->compart_id);
+	put_u32(&fixed[4], path_size);
+	put_u64(&fixed[8], obj->start);
+	put_u64(&fixed[16], obj->end);
+
+	raw_part parts[] = { { fixed, sizeof(fixed) }, { obj->path, path_size } };
+	return write_record_parts(writer, RAW_REC_LINKMAP_OBJ, parts, 2);
+}
+
+int raw_write_compart(raw_writer *writer, const raw_compart *compart)
+{
+	unsigned char fixed[RAW_COMPART_SIZE];
+	uint32_t name_size = string_size(compart->name);
+	uint32_t path_size = string_size(compart->library_path);
+
+	put_u32(&fixed[0], compart->compart_id);
+	put_u32(&fixed[4], compart->parent_id);
+	put_u32(&fixed[8], compart->is_default);
+	put_u32(&fixed[12], name_size);
+	put_u32(&fixed[16], path_size);
+	put_u32(&fixed[20], 0);
+	put_u64(&fixed[24], compart->start);
+	put_u64(&fixed[32], compart->end);
+
+	raw_part parts[] = {
+		{ fixed, sizeof(fixed) },
+		{ compart->name, name_size },
+		{ compart->library_path, path_size },
+	};
+	return write_record_parts(writer, RAW_REC_COMPART, parts, 3);
+}
+
+int raw_write_page(raw_writer *writer, const raw_page_caps *page)
+{
+	unsigned char fixed[RAW_PAGE_SIZE];
+
+	put_u64(&fixed[0], page->page);
+	memcpy(&fixed[8], page->tags, RAW_TAG_BYTES_PER_PAGE);
+
+	raw_part parts[] = {
+		{ fixed, sizeof(fixed) },
+		{ page->caps, (size_t)page->ncaps*RAW_CAP_SIZE },
+	};
+	return write_record_parts(writer, RAW_REC_PAGE, parts, 2);
+}
+
+int raw_write_end(raw_writer *writer, const raw_snapshot_end *end)
+{
+	unsigned char payload[RAW_END_SIZE];
+
+	put_u64(&payload[0], end->pages);
+	put_u64(&payload[8], end->caps);
+	put_u64(&payload[16], end->stopped_ns);
+	return raw_write_record(writer, RAW_REC_END, payload, sizeof(payload));
+}
+
+int raw_write_target_read(raw_writer *writer, const raw_target_read *read)
+{
+	unsigned char fixed[RAW_TARGET_READ_SIZE];
+
+	put_u32(&fixed[0], read->op);
+	put_u32(&fixed[4], (uint32_t)read->result);
+	put_u64(&fixed[8], read->addr);
+	put_u64(&fixed[16], read->length);
+
+	raw_part parts[] = { { fixed, sizeof(fixed) }, { read->data, read->data_size } };
+	return write_record_parts(writer, RAW_REC_TARGET_READ, parts, 2);
+}
+
+int raw_write_scan_range(raw_writer *writer, const raw_scan_range *range)
+{
+	unsigned char payload[RAW_SCAN_RANGE_SIZE];
+
+	put_u64(&payload[0], range->start);
+	put_u64(&payload[8], range->end);
+	return raw_write_record(writer, RAW_REC_SCAN_RANGE, payload, sizeof(payload));
+}
+
+/*
+ * raw_writer_close(writer)
+ * Flushes and closes the snapshot. Returns 0 if every record has been
+ * written, -1 otherwise.
+ */
+int raw_writer_close(raw_writer *writer)
+{
+	int rc = writer->failed ? -1 : 0;
+
+	if (writer->file != NULL && fclose(writer->file) != 0) {
+		rc = -1;
+	}
+	free(writer->buf);
+	writer->file = NULL;
+	writer->buf = NULL;
+	return rc;
+}
+
+/*
+ * raw_reader_open(reader, path)
+ * Maps the raw snapshot path and checks its header. Snapshots of a newer
+ * version than this one are rejected, a longer header is skipped and the
+ * fields missing from a shorter one are left at 0.
+ * Returns 0 on success, -1 otherwise.
+ */
+int raw_reader_open(raw_reader *reader, const char *path)
+{
+	struct stat st;
+
+	memset(reader, 0, sizeof(raw_reader));
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size < RAW_SNAPSHOT_MIN_HEADER_SIZE) {
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+	reader->map = map;
+	reader->size = st.st_size;
+
+	const unsigned char *hdr = reader->map;
+	uint32_t header_size = get_u32(&hdr[12]);
+	reader->header.version = get_u32(&hdr[8]);
+	if (memcmp(hdr, RAW_SNAPSHOT_MAGIC, RAW_SNAPSHOT_MAGIC_SIZE) != 0 ||
+	    reader->header.version == 0 || reader->header.version > RAW_SNAPSHOT_VERSION ||
+	    header_size < RAW_SNAPSHOT_MIN_HEADER_SIZE || header_size > reader->size) {
+		debug_print(INFO, "%s is not a raw snapshot chericat can read\n", path);
+		raw_reader_close(reader);
+		return -1;
+	}
+	reader->header.page_size = get_u32(&hdr[16]);
+	reader->header.cap_size = get_u32(&hdr[20]);
+	reader->header.pid = get_u64(&hdr[24]);
+	reader->header.timestamp = get_u64(&hdr[32]);
+	reader->header.machine = header_size >= 44 ? get_u32(&hdr[40]) : RAW_MACHINE_UNKNOWN;
+	reader->off = padded(header_size);
+	return 0;
+}
+
+/*
+ * raw_reader_next(reader, record)
+ * Reads the next record of the snapshot. Returns 1 if there is one, 0 at the
+ * end of the file and -1 if the file is cut short in the middle of a record.
+ */
+int raw_reader_next(raw_reader *reader, raw_record *record)
+{
+	if (reader->off >= reader->size) {
+		return 0;
+	}
+	if (reader->size - reader->off < RAW_RECORD_HEADER_SIZE) {
+		return -1;
+	}
+	const unsigned char *hdr = &reader->map[reader->off];
+	record->type = get_u32(&hdr[0]);
+	record->length = get_u32(&hdr[4]);
+	if (reader->size - reader->off - RAW_RECORD_HEADER_SIZE < record->length) {
+		return -1;
+	}
+	record->payload = &hdr[RAW_RECORD_HEADER_SIZE];
+	reader->off += RAW_RECORD_HEADER_SIZE + padded(record->length);
+	return 1;
+}
+
+void raw_reader_close(raw_reader *reader)
+{
+	if (reader->map != NULL) {
+		munmap((void *)reader->map, reader->size);
+	}
+	reader->map = NULL;
+	reader->size = 0;
+}
+
+/*
+ * record_string
+ * Points *s to the string of size bytes at *off in the payload of record,
+ * NULL if size is 0, and moves *off past it. Returns -1 if the string is
+ * not within the payload or not terminated.
+ */
+static int record_string(const raw_record *record, uint32_t *off, uint32_t size, const char **s)
+{
+	if (size == 0) {
+		*s = NULL;
+		return 0;
+	}
+	if (record->length - *off < size || record->payload[*off + size - 1] != '\0') {
+		return -1;
+	}
+	*s = (const char *)&record->payload[*off];
+	*off += size;
+	return 0;
+}
+
+/*
+ * raw_record_vm_entry and friends
+ * Decode the payload of a record of their type. The strings point into the
+ * mapped file. Return 0 on success, -1 if the record is of another type or
+ * malformed.
+ */
+int raw_record_vm_entry(const raw_record *record, raw_vm_entry *vm)
+{
+	const unsigned char *p = record->payload;
+	uint32_t off = RAW_VM_ENTRY_SIZE;
+
+	if (record->type != RAW_REC_VM_ENTRY || record->length < RAW_VM_ENTRY_SIZE) {
+		return -1;
+	}
+	vm->start = get_u64(&p[0]);
+	vm->end = get_u64(&p[8]);
+	vm->reservation = get_u64(&p[16]);
+	vm->protection = get_u32(&p[24]);
+	vm->flags = get_u32(&p[28]);
+	vm->type = get_u32(&p[32]);
+	if (record_string(record, &off, get_u32(&p[36]), &vm->path) != 0) {
+		return -1;
+	}
+	if (vm->path == NULL) {
+		vm->path = "";
+	}
+	return 0;
+}
+
+int raw_record_linkmap_obj(const raw_record *record, raw_linkmap_obj *obj)
+{
+	const unsigned char *p = record->payload;
+	uint32_t off = RAW_LINKMAP_OBJ_SIZE;
+
+	if (record->type != RAW_REC_LINKMAP_OBJ || record->length < RAW_LINKMAP_OBJ_SIZE) {
+		return -1;
+	}
+	obj->compart_id = (int32_t)get_u32(&p[0]);
+	obj->start = get_u64(&p[8]);
+	obj->end = get_u64(&p[16]);
+	return record_string(record, &off, get_u32(&p[4]), &obj->path);
+}
+
+int raw_record_compart(const raw_record *record, raw_compart *compart)
+{
+	const unsigned char *p = record->payload;
+	uint32_t off = RAW_COMPART_SIZE;
+
+	if (record->type != RAW_REC_COMPART || record->length < RAW_COMPART_SIZE) {
+		return -1;
+	}
+	compart->compart_id = (int32_t)get_u32(&p[0]);
+	compart->parent_id = (int32_t)get_u32(&p[4]);
+	compart->is_default = get_u32(&p[8]);
+	compart->start = get_u64(&p[24]);
+	compart->end = get_u64(&p[32]);
+	if (record_string(record, &off, get_u32(&p[12]), &compart->name) != 0 ||
+	    record_string(record, &off, get_u32(&p[16]), &compart->library_path) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+int raw_record_page(const raw_record *record, raw_page_caps *page)
+{
+	const unsigned char *p = record->payload;
+	int ncaps = 0;
+
+	if (record->type != RAW_REC_PAGE || record->length < RAW_PAGE_SIZE) {
+		return -1;
+	}
+	page->page = get_u64(&p[0]);
+	page->tags = &p[8];
+	for (int i=0; i<RAW_TAG_BYTES_PER_PAGE; i++) {
+		ncaps += __builtin_popcount(page->tags[i]);
+	}
+	// One capability for each tag, no more and no less
+	if (record->length != RAW_PAGE_SIZE + (uint32_t)ncaps*RAW_CAP_SIZE) {
+		return -1;
+	}
+	page->caps = &p[RAW_PAGE_SIZE];
+	page->ncaps = ncaps;
+	return 0;
+}
+
+int raw_record_end(const raw_record *record, raw_snapshot_end *end)
+{
+	const unsigned char *p = record->payload;
+
+	if (record->type != RAW_REC_END || record->length < RAW_END_SIZE) {
+		return -1;
+	}
+	end->pages = get_u64(&p[0]);
+	end->caps = get_u64(&p[8]);
+	end->stopped_ns = get_u64(&p[16]);
+	return 0;
+}
+
+int raw_record_target_read(const raw_record *record, raw_target_read *read)
+{
+	const unsigned char *p = record->payload;
+
+	if (record->type != RAW_REC_TARGET_READ || record->length < RAW_TARGET_READ_SIZE) {
+		return -1;
+	}
+	read->op = get_u32(&p[0]);
+	read->result = (int32_t)get_u32(&p[4]);
+	read->addr = get_u64(&p[8]);
+	read->length = get_u64(&p[16]);
+	read->data = &p[RAW_TARGET_READ_SIZE];
+	read->data_size = record->length - RAW_TARGET_READ_SIZE;
+	return 0;
+}
+
+int raw_record_scan_range(const raw_record *record, raw_scan_range *range)
+{
+	const unsigned char *p = record->payload;
+
+	if (record->type != RAW_REC_SCAN_RANGE || record->length < RAW_SCAN_RANGE_SIZE) {
+		return -1;
+	}
+	range->start = get_u64(&p[0]);
+	range->end = get_u64(&p[8]);
+	return 0;
+}
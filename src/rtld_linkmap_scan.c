@@ -116,8 +116,8 @@ void getprocs_with_procstat_sysctl(sqlite3 *db, int pid)
            created. Once we know how to deal with this problem we can remove 
            the calls from scan_mem and only make them here when users choose 
            the "show comp" command line option */
-	//struct r_debug obtained_r_debug = get_r_debug(pid, psp, kipp);
-	//scan_rtld_linkmap(pid, db, obtained_r_debug);
+	//struct r_debug obtained_r_debug = get_r_debug(pid, &target, psp, kipp);
+	//scan_rtld_linkmap(&target, db, obtained_r_debug);
 
 	if (kipp != NULL) {
 		procstat_freeprocs(psp, kipp);
@@ -131,8 +131,10 @@ void getprocs_with_procstat_sysctl(sqlite3 *db, int pid)
  * the dynamic table, which can then be traced to find the debug struct
  * exposed by cheribsd for debugger. This debug struct, r_debug, contains
  * the entry to the rtld link_map and compartments array.
+ * The target must already be attached and stopped by the caller, its memory
+ * is read through target.
  */
-struct r_debug get_r_debug(int pid, struct procstat *psp, struct kinfo_proc *kipp)
+struct r_debug get_r_debug(int pid, const scan_target *target, struct procstat *psp, struct kinfo_proc *kipp)
 {
     // ***** AUXV --> PHDR ***** //
     // First we need to use the auxiliary vector obtained by procstat to find out
@@ -167,15 +169,13 @@ struct r_debug get_r_debug(int pid, struct procstat *psp, struct kinfo_proc *kip
 
     // ***** PHDR --> PT_DYNAMIC ***** //
     // Using the PHDR address, read the program header entries of the target
-    // process space into memory using ptrace
-    ptrace_attach(pid);
-	
+    // process space into memory through target. The caller holds the target stopped.
     Elf_Phdr *target_phdr = calloc(phent, phnum);
-    piod_read(pid, PIOD_READ_D, (void*)phdr, target_phdr, phent*phnum);
+    target_read(target, (void*)phdr, target_phdr, phent*phnum);
     debug_print(INFO, "remote_phdr: %p local_phdr: %p\n", phdr, target_phdr);
 
     // Scan the program header entries from read memory to find the PT_DYNAMIC section
-    void *dyn = malloc(sizeof(void*));
+    void *dyn = NULL;
     int dyn_size=0;
 	
     for (int i=0; i<phnum; i++) {
@@ -189,15 +189,15 @@ struct r_debug get_r_debug(int pid, struct procstat *psp, struct kinfo_proc *kip
     assert(dyn != NULL);
 
     // ***** PT_DYNAMIC --> DT_DEBUG ***** //
-    // Now that we have the address of the dynamic section, we can use ptrace 
-    // to scan the memory to obtain the data stored in it.
+    // Now that we have the address of the dynamic section, we can read 
+    // the target to scan the memory to obtain the data stored in it.
     Elf_Dyn *target_dyn = calloc(dyn_size, sizeof(*target_dyn));
     int phoff = sizeof(Elf_Ehdr);
     uint64_t elf_base = (uint64_t)((char*)phdr - phoff);
-    piod_read(pid, PIOD_READ_D, (dyn+elf_base), target_dyn, dyn_size);
+    target_read(target, (dyn+elf_base), target_dyn, dyn_size);
     debug_print(INFO, "remote_dyn: %p local_dyn %p\n", dyn+elf_base, target_dyn);
 	
-    void *remote_debug = malloc(sizeof(void*));
+    void *remote_debug = NULL;
 
     for (int i=0; i<dyn_size; i++) {
 	if (target_dyn[i].d_tag == DT_DEBUG) {
@@ -210,14 +210,13 @@ struct r_debug get_r_debug(int pid, struct procstat *psp, struct kinfo_proc *kip
 
     // ***** DT_DEBUG --> Linkmap ***** //
     // We now have the address of the debug section on the dynamic table
-    // next step is then to use the same ptrace trick to get the data at this 
+    // next step is then to use the same trick to get the data at this 
     // address in the target process. This data contains the rtld link_map 
     // we are looking for.
 
     struct r_debug local_debug;
-    piod_read(pid, PIOD_READ_D, remote_debug, (void*)&local_debug, sizeof(struct r_debug));
+    target_read(target, remote_debug, (void*)&local_debug, sizeof(struct r_debug));
 
-    ptrace_detach(pid);
     free(target_phdr);
     free(target_dyn);
 
@@ -233,11 +232,12 @@ struct r_debug get_r_debug(int pid, struct procstat *psp, struct kinfo_proc *kip
 /* scan_linkmap
  * Using the linkmap exposed via r_debug, we can get the list of mapped libraries and their 
  * corresponding compart_id.
+ * The target must already be attached and stopped by the caller, its memory
+ * is read through target. The list and its paths are allocated from a, and
+ * freed with it.
  */
-compart_data_list *scan_rtld_linkmap(int pid, sqlite3 *db, struct r_debug target_debug)
+compart_data_list *scan_rtld_linkmap(const scan_target *target, sqlite3 *db, struct r_debug target_debug, arena *a)
 {
-    ptrace_attach(pid);
-
     struct link_map *r_map = target_debug.r_map;
     compart_data_list *comparts_head = NULL;
 
@@ -245,12 +245,14 @@ compart_data_list *scan_rtld_linkmap(int pid, sqlite3 *db, struct r_debug target
 
 	Obj_Entry entry;
 	void *linkmap_addr = __containerof(r_map, Obj_Entry, linkmap);
-	piod_read(pid, PIOD_READ_D, linkmap_addr, &entry, sizeof(Obj_Entry));
+	target_read(target, linkmap_addr, &entry, sizeof(Obj_Entry));
 	debug_print(INFO, "remote_next_entry: %p local_next_entry: %#p mapbase: %p mapsize: %lu\n", linkmap_addr, entry, entry.mapbase, entry.mapsize);
 
-	char *path = get_string(pid, (psaddr_t)entry.linkmap.l_name, 0);
+	char *remote_path = get_string(target, (psaddr_t)entry.linkmap.l_name, 0);
+	char *path = arena_strdup(a, remote_path);
+	free(remote_path);
 
-	char *path_name = (char*)malloc(sizeof(path));
+	char *path_name;
 	get_filename_from_path(path, &path_name);			
 	debug_print(INFO, "remote_linkmap_name: %p path: %s default_compart_id: %d\n", entry.linkmap.l_name, path_name, entry.default_compart_id);
 
@@ -262,13 +264,13 @@ compart_data_list *scan_rtld_linkmap(int pid, sqlite3 *db, struct r_debug target
 	default_data.is_default = true;
 
 	compart_data_list *comparts_entry;
-	comparts_entry = (compart_data_list*)malloc(sizeof(compart_data_list));
+	comparts_entry = arena_alloc(a, sizeof(compart_data_list));
 	comparts_entry->data = default_data;
 	comparts_entry->next = comparts_head;
 	comparts_head = comparts_entry;
 
 	char *insert_default_compart_q;
-	asprintf(&insert_default_compart_q, "INSERT OR REPLACE INTO comparts(compart_id, library_path, start_addr, end_addr, is_default) VALUES (%d, \"%s\", \"0x%lx\", \"0x%lx\", %d);", default_data.id, path_name, default_data.start_addr, default_data.end_addr, default_data.is_default);
+	asprintf(&insert_default_compart_q, "INSERT OR REPLACE INTO comparts(compart_id, library_path, start_addr, end_addr, is_default, snapshot_id) VALUES (%d, \"%s\", %lu, %lu, %d, %ld);", default_data.id, path_name, default_data.start_addr, default_data.end_addr, default_data.is_default, get_snapshot_id(db));
 
 	sql_query_exec(db, insert_default_compart_q, NULL, NULL);
 	free(insert_default_compart_q);
@@ -281,14 +283,15 @@ compart_data_list *scan_rtld_linkmap(int pid, sqlite3 *db, struct r_debug target
 
 	    for (int i=0; i<entry.ncomparts; i++) {
 		// Found a sub-compartment, construct an entry and then add to the list
-		piod_read(pid, PIOD_READ_D, subcompart_addr, &current_subcompart, sizeof(Compart_Entry));
+		target_read(target, subcompart_addr, &current_subcompart, sizeof(Compart_Entry));
 
-		char *compart_full_name = get_string(pid, (psaddr_t)current_subcompart.compart_name, 0);
-		char *compart_name = (char*)malloc(sizeof(compart_full_name));
+		char *compart_full_name = get_string(target, (psaddr_t)current_subcompart.compart_name, 0);
+		char *compart_name;
 		get_filename_from_path(compart_full_name, &compart_name);			
+		free(compart_full_name);
 		
 		char *insert_subcomparts_q;
-		asprintf(&insert_subcomparts_q, "INSERT OR REPLACE INTO comparts(compart_id, compart_name, start_addr, end_addr, is_default, parent_id) VALUES (%d, \"%s\", \"0x%lx\", \"0x%lx\", %d, %d);", current_subcompart.compart_id, compart_name, current_subcompart.start, current_subcompart.end, false, default_data.id);
+		asprintf(&insert_subcomparts_q, "INSERT OR REPLACE INTO comparts(compart_id, compart_name, start_addr, end_addr, is_default, parent_id, snapshot_id) VALUES (%d, \"%s\", %lu, %lu, %d, %d, %ld);", current_subcompart.compart_id, compart_name, current_subcompart.start, current_subcompart.end, false, default_data.id, get_snapshot_id(db));
 		sql_query_exec(db, insert_subcomparts_q, NULL, NULL);
 		free(insert_subcomparts_q);
 		free(compart_name);
@@ -300,20 +303,17 @@ compart_data_list *scan_rtld_linkmap(int pid, sqlite3 *db, struct r_debug target
 	r_map = entry.linkmap.l_next;
     }
 
-    ptrace_detach(pid);
-    free(r_map);
-
     return comparts_head;
 }
 
 /* scan_r_comparts
  * Using the r_comparts array exposed via r_debug, we can obtain the list of 
  * compartments names and their ids.
+ * The target must already be attached and stopped by the caller, its memory
+ * is read through target. The names are allocated from a, and freed with it.
  */
-char **scan_r_comparts(int pid, sqlite3 *db, struct r_debug target_debug)
+char **scan_r_comparts(const scan_target *target, sqlite3 *db, struct r_debug target_debug, arena *a)
 {
-    ptrace_attach(pid);
-
     // In gdb, this is how the same data is extracted: 
     // ((struct compart *)r_debug->r_comparts)[r_debug->r_comparts_size]
 
@@ -324,17 +324,17 @@ char **scan_r_comparts(int pid, sqlite3 *db, struct r_debug target_debug)
     // it can be queried from ELF syms. During the ELF syms we can extract this value and store
     // it to a local variable or it can be queried from the elf_sym sqlite table.
     int comparts_entry_size = sizeof(compart_t);
-    char **compart_names = calloc(comparts_entry_size*sizeof(char), comparts_size);
+    char **compart_names = arena_calloc(a, comparts_size, sizeof(char *));
 
     for (int i=0; i<comparts_size; i++) {
         compart_t comparts_entry;
-        piod_read(pid, PIOD_READ_D, comparts, &comparts_entry, sizeof(compart_t));
+        target_read(target, comparts, &comparts_entry, sizeof(compart_t));
         
-	comparts = comparts + sizeof(compart_t);
+	comparts = comparts + comparts_entry_size;
 	
-	char *compart_full_name = get_string(pid, (psaddr_t)comparts_entry.name, 0);
+	char *compart_full_name = get_string(target, (psaddr_t)comparts_entry.name, 0);
         if (compart_full_name != NULL) {
-	    char *compart_name = (char*)malloc(sizeof(compart_full_name));
+	    char *compart_name;
 	    get_filename_from_path(compart_full_name, &compart_name);			
 
 	    debug_print(INFO, "i: %d remote_comparts_entry: %p obtained compartment name: %s\n", i, comparts_entry, compart_name);
@@ -343,14 +343,16 @@ char **scan_r_comparts(int pid, sqlite3 *db, struct r_debug target_debug)
 	    asprintf(&insert_comparts_db_table_q, 
 		"UPDATE comparts SET "
 		"compart_name=\"%s\" "
-                "WHERE compart_id=%d;", compart_name, i);
+                "WHERE compart_id=%d AND snapshot_id=%ld;", compart_name, i, get_snapshot_id(db));
 	    sql_query_exec(db, insert_comparts_db_table_q, NULL, NULL);
 	    free(insert_comparts_db_table_q);
+	    free(compart_name);
+
+	    compart_names[i] = arena_strdup(a, compart_full_name);
+	    free(compart_full_name);
 	}
-	compart_names[i] = compart_full_name;
     }
 
-    ptrace_detach(pid);
     return compart_names;
 }
 
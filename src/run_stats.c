@@ -0,0 +1,156 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "run_stats.h"
+
+/* Set by --stats, see set_run_stats */
+static int run_stats_on = 0;
+static struct timespec run_started;
+
+static atomic_ulong phase_calls[RUN_PHASES];
+static atomic_ulong phase_wall_ns[RUN_PHASES];
+static atomic_ulong phase_cpu_ns[RUN_PHASES];
+static atomic_ulong counters[RUN_COUNTERS];
+
+static const char *phase_names[RUN_PHASES] = {
+	[RUN_PHASE_PROCSTAT] = "procstat",
+	[RUN_PHASE_R_DEBUG] = "r_debug",
+	[RUN_PHASE_LINKMAP] = "linkmap",
+	[RUN_PHASE_R_COMPARTS] = "r_comparts",
+	[RUN_PHASE_ELF_PARSE] = "elf_parse",
+	[RUN_PHASE_TAG_READ] = "tag_read",
+	[RUN_PHASE_CAP_READ] = "cap_read",
+	[RUN_PHASE_SQL_INSERT] = "sql_insert",
+	[RUN_PHASE_VIEW] = "view",
+};
+
+static u_long elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+	return (u_long)(to->tv_sec - from->tv_sec) * 1000000000UL + to->tv_nsec - from->tv_nsec;
+}
+
+/*
+ * set_run_stats(enabled)
+ * With enabled set, the phases and counters of the run are recorded from
+ * now on. It has to be set before any thread is started.
+ */
+void set_run_stats(int enabled)
+{
+	run_stats_on = enabled;
+	clock_gettime(CLOCK_MONOTONIC, &run_started);
+}
+
+int run_stats_enabled(void)
+{
+	return run_stats_on;
+}
+
+/*
+ * run_phase_begin(timer, phase)
+ * Starts timing phase on the calling thread, until run_phase_end(timer) is
+ * called on the same thread.
+ */
+void run_phase_begin(run_timer *timer, run_phase phase)
+{
+	assert(phase >= 0 && phase < RUN_PHASES);
+
+	timer->active = run_stats_on;
+	if (!timer->active) {
+		return;
+	}
+	timer->phase = phase;
+	clock_gettime(CLOCK_MONOTONIC, &timer->wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &timer->cpu);
+}
+
+void run_phase_end(run_timer *timer)
+{
+	struct timespec wall, cpu;
+
+	if (!timer->active) {
+		return;
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	atomic_fetch_add_explicit(&phase_calls[timer->phase], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&phase_wall_ns[timer->phase], elapsed_ns(&timer->wall, &wall), memory_order_relaxed);
+	atomic_fetch_add_explicit(&phase_cpu_ns[timer->phase], elapsed_ns(&timer->cpu, &cpu), memory_order_relaxed);
+	timer->active = 0;
+}
+
+/*
+ * run_count(counter, n)
+ * Adds n to counter, from any thread.
+ */
+void run_count(run_counter counter, u_long n)
+{
+	assert(counter >= 0 && counter < RUN_COUNTERS);
+
+	if (run_stats_on) {
+		atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+	}
+}
+
+const char *run_phase_name(run_phase phase)
+{
+	assert(phase >= 0 && phase < RUN_PHASES);
+	return phase_names[phase];
+}
+
+/*
+ * get_run_stats(stats)
+ * Reads what has been recorded so far into stats.
+ */
+void get_run_stats(run_stats *stats)
+{
+	struct timespec now, cpu;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	stats->wall = elapsed_ns(&run_started, &now) / 1e9;
+	stats->cpu = cpu.tv_sec + cpu.tv_nsec / 1e9;
+
+	for (int p=0; p<RUN_PHASES; p++) {
+		stats->phases[p].calls = atomic_load(&phase_calls[p]);
+		stats->phases[p].wall = atomic_load(&phase_wall_ns[p]) / 1e9;
+		stats->phases[p].cpu = atomic_load(&phase_cpu_ns[p]) / 1e9;
+	}
+	for (int c=0; c<RUN_COUNTERS; c++) {
+		stats->counters[c] = atomic_load(&counters[c]);
+	}
+}
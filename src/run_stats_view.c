@@ -0,0 +1,73 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sqlite3.h>
+
+#include <libxo/xo.h>
+
+#include "run_stats.h"
+
+/*
+ * run_stats_view
+ * Shows the time taken by each phase of the run and its counters, see
+ * --stats. The wall and CPU times are in seconds, a phase run by several
+ * threads adds up the time of each one. The high water of the memory used by
+ * SQLite is in bytes.
+ */
+void run_stats_view(void)
+{
+	run_stats stats;
+	sqlite3_int64 current = 0, highwater = 0;
+
+	get_run_stats(&stats);
+	sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+
+	xo_emit("{T:/\n%-12s %10s %10s %10s}\n", "PHASE", "WALL", "CPU", "CALLS");
+	xo_open_list("phase");
+	for (int p=0; p<RUN_PHASES; p++) {
+		xo_open_instance("phase");
+		xo_emit("{k:name/%-12s} ", run_phase_name(p));
+		xo_emit("{:wall/%10.3f} ", stats.phases[p].wall);
+		xo_emit("{:cpu/%10.3f} ", stats.phases[p].cpu);
+		xo_emit("{:calls/%10lu}\n", stats.phases[p].calls);
+		xo_close_instance("phase");
+	}
+	xo_close_list("phase");
+
+	xo_emit("{Lwc:Wall seconds}{:total_wall/%.3f}\n", stats.wall);
+	xo_emit("{Lwc:CPU seconds}{:total_cpu/%.3f}\n", stats.cpu);
+	xo_emit("{Lwc:ptrace calls}{:ptrace_calls/%lu}\n", stats.counters[RUN_PTRACE_CALLS]);
+	xo_emit("{Lwc:Bytes read}{:bytes_read/%lu}\n", stats.counters[RUN_BYTES_READ]);
+	xo_emit("{Lwc:Capabilities found}{:caps_found/%lu}\n", stats.counters[RUN_CAPS_FOUND]);
+	xo_emit("{Lwc:Rows written}{:rows_written/%lu}\n", stats.counters[RUN_ROWS_WRITTEN]);
+	xo_emit("{Lwc:SQLite memory high water}{:sqlite_highwater/%lld}\n", (long long)highwater);
+}
@@ -0,0 +1,341 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "cap_decode.h"
+#include "db_process.h"
+#include "run_stats.h"
+#include "scan_delta.h"
+#include "scan_pool.h"
+#include "tag_scan.h"
+
+#define HASH_SEED	0xcbf29ce484222325ULL
+#define HASH_PRIME	0x100000001b3ULL
+
+/*
+ * hash_bytes
+ * Mixes len bytes into h, 8 bytes at a time. The hashes only tell whether a
+ * page has changed between two scans on the same host.
+ */
+static uint64_t hash_bytes(uint64_t h, const unsigned char *bytes, size_t len)
+{
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, bytes, sizeof(v));
+		h = (h ^ v) * HASH_PRIME;
+		h ^= h >> 32;
+		bytes += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		h = (h ^ *bytes++) * HASH_PRIME;
+		len--;
+	}
+	return h;
+}
+
+uint64_t page_tags_hash(const raw_page *raw)
+{
+	return hash_bytes(HASH_SEED, raw->tags, TAG_SCAN_BYTES_PER_PAGE);
+}
+
+/* page_caps_hash
+ * Hashes the slots of the tagged capabilities of raw, the bytes of the
+ * untagged granules between them do not matter.
+ */
+uint64_t page_caps_hash(const raw_page *raw)
+{
+	uint64_t h = HASH_SEED;
+
+	for (int slot=raw->first_slot; slot<TAG_SCAN_TAGS_PER_PAGE; slot++) {
+		if (raw->tags[slot/8] & (1 << (slot%8))) {
+			h = hash_bytes(h, &raw->slots[(slot-raw->first_slot)*CAP_DECODE_SLOT_SIZE], CAP_DECODE_SLOT_SIZE);
+		}
+	}
+	return h;
+}
+
+static size_t page_slot(uint64_t page, size_t mask)
+{
+	return ((page / TAG_SCAN_PAGE_SIZE) * 0x9e3779b97f4a7c15ULL >> 17) & mask;
+}
+
+static page_hash_entry *find_previous(scan_delta *delta, uint64_t page)
+{
+	for (size_t i=page_slot(page, delta->mask); delta->previous[i].used; i=(i+1) & delta->mask) {
+		if (delta->previous[i].page == page) {
+			return &delta->previous[i];
+		}
+	}
+	return NULL;
+}
+
+static sqlite3_stmt *prepare(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "Unable to prepare %s on db %s: %s", query, get_dbname(), sqlite3_errmsg(db));
+	}
+	return stmt;
+}
+
+static void step_reset(scan_delta *delta, sqlite3_stmt *stmt)
+{
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		fprintf(stderr, "SQL error updating the scan: %s (db: %s)\n", sqlite3_errmsg(delta->db), get_dbname());
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+/*
+ * load_previous
+ * Reads the page hashes of the previous incremental scan of the process into
+ * an open addressing table, at most half full.
+ */
+static void load_previous(scan_delta *delta)
+{
+	sqlite3_stmt *stmt = prepare(delta->db, "SELECT COUNT(*) FROM page_hash WHERE pid = ?;");
+	sqlite3_bind_int64(stmt, 1, delta->pid);
+	size_t count = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+	sqlite3_finalize(stmt);
+
+	size_t capacity = 64;
+	while (capacity < count*2) {
+		capacity *= 2;
+	}
+	delta->previous = calloc(capacity, sizeof(page_hash_entry));
+	if (delta->previous == NULL) {
+		errx(1, "Cannot allocate the hashes of %zu pages", count);
+	}
+	delta->mask = capacity - 1;
+
+	stmt = prepare(delta->db, "SELECT page_addr, tags_hash, caps_hash FROM page_hash WHERE pid = ?;");
+	sqlite3_bind_int64(stmt, 1, delta->pid);
+	while (sqlite3_step(stmt) == SQLITE_ROW && delta->previous_count < count) {
+		uint64_t page = sqlite3_column_int64(stmt, 0);
+		size_t i = page_slot(page, delta->mask);
+		while (delta->previous[i].used) {
+			i = (i+1) & delta->mask;
+		}
+		page_hash_entry *entry = &delta->previous[i];
+		entry->page = page;
+		entry->tags_hash = sqlite3_column_int64(stmt, 1);
+		entry->caps_hash = sqlite3_column_int64(stmt, 2);
+		entry->used = 1;
+		delta->previous_count++;
+	}
+	sqlite3_finalize(stmt);
+}
+
+/*
+ * scan_delta_previous(db, pid)
+ * Returns the snapshot the page hashes of process pid were taken of, by its
+ * previous incremental scan, or 0 if an incremental scan of pid has nothing
+ * to compare with. The snapshots taken since, of pid or of other processes,
+ * do not matter.
+ */
+int64_t scan_delta_previous(sqlite3 *db, int64_t pid)
+{
+	int64_t previous_id = 0;
+
+	if (!db_table_exists(db, "page_hash_snapshot") || !db_table_exists(db, "snapshot")) {
+		return (0);
+	}
+	sqlite3_stmt *stmt = prepare(db, "SELECT h.snapshot_id FROM page_hash_snapshot h "
+	    "JOIN snapshot s ON s.snapshot_id = h.snapshot_id "
+	    "WHERE h.pid = ?1 AND s.pid = ?1;");
+	sqlite3_bind_int64(stmt, 1, pid);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		previous_id = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return previous_id;
+}
+
+/*
+ * scan_delta_open(db, delta, pid, previous_id)
+ * Starts an incremental scan of process pid into the snapshot being taken
+ * into db, inside the snapshot transaction, against the snapshot previous_id
+ * the page hashes of pid were taken of, see scan_delta_previous. With a
+ * previous_id of 0 the page hashes of pid are cleared and every page is
+ * written.
+ */
+int scan_delta_open(sqlite3 *db, scan_delta *delta, int64_t pid, int64_t previous_id)
+{
+	memset(delta, 0, sizeof(scan_delta));
+	delta->db = db;
+	delta->pid = pid;
+	delta->previous_id = previous_id;
+
+	if (create_page_hash_table(db) != 0 || cap_writer_open(db, &delta->writer) != 0) {
+		return (1);
+	}
+	if (previous_id == 0) {
+		sqlite3_stmt *stmt = prepare(db, "DELETE FROM page_hash WHERE pid = ?;");
+		sqlite3_bind_int64(stmt, 1, pid);
+		int rc = sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+		if (rc != SQLITE_DONE) {
+			return (1);
+		}
+	}
+	load_previous(delta);
+	debug_print(TROUBLESHOOT, "Key Stage: Incremental scan against %zu pages of snapshot %ld\n",
+	    delta->previous_count, (long)previous_id);
+
+	// The page keeps the path of its vm entry in this scan
+	delta->copy_caps_stmt = prepare(db,
+	    "INSERT INTO cap_info(cap_loc_addr, cap_loc_path_id, cap_addr, perms, base, top, snapshot_id) "
+	    "SELECT cap_loc_addr, ?1, cap_addr, perms, base, top, ?2 FROM cap_info "
+	    "WHERE snapshot_id = ?3 AND cap_loc_addr >= ?4 AND cap_loc_addr < ?5 ORDER BY cap_loc_addr;");
+	delta->upsert_hash_stmt = prepare(db,
+	    "INSERT OR REPLACE INTO page_hash(pid, page_addr, tags_hash, caps_hash) VALUES(?, ?, ?, ?);");
+	delta->delete_hash_stmt = prepare(db, "DELETE FROM page_hash WHERE pid = ? AND page_addr = ?;");
+	return (0);
+}
+
+/*
+ * copy_page_caps
+ * Copies the capabilities of an unchanged page from the previous snapshot.
+ */
+static void copy_page_caps(scan_delta *delta, const raw_page *raw)
+{
+	int64_t path_id = path_cache_id(&delta->writer.paths, raw->path);
+	if (path_id == 0) {
+		return;
+	}
+	sqlite3_bind_int64(delta->copy_caps_stmt, 1, path_id);
+	sqlite3_bind_int64(delta->copy_caps_stmt, 2, delta->writer.snapshot_id);
+	sqlite3_bind_int64(delta->copy_caps_stmt, 3, delta->previous_id);
+	sqlite3_bind_int64(delta->copy_caps_stmt, 4, (sqlite3_int64)raw->page);
+	sqlite3_bind_int64(delta->copy_caps_stmt, 5, (sqlite3_int64)(raw->page + TAG_SCAN_PAGE_SIZE));
+	step_reset(delta, delta->copy_caps_stmt);
+	delta->copied += sqlite3_changes(delta->db);
+}
+
+static void write_capability(void *arg, u_long cap_loc_addr, const cap_decoded *cap)
+{
+	scan_delta *delta = arg;
+
+	cap_writer_insert(&delta->writer, cap_loc_addr, delta->path, cap->addr, cap->perms, cap->base, cap->top);
+	delta->caps++;
+}
+
+/*
+ * scan_delta_page(arg, raw)
+ * The page sink of an incremental scan. A page whose tags and capabilities
+ * hash to the same values as in the previous scan has its capabilities
+ * copied from the previous snapshot, otherwise they are decoded again.
+ */
+void scan_delta_page(void *arg, const raw_page *raw)
+{
+	scan_delta *delta = arg;
+	uint64_t tags_hash = page_tags_hash(raw);
+	uint64_t caps_hash = page_caps_hash(raw);
+
+	run_timer timer;
+
+	// The rows of a page are timed as one batch
+	run_phase_begin(&timer, RUN_PHASE_SQL_INSERT);
+	page_hash_entry *entry = find_previous(delta, raw->page);
+	if (entry != NULL) {
+		entry->seen = 1;
+		if (entry->tags_hash == tags_hash && entry->caps_hash == caps_hash) {
+			copy_page_caps(delta, raw);
+			delta->unchanged++;
+			run_phase_end(&timer);
+			return;
+		}
+	}
+
+	delta->path = raw->path;
+	decode_page_caps(raw, write_capability, delta);
+
+	sqlite3_bind_int64(delta->upsert_hash_stmt, 1, delta->pid);
+	sqlite3_bind_int64(delta->upsert_hash_stmt, 2, (sqlite3_int64)raw->page);
+	sqlite3_bind_int64(delta->upsert_hash_stmt, 3, (sqlite3_int64)tags_hash);
+	sqlite3_bind_int64(delta->upsert_hash_stmt, 4, (sqlite3_int64)caps_hash);
+	step_reset(delta, delta->upsert_hash_stmt);
+	delta->changed++;
+	run_phase_end(&timer);
+}
+
+/*
+ * scan_delta_close(delta)
+ * Forgets the pages that had capabilities in the previous scan but none in
+ * this one, records the snapshot the page hashes of the process are now of
+ * and releases the statements of the scan.
+ */
+void scan_delta_close(scan_delta *delta)
+{
+	for (size_t i=0; i<=delta->mask; i++) {
+		page_hash_entry *entry = &delta->previous[i];
+		if (!entry->used || entry->seen) {
+			continue;
+		}
+		sqlite3_bind_int64(delta->delete_hash_stmt, 1, delta->pid);
+		sqlite3_bind_int64(delta->delete_hash_stmt, 2, (sqlite3_int64)entry->page);
+		step_reset(delta, delta->delete_hash_stmt);
+		delta->removed++;
+	}
+
+	sqlite3_stmt *stmt = prepare(delta->db,
+	    "INSERT OR REPLACE INTO page_hash_snapshot(pid, snapshot_id) VALUES(?, ?);");
+	sqlite3_bind_int64(stmt, 1, delta->pid);
+	sqlite3_bind_int64(stmt, 2, delta->writer.snapshot_id);
+	step_reset(delta, stmt);
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(delta->copy_caps_stmt);
+	sqlite3_finalize(delta->upsert_hash_stmt);
+	sqlite3_finalize(delta->delete_hash_stmt);
+	cap_writer_close(&delta->writer);
+	free(delta->previous);
+	delta->previous = NULL;
+}
+
+void print_scan_delta_stats(scan_delta *delta)
+{
+	debug_print(INFO, "Incremental scan: %lu pages unchanged, %lu new or changed, %lu removed, "
+	    "%lu capabilities written, %lu copied from snapshot %ld\n", delta->unchanged, delta->changed,
+	    delta->removed, delta->caps, delta->copied, (long)delta->previous_id);
+}
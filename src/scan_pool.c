@@ -0,0 +1,700 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "common.h"
+#include "cap_decode.h"
+#include "db_process.h"
+#include "mpmc_ring.h"
+#include "run_stats.h"
+#include "scan_pool.h"
+#include "tag_scan.h"
+
+/* A range of a vm entry scanned by one reader */
+typedef struct scan_task {
+	u_long start;
+	u_long end;
+	const char *path;
+} scan_task;
+
+/* A decoded capability on its way to the writer */
+typedef struct cap_record {
+	u_long cap_loc_addr;
+	const char *path;
+	cap_decoded cap;
+} cap_record;
+
+/*
+ * The threads waiting for a queue to change. A thread that finds the queue
+ * full or empty tries again SCAN_POOL_SPINS times, then sleeps on cond until
+ * the other side wakes it with queue_wake. The other side only takes the lock
+ * when there are sleepers.
+ */
+typedef struct queue_waiters {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	atomic_int sleepers;
+} queue_waiters;
+
+#define SCAN_POOL_SPINS	64
+
+/* Capabilities written by the writer between two reads of the clock */
+#define SCAN_POOL_WRITE_BATCH	256
+
+/*
+ * A ring between two stages of the pipeline. The consumer waits on filled
+ * while it is empty, the producers wait on drained while it is full. The
+ * ring is closed once all its producers are done.
+ */
+typedef struct scan_queue {
+	mpmc_ring ring;
+	atomic_int producers;	/* Producers not done yet */
+	queue_waiters filled;
+	queue_waiters drained;
+} scan_queue;
+
+/* The counters of a stage, updated by its threads */
+typedef struct stage_counters {
+	atomic_ulong items;
+	atomic_ulong stalls;
+	atomic_ulong idle;
+	double seconds;
+} stage_counters;
+
+struct scan_pool {
+	scan_target target;
+	cap_writer *writer;
+	raw_page_fn page_sink;
+	void *page_sink_arg;
+	int readers;
+	double started;
+
+	scan_task *tasks;
+	int task_count;
+	int task_capacity;
+	atomic_int next_task;
+
+	// The paths of the vm entries, interned once and shared by their tasks
+	// and records
+	arena path_arena;
+	str_table paths;
+	int path_count;		/* vm entries added */
+
+	scan_queue pages;	/* From the readers to the decoder */
+	scan_queue records;	/* From the decoder to the writer */
+
+	pthread_t *reader_threads;
+	cap_scan_stats *reader_stats;
+	void *readers_arg;
+	pthread_t decoder_thread;
+	pthread_t writer_thread;
+	int reads_joined;
+	u_long stored;
+
+	stage_counters read;
+	stage_counters decode;
+	stage_counters write;
+};
+
+typedef struct scan_reader {
+	scan_pool *pool;
+	const char *path;
+	cap_scan_stats *stats;
+	raw_page raw;
+} scan_reader;
+
+static int scan_pool_workers = SCAN_POOL_DEFAULT_WORKERS;
+
+void set_scan_pool_workers(int workers)
+{
+	assert(workers > 0 && workers <= SCAN_POOL_MAX_WORKERS);
+	scan_pool_workers = workers;
+}
+
+int get_scan_pool_workers(void)
+{
+	return scan_pool_workers;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int queue_init(scan_queue *queue, size_t capacity, size_t elem_size, int producers)
+{
+	if (mpmc_ring_init(&queue->ring, capacity, elem_size) != 0) {
+		return -1;
+	}
+	atomic_init(&queue->producers, producers);
+	pthread_mutex_init(&queue->filled.lock, NULL);
+	pthread_cond_init(&queue->filled.cond, NULL);
+	atomic_init(&queue->filled.sleepers, 0);
+	pthread_mutex_init(&queue->drained.lock, NULL);
+	pthread_cond_init(&queue->drained.cond, NULL);
+	atomic_init(&queue->drained.sleepers, 0);
+	return 0;
+}
+
+static void queue_free(scan_queue *queue)
+{
+	mpmc_ring_free(&queue->ring);
+	pthread_mutex_destroy(&queue->filled.lock);
+	pthread_cond_destroy(&queue->filled.cond);
+	pthread_mutex_destroy(&queue->drained.lock);
+	pthread_cond_destroy(&queue->drained.cond);
+}
+
+/*
+ * queue_wake
+ * Wakes the threads sleeping on waiters after the queue has changed. The
+ * fences of queue_wake and queue_wait make sure that either the change is
+ * seen by the sleeper before it sleeps, or the sleeper is seen here.
+ */
+static void queue_wake(queue_waiters *waiters)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&waiters->sleepers, memory_order_relaxed) > 0) {
+		pthread_mutex_lock(&waiters->lock);
+		pthread_cond_broadcast(&waiters->cond);
+		pthread_mutex_unlock(&waiters->lock);
+	}
+}
+
+/*
+ * queue_wait
+ * Waits on waiters until ready(arg) returns non-zero, spinning for a while
+ * before going to sleep.
+ */
+static void queue_wait(queue_waiters *waiters, int (*ready)(void *), void *arg)
+{
+	for (int spin=0; spin<SCAN_POOL_SPINS; spin++) {
+		if (ready(arg)) {
+			return;
+		}
+	}
+	pthread_mutex_lock(&waiters->lock);
+	atomic_fetch_add(&waiters->sleepers, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	while (!ready(arg)) {
+		pthread_cond_wait(&waiters->cond, &waiters->lock);
+	}
+	atomic_fetch_sub(&waiters->sleepers, 1);
+	pthread_mutex_unlock(&waiters->lock);
+}
+
+typedef struct queue_op {
+	scan_queue *queue;
+	void *elem;
+	int popped;
+} queue_op;
+
+static int try_push(void *arg)
+{
+	queue_op *op = arg;
+
+	return mpmc_ring_push(&op->queue->ring, op->elem) == 0;
+}
+
+static int try_pop(void *arg)
+{
+	queue_op *op = arg;
+
+	if (mpmc_ring_pop(&op->queue->ring, op->elem) == 0) {
+		op->popped = 1;
+		return 1;
+	}
+	// The producers push everything before they count themselves done
+	if (atomic_load(&op->queue->producers) == 0) {
+		op->popped = mpmc_ring_pop(&op->queue->ring, op->elem) == 0;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * queue_try_pop
+ * Moves the oldest element of queue to elem if there is one, without
+ * waiting. Returns 0 on success, -1 if the queue is empty.
+ */
+static int queue_try_pop(scan_queue *queue, void *elem)
+{
+	if (mpmc_ring_pop(&queue->ring, elem) != 0) {
+		return -1;
+	}
+	queue_wake(&queue->drained);
+	return 0;
+}
+
+/*
+ * queue_push
+ * Pushes elem to queue, waiting for room when the next stage is behind. The
+ * waits are counted as stalls of the stage.
+ */
+static void queue_push(scan_queue *queue, const void *elem, stage_counters *stage)
+{
+	queue_op op = { queue, (void *)elem, 0 };
+
+	if (!try_push(&op)) {
+		atomic_fetch_add_explicit(&stage->stalls, 1, memory_order_relaxed);
+		queue_wait(&queue->drained, try_push, &op);
+	}
+	atomic_fetch_add_explicit(&stage->items, 1, memory_order_relaxed);
+	queue_wake(&queue->filled);
+}
+
+/*
+ * queue_pop
+ * Moves the oldest element of queue to elem, waiting for one while the
+ * previous stage is running. The waits are counted as idle time of the
+ * stage. Returns 0 on success, -1 once the queue is closed and drained.
+ */
+static int queue_pop(scan_queue *queue, void *elem, stage_counters *stage)
+{
+	queue_op op = { queue, elem, 0 };
+
+	if (!try_pop(&op)) {
+		atomic_fetch_add_explicit(&stage->idle, 1, memory_order_relaxed);
+		queue_wait(&queue->filled, try_pop, &op);
+	}
+	if (!op.popped) {
+		return -1;
+	}
+	queue_wake(&queue->drained);
+	return 0;
+}
+
+/*
+ * queue_close
+ * Counts a producer of queue as done, the consumer is woken to drain it once
+ * they all are.
+ */
+static void queue_close(scan_queue *queue)
+{
+	atomic_fetch_sub(&queue->producers, 1);
+	queue_wake(&queue->filled);
+}
+
+/*
+ * read_page_caps
+ * Given the tags of a page - page_tags - read by the PIOD_READ_CHERI_TAGS API,
+ * reads the capability slots of the page starting at "page" into raw. The
+ * slots from the first to the last tagged one are read with a single request.
+ * If the batched read fails each capability is read on its own instead, and
+ * the tags of the ones that cannot be read are dropped.
+ * Returns the number of capabilities read.
+ */
+int read_page_caps(const scan_target *target, u_long page, const unsigned char *page_tags,
+    raw_page *raw, cap_scan_stats *stats)
+{
+	int first_slot = -1;
+	int last_slot = -1;
+	for (int slot=0; slot<TAG_SCAN_TAGS_PER_PAGE; slot++) {
+		if (page_tags[slot/8] & (1 << (slot%8))) {
+			if (first_slot == -1) {
+				first_slot = slot;
+			}
+			last_slot = slot;
+		}
+	}
+	if (first_slot == -1) {
+		return 0;
+	}
+
+	raw->page = page;
+	raw->first_slot = first_slot;
+	memcpy(raw->tags, page_tags, TAG_SCAN_BYTES_PER_PAGE);
+
+	run_timer timer;
+	run_phase_begin(&timer, RUN_PHASE_CAP_READ);
+	int batched = target->read_caps(target->arg, page + first_slot*TAG_SCAN_GRANULE_SIZE,
+	    raw->slots, last_slot-first_slot+1) == 0;
+	stats->cap_requests++;
+
+	int cap_count = 0;
+	for (int slot=first_slot; slot<=last_slot; slot++) {
+		if ((raw->tags[slot/8] & (1 << (slot%8))) == 0) {
+			continue;
+		}
+		if (!batched) {
+			stats->cap_requests++;
+			if (target->read_caps(target->arg, page + slot*TAG_SCAN_GRANULE_SIZE,
+			    &raw->slots[(slot-first_slot)*CAP_DECODE_SLOT_SIZE], 1) != 0) {
+				raw->tags[slot/8] &= ~(1 << (slot%8));
+				continue;
+			}
+		}
+		cap_count++;
+		stats->caps++;
+	}
+	run_phase_end(&timer);
+	return cap_count;
+}
+
+/*
+ * decode_page_caps
+ * Decodes the tagged slots of raw and calls found for each capability.
+ */
+void decode_page_caps(const raw_page *raw, cap_found_fn found, void *found_arg)
+{
+	for (int slot=raw->first_slot; slot<TAG_SCAN_TAGS_PER_PAGE; slot++) {
+		if ((raw->tags[slot/8] & (1 << (slot%8))) == 0) {
+			continue;
+		}
+		cap_decoded cap;
+		cap_decode_slot(&raw->slots[(slot-raw->first_slot)*CAP_DECODE_SLOT_SIZE], &cap);
+		found(found_arg, raw->page + slot*TAG_SCAN_GRANULE_SIZE, &cap);
+	}
+}
+
+/*
+ * scan_pool_create(target, writer, readers)
+ * Makes a pool of readers of the capabilities of target, the capabilities
+ * are decoded by one thread and stored through writer by another.
+ */
+scan_pool *scan_pool_create(const scan_target *target, cap_writer *writer, int readers)
+{
+	assert(readers > 0 && readers <= SCAN_POOL_MAX_WORKERS);
+
+	scan_pool *pool = calloc(1, sizeof(scan_pool));
+	if (pool == NULL ||
+	    queue_init(&pool->pages, SCAN_POOL_PAGE_QUEUE_SIZE, sizeof(raw_page), readers) != 0 ||
+	    queue_init(&pool->records, SCAN_POOL_QUEUE_SIZE, sizeof(cap_record), 1) != 0) {
+		errx(1, "Cannot allocate the scan pool for %d readers", readers);
+	}
+	pool->target = *target;
+	pool->writer = writer;
+	pool->readers = readers;
+	arena_init(&pool->path_arena, 0);
+	str_table_init(&pool->paths, &pool->path_arena);
+	return pool;
+}
+
+/*
+ * scan_pool_set_page_sink(pool, sink, arg)
+ * Hands the pages read by the pool to sink, from the decoder thread, rather
+ * than decoding and storing their capabilities. The writer of the pool is
+ * then not used and can be NULL.
+ */
+void scan_pool_set_page_sink(scan_pool *pool, raw_page_fn sink, void *arg)
+{
+	pool->page_sink = sink;
+	pool->page_sink_arg = arg;
+}
+
+/*
+ * scan_pool_add(pool, start, end, path)
+ * Queues the vm entry [start, end) mapped from path to be scanned, in tasks
+ * of up to SCAN_POOL_TASK_PAGES pages so that a large entry is spread over
+ * the readers.
+ */
+void scan_pool_add(scan_pool *pool, u_long start, u_long end, const char *path)
+{
+	char *task_path = str_intern(&pool->paths, path);
+	pool->path_count++;
+
+	const u_long task_size = (u_long)SCAN_POOL_TASK_PAGES*TAG_SCAN_PAGE_SIZE;
+	u_long task_start = start;
+	while (task_start < end) {
+		if (pool->task_count == pool->task_capacity) {
+			pool->task_capacity = pool->task_capacity == 0 ? 256 : pool->task_capacity*2;
+			pool->tasks = realloc(pool->tasks, pool->task_capacity*sizeof(scan_task));
+			if (pool->tasks == NULL) {
+				errx(1, "Cannot grow the scan pool to %d tasks", pool->task_capacity);
+			}
+		}
+		scan_task *task = &pool->tasks[pool->task_count++];
+		task->start = task_start;
+		task->end = end - task_start > task_size ? task_start + task_size : end;
+		task->path = task_path;
+		task_start = task->end;
+	}
+}
+
+static void scan_reader_page(void *arg, u_long page, const unsigned char *page_tags)
+{
+	scan_reader *reader = (scan_reader *)arg;
+	scan_pool *pool = reader->pool;
+
+	if (read_page_caps(&pool->target, page, page_tags, &reader->raw, reader->stats) > 0) {
+		reader->raw.path = reader->path;
+		queue_push(&pool->pages, &reader->raw, &pool->read);
+	}
+}
+
+/*
+ * scan_reader_main
+ * Takes the next task of the pool until there are none left. Each reader has
+ * its own tag and capability buffers, the tasks are handed out with an
+ * atomic counter.
+ */
+static void *scan_reader_main(void *arg)
+{
+	scan_reader *reader = arg;
+	scan_pool *pool = reader->pool;
+	int t;
+
+	while ((t = atomic_fetch_add(&pool->next_task, 1)) < pool->task_count) {
+		scan_task *task = &pool->tasks[t];
+		reader->path = task->path;
+		tag_scan_range(task->start, task->end, pool->target.read_tags, pool->target.arg,
+		    scan_reader_page, reader, &reader->stats->tags);
+	}
+	queue_close(&pool->pages);
+	return NULL;
+}
+
+typedef struct scan_decoder {
+	scan_pool *pool;
+	const char *path;
+} scan_decoder;
+
+static void queue_capability(void *arg, u_long cap_loc_addr, const cap_decoded *cap)
+{
+	scan_decoder *decoder = arg;
+	cap_record record = { cap_loc_addr, decoder->path, *cap };
+
+	queue_push(&decoder->pool->records, &record, &decoder->pool->decode);
+}
+
+static void decode_page(scan_decoder *decoder, const raw_page *raw)
+{
+	scan_pool *pool = decoder->pool;
+
+	if (pool->page_sink != NULL) {
+		pool->page_sink(pool->page_sink_arg, raw);
+		atomic_fetch_add_explicit(&pool->decode.items, 1, memory_order_relaxed);
+		return;
+	}
+	decoder->path = raw->path;
+	decode_page_caps(raw, queue_capability, decoder);
+}
+
+/*
+ * scan_decoder_main
+ * Decodes the pages read by the readers until they are all done and their
+ * queue is drained. With a page sink the pages are handed to it instead.
+ */
+static void *scan_decoder_main(void *arg)
+{
+	scan_pool *pool = arg;
+	scan_decoder decoder = { pool, NULL };
+	raw_page *raw = malloc(sizeof(raw_page));
+	if (raw == NULL) {
+		errx(1, "Cannot allocate the decoder page buffer");
+	}
+
+	while (queue_pop(&pool->pages, raw, &pool->decode) == 0) {
+		decode_page(&decoder, raw);
+	}
+	free(raw);
+	pool->decode.seconds = now() - pool->started;
+	queue_close(&pool->records);
+	return NULL;
+}
+
+static void store_capability(scan_pool *pool, const cap_record *record)
+{
+	const cap_decoded *cap = &record->cap;
+	char perms[CAP_PERMS_STR_SIZE];
+
+	debug_print(VERBOSE, "Decoded cap at 0x%lx: addr 0x%lx perms: %s base: 0x%lx top: 0x%lx otype: %ld sealed: %d\n",
+	    record->cap_loc_addr, cap->addr, cap_perms_str(cap->perms, perms, sizeof(perms)),
+	    cap->base, cap->top, (long)cap->otype, cap->sealed);
+
+	cap_writer_insert(pool->writer, record->cap_loc_addr, record->path, cap->addr, cap->perms,
+	    cap->base, cap->top);
+	atomic_fetch_add_explicit(&pool->write.items, 1, memory_order_relaxed);
+}
+
+/*
+ * scan_writer_main
+ * Stores the decoded capabilities until the decoder is done and their queue
+ * is drained. This is the only thread using the database while the pool
+ * runs. The capabilities queued are written and timed in batches of up to
+ * SCAN_POOL_WRITE_BATCH, the waits for more are left out.
+ */
+static void *scan_writer_main(void *arg)
+{
+	scan_pool *pool = arg;
+	cap_record record;
+	run_timer timer;
+
+	while (queue_pop(&pool->records, &record, &pool->write) == 0) {
+		int batch = 0;
+		run_phase_begin(&timer, RUN_PHASE_SQL_INSERT);
+		do {
+			store_capability(pool, &record);
+			pool->stored++;
+		} while (++batch < SCAN_POOL_WRITE_BATCH && queue_try_pop(&pool->records, &record) == 0);
+		run_phase_end(&timer);
+	}
+	pool->write.seconds = now() - pool->started;
+	return NULL;
+}
+
+/*
+ * scan_pool_start(pool)
+ * Starts the readers, the decoder and the writer of the pool on the queued
+ * vm entries. The database of the writer must not be used until
+ * scan_pool_finish has returned.
+ */
+void scan_pool_start(scan_pool *pool)
+{
+	debug_print(TROUBLESHOOT, "Key Stage: Scanning %d tasks from %d vm entries with %d readers\n",
+	    pool->task_count, pool->path_count, pool->readers);
+
+	pool->reader_threads = calloc(pool->readers, sizeof(pthread_t));
+	pool->reader_stats = calloc(pool->readers, sizeof(cap_scan_stats));
+	scan_reader *readers = calloc(pool->readers, sizeof(scan_reader));
+	if (pool->reader_threads == NULL || pool->reader_stats == NULL || readers == NULL) {
+		errx(1, "Cannot allocate %d scan readers", pool->readers);
+	}
+	pool->started = now();
+
+	if (pthread_create(&pool->writer_thread, NULL, scan_writer_main, pool) != 0 ||
+	    pthread_create(&pool->decoder_thread, NULL, scan_decoder_main, pool) != 0) {
+		errx(1, "Cannot start the scan decoder and writer");
+	}
+	for (int r=0; r<pool->readers; r++) {
+		readers[r].pool = pool;
+		readers[r].stats = &pool->reader_stats[r];
+		if (pthread_create(&pool->reader_threads[r], NULL, scan_reader_main, &readers[r]) != 0) {
+			errx(1, "Cannot start scan reader %d", r);
+		}
+	}
+	// The readers are freed once they have been joined
+	pool->readers_arg = readers;
+}
+
+/*
+ * scan_pool_wait_reads(pool)
+ * Waits until every read from the target is done, the target can be
+ * released while the capabilities are still being decoded and written.
+ */
+void scan_pool_wait_reads(scan_pool *pool)
+{
+	if (pool->reads_joined) {
+		return;
+	}
+	for (int r=0; r<pool->readers; r++) {
+		pthread_join(pool->reader_threads[r], NULL);
+	}
+	pool->read.seconds = now() - pool->started;
+	pool->reads_joined = 1;
+	free(pool->readers_arg);
+	pool->readers_arg = NULL;
+}
+
+static void add_stage_stats(scan_stage_stats *out, stage_counters *stage)
+{
+	out->items += atomic_load(&stage->items);
+	out->stalls += atomic_load(&stage->stalls);
+	out->idle += atomic_load(&stage->idle);
+	out->seconds += stage->seconds;
+}
+
+/*
+ * scan_pool_finish(pool, stats)
+ * Waits until every capability found has been written. The counters of the
+ * readers and of each stage are added to stats. Returns the number of
+ * capabilities stored.
+ */
+u_long scan_pool_finish(scan_pool *pool, cap_scan_stats *stats)
+{
+	scan_pool_wait_reads(pool);
+	pthread_join(pool->decoder_thread, NULL);
+	pthread_join(pool->writer_thread, NULL);
+
+	for (int r=0; r<pool->readers; r++) {
+		cap_scan_stats *reader_stats = &pool->reader_stats[r];
+		stats->tags.pages += reader_stats->tags.pages;
+		stats->tags.tagged_pages += reader_stats->tags.tagged_pages;
+		stats->tags.requests += reader_stats->tags.requests;
+		stats->caps += reader_stats->caps;
+		stats->cap_requests += reader_stats->cap_requests;
+		run_count(RUN_CAPS_FOUND, reader_stats->caps);
+	}
+	add_stage_stats(&stats->read, &pool->read);
+	add_stage_stats(&stats->decode, &pool->decode);
+	add_stage_stats(&stats->write, &pool->write);
+	return pool->stored;
+}
+
+/*
+ * scan_pool_run(pool, stats)
+ * Scans the queued vm entries and waits until all the capabilities found have
+ * been written, see scan_pool_start and scan_pool_finish.
+ */
+u_long scan_pool_run(scan_pool *pool, cap_scan_stats *stats)
+{
+	scan_pool_start(pool);
+	return scan_pool_finish(pool, stats);
+}
+
+void scan_pool_free(scan_pool *pool)
+{
+	str_table_free(&pool->paths);
+	arena_free(&pool->path_arena);
+	free(pool->tasks);
+	free(pool->reader_threads);
+	free(pool->reader_stats);
+	queue_free(&pool->pages);
+	queue_free(&pool->records);
+	free(pool);
+}
+
+void print_cap_scan_stats(cap_scan_stats *stats)
+{
+	print_tag_scan_stats(&stats->tags);
+	debug_print(INFO, "Capability scan: %lu capabilities read with %lu requests\n",
+	    stats->caps, stats->cap_requests);
+	debug_print(INFO, "Scan stages: read %lu pages in %.3fs (%lu stalls), "
+	    "decode %lu caps by %.3fs (%lu stalls, %lu idle), write %lu caps by %.3fs (%lu idle)\n",
+	    stats->read.items, stats->read.seconds, stats->read.stalls,
+	    stats->decode.items, stats->decode.seconds, stats->decode.stalls, stats->decode.idle,
+	    stats->write.items, stats->write.seconds, stats->write.idle);
+}
@@ -0,0 +1,289 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "compart_index.h"
+#include "db_process.h"
+#include "snapshot_diff.h"
+
+/* The capabilities and compartments of one of the two snapshots */
+typedef struct diff_side {
+	db_cursor cursor;
+	cap_info cap;		/* Current row of the cursor */
+	int rc;			/* Of the last cap_cursor_next */
+	comp_info *comparts;	/* Sorted by compart_id */
+	int comp_count;
+	arena comp_arena;	/* The strings of comparts */
+	str_table comp_strings;
+	compart_index index;
+} diff_side;
+
+static int compare_compart_id(const void *a, const void *b)
+{
+	const comp_info *ca = a, *cb = b;
+
+	return (ca->compart_id > cb->compart_id) - (ca->compart_id < cb->compart_id);
+}
+
+static int diff_side_open(sqlite3 *db, int64_t snapshot_id, diff_side *side)
+{
+	memset(side, 0, sizeof(diff_side));
+	arena_init(&side->comp_arena, 0);
+	str_table_init(&side->comp_strings, &side->comp_arena);
+
+	if (db_table_exists(db, "comparts")) {
+		side->comp_count = get_snapshot_comp_info(db, snapshot_id, &side->comp_strings, &side->comparts);
+		if (side->comp_count == -1) {
+			return (1);
+		}
+	}
+	compart_index_build(&side->index, side->comparts, side->comp_count);
+	qsort(side->comparts, side->comp_count, sizeof(comp_info), compare_compart_id);
+
+	if (cap_loc_cursor_open(db, &side->cursor, snapshot_id) != 0) {
+		return (1);
+	}
+	side->rc = cap_cursor_next(&side->cursor, &side->cap);
+	return (0);
+}
+
+static void diff_side_close(diff_side *side)
+{
+	if (side->cursor.stmt != NULL) {
+		db_cursor_close(&side->cursor);
+	}
+	compart_index_free(&side->index);
+	free(side->comparts);
+	str_table_free(&side->comp_strings);
+	arena_free(&side->comp_arena);
+}
+
+/*
+ * diff_side_compart
+ * Name of the compartment holding the current capability of side, NULL if
+ * it is in none.
+ */
+static const char *diff_side_compart(const diff_side *side)
+{
+	comp_info key, *comp;
+
+	key.compart_id = compart_index_lookup(&side->index, side->cap.cap_loc_addr);
+	if (key.compart_id == COMPART_ID_NONE) {
+		return NULL;
+	}
+	comp = bsearch(&key, side->comparts, side->comp_count, sizeof(comp_info), compare_compart_id);
+	return comp != NULL ? comp->compart_name : NULL;
+}
+
+/*
+ * compare_names
+ * Orders the rollups by name, with the one of the capabilities outside of
+ * any compartment (NULL) first.
+ */
+static int compare_names(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL) {
+		return (a != NULL) - (b != NULL);
+	}
+	return strcmp(a, b);
+}
+
+/*
+ * rollup_find
+ * The rollup of name, added if there is none yet. The rollups are looked up
+ * by a binary search, the capabilities come in address order so most of the
+ * lookups are for the same name as the previous one.
+ */
+static cap_diff_counts *rollup_find(cap_diff_rollups *rollups, int *last, const char *name)
+{
+	int lo = 0, hi = rollups->count;
+
+	if (*last < rollups->count && compare_names(rollups->entries[*last].name, name) == 0) {
+		return &rollups->entries[*last].counts;
+	}
+	while (lo < hi) {
+		int mid = lo + (hi-lo)/2;
+		int cmp = compare_names(rollups->entries[mid].name, name);
+		if (cmp == 0) {
+			*last = mid;
+			return &rollups->entries[mid].counts;
+		}
+		if (cmp < 0) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (rollups->count == rollups->capacity) {
+		rollups->capacity = rollups->capacity == 0 ? 64 : rollups->capacity*2;
+		rollups->entries = realloc(rollups->entries, rollups->capacity * sizeof(cap_diff_rollup));
+		assert(rollups->entries != NULL);
+	}
+	memmove(&rollups->entries[lo+1], &rollups->entries[lo], (rollups->count-lo) * sizeof(cap_diff_rollup));
+	memset(&rollups->entries[lo], 0, sizeof(cap_diff_rollup));
+	if (name != NULL) {
+		rollups->entries[lo].name = strdup(name);
+		assert(rollups->entries[lo].name != NULL);
+	}
+	rollups->count++;
+	*last = lo;
+	return &rollups->entries[lo].counts;
+}
+
+static void count_change(cap_diff_counts *counts, cap_diff_kind kind)
+{
+	switch (kind) {
+	case CAP_DIFF_ADDED:
+		counts->added++;
+		break;
+	case CAP_DIFF_REMOVED:
+		counts->removed++;
+		break;
+	case CAP_DIFF_MODIFIED:
+		counts->modified++;
+		break;
+	}
+}
+
+static int same_cap(const cap_info *a, const cap_info *b)
+{
+	return a->cap_addr == b->cap_addr && a->perms == b->perms &&
+	    a->base == b->base && a->top == b->top;
+}
+
+/*
+ * snapshot_diff_run(db, before_id, after_id, fn, arg, diff)
+ * Compares the capabilities of snapshot after_id with those of before_id.
+ * Both snapshots are read once, in the order of cap_loc_addr from the
+ * cap_info_snapshot_loc index, and merged: a location only in before has
+ * lost its capability, one only in after has gained one, and one in both
+ * has a modified capability if the two differ. The time taken is linear in
+ * the size of the snapshots, plus a lookup in the compartments and rollups
+ * for each change.
+ * fn, if not NULL, is called for each change. Returns 0 on success, 1 if a
+ * snapshot could not be read.
+ */
+int snapshot_diff_run(sqlite3 *db, int64_t before_id, int64_t after_id, cap_diff_fn fn, void *arg,
+    snapshot_diff *diff)
+{
+	diff_side before, after;
+	int last_mapping = 0, last_compart = 0;
+	int rc = 0;
+
+	memset(diff, 0, sizeof(snapshot_diff));
+	memset(&before, 0, sizeof(diff_side));
+	memset(&after, 0, sizeof(diff_side));
+	diff->before_id = before_id;
+	diff->after_id = after_id;
+
+	if (diff_side_open(db, before_id, &before) != 0 || diff_side_open(db, after_id, &after) != 0) {
+		diff_side_close(&before);
+		diff_side_close(&after);
+		return (1);
+	}
+
+	while (before.rc == 1 || after.rc == 1) {
+		int cmp;
+		cap_diff_kind kind;
+		diff_side *side;
+
+		if (before.rc != 1) {
+			cmp = 1;
+		} else if (after.rc != 1) {
+			cmp = -1;
+		} else {
+			// Same order as the index, which sorts the addresses as signed integers
+			int64_t a = (int64_t)before.cap.cap_loc_addr, b = (int64_t)after.cap.cap_loc_addr;
+			cmp = (a > b) - (a < b);
+		}
+
+		if (cmp == 0 && same_cap(&before.cap, &after.cap)) {
+			diff->unchanged++;
+			before.rc = cap_cursor_next(&before.cursor, &before.cap);
+			after.rc = cap_cursor_next(&after.cursor, &after.cap);
+			continue;
+		}
+
+		kind = cmp < 0 ? CAP_DIFF_REMOVED : cmp > 0 ? CAP_DIFF_ADDED : CAP_DIFF_MODIFIED;
+		side = kind == CAP_DIFF_REMOVED ? &before : &after;
+
+		const char *compart_name = diff_side_compart(side);
+		count_change(&diff->total, kind);
+		count_change(rollup_find(&diff->mappings, &last_mapping, side->cap.cap_loc_path), kind);
+		count_change(rollup_find(&diff->comparts, &last_compart, compart_name), kind);
+		if (fn != NULL) {
+			fn(arg, kind, kind == CAP_DIFF_ADDED ? NULL : &before.cap,
+			    kind == CAP_DIFF_REMOVED ? NULL : &after.cap, compart_name);
+		}
+
+		if (kind != CAP_DIFF_ADDED) {
+			before.rc = cap_cursor_next(&before.cursor, &before.cap);
+		}
+		if (kind != CAP_DIFF_REMOVED) {
+			after.rc = cap_cursor_next(&after.cursor, &after.cap);
+		}
+	}
+	if (before.rc != 0 || after.rc != 0) {
+		rc = 1;
+	}
+
+	diff_side_close(&before);
+	diff_side_close(&after);
+
+	debug_print(TROUBLESHOOT, "Key Stage: Snapshot %ld to %ld: %lu added, %lu removed, %lu modified, "
+	    "%lu unchanged capabilities\n", before_id, after_id, diff->total.added, diff->total.removed,
+	    diff->total.modified, diff->unchanged);
+	return rc;
+}
+
+void snapshot_diff_free(snapshot_diff *diff)
+{
+	for (int i=0; i<diff->mappings.count; i++) {
+		free(diff->mappings.entries[i].name);
+	}
+	for (int i=0; i<diff->comparts.count; i++) {
+		free(diff->comparts.entries[i].name);
+	}
+	free(diff->mappings.entries);
+	free(diff->comparts.entries);
+	memset(diff, 0, sizeof(snapshot_diff));
+}
@@ -0,0 +1,152 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxo/xo.h>
+
+#include "cap_decode.h"
+#include "db_process.h"
+#include "snapshot_diff.h"
+#include "snapshot_diff_view.h"
+
+static const char *cap_diff_kind_names[] = {
+	[CAP_DIFF_ADDED] = "added",
+	[CAP_DIFF_REMOVED] = "removed",
+	[CAP_DIFF_MODIFIED] = "modified",
+};
+
+#define CAP_FIELDS(side)	"{:" side "_cap_addr/%#lx}{L:[}{:" side "_perms/%s}{L:,}" \
+				"{:" side "_base/%#lx}{L:-}{:" side "_top/%#lx}{L:]}"
+
+static void emit_cap(const char *format, const cap_info *cap)
+{
+	char perms[CAP_PERMS_STR_SIZE];
+
+	if (cap == NULL) {
+		xo_emit("{L:-}");
+		return;
+	}
+	xo_emit(format, cap->cap_addr, cap_perms_str(cap->perms, perms, sizeof(perms)),
+	    cap->base, cap->top);
+}
+
+/*
+ * emit_cap_diff
+ * One line for each capability that differs, as snapshot_diff_run finds them.
+ */
+static void emit_cap_diff(void *arg, cap_diff_kind kind, const cap_info *before,
+    const cap_info *after, const char *compart_name)
+{
+	const cap_info *cap = after != NULL ? after : before;
+
+	xo_open_instance("cap_diff_output");
+	xo_emit("{:change/%-8s} ", cap_diff_kind_names[kind]);
+	xo_emit("{:cap_loc_addr/%#18lx} ", cap->cap_loc_addr);
+	xo_emit("{:cap_loc_path/%-40s} ", cap->cap_loc_path);
+	xo_emit("{:compart_name/%-20s} ", compart_name != NULL ? compart_name : "-");
+	emit_cap(CAP_FIELDS("before"), before);
+	xo_emit("{L: -> }");
+	emit_cap(CAP_FIELDS("after"), after);
+	xo_emit("\n");
+	xo_close_instance("cap_diff_output");
+}
+
+static void emit_rollups(const char *list, const char *title, const cap_diff_rollups *rollups)
+{
+	xo_emit("{T:/\n%-60s %9s %9s %9s}\n", title, "ADDED", "REMOVED", "MODIFIED");
+
+	xo_open_list(list);
+	for (int i=0; i<rollups->count; i++) {
+		const cap_diff_rollup *rollup = &rollups->entries[i];
+
+		xo_open_instance(list);
+		xo_emit("{:name/%-60s} ", rollup->name != NULL ? rollup->name : "-");
+		xo_emit("{:added/%9lu} ", rollup->counts.added);
+		xo_emit("{:removed/%9lu} ", rollup->counts.removed);
+		xo_emit("{:modified/%9lu}\n", rollup->counts.modified);
+		xo_close_instance(list);
+	}
+	xo_close_list(list);
+}
+
+/*
+ * snapshot_diff_view
+ * Shows how the capabilities changed from snapshot before_id to after_id:
+ *
+ * 1. Each capability that was added, removed or modified, in the order of
+ * cap_loc_addr: change, cap_loc_addr, cap_loc_path, compart_name, the
+ * capability before and after.
+ *
+ * 2. The number of changes in each mapping path and in each compartment.
+ *
+ * 3. The total number of changes, and of capabilities left as they were.
+ */
+void snapshot_diff_view(sqlite3 *db, int64_t before_id, int64_t after_id)
+{
+	snapshot_diff diff;
+
+	int dbname_len = strlen(get_dbname());
+	for (int l=0; l<dbname_len+4; l++) {	
+		xo_emit("{:/-}");
+	}
+	xo_emit("{:/\n %s \n}", get_dbname());
+	for (int l=0; l<dbname_len+4; l++) {	
+		xo_emit("{:/-}");
+	}
+	xo_emit("\n{Lwc:Snapshot}{:before_snapshot_id/%ld}{L: -> }{:after_snapshot_id/%ld}\n",
+	    before_id, after_id);
+
+	xo_emit("{T:/\n%-8s %18s %-40s %-20s %s}\n",
+		"CHANGE", "CAP_LOC", "CAP_LOC_PATH", "COMPART", "BEFORE -> AFTER");
+
+	xo_open_list("cap_diff_output");
+	if (snapshot_diff_run(db, before_id, after_id, emit_cap_diff, NULL, &diff) != 0) {
+		errx(1, "Unable to compare snapshot %ld with snapshot %ld of %s", before_id, after_id,
+		    get_dbname());
+	}
+	xo_close_list("cap_diff_output");
+
+	emit_rollups("mapping_diff_output", "MAPPING", &diff.mappings);
+	emit_rollups("compart_diff_output", "COMPARTMENT", &diff.comparts);
+
+	xo_open_container("diff_total");
+	xo_emit("\n{Lwc:Added}{:added/%lu}, {Lwc:Removed}{:removed/%lu}, {Lwc:Modified}{:modified/%lu}, "
+	    "{Lwc:Unchanged}{:unchanged/%lu}\n",
+	    diff.total.added, diff.total.removed, diff.total.modified, diff.unchanged);
+	xo_close_container("diff_total");
+
+	snapshot_diff_free(&diff);
+}
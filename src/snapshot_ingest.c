@@ -0,0 +1,671 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/param.h>
+#include <sys/types.h>
+
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "arena.h"
+#include "common.h"
+#include "cap_decode.h"
+#include "db_process.h"
+#include "raw_snapshot.h"
+#include "run_stats.h"
+#include "scan_pool.h"
+#include "snapshot_ingest.h"
+#include "target_log.h"
+
+typedef void (*cap_decode_fn)(const void *cap_bytes, int tag, cap_decoded *out);
+
+/* A vm entry of the snapshot and the name it is stored under */
+typedef struct ingest_vm {
+	raw_vm_entry entry;
+	char *mmap_path;
+	int compart_id;
+} ingest_vm;
+
+/* A mapped ELF file, at the start of its first vm entry */
+typedef struct ingest_elf {
+	const char *path;
+	uint64_t base;
+	int parsed;
+	ingest_elf_sections sections;
+} ingest_elf;
+
+/* A decoded capability on its way to the database */
+typedef struct ingest_cap {
+	uint64_t cap_loc_addr;
+	const char *path;
+	cap_decoded cap;
+} ingest_cap;
+
+typedef struct ingest_chunk {
+	ingest_cap *caps;
+	int count;
+	atomic_int done;
+} ingest_chunk;
+
+/*
+ * The pages of a snapshot, decoded in chunks by the workers. The chunks are
+ * written to the database in order by the thread that runs the ingest, the
+ * workers stay at most window chunks ahead of it.
+ */
+typedef struct ingest_job {
+	raw_record *pages;
+	u_long page_count;
+	ingest_vm *vms;
+	int vm_count;
+	cap_decode_fn decode;
+
+	ingest_chunk *chunks;
+	int chunk_count;
+	int window;
+	atomic_int next_chunk;
+	atomic_int written;
+	atomic_ulong malformed;
+} ingest_job;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *grow(void *array, int count, int *capacity, size_t elem_size)
+{
+	if (count < *capacity) {
+		return array;
+	}
+	*capacity = *capacity == 0 ? 64 : *capacity*2;
+	array = realloc(array, *capacity*elem_size);
+	if (array == NULL) {
+		errx(1, "Out of memory ingesting the snapshot, cannot grow to %d entries", *capacity);
+	}
+	return array;
+}
+
+/*
+ * find_vm
+ * Returns the vm entry that contains addr, the entries are in vm map order
+ * and do not overlap. NULL if there is none.
+ */
+static const ingest_vm *find_vm(const ingest_vm *vms, int vm_count, uint64_t addr)
+{
+	int lo = 0;
+	int hi = vm_count;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo)/2;
+		if (vms[mid].entry.end <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < vm_count && vms[lo].entry.start <= addr) {
+		return &vms[lo];
+	}
+	return NULL;
+}
+
+/*
+ * decode_chunk
+ * Decodes the capabilities of the pages of chunk c, in the order they are
+ * in the snapshot.
+ */
+static void decode_chunk(ingest_job *job, int c)
+{
+	ingest_chunk *chunk = &job->chunks[c];
+	u_long first = (u_long)c*INGEST_CHUNK_PAGES;
+	u_long last = first + INGEST_CHUNK_PAGES < job->page_count ? first + INGEST_CHUNK_PAGES : job->page_count;
+	int capacity = 0;
+
+	for (u_long i=first; i<last; i++) {
+		raw_page_caps page;
+		if (raw_record_page(&job->pages[i], &page) != 0) {
+			atomic_fetch_add_explicit(&job->malformed, 1, memory_order_relaxed);
+			continue;
+		}
+		const ingest_vm *vm = find_vm(job->vms, job->vm_count, page.page);
+		const char *path = vm != NULL ? vm->mmap_path : "Unknown";
+
+		int k = 0;
+		for (int slot=0; slot<RAW_TAGS_PER_PAGE; slot++) {
+			if ((page.tags[slot/8] & (1 << (slot%8))) == 0) {
+				continue;
+			}
+			chunk->caps = grow(chunk->caps, chunk->count, &capacity, sizeof(ingest_cap));
+			ingest_cap *cap = &chunk->caps[chunk->count++];
+			cap->cap_loc_addr = page.page + (uint64_t)slot*RAW_CAP_SIZE;
+			cap->path = path;
+			job->decode(&page.caps[k*RAW_CAP_SIZE], 1, &cap->cap);
+			k++;
+		}
+	}
+}
+
+static void *ingest_worker_main(void *arg)
+{
+	ingest_job *job = arg;
+	int c;
+
+	while ((c = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+		while (c >= atomic_load(&job->written) + job->window) {
+			sched_yield();
+		}
+		decode_chunk(job, c);
+		atomic_store(&job->chunks[c].done, 1);
+	}
+	return NULL;
+}
+
+/*
+ * write_caps
+ * Starts the workers on the pages of job and writes the capabilities they
+ * decode to cap_info, one chunk at a time in snapshot order. Returns the
+ * number of capabilities written.
+ */
+static u_long write_caps(sqlite3 *db, ingest_job *job, int workers)
+{
+	cap_writer writer;
+	u_long caps = 0;
+
+	if (cap_writer_open(db, &writer) != 0) {
+		errx(1, "Unable to prepare the cap_info insert statement on db %s", get_dbname());
+	}
+
+	job->chunk_count = (job->page_count + INGEST_CHUNK_PAGES - 1) / INGEST_CHUNK_PAGES;
+	job->chunks = calloc(job->chunk_count > 0 ? job->chunk_count : 1, sizeof(ingest_chunk));
+	pthread_t *threads = calloc(workers, sizeof(pthread_t));
+	if (job->chunks == NULL || threads == NULL) {
+		errx(1, "Cannot allocate the ingest of %lu pages", job->page_count);
+	}
+	job->window = workers*INGEST_CHUNKS_AHEAD;
+
+	for (int w=0; w<workers; w++) {
+		if (pthread_create(&threads[w], NULL, ingest_worker_main, job) != 0) {
+			errx(1, "Cannot start ingest worker %d", w);
+		}
+	}
+
+	for (int c=0; c<job->chunk_count; c++) {
+		ingest_chunk *chunk = &job->chunks[c];
+		while (!atomic_load(&chunk->done)) {
+			sched_yield();
+		}
+		run_timer timer;
+		run_phase_begin(&timer, RUN_PHASE_SQL_INSERT);
+		for (int i=0; i<chunk->count; i++) {
+			ingest_cap *cap = &chunk->caps[i];
+			cap_writer_insert(&writer, cap->cap_loc_addr, cap->path, cap->cap.addr, cap->cap.perms,
+			    cap->cap.base, cap->cap.top);
+		}
+		run_phase_end(&timer);
+		caps += chunk->count;
+		free(chunk->caps);
+		chunk->caps = NULL;
+		atomic_store(&job->written, c+1);
+	}
+
+	for (int w=0; w<workers; w++) {
+		pthread_join(threads[w], NULL);
+	}
+	free(threads);
+	free(job->chunks);
+	cap_writer_close(&writer);
+	run_count(RUN_CAPS_FOUND, caps);
+	return caps;
+}
+
+/*
+ * name_vm_entries
+ * Works out the mmap_path and compartment of each vm entry in the same way as
+ * scan_mem: anonymous entries are named after the ELF file whose first entry
+ * starts at their reservation, or else as guard, stack or heap entries, and
+ * the entries holding the .plt or .got of the last ELF file seen are marked
+ * as such. The compartment is the first linkmap object whose path starts
+ * the name. The names are interned into paths.
+ */
+static void name_vm_entries(ingest_vm *vms, int vm_count, ingest_elf *elfs, int elf_count,
+    raw_linkmap_obj *objs, int obj_count, str_table *paths)
+{
+	int elf_index = -1;
+
+	for (int i=0; i<vm_count; i++) {
+		raw_vm_entry *entry = &vms[i].entry;
+		const char *name = NULL;
+
+		if (entry->path[0] != '\0') {
+			for (int j=0; j<elf_count; j++) {
+				if (strcmp(elfs[j].path, entry->path) == 0) {
+					elf_index = j;
+					break;
+				}
+			}
+			name = entry->path;
+		} else {
+			for (int j=0; j<elf_count && name == NULL; j++) {
+				if (elfs[j].base == entry->reservation) {
+					name = elfs[j].path;
+				}
+			}
+			if (name == NULL) {
+				if (entry->type == RAW_KVME_TYPE_GUARD) {
+					name = "Guard";
+				} else if (entry->flags & RAW_KVME_FLAG_GROWS_DOWN) {
+					name = "Stack";
+				} else {
+					name = "Heap(others)";
+				}
+			}
+		}
+
+		int has_plt = 0, has_got = 0;
+		if (elf_index >= 0 && elfs[elf_index].parsed) {
+			ingest_elf_sections *sect = &elfs[elf_index].sections;
+			has_plt = entry->start <= sect->plt_addr && entry->end >= sect->plt_addr + sect->plt_size;
+			has_got = entry->start <= sect->got_addr && entry->end >= sect->got_addr + sect->got_size;
+		}
+		char *mmap_path;
+		if (has_plt || has_got) {
+			char path_buf[PATH_MAX + 16];
+			snprintf(path_buf, sizeof(path_buf), "%s%s%s", name, has_plt ? "(.plt)" : "",
+			    has_got ? "(.got)" : "");
+			mmap_path = str_intern(paths, path_buf);
+		} else {
+			mmap_path = str_intern(paths, name);
+		}
+		vms[i].mmap_path = mmap_path;
+
+		vms[i].compart_id = -1;
+		for (int j=0; j<obj_count; j++) {
+			if (objs[j].path != NULL && strncmp(objs[j].path, mmap_path, strlen(objs[j].path)) == 0) {
+				vms[i].compart_id = objs[j].compart_id;
+				break;
+			}
+		}
+	}
+}
+
+static sqlite3_stmt *prepare(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL) != SQLITE_OK) {
+		errx(1, "Unable to prepare %s on db %s: %s", query, get_dbname(), sqlite3_errmsg(db));
+	}
+	return stmt;
+}
+
+static void step_reset(sqlite3 *db, sqlite3_stmt *stmt)
+{
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		fprintf(stderr, "SQL error ingesting the snapshot: %s (db: %s)\n", sqlite3_errmsg(db), get_dbname());
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+/*
+ * replay_scan
+ * Scans the ranges of a scan recorded with -R again, through a scan_pool
+ * whose reads are served by replay, and writes the capabilities it finds to
+ * cap_info as scan_mem did. Returns the number of capabilities written.
+ */
+static u_long replay_scan(sqlite3 *db, ingest_job *job, target_replay *replay, raw_scan_range *ranges,
+    int range_count, int workers, ingest_stats *stats)
+{
+	cap_writer writer;
+	scan_target target;
+	cap_scan_stats scan_stats = {};
+
+	if (cap_writer_open(db, &writer) != 0) {
+		errx(1, "Unable to prepare the cap_info insert statement on db %s", get_dbname());
+	}
+	target_replay_start(replay, &target);
+
+	scan_pool *pool = scan_pool_create(&target, &writer, workers);
+	for (int i=0; i<range_count; i++) {
+		const ingest_vm *vm = find_vm(job->vms, job->vm_count, ranges[i].start);
+		scan_pool_add(pool, ranges[i].start, ranges[i].end, vm != NULL ? vm->mmap_path : "Unknown");
+	}
+	u_long caps = scan_pool_run(pool, &scan_stats);
+	scan_pool_free(pool);
+	cap_writer_close(&writer);
+	print_cap_scan_stats(&scan_stats);
+
+	stats->pages = scan_stats.tags.tagged_pages;
+	stats->replayed_reads = atomic_load(&replay->hits);
+	stats->missed_reads = atomic_load(&replay->misses);
+	return caps;
+}
+
+static void write_vm_entries(sqlite3 *db, int64_t snapshot_id, ingest_vm *vms, int vm_count,
+    ingest_elf *elfs, int elf_count)
+{
+	path_cache paths;
+	if (path_cache_open(db, &paths) != 0) {
+		errx(1, "Unable to look up the paths of the vm entries");
+	}
+	sqlite3_stmt *stmt = prepare(db,
+	    "INSERT INTO vm(start_addr, end_addr, mmap_path_id, compart_id, kve_protection, mmap_flags, vnode_type, "
+	    "snapshot_id) VALUES(?, ?, ?, ?, ?, ?, ?, ?);");
+	for (int i=0; i<vm_count; i++) {
+		int64_t path_id = path_cache_id(&paths, vms[i].mmap_path);
+		if (path_id == 0) {
+			errx(1, "Unable to add the path %s", vms[i].mmap_path);
+		}
+		sqlite3_bind_int64(stmt, 1, (sqlite3_int64)vms[i].entry.start);
+		sqlite3_bind_int64(stmt, 2, (sqlite3_int64)vms[i].entry.end);
+		sqlite3_bind_int64(stmt, 3, path_id);
+		sqlite3_bind_int(stmt, 4, vms[i].compart_id);
+		sqlite3_bind_int(stmt, 5, vms[i].entry.protection);
+		sqlite3_bind_int(stmt, 6, vms[i].entry.flags);
+		sqlite3_bind_int(stmt, 7, vms[i].entry.type);
+		sqlite3_bind_int64(stmt, 8, snapshot_id);
+		step_reset(db, stmt);
+	}
+	sqlite3_finalize(stmt);
+	path_cache_close(&paths);
+
+	stmt = prepare(db, "UPDATE vm SET plt_addr = ?, plt_size = ?, got_addr = ?, got_size = ? "
+	    "WHERE mmap_path_id = (SELECT path_id FROM paths WHERE path = ?) AND snapshot_id = ?;");
+	for (int i=0; i<elf_count; i++) {
+		if (!elfs[i].parsed) {
+			continue;
+		}
+		sqlite3_bind_int64(stmt, 1, (sqlite3_int64)elfs[i].sections.plt_addr);
+		sqlite3_bind_int64(stmt, 2, (sqlite3_int64)elfs[i].sections.plt_size);
+		sqlite3_bind_int64(stmt, 3, (sqlite3_int64)elfs[i].sections.got_addr);
+		sqlite3_bind_int64(stmt, 4, (sqlite3_int64)elfs[i].sections.got_size);
+		sqlite3_bind_text(stmt, 5, elfs[i].path, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 6, snapshot_id);
+		step_reset(db, stmt);
+	}
+	sqlite3_finalize(stmt);
+}
+
+static void write_comparts(sqlite3 *db, int64_t snapshot_id, raw_compart *comparts, int compart_count)
+{
+	sqlite3_stmt *stmt = prepare(db,
+	    "INSERT INTO comparts(compart_id, compart_name, library_path, start_addr, end_addr, "
+	    "is_default, parent_id, snapshot_id) VALUES(?, ?, ?, ?, ?, ?, ?, ?);");
+	for (int i=0; i<compart_count; i++) {
+		raw_compart *compart = &comparts[i];
+		sqlite3_bind_int(stmt, 1, compart->compart_id);
+		if (compart->name != NULL) {
+			sqlite3_bind_text(stmt, 2, compart->name, -1, SQLITE_STATIC);
+		}
+		if (compart->library_path != NULL) {
+			sqlite3_bind_text(stmt, 3, compart->library_path, -1, SQLITE_STATIC);
+		}
+		sqlite3_bind_int64(stmt, 4, (sqlite3_int64)compart->start);
+		sqlite3_bind_int64(stmt, 5, (sqlite3_int64)compart->end);
+		sqlite3_bind_int(stmt, 6, compart->is_default);
+		if (!compart->is_default) {
+			sqlite3_bind_int(stmt, 7, compart->parent_id);
+		}
+		sqlite3_bind_int64(stmt, 8, snapshot_id);
+		step_reset(db, stmt);
+	}
+	sqlite3_finalize(stmt);
+}
+
+/*
+ * ingest_snapshot(db, path, workers, parse_elf, stats)
+ * Loads the raw snapshot path, written by -o, into a new snapshot of db, as
+ * scan_mem would have stored the same target.
+ * The snapshot is mapped rather than read, and its capabilities are decoded
+ * by workers threads while this one writes them. The symbols of the mapped
+ * ELF files are read by parse_elf, if it is not NULL, from the files found on
+ * this host. Returns 0 on success, -1 if the snapshot cannot be read.
+ *
+ * A record file written by -R holds no page, the reads it recorded from the
+ * target are replayed instead: the ranges it scanned are scanned again by a
+ * scan_pool of workers readers, which get their tags and capabilities from
+ * the record rather than the target.
+ */
+int ingest_snapshot(sqlite3 *db, const char *path, int workers, ingest_elf_fn parse_elf,
+    ingest_stats *stats)
+{
+	raw_reader reader;
+	raw_record record;
+	double started = now();
+	int rc;
+
+	assert(workers > 0);
+	memset(stats, 0, sizeof(ingest_stats));
+	if (raw_reader_open(&reader, path) != 0) {
+		return -1;
+	}
+	stats->bytes = reader.size;
+
+	ingest_job job = {};
+	if (reader.header.machine == RAW_MACHINE_AARCH64 || reader.header.machine == RAW_MACHINE_UNKNOWN) {
+		job.decode = cap_decode_morello;
+	} else if (reader.header.machine == RAW_MACHINE_HOST) {
+		job.decode = cap_decode_bytes;
+	} else {
+		debug_print(INFO, "The capabilities of machine %u in %s cannot be decoded on this host\n",
+		    reader.header.machine, path);
+		raw_reader_close(&reader);
+		return -1;
+	}
+
+	// Index the records, the pages are only decoded by the workers
+	ingest_elf *elfs = NULL;
+	raw_linkmap_obj *objs = NULL;
+	raw_compart *comparts = NULL;
+	raw_scan_range *ranges = NULL;
+	target_replay replay = {};
+	int elf_count = 0, obj_count = 0, compart_count = 0, page_count = 0, range_count = 0;
+	int vm_capacity = 0, elf_capacity = 0, obj_capacity = 0, compart_capacity = 0, page_capacity = 0;
+	int range_capacity = 0;
+
+	while ((rc = raw_reader_next(&reader, &record)) == 1) {
+		switch (record.type) {
+		case RAW_REC_VM_ENTRY:
+			job.vms = grow(job.vms, job.vm_count, &vm_capacity, sizeof(ingest_vm));
+			if (raw_record_vm_entry(&record, &job.vms[job.vm_count].entry) != 0) {
+				stats->skipped++;
+				break;
+			}
+			job.vm_count++;
+			break;
+		case RAW_REC_LINKMAP_OBJ:
+			objs = grow(objs, obj_count, &obj_capacity, sizeof(raw_linkmap_obj));
+			if (raw_record_linkmap_obj(&record, &objs[obj_count]) != 0) {
+				stats->skipped++;
+				break;
+			}
+			obj_count++;
+			break;
+		case RAW_REC_COMPART:
+			comparts = grow(comparts, compart_count, &compart_capacity, sizeof(raw_compart));
+			if (raw_record_compart(&record, &comparts[compart_count]) != 0) {
+				stats->skipped++;
+				break;
+			}
+			compart_count++;
+			break;
+		case RAW_REC_PAGE:
+			job.pages = grow(job.pages, page_count, &page_capacity, sizeof(raw_record));
+			job.pages[page_count++] = record;
+			break;
+		case RAW_REC_TARGET_READ:
+			if (target_replay_add(&replay, &record) != 0) {
+				stats->skipped++;
+			}
+			break;
+		case RAW_REC_SCAN_RANGE:
+			ranges = grow(ranges, range_count, &range_capacity, sizeof(raw_scan_range));
+			if (raw_record_scan_range(&record, &ranges[range_count]) != 0) {
+				stats->skipped++;
+				break;
+			}
+			range_count++;
+			break;
+		case RAW_REC_END:
+			stats->complete = 1;
+			break;
+		case RAW_REC_AUXV:
+		case RAW_REC_R_DEBUG:
+			break;
+		default:
+			stats->skipped++;
+		}
+	}
+	if (rc != 0 || !stats->complete) {
+		debug_print(INFO, "%s was cut short, ingesting the records before the cut\n", path);
+	}
+	job.page_count = page_count;
+
+	// The vm entries are looked up by address
+	for (int i=1; i<job.vm_count; i++) {
+		if (job.vms[i].entry.start < job.vms[i-1].entry.end) {
+			debug_print(INFO, "The vm entries of %s are not in vm map order\n", path);
+			break;
+		}
+	}
+
+	create_vm_cap_db(db);
+	create_elf_sym_db(db);
+	create_comparts_table(db);
+
+	begin_transaction(db);
+	sql_query_exec(db, "DROP TABLE IF EXISTS cap_compart; DROP TABLE IF EXISTS cap_compart_snapshot;", NULL, NULL);
+	stats->snapshot_id = snapshot_begin(db, reader.header.pid, reader.header.timestamp);
+	if (stats->snapshot_id == 0) {
+		sql_query_exec(db, "ROLLBACK;", NULL, NULL);
+		free(job.vms);
+		free(job.pages);
+		free(objs);
+		free(comparts);
+		free(ranges);
+		target_replay_free(&replay);
+		raw_reader_close(&reader);
+		return -1;
+	}
+
+	for (int i=0; i<job.vm_count; i++) {
+		const char *elf_path = job.vms[i].entry.path;
+		int seen = elf_path[0] == '\0';
+		for (int j=0; j<elf_count && !seen; j++) {
+			seen = strcmp(elfs[j].path, elf_path) == 0;
+		}
+		if (seen) {
+			continue;
+		}
+		elfs = grow(elfs, elf_count, &elf_capacity, sizeof(ingest_elf));
+		ingest_elf *elf = &elfs[elf_count++];
+		memset(elf, 0, sizeof(ingest_elf));
+		elf->path = elf_path;
+		elf->base = job.vms[i].entry.start;
+		if (parse_elf != NULL && parse_elf(db, elf_path, elf->base, &elf->sections) == 0) {
+			elf->parsed = 1;
+			stats->elf_files++;
+		} else {
+			debug_print(VERBOSE, "No symbols for %s, it is not on this host\n", elf_path);
+		}
+	}
+
+	// The names of the vm entries are freed with the arena once they are written
+	arena path_arena;
+	str_table paths;
+	arena_init(&path_arena, 0);
+	str_table_init(&paths, &path_arena);
+	name_vm_entries(job.vms, job.vm_count, elfs, elf_count, objs, obj_count, &paths);
+	write_vm_entries(db, stats->snapshot_id, job.vms, job.vm_count, elfs, elf_count);
+	write_comparts(db, stats->snapshot_id, comparts, compart_count);
+	// The scan pool decodes the capabilities it reads as those of this host
+#ifdef __CHERI__
+	int replayable = reader.header.machine == RAW_MACHINE_HOST;
+#else
+	int replayable = job.decode == cap_decode_morello;
+#endif
+	if (page_count == 0 && range_count > 0 && replayable) {
+		stats->caps = replay_scan(db, &job, &replay, ranges, range_count, workers, stats);
+	} else {
+		if (range_count > 0 && !replayable) {
+			debug_print(INFO, "The reads recorded in %s cannot be replayed on this host\n", path);
+		}
+		stats->caps = write_caps(db, &job, workers);
+		stats->pages = page_count - atomic_load(&job.malformed);
+	}
+
+	snapshot_end(db, now() - started);
+	commit_transaction(db);
+
+	stats->vm_entries = job.vm_count;
+	stats->comparts = compart_count;
+	stats->skipped += atomic_load(&job.malformed);
+	stats->seconds = now() - started;
+
+	str_table_free(&paths);
+	arena_free(&path_arena);
+	free(job.vms);
+	free(job.pages);
+	free(elfs);
+	free(objs);
+	free(comparts);
+	free(ranges);
+	target_replay_free(&replay);
+	raw_reader_close(&reader);
+	return 0;
+}
+
+void print_ingest_stats(const char *path, ingest_stats *stats)
+{
+	double mb = stats->bytes / (1024.0*1024.0);
+
+	debug_print(INFO, "Ingested %s as snapshot %ld: %lu vm entries, %lu compartments, %lu ELF files, "
+	    "%lu pages, %lu capabilities%s\n", path, stats->snapshot_id, stats->vm_entries, stats->comparts, stats->elf_files,
+	    stats->pages, stats->caps, stats->complete ? "" : " (incomplete snapshot)");
+	debug_print(INFO, "Ingest: %.1f MB in %.3fs, %.1f MB/s, %lu records skipped\n",
+	    mb, stats->seconds, stats->seconds > 0 ? mb / stats->seconds : 0, stats->skipped);
+	if (stats->replayed_reads > 0 || stats->missed_reads > 0) {
+		debug_print(INFO, "Replayed %lu reads from the target, %lu reads were not recorded\n",
+		    stats->replayed_reads, stats->missed_reads);
+	}
+}
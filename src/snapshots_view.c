@@ -0,0 +1,93 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libxo/xo.h>
+
+#include "db_process.h"
+
+/*
+ * snapshots_view
+ * Lists the snapshots stored in the database, the ones the views can be
+ * pointed at with -s:
+ * snapshot_id, pid, started, duration, no_of_vm_entries, no_of_caps, command
+ */
+void snapshots_view(sqlite3 *db)
+{
+	db_cursor cursor;
+	snapshot_info snapshot;
+	int rc;
+
+	int dbname_len = strlen(get_dbname());
+	for (int l=0; l<dbname_len+4; l++) {	
+		xo_emit("{:/-}");
+	}
+	xo_emit("{:/\n %s \n}", get_dbname());
+	for (int l=0; l<dbname_len+4; l++) {	
+		xo_emit("{:/-}");
+	}
+
+	xo_emit("{T:/\n%8s %7s %-20s %9s %6s %9s %-s}\n",
+		"SNAPSHOT", "PID", "STARTED", "SECONDS", "VM", "CAPS", "COMMAND");
+
+	rc = snapshot_cursor_open(db, &cursor);
+	assert(rc == 0);
+
+	xo_open_list("snapshot_output");
+	while ((rc = snapshot_cursor_next(&cursor, &snapshot)) == 1) {
+		char started[32] = "-";
+		time_t started_at = snapshot.started;
+		struct tm tm;
+
+		if (started_at != 0 && localtime_r(&started_at, &tm) != NULL) {
+			strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", &tm);
+		}
+
+		xo_open_instance("snapshot_output");
+		xo_emit("{:snapshot_id/%8ld} ", snapshot.snapshot_id);
+		xo_emit("{:pid/%7ld} ", snapshot.pid);
+		xo_emit("{:started/%-20s} ", started);
+		xo_emit("{:duration/%9.3f} ", snapshot.duration);
+		xo_emit("{:vm_count/%6d} ", snapshot.vm_count);
+		xo_emit("{:cap_count/%9d} ", snapshot.cap_count);
+		xo_emit("{:command/%s}\n", snapshot.command != NULL ? snapshot.command : "-");
+		xo_close_instance("snapshot_output");
+	}
+	xo_close_list("snapshot_output");
+	assert(rc == 0);
+	db_cursor_close(&cursor);
+}
@@ -0,0 +1,248 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db_process.h"
+#include "sym_index.h"
+
+static int compare_entries(const void *a, const void *b)
+{
+	const sym_index_entry *x = (const sym_index_entry *)a;
+	const sym_index_entry *y = (const sym_index_entry *)b;
+
+	if (x->start != y->start) {
+		return (x->start > y->start) - (x->start < y->start);
+	}
+	// Keep the order of the table for symbols at the same address
+	return (x->sym > y->sym) - (x->sym < y->sym);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Of the symbols containing an address, the closest one is the one starting
+ * last, and of those starting at the same address the first one in the
+ * table. The entries are sorted that way, so it is the one with the highest
+ * start and the lowest position at that start.
+ */
+static int entry_is_closer(const sym_index_entry *entries, int x, int y)
+{
+	return entries[x].start > entries[y].start || (entries[x].start == entries[y].start && x < y);
+}
+
+/*
+ * The symbols whose range has started, kept in a binary heap of positions in
+ * entries with the closest one on top. Those that have ended are only
+ * removed once they come to the top.
+ */
+static void active_push(const sym_index_entry *entries, int *heap, int *count, int entry)
+{
+	int i = (*count)++;
+
+	while (i > 0 && entry_is_closer(entries, entry, heap[(i-1)/2])) {
+		heap[i] = heap[(i-1)/2];
+		i = (i-1)/2;
+	}
+	heap[i] = entry;
+}
+
+static void active_pop(const sym_index_entry *entries, int *heap, int *count)
+{
+	int last = heap[--(*count)];
+	int i = 0;
+
+	for (;;) {
+		int child = 2*i + 1;
+		if (child >= *count) {
+			break;
+		}
+		if (child+1 < *count && entry_is_closer(entries, heap[child+1], heap[child])) {
+			child++;
+		}
+		if (!entry_is_closer(entries, heap[child], last)) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+}
+
+/*
+ * sym_index_build(index, syms, sym_count)
+ * Sorts the defined symbols of syms by address. Undefined symbols and
+ * symbols without an address are left out. syms must outlive the index.
+ * The ranges of the sized symbols are then flattened into disjoint segments
+ * as compart_index_build does: the boundaries are swept once in address
+ * order, every elementary segment is given to the closest symbol covering
+ * it, and neighbouring segments of the same symbol are merged. The build
+ * takes O(n log n). Returns the number of symbols indexed.
+ */
+int sym_index_build(sym_index *index, const sym_info *syms, int sym_count)
+{
+	index->syms = syms;
+	index->entries = calloc(sym_count + 1, sizeof(sym_index_entry));
+	index->segments = calloc(2*sym_count + 1, sizeof(sym_segment));
+	index->count = 0;
+	index->segment_count = 0;
+	uint64_t *bounds = calloc(2*sym_count + 1, sizeof(uint64_t));
+	int *active = calloc(sym_count + 1, sizeof(int));
+	if (index->entries == NULL || index->segments == NULL || bounds == NULL || active == NULL) {
+		errx(1, "Cannot allocate the symbol index for %d symbols", sym_count);
+	}
+
+	int nbounds = 0;
+	for (int s=0; s<sym_count; s++) {
+		if (syms[s].addr == 0 || (syms[s].shndx != NULL && strcmp(syms[s].shndx, "UND") == 0)) {
+			continue;
+		}
+		sym_index_entry *entry = &index->entries[index->count++];
+		entry->start = syms[s].addr;
+		entry->end = syms[s].addr + syms[s].size;
+		if (entry->end < entry->start) {
+			entry->end = UINT64_MAX;
+		}
+		entry->sym = s;
+		if (entry->start < entry->end) {
+			bounds[nbounds++] = entry->start;
+			bounds[nbounds++] = entry->end;
+		}
+	}
+	qsort(index->entries, index->count, sizeof(sym_index_entry), compare_entries);
+	qsort(bounds, nbounds, sizeof(uint64_t), compare_u64);
+
+	int next = 0;
+	int nactive = 0;
+	for (int b=0; b+1<nbounds; b++) {
+		uint64_t start = bounds[b];
+		uint64_t end = bounds[b+1];
+		if (start == end) {
+			continue;
+		}
+
+		while (next < index->count && index->entries[next].start <= start) {
+			if (index->entries[next].start < index->entries[next].end) {
+				active_push(index->entries, active, &nactive, next);
+			}
+			next++;
+		}
+		// A symbol still active ends at a later boundary, so covers the segment
+		while (nactive > 0 && index->entries[active[0]].end <= start) {
+			active_pop(index->entries, active, &nactive);
+		}
+		if (nactive == 0) {
+			continue;
+		}
+
+		sym_segment *last = index->segment_count > 0 ? &index->segments[index->segment_count-1] : NULL;
+		if (last != NULL && last->end == start && last->entry == active[0]) {
+			last->end = end;
+		} else {
+			index->segments[index->segment_count].start = start;
+			index->segments[index->segment_count].end = end;
+			index->segments[index->segment_count].entry = active[0];
+			index->segment_count++;
+		}
+	}
+
+	free(bounds);
+	free(active);
+	return index->count;
+}
+
+/*
+ * sym_index_lookup(index, addr, offset)
+ * Returns the symbol at addr or, if there is none, the closest symbol whose
+ * range [value, value+size) contains addr. The distance of addr from the
+ * symbol is stored in offset. Returns NULL if no symbol covers addr.
+ */
+const sym_info *sym_index_lookup(const sym_index *index, uint64_t addr, uint64_t *offset)
+{
+	int lo = 0;
+	int hi = index->count;
+
+	// Find the first symbol starting at or after addr
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (index->entries[mid].start < addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < index->count && index->entries[lo].start == addr) {
+		if (offset != NULL) {
+			*offset = 0;
+		}
+		return &index->syms[index->entries[lo].sym];
+	}
+
+	// Otherwise the segment containing addr, the first one ending after it
+	lo = 0;
+	hi = index->segment_count;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (index->segments[mid].end <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < index->segment_count && index->segments[lo].start <= addr) {
+		const sym_index_entry *entry = &index->entries[index->segments[lo].entry];
+		if (offset != NULL) {
+			*offset = addr - entry->start;
+		}
+		return &index->syms[entry->sym];
+	}
+	return NULL;
+}
+
+void sym_index_free(sym_index *index)
+{
+	free(index->entries);
+	free(index->segments);
+	index->entries = NULL;
+	index->segments = NULL;
+	index->count = 0;
+	index->segment_count = 0;
+}
@@ -0,0 +1,155 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "run_stats.h"
+#include "tag_scan.h"
+
+static size_t tag_scan_chunk_pages = TAG_SCAN_DEFAULT_CHUNK_PAGES;
+
+void set_tag_scan_chunk_pages(size_t pages)
+{
+	assert(pages > 0 && pages <= TAG_SCAN_MAX_CHUNK_PAGES);
+	tag_scan_chunk_pages = pages;
+}
+
+size_t get_tag_scan_chunk_pages(void)
+{
+	return tag_scan_chunk_pages;
+}
+
+static int page_has_tags(const unsigned char *page_tags)
+{
+	unsigned char any = 0;
+
+	for (int i=0; i<TAG_SCAN_BYTES_PER_PAGE; i++) {
+		any |= page_tags[i];
+	}
+	return any != 0;
+}
+
+static void visit_pages(u_long start, size_t npages, const unsigned char *tagsbuf,
+    tag_page_fn page_fn, void *page_arg, tag_scan_stats *stats)
+{
+	for (size_t i=0; i<npages; i++) {
+		const unsigned char *page_tags = &tagsbuf[i*TAG_SCAN_BYTES_PER_PAGE];
+
+		if (page_has_tags(page_tags)) {
+			stats->tagged_pages++;
+			page_fn(page_arg, start + i*TAG_SCAN_PAGE_SIZE, page_tags);
+		}
+	}
+	stats->pages += npages;
+}
+
+/*
+ * tag_scan_range
+ * Reads the tags of the pages in [start, end) in chunks of up to
+ * tag_scan_chunk_pages pages per request, rather than one request per page,
+ * and calls page_fn for each page that has at least one tag set.
+ * If a chunk cannot be read in one go, e.g. because part of it is not
+ * accessible, it is retried one page at a time so that the readable pages are
+ * still scanned, the same as reading each page individually.
+ */
+int tag_scan_range(u_long start, u_long end, tag_read_fn read_tags, void *read_arg,
+    tag_page_fn page_fn, void *page_arg, tag_scan_stats *stats)
+{
+	size_t chunk_pages = tag_scan_chunk_pages;
+	run_timer timer;
+	unsigned char *tagsbuf = malloc(chunk_pages*TAG_SCAN_BYTES_PER_PAGE);
+	if (tagsbuf == NULL) {
+		errx(1, "Cannot allocate %zu bytes for the tags buffer", chunk_pages*TAG_SCAN_BYTES_PER_PAGE);
+	}
+
+	u_long page = start & ~((u_long)TAG_SCAN_PAGE_SIZE-1);
+
+	while (page < end) {
+		size_t npages = (end - page + TAG_SCAN_PAGE_SIZE - 1) / TAG_SCAN_PAGE_SIZE;
+		if (npages > chunk_pages) {
+			npages = chunk_pages;
+		}
+
+		run_phase_begin(&timer, RUN_PHASE_TAG_READ);
+		ssize_t nread = read_tags(read_arg, page, tagsbuf, npages*TAG_SCAN_BYTES_PER_PAGE);
+		run_phase_end(&timer);
+		stats->requests++;
+
+		if (nread >= TAG_SCAN_BYTES_PER_PAGE) {
+			// A short read covers the leading pages only, the next request
+			// carries on from the first page that was not read.
+			size_t nread_pages = nread / TAG_SCAN_BYTES_PER_PAGE;
+			visit_pages(page, nread_pages, tagsbuf, page_fn, page_arg, stats);
+			page += nread_pages*TAG_SCAN_PAGE_SIZE;
+			continue;
+		}
+
+		debug_print(TROUBLESHOOT, "Reading tags of %zu pages at 0x%lx returned %zd, retrying per page\n",
+		    npages, page, nread);
+
+		if (npages > 1) {
+			for (size_t i=0; i<npages; i++) {
+				u_long single = page + i*TAG_SCAN_PAGE_SIZE;
+				run_phase_begin(&timer, RUN_PHASE_TAG_READ);
+				nread = read_tags(read_arg, single, tagsbuf, TAG_SCAN_BYTES_PER_PAGE);
+				run_phase_end(&timer);
+				stats->requests++;
+				if (nread == TAG_SCAN_BYTES_PER_PAGE) {
+					visit_pages(single, 1, tagsbuf, page_fn, page_arg, stats);
+				} else {
+					stats->pages++;
+				}
+			}
+		} else {
+			stats->pages++;
+		}
+		page += npages*TAG_SCAN_PAGE_SIZE;
+	}
+
+	free(tagsbuf);
+	return 0;
+}
+
+void print_tag_scan_stats(tag_scan_stats *stats)
+{
+	u_long saved = stats->pages > stats->requests ? stats->pages - stats->requests : 0;
+
+	debug_print(INFO, "Tag scan: %lu pages (%lu with tags) read with %lu requests, %lu fewer than one request per page\n",
+	    stats->pages, stats->tagged_pages, stats->requests, saved);
+}
@@ -0,0 +1,251 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "cap_decode.h"
+#include "raw_snapshot.h"
+#include "scan_pool.h"
+#include "tag_scan.h"
+#include "target_log.h"
+
+/*
+ * log_read
+ * Writes a read of the recorder's target to its snapshot, with the data_size
+ * bytes it has read into data.
+ */
+static void log_read(target_recorder *recorder, uint32_t op, int32_t result, u_long addr, uint64_t length,
+    const void *data, size_t data_size)
+{
+	raw_target_read read = { op, result, addr, length, data, data_size };
+
+	pthread_mutex_lock(&recorder->lock);
+	if (raw_write_target_read(recorder->writer, &read) != 0) {
+		debug_print(TROUBLESHOOT, "Unable to record the read of %lu at 0x%lx\n", (u_long)length, addr);
+	}
+	recorder->reads++;
+	pthread_mutex_unlock(&recorder->lock);
+}
+
+static ssize_t record_tags(void *arg, u_long start, unsigned char *tagsbuf, size_t len)
+{
+	target_recorder *recorder = arg;
+	ssize_t nread = recorder->inner.read_tags(recorder->inner.arg, start, tagsbuf, len);
+
+	log_read(recorder, RAW_TARGET_TAGS, (int32_t)nread, start, len, tagsbuf, nread > 0 ? nread : 0);
+	return nread;
+}
+
+static int record_caps(void *arg, u_long addr, unsigned char *capbuf, int nslots)
+{
+	target_recorder *recorder = arg;
+	int rc = recorder->inner.read_caps(recorder->inner.arg, addr, capbuf, nslots);
+
+	log_read(recorder, RAW_TARGET_CAPS, rc, addr, nslots, capbuf,
+	    rc == 0 ? (size_t)nslots*CAP_DECODE_SLOT_SIZE : 0);
+	return rc;
+}
+
+static int record_data(void *arg, u_long addr, void *buf, size_t len)
+{
+	target_recorder *recorder = arg;
+	int rc = recorder->inner.read_data(recorder->inner.arg, addr, buf, len);
+
+	log_read(recorder, RAW_TARGET_DATA, rc, addr, len, buf, rc == 0 ? len : 0);
+	return rc;
+}
+
+/*
+ * target_recorder_init(recorder, inner, writer, target)
+ * Sets target to read from inner, recording the reads into writer.
+ */
+void target_recorder_init(target_recorder *recorder, const scan_target *inner, raw_writer *writer,
+    scan_target *target)
+{
+	recorder->inner = *inner;
+	recorder->writer = writer;
+	recorder->reads = 0;
+	pthread_mutex_init(&recorder->lock, NULL);
+
+	target->read_tags = record_tags;
+	target->read_caps = record_caps;
+	target->read_data = record_data;
+	target->arg = recorder;
+}
+
+/*
+ * target_recorder_range(recorder, start, end)
+ * Records that the capabilities of start to end are scanned, so that the
+ * replay can scan the same ranges.
+ */
+void target_recorder_range(target_recorder *recorder, u_long start, u_long end)
+{
+	raw_scan_range range = { start, end };
+
+	pthread_mutex_lock(&recorder->lock);
+	raw_write_scan_range(recorder->writer, &range);
+	pthread_mutex_unlock(&recorder->lock);
+}
+
+void target_recorder_destroy(target_recorder *recorder)
+{
+	debug_print(INFO, "Recorded %lu reads from the target\n", recorder->reads);
+	pthread_mutex_destroy(&recorder->lock);
+}
+
+/*
+ * target_replay_add
+ * Adds the read of a RAW_REC_TARGET_READ record to the replay. Returns -1 if
+ * the record is malformed.
+ */
+int target_replay_add(target_replay *replay, const raw_record *record)
+{
+	raw_target_read read;
+
+	if (raw_record_target_read(record, &read) != 0) {
+		return -1;
+	}
+	if (replay->count == replay->capacity) {
+		replay->capacity = replay->capacity == 0 ? 1024 : replay->capacity*2;
+		replay->reads = realloc(replay->reads, replay->capacity*sizeof(raw_target_read));
+		if (replay->reads == NULL) {
+			errx(1, "Out of memory, cannot grow the replay to %lu reads", replay->capacity);
+		}
+	}
+	replay->reads[replay->count++] = read;
+	return 0;
+}
+
+static int compare_reads(const void *a, const void *b)
+{
+	const raw_target_read *ra = a;
+	const raw_target_read *rb = b;
+
+	if (ra->op != rb->op) {
+		return ra->op < rb->op ? -1 : 1;
+	}
+	if (ra->addr != rb->addr) {
+		return ra->addr < rb->addr ? -1 : 1;
+	}
+	if (ra->length != rb->length) {
+		return ra->length < rb->length ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+ * find_read
+ * Returns the recorded read of length at addr, NULL if it was not recorded.
+ * The same read recorded more than once had the same result each time, as
+ * the target was stopped, so any of them will do.
+ */
+static const raw_target_read *find_read(target_replay *replay, uint32_t op, u_long addr, uint64_t length)
+{
+	raw_target_read key = { .op = op, .addr = addr, .length = length };
+	const raw_target_read *read = bsearch(&key, replay->reads, replay->count, sizeof(raw_target_read),
+	    compare_reads);
+
+	if (read == NULL) {
+		atomic_fetch_add_explicit(&replay->misses, 1, memory_order_relaxed);
+		debug_print(TROUBLESHOOT, "No recorded read of %lu at 0x%lx\n", (u_long)length, addr);
+		return NULL;
+	}
+	atomic_fetch_add_explicit(&replay->hits, 1, memory_order_relaxed);
+	return read;
+}
+
+static ssize_t replay_tags(void *arg, u_long start, unsigned char *tagsbuf, size_t len)
+{
+	const raw_target_read *read = find_read(arg, RAW_TARGET_TAGS, start, len);
+
+	if (read == NULL || read->result < 0 || read->data_size > len) {
+		return -1;
+	}
+	memcpy(tagsbuf, read->data, read->data_size);
+	return read->result;
+}
+
+static int replay_caps(void *arg, u_long addr, unsigned char *capbuf, int nslots)
+{
+	const raw_target_read *read = find_read(arg, RAW_TARGET_CAPS, addr, nslots);
+
+	if (read == NULL || read->result != 0 || read->data_size != (size_t)nslots*CAP_DECODE_SLOT_SIZE) {
+		return -1;
+	}
+	memcpy(capbuf, read->data, read->data_size);
+	return 0;
+}
+
+static int replay_data(void *arg, u_long addr, void *buf, size_t len)
+{
+	const raw_target_read *read = find_read(arg, RAW_TARGET_DATA, addr, len);
+
+	if (read == NULL || read->result != 0 || read->data_size != len) {
+		return -1;
+	}
+	memcpy(buf, read->data, len);
+	return 0;
+}
+
+/*
+ * target_replay_start(replay, target)
+ * Sets target to serve the reads added to replay, no read can be added
+ * once it has started.
+ */
+void target_replay_start(target_replay *replay, scan_target *target)
+{
+	qsort(replay->reads, replay->count, sizeof(raw_target_read), compare_reads);
+	atomic_store(&replay->hits, 0);
+	atomic_store(&replay->misses, 0);
+
+	target->read_tags = replay_tags;
+	target->read_caps = replay_caps;
+	target->read_data = replay_data;
+	target->arg = replay;
+}
+
+void target_replay_free(target_replay *replay)
+{
+	free(replay->reads);
+	replay->reads = NULL;
+	replay->count = 0;
+	replay->capacity = 0;
+}
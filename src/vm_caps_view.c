@@ -53,19 +53,22 @@
  * 1. "SELECT * FROM vm;"
  * Results are formatted into: start_addr, end_addr, mmap_path
  *
- * 2. "SELECT * FROM cap_info WHERE cap_loc_addr >= start_addr AND cap_loc_addr <= end_addr;"
+ * 2. The capabilities stored in each vm entry, counted with a single range
+ * join on cap_info(cap_loc_addr).
  * Results are added: no_of_caps(%), no_of_ro_caps, no_of_rw_caps, no_of_x_caps
+ *
+ * Both come from the same cursor (vm_cap_stats_cursor_open), one vm entry at
+ * a time.
  * 
  */
 void vm_caps_view(sqlite3 *db) 
 {
-	vm_info *vm_info_captured;
-	int vm_count = get_all_vm_info(db, &vm_info_captured);
-	assert(vm_count != -1);
+	db_cursor cursor;
+	vm_info vm;
+	vm_cap_stats stats;
+	int rc;
 
-	cap_info *cap_info_captured;
-	int cap_count = get_all_cap_info(db, &cap_info_captured);
-	assert(cap_count != -1);
+	int cap_count = cap_info_count(db);
 
 	int dbname_len = strlen(get_dbname());
 	for (int l=0; l<dbname_len+4; l++) {	
@@ -80,81 +83,48 @@ void vm_caps_view(sqlite3 *db)
 	xo_emit("{T:/\n%*s %*s %6s %5s %5s %5s %5s %8s %8s %-5s %-2s %5s %-s}\n",
 		ptrwidth, "START", ptrwidth-1, "END", "PRT", "ro", "rw", "rx", "rwx", "TOTAL", "DENSITY", "FLAGS", "TP", "COMPART", "PATH");
 		
+	rc = vm_cap_stats_cursor_open(db, &cursor);
+	assert(rc == 0);
+
 	xo_open_list("vm_cap_output");
-	for (int i=0; i<vm_count; i++) {
+	while ((rc = vm_cap_stats_cursor_next(&cursor, &vm, &stats)) == 1) {
 		xo_open_instance("vm_cap_output");
-		xo_emit("{:mmap_start_addr/%*s}", ptrwidth, vm_info_captured[i].start_addr);
-		xo_emit("{:mmap_end_addr/%*s}", ptrwidth, vm_info_captured[i].end_addr);
+		xo_emit("{:mmap_start_addr/%#*lx}", ptrwidth, vm.start_addr);
+		xo_emit("{:mmap_end_addr/%#*lx}", ptrwidth, vm.end_addr);
 			
-		xo_emit("{:read/%3s}", vm_info_captured[i].kve_protection & KVME_PROT_READ ?
+		xo_emit("{:read/%3s}", vm.kve_protection & KVME_PROT_READ ?
 			"r" : "-");
-		xo_emit("{:write/%s}", vm_info_captured[i].kve_protection & KVME_PROT_WRITE ?
+		xo_emit("{:write/%s}", vm.kve_protection & KVME_PROT_WRITE ?
 			"w" : "-");
-		xo_emit("{:exec/%s}", vm_info_captured[i].kve_protection & KVME_PROT_EXEC ?
+		xo_emit("{:exec/%s}", vm.kve_protection & KVME_PROT_EXEC ?
 			"x" : "-");
-		xo_emit("{:read_cap/%s}", vm_info_captured[i].kve_protection & KVME_PROT_READ_CAP ? 
+		xo_emit("{:read_cap/%s}", vm.kve_protection & KVME_PROT_READ_CAP ? 
 			"R" : "-");
-		xo_emit("{:write_cap/%s} ", vm_info_captured[i].kve_protection & KVME_PROT_WRITE_CAP ? 
+		xo_emit("{:write_cap/%s} ", vm.kve_protection & KVME_PROT_WRITE_CAP ? 
 			"W" : "-");
 
-		uintptr_t start_addr = (uintptr_t)strtol(vm_info_captured[i].start_addr, NULL, 0);
-	       	uintptr_t end_addr = (uintptr_t)strtol(vm_info_captured[i].end_addr, NULL, 0);
-		
-		int out_cap_count=0;
-		int ro_count=0;
-		int rw_count=0;
-		int rx_count=0;
-		int rwx_count=0;
+		xo_emit("{:ro_count/%5d} ", stats.ro);
+		xo_emit("{:rw_count/%5d} ", stats.rw);
+		xo_emit("{:rx_count/%5d} ", stats.rx);
+		xo_emit("{:rwx_count/%5d} ", stats.rwx);
+		xo_emit("{:out_cap_count/%8d} ", stats.total);
 
-		for (int j=0; j<cap_count; j++) {
-			uintptr_t cap_loc_addr = (uintptr_t)strtol(cap_info_captured[j].cap_loc_addr, NULL, 0);
+		xo_emit("{:out_cap_density/%8.2f%%} ", ((float)stats.total/cap_count)*100);
 			
-			if (cap_loc_addr >= start_addr && cap_loc_addr <= end_addr) {
-				out_cap_count++;
-				if (strchr(cap_info_captured[j].perms, 'r') != NULL &&
-					strchr(cap_info_captured[j].perms, 'w') == NULL &&
-					strchr(cap_info_captured[j].perms, 'x') == NULL) {
-					ro_count++;
-				}
-				if (strchr(cap_info_captured[j].perms, 'r') != NULL &&
-					strchr(cap_info_captured[j].perms, 'w') != NULL &&
-					strchr(cap_info_captured[j].perms, 'x') == NULL) {
-					rw_count++;
-				}
-				if (strchr(cap_info_captured[j].perms, 'r') != NULL &&
-					strchr(cap_info_captured[j].perms, 'x') != NULL &&
-					strchr(cap_info_captured[j].perms, 'w') == NULL) {
-					rx_count++;
-				}
-				if (strchr(cap_info_captured[j].perms, 'r') != NULL &&
-					strchr(cap_info_captured[j].perms, 'x') != NULL &&
-					strchr(cap_info_captured[j].perms, 'w') != NULL) {
-					rwx_count++;
-				}
-			}
-		}
-		xo_emit("{:ro_count/%5d} ", ro_count);
-		xo_emit("{:rw_count/%5d} ", rw_count);
-		xo_emit("{:rx_count/%5d} ", rx_count);
-		xo_emit("{:rwx_count/%5d} ", rwx_count);
-		xo_emit("{:out_cap_count/%8d} ", out_cap_count);
-
-		xo_emit("{:out_cap_density/%8.2f%%} ", ((float)out_cap_count/cap_count)*100);
-			
-		xo_emit("{:copy_on_write/%-1s}", vm_info_captured[i].mmap_flags &
+		xo_emit("{:copy_on_write/%-1s}", vm.mmap_flags &
 		    	KVME_FLAG_COW ? "C" : "-");
-		xo_emit("{:need_copy/%-1s}", vm_info_captured[i].mmap_flags &
+		xo_emit("{:need_copy/%-1s}", vm.mmap_flags &
 		   	KVME_FLAG_NEEDS_COPY ? "N" : "-");
-		xo_emit("{:super_pages/%-1s}", vm_info_captured[i].mmap_flags &
+		xo_emit("{:super_pages/%-1s}", vm.mmap_flags &
 			KVME_FLAG_SUPER ? "S" : "-");
-		xo_emit("{:grows_down/%-1s}", vm_info_captured[i].mmap_flags &
-			KVME_FLAG_GROWS_UP ? "U" : vm_info_captured[i].mmap_flags &
+		xo_emit("{:grows_down/%-1s}", vm.mmap_flags &
+			KVME_FLAG_GROWS_UP ? "U" : vm.mmap_flags &
 	    		KVME_FLAG_GROWS_DOWN ? "D" : "-");
-		xo_emit("{:wired/%-1s} ", vm_info_captured[i].mmap_flags &
+		xo_emit("{:wired/%-1s} ", vm.mmap_flags &
 	    		KVME_FLAG_USER_WIRED ? "W" : "-");
 			
 		const char *str;	
-		switch (vm_info_captured[i].vnode_type) {
+		switch (vm.vnode_type) {
 		case KVME_TYPE_NONE:
 			str = "--";
 			break;
@@ -192,30 +162,19 @@ void vm_caps_view(sqlite3 *db)
 		}
 		xo_emit("{:kve_type/%-2s} ", str);	
 			
-		xo_emit("{:compart_id/%7d} ", vm_info_captured[i].compart_id);
+		xo_emit("{:compart_id/%7d} ", vm.compart_id);
 
-		char *filename = (char*)malloc(sizeof(vm_info_captured[i].mmap_path));
-		get_filename_from_path(vm_info_captured[i].mmap_path, &filename);			
+		char *filename;
+		get_filename_from_path(vm.mmap_path, &filename);			
 		xo_emit("{:mmap_path/%s}\n", filename);
 		free(filename);
-
-		free(vm_info_captured[i].start_addr);
-		free(vm_info_captured[i].end_addr);
-		free(vm_info_captured[i].mmap_path);
 		
 		xo_close_instance("vm_cap_output");
 	}
-	for (int k=0; k<cap_count; k++) {
-		free(cap_info_captured[k].cap_loc_addr);
-		free(cap_info_captured[k].cap_addr);
-		free(cap_info_captured[k].perms);
-		free(cap_info_captured[k].base);
-		free(cap_info_captured[k].top);
-	}
-	
+
 	xo_close_list("vm_cap_output");
-	free(vm_info_captured);
-	free(cap_info_captured);
+	assert(rc == 0);
+	db_cursor_close(&cursor);
 
 }
 
@@ -0,0 +1,141 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the arena and the string table: alignment, requests larger than a
+ * block, every allocation being kept until arena_free, and equal strings
+ * being interned to the same copy through the growth of the table.
+ *
+ * cc -I../includes -o arena_test arena_test.c ../src/arena.c
+ */
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define STRINGS	5000
+
+static void check_arena(void)
+{
+	arena a;
+
+	arena_init(&a, 1024);
+	assert(a.blocks == NULL && a.block_count == 0);
+
+	// Every allocation is aligned for any type, whatever was asked before it
+	unsigned char *small[64];
+	for (int i=0; i<64; i++) {
+		small[i] = arena_alloc(&a, i + 1);
+		assert((uintptr_t)small[i] % alignof(max_align_t) == 0);
+		memset(small[i], i, i + 1);
+	}
+
+	// A large request gets a block of its own, the smaller ones carry on
+	// filling the current block
+	u_long blocks = a.block_count;
+	unsigned char *large = arena_alloc(&a, 4096);
+	memset(large, 0xff, 4096);
+	assert(a.block_count == blocks + 1);
+	unsigned char *after = arena_alloc(&a, 8);
+	assert(a.block_count == blocks + 1);
+	memset(after, 0xee, 8);
+
+	for (int i=0; i<64; i++) {
+		for (int j=0; j<=i; j++) {
+			assert(small[i][j] == i);
+		}
+	}
+
+	int *zeroed = arena_calloc(&a, 100, sizeof(int));
+	for (int i=0; i<100; i++) {
+		assert(zeroed[i] == 0);
+	}
+	assert(a.used <= a.reserved);
+
+	char *copy = arena_strdup(&a, "libc.so.7");
+	assert(strcmp(copy, "libc.so.7") == 0);
+
+	arena_free(&a);
+	assert(a.blocks == NULL && a.used == 0 && a.reserved == 0 && a.block_size == 1024);
+}
+
+static void check_intern(void)
+{
+	arena a;
+	str_table table;
+	char *interned[STRINGS];
+	char *found, *empty;
+	char name[32];
+
+	arena_init(&a, 0);
+	str_table_init(&table, &a);
+	found = str_intern(&table, NULL);
+	assert(found == NULL);
+
+	for (int i=0; i<STRINGS; i++) {
+		snprintf(name, sizeof(name), "/lib/libsynth%d.so", i);
+		interned[i] = str_intern(&table, name);
+		assert(strcmp(interned[i], name) == 0);
+		assert(interned[i] != name);
+	}
+	assert(table.count == STRINGS);
+	assert(2*table.count <= table.capacity);
+
+	// The same copies are found again after the table has grown
+	for (int i=0; i<STRINGS; i++) {
+		snprintf(name, sizeof(name), "/lib/libsynth%d.so", i);
+		found = str_intern(&table, name);
+		assert(found == interned[i]);
+	}
+	assert(table.count == STRINGS);
+	empty = str_intern(&table, "");
+	found = str_intern(&table, "");
+	assert(found == empty);
+
+	str_table_free(&table);
+	assert(table.slots == NULL && table.count == 0 && table.arena == &a);
+	arena_free(&a);
+}
+
+int main(void)
+{
+	check_arena();
+	check_intern();
+
+	printf("Test OK!\n");
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the binary capability decoder against canned capability bytes and
+ * against capabilities made at run time. The capabilities made at run time
+ * need a CHERI purecap host, on a Morello one they are also checked against
+ * the software decoder used by hosts without CHERI:
+ *
+ * cc -I../includes -o cap_decode_test cap_decode_test.c ../src/cap_decode.c
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __CHERI__
+#include <cheri/cheric.h>
+#endif
+
+#include "cap_decode.h"
+
+static void check_perms_str(void)
+{
+	char buf[CAP_PERMS_STR_SIZE];
+
+	assert(strcmp(cap_perms_str(0, buf, sizeof(buf)), "") == 0);
+	assert(strcmp(cap_perms_str(CAP_PERM_LOAD | CAP_PERM_STORE, buf, sizeof(buf)), "rw") == 0);
+	assert(strcmp(cap_perms_str(CAP_PERM_LOAD | CAP_PERM_EXECUTE | CAP_PERM_LOAD_CAP | CAP_PERM_GLOBAL,
+	    buf, sizeof(buf)), "rxR") == 0);
+	assert(strcmp(cap_perms_str(0xffffffff, buf, sizeof(buf)), "rwxRWE") == 0);
+	// Truncated to the size of the buffer
+	assert(strcmp(cap_perms_str(0xffffffff, buf, 3), "rw") == 0);
+}
+
+static void check_canned_null_derived(void)
+{
+	// A NULL-derived capability: only the address is set, the upper half of
+	// the capability (bounds, permissions, otype) is all zero.
+	unsigned char slot[CAP_DECODE_SLOT_SIZE] = {
+		0x00,
+		0x34, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	cap_decoded cap;
+
+	cap_decode_slot(slot, &cap);
+	assert(cap.addr == 0x1234);
+	assert(cap.base == 0);
+	assert(cap.top == UINT64_MAX);
+	assert(cap.perms == 0);
+	assert(cap.tag == 0);
+	assert(cap.sealed == 0);
+}
+
+static void check_canned_tag_byte(void)
+{
+	unsigned char slot[CAP_DECODE_SLOT_SIZE] = { 0x01 };
+	cap_decoded cap;
+
+	cap_decode_slot(slot, &cap);
+	assert(cap.tag == 1);
+	assert(cap.addr == 0);
+}
+
+/* The bytes of a Morello capability, from its address and upper half */
+static void morello_bytes(unsigned char *bytes, uint64_t addr, uint64_t pesbt)
+{
+	for (int i=0; i<8; i++) {
+		bytes[i] = addr >> (8*i);
+		bytes[8+i] = pesbt >> (8*i);
+	}
+}
+
+static void check_canned_morello(void)
+{
+	unsigned char bytes[CAP_DECODE_CAP_SIZE];
+	cap_decoded cap;
+
+	// Zero exponent (bit 94 set): [0x1000, 0x1100) with rw
+	uint64_t rw = (1ULL << 63) | (1ULL << 62);
+	morello_bytes(bytes, 0x1010, rw | (1ULL << 30) | (0x1100 << 16) | 0x1000);
+	cap_decode_morello(bytes, 1, &cap);
+	assert(cap.addr == 0x1010 && cap.base == 0x1000 && cap.top == 0x1100 && cap.length == 0x100);
+	assert(cap.perms == (CAP_PERM_LOAD | CAP_PERM_STORE));
+	assert(cap.tag == 1 && cap.sealed == 0 && cap.flags == 0);
+
+	// The flags in the top byte of the address do not move the bounds
+	morello_bytes(bytes, 0x0100000000001010ULL, rw | (1ULL << 30) | (0x1100 << 16) | 0x1000);
+	cap_decode_morello(bytes, 1, &cap);
+	assert(cap.base == 0x1000 && cap.top == 0x1100 && cap.flags == 1);
+
+	// The top crosses a 0x4000 boundary that the base does not
+	morello_bytes(bytes, 0x3ff0, (1ULL << 30) | (0x0010 << 16) | 0x3ff0);
+	cap_decode_morello(bytes, 1, &cap);
+	assert(cap.base == 0x3ff0 && cap.top == 0x4010);
+
+	// Internal exponent 6, stored inverted as 0b111:0b001 in the low bits of
+	// limit and base: [0x40000000, 0x40100000), rx, sealed as a sentry
+	uint64_t rx = (1ULL << 63) | (1ULL << 61);
+	morello_bytes(bytes, 0x40000010, rx | (1ULL << 31) | (0x7 << 16) | 0x1);
+	cap_decode_morello(bytes, 1, &cap);
+	assert(cap.base == 0x40000000 && cap.top == 0x40100000 && cap.length == 0x100000);
+	assert(cap.perms == (CAP_PERM_LOAD | CAP_PERM_EXECUTE));
+	assert(cap.otype == 1 && cap.sealed == 1);
+
+	// All zeros, the bounds are the whole address space
+	morello_bytes(bytes, 0x1234, 0);
+	cap_decode_morello(bytes, 0, &cap);
+	assert(cap.addr == 0x1234 && cap.base == 0 && cap.top == UINT64_MAX && cap.length == UINT64_MAX);
+	assert(cap.perms == 0 && cap.tag == 0 && cap.sealed == 0);
+}
+
+#ifdef __CHERI__
+/* On Morello the software decoder agrees with the cheric accessors */
+static void check_same_as_morello(const unsigned char *bytes)
+{
+#ifdef __aarch64__
+	cap_decoded hw, sw;
+
+	cap_decode_bytes(bytes, 1, &hw);
+	cap_decode_morello(bytes, 1, &sw);
+	assert(hw.addr == sw.addr && hw.base == sw.base && hw.top == sw.top && hw.length == sw.length);
+	assert(hw.perms == sw.perms && hw.otype == sw.otype && hw.sealed == sw.sealed);
+#endif
+}
+
+static void check_runtime_data_cap(void)
+{
+	static char buffer[64];
+	void *ptr = cheri_setbounds(buffer, sizeof(buffer));
+	unsigned char bytes[CAP_DECODE_CAP_SIZE];
+	cap_decoded cap;
+
+	memcpy(bytes, &ptr, sizeof(bytes));
+	cap_decode_bytes(bytes, 1, &cap);
+	assert(cap.addr == (uint64_t)(uintptr_t)buffer);
+	assert(cap.base == (uint64_t)(uintptr_t)buffer);
+	assert(cap.length == sizeof(buffer));
+	assert(cap.top == cap.base + sizeof(buffer));
+	assert(cap.perms & CAP_PERM_LOAD);
+	assert(cap.perms & CAP_PERM_STORE);
+	assert(!(cap.perms & CAP_PERM_EXECUTE));
+	assert(cap.sealed == 0);
+	check_same_as_morello(bytes);
+
+	// Dropping the store permission shows in the decoded perms
+	void *ro = cheri_andperm(ptr, ~(CHERI_PERM_STORE | CHERI_PERM_STORE_CAP | CHERI_PERM_STORE_LOCAL_CAP));
+	memcpy(bytes, &ro, sizeof(bytes));
+	cap_decode_bytes(bytes, 1, &cap);
+	assert(cap.perms & CAP_PERM_LOAD);
+	assert(!(cap.perms & CAP_PERM_STORE));
+	assert(!(cap.perms & CAP_PERM_STORE_CAP));
+	check_same_as_morello(bytes);
+}
+
+static void check_runtime_code_cap(void)
+{
+	void (*fn)(void) = check_perms_str;
+	unsigned char bytes[CAP_DECODE_CAP_SIZE];
+	cap_decoded cap;
+
+	memcpy(bytes, &fn, sizeof(bytes));
+	cap_decode_bytes(bytes, 1, &cap);
+	// Function pointers are sealed entry capabilities
+	assert(cap.perms & CAP_PERM_EXECUTE);
+	assert(cap.sealed == 1);
+	assert(cap.addr >= cap.base && cap.addr < cap.top);
+	check_same_as_morello(bytes);
+}
+#endif // __CHERI__
+
+int main(int argc, char *argv[])
+{
+	check_perms_str();
+	check_canned_null_derived();
+	check_canned_tag_byte();
+	check_canned_morello();
+#ifdef __CHERI__
+	check_runtime_data_cap();
+	check_runtime_code_cap();
+#endif
+
+	printf("Test OK!\n");
+	return 0;
+}
@@ -161,6 +161,97 @@ else
     exit 1
 fi
 
+########
+# Test that chericat with -t with an invalid number of pages would result in an error message
+########
+pass=0
+output=$($bin -t 0 2>&1)
+echo "$output" | grep -q "is not a valid number of pages" -
+if [ $? == 0 ]; then
+    pass=1
+else
+    echo "Unexpected result for -t with an invalid number of pages"
+    exit 1
+fi
+
+########
+# Test that chericat with -j with an invalid number of workers would result in an error message
+########
+pass=0
+output=$($bin -j 0 2>&1)
+echo "$output" | grep -q "is not a valid number of workers" -
+if [ $? == 0 ]; then
+    pass=1
+else
+    echo "Unexpected result for -j with an invalid number of workers"
+    exit 1
+fi
+
+########
+# Test that chericat with -o without -p would result in an error message
+########
+pass=0
+output=$($bin -o snapshot.raw 2>&1)
+echo "$output" | grep -q "expecting -p <pid>" -
+if [ $? == 0 ]; then
+    pass=1
+else
+    echo "Unexpected result for -o without -p"
+    exit 1
+fi
+
+########
+# Test that chericat with -I without -p would result in an error message
+########
+pass=0
+output=$($bin -I 2>&1)
+echo "$output" | grep -q "expecting -p <pid>" -
+if [ $? == 0 ]; then
+    pass=1
+else
+    echo "Unexpected result for -I without -p"
+    exit 1
+fi
+
+########
+# Test that chericat with -R and -o would result in an error message
+########
+pass=0
+output=$($bin -p 1 -R scan.rec -o snapshot.raw 2>&1)
+echo "$output" | grep -q "it cannot be used with -o" -
+if [ $? == 0 ]; then
+    pass=1
+else
+    echo "Unexpected result for -R with -o"
+    exit 1
+fi
+
+########
+# Test that chericat with -s and -p would result in an error message
+########
+pass=0
+output=$($bin -s 1 -p 1 2>&1)
+echo "$output" | grep -q "a scan or ingest always takes a new one" -
+if [ $? == 0 ]; then
+    pass=1
+else
+    echo "Unexpected result for -s with -p"
+    exit 1
+fi
+
+########
+# Test that the diff command with a single snapshot id would result in an error message
+########
+pass=0
+output=$($bin -f invalid diff 1 2>&1)
+echo "$output" | grep -q "Expecting two snapshot ids" -
+if [ $? == 0 ]; then
+    pass=1
+else
+    echo "Unexpected result for diff with a single snapshot id"
+    exit 1
+fi
+
 ########
 # Check overall test status
 #########
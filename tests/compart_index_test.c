@@ -0,0 +1,272 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the compartment attribution of capabilities: the flattening of
+ * nested and overlapping compartment ranges, checked against a search of
+ * every compartment, the lookups at their boundaries, and the cap_compart
+ * table built from a small database holding two snapshots.
+ *
+ * cc -D_GNU_SOURCE -I../includes -o compart_index_test compart_index_test.c \
+ *     ../src/compart_index.c ../src/db_process.c ../src/arena.c ../src/common.c \
+ *     ../src/run_stats.c -lsqlite3
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "compart_index.h"
+#include "db_process.h"
+
+static sqlite3_int64 query_int(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 val;
+
+	int rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	val = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return val;
+}
+
+static void check_lookups(void)
+{
+	int rc;
+
+	// Two libraries, the first one with a sub-compartment in its middle
+	comp_info comparts[] = {
+		{ .compart_id = 1, .start_addr = 0x1000, .end_addr = 0x5000 },
+		{ .compart_id = 2, .start_addr = 0x8000, .end_addr = 0x9000 },
+		{ .compart_id = 3, .start_addr = 0x2000, .end_addr = 0x3000 },
+		{ .compart_id = 4, .start_addr = 0, .end_addr = 0 },
+	};
+	compart_index index;
+
+	// 0x1000-0x2000 (1), 0x2000-0x3000 (3), 0x3000-0x5000 (1), 0x8000-0x9000 (2)
+	rc = compart_index_build(&index, comparts, 4);
+	assert(rc == 4);
+
+	assert(compart_index_lookup(&index, 0x0fff) == COMPART_ID_NONE);
+	assert(compart_index_lookup(&index, 0x1000) == 1);
+	assert(compart_index_lookup(&index, 0x1ff0) == 1);
+	assert(compart_index_lookup(&index, 0x2000) == 3);
+	assert(compart_index_lookup(&index, 0x2ff0) == 3);
+	assert(compart_index_lookup(&index, 0x3000) == 1);
+	assert(compart_index_lookup(&index, 0x4ff0) == 1);
+	assert(compart_index_lookup(&index, 0x5000) == COMPART_ID_NONE);
+	assert(compart_index_lookup(&index, 0x7000) == COMPART_ID_NONE);
+	assert(compart_index_lookup(&index, 0x8000) == 2);
+	assert(compart_index_lookup(&index, 0x9000) == COMPART_ID_NONE);
+	assert(compart_index_lookup(&index, UINT64_MAX) == COMPART_ID_NONE);
+
+	compart_index_free(&index);
+
+	rc = compart_index_build(&index, comparts, 0);
+	assert(rc == 0);
+	assert(compart_index_lookup(&index, 0x1000) == COMPART_ID_NONE);
+	compart_index_free(&index);
+}
+
+// The smallest compartment containing addr, the first one of the same size
+static int search_comparts(const comp_info *comparts, int comp_count, uint64_t addr)
+{
+	int compart_id = COMPART_ID_NONE;
+	uint64_t smallest = UINT64_MAX;
+
+	for (int i=0; i<comp_count; i++) {
+		if (comparts[i].start_addr <= addr && addr < comparts[i].end_addr &&
+		    comparts[i].end_addr - comparts[i].start_addr < smallest) {
+			smallest = comparts[i].end_addr - comparts[i].start_addr;
+			compart_id = comparts[i].compart_id;
+		}
+	}
+	return compart_id;
+}
+
+static void check_overlaps(void)
+{
+	int rc;
+
+	// Partly overlapping ranges, and two of the same size
+	comp_info comparts[] = {
+		{ .compart_id = 5, .start_addr = 0x1000, .end_addr = 0x4000 },
+		{ .compart_id = 6, .start_addr = 0x3000, .end_addr = 0x5000 },
+		{ .compart_id = 7, .start_addr = 0x6000, .end_addr = 0x7000 },
+		{ .compart_id = 8, .start_addr = 0x6000, .end_addr = 0x7000 },
+	};
+	compart_index index;
+
+	rc = compart_index_build(&index, comparts, 4);
+	assert(rc == 3);
+	assert(compart_index_lookup(&index, 0x2ff0) == 5);
+	assert(compart_index_lookup(&index, 0x3000) == 6);
+	assert(compart_index_lookup(&index, 0x4ff0) == 6);
+	assert(compart_index_lookup(&index, 0x6000) == 7);
+	compart_index_free(&index);
+
+	// Random ranges, looked up at and around every boundary
+	comp_info random_comparts[200];
+	srandom(8);
+	for (int round=0; round<20; round++) {
+		int count = 1 + random() % 200;
+		for (int i=0; i<count; i++) {
+			uint64_t start = (random() % 256) * 0x100;
+			random_comparts[i].compart_id = i;
+			random_comparts[i].start_addr = start;
+			random_comparts[i].end_addr = start + (random() % 64) * 0x100;
+		}
+		compart_index_build(&index, random_comparts, count);
+		for (int i=0; i<count; i++) {
+			uint64_t bounds[] = { random_comparts[i].start_addr, random_comparts[i].end_addr };
+			for (int b=0; b<2; b++) {
+				for (uint64_t addr = bounds[b] - 1; addr != bounds[b] + 2; addr++) {
+					assert(compart_index_lookup(&index, addr) ==
+					    search_comparts(random_comparts, count, addr));
+				}
+			}
+		}
+		compart_index_free(&index);
+	}
+}
+
+static void check_cap_compart(void)
+{
+	sqlite3 *db;
+	int rc;
+	int64_t snapshot_id;
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	create_vm_cap_db(db);
+	create_comparts_table(db);
+	snapshot_id = snapshot_begin(db, 100, 0);
+	assert(snapshot_id == 1);
+	rc = sql_query_exec(db,
+	    "INSERT INTO comparts VALUES(1, 'libc', '/lib/libc.so.7', 4096, 20480, 1, NULL, 1);"
+	    "INSERT INTO comparts VALUES(2, 'libthr', '/lib/libthr.so.3', 32768, 36864, 1, NULL, 1);"
+	    "INSERT INTO paths VALUES(1, '/lib/libc.so.7', 'libc.so.7', '');"
+	    "INSERT INTO paths VALUES(2, '/lib/libthr.so.3', 'libthr.so.3', '');"
+	    "INSERT INTO cap_info VALUES(4112, 1, 32784, 3, 32768, 36864, 1);"
+	    "INSERT INTO cap_info VALUES(4128, 1, 8192, 1, 4096, 20480, 1);"
+	    "INSERT INTO cap_info VALUES(4144, 1, 8208, 1, 4096, 20480, 1);"
+	    "INSERT INTO cap_info VALUES(32784, 2, 65536, 5, 65536, 69632, 1);",
+	    NULL, NULL);
+	assert(rc == 0);
+
+	rc = build_cap_compart(db);
+	assert(rc == 4);
+	// Built once, then reused
+	rc = build_cap_compart(db);
+	assert(rc == 4);
+
+	db_cursor cursor;
+	compart_pair_stats pair;
+	rc = compart_pair_cursor_open(db, &cursor);
+	assert(rc == 0);
+	rc = compart_pair_cursor_next(&cursor, &pair);
+	assert(rc == 1);
+	assert(pair.src_compart_id == 1 && pair.dest_compart_id == 1);
+	assert(strcmp(pair.src_compart_name, "libc") == 0);
+	assert(pair.caps.total == 2 && pair.caps.ro == 2);
+	rc = compart_pair_cursor_next(&cursor, &pair);
+	assert(rc == 1);
+	assert(pair.src_compart_id == 1 && pair.dest_compart_id == 2);
+	assert(strcmp(pair.dest_compart_name, "libthr") == 0);
+	assert(pair.caps.total == 1 && pair.caps.rw == 1);
+	rc = compart_pair_cursor_next(&cursor, &pair);
+	assert(rc == 1);
+	assert(pair.src_compart_id == 2 && pair.dest_compart_id == COMPART_ID_NONE);
+	assert(pair.dest_compart_name == NULL);
+	assert(pair.caps.rx == 1);
+	rc = compart_pair_cursor_next(&cursor, &pair);
+	assert(rc == 0);
+	assert(cursor.rows == 3);
+	db_cursor_close(&cursor);
+
+	// A later snapshot of the same process, where libthr holds no capability
+	snapshot_id = snapshot_begin(db, 100, 60);
+	assert(snapshot_id == 2);
+	rc = sql_query_exec(db,
+	    "INSERT INTO comparts VALUES(1, 'libc', '/lib/libc.so.7', 4096, 20480, 1, NULL, 2);"
+	    "INSERT INTO comparts VALUES(2, 'libthr', '/lib/libthr.so.3', 32768, 36864, 1, NULL, 2);"
+	    "INSERT INTO cap_info VALUES(4112, 1, 32784, 3, 32768, 36864, 2);",
+	    NULL, NULL);
+	assert(rc == 0);
+	rc = build_cap_compart(db);
+	assert(rc == 1);
+	assert(cap_info_count(db) == 1);
+
+	// The first one is left as it was
+	rc = select_snapshot(db, 1);
+	assert(rc == 0);
+	assert(get_snapshot_id(db) == 1);
+	rc = build_cap_compart(db);
+	assert(rc == 4);
+	assert(cap_info_count(db) == 4);
+
+	// Mapped again when not recorded as done, although the counts still match
+	rc = sql_query_exec(db, "UPDATE comparts SET start_addr = 4128 WHERE compart_id = 1; "
+	    "DELETE FROM cap_compart_snapshot;", NULL, NULL);
+	assert(rc == 0);
+	rc = build_cap_compart(db);
+	assert(rc == 4);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_compart m JOIN cap_info c ON c.rowid = m.cap_id "
+	    "WHERE c.snapshot_id = 1 AND m.src_compart_id = -1;") == 1);
+	rc = select_snapshot(db, 3);
+	assert(rc == 1);
+
+	sqlite3_close(db);
+}
+
+int main(int argc, char *argv[])
+{
+	set_print_level(NOPRINT);
+
+	check_lookups();
+	check_overlaps();
+	check_cap_compart();
+
+	printf("Test OK!\n");
+	return 0;
+}
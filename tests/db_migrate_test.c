@@ -0,0 +1,270 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Writes a database with the text schema of version 0, as older versions of
+ * chericat did, and checks that migrate_db brings it to the INTEGER schema
+ * without losing data:
+ *
+ * cc -D_GNU_SOURCE -I../includes -o db_migrate_test db_migrate_test.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+
+static const char *version0_db =
+	"CREATE TABLE vm(start_addr VARCHAR NOT NULL, end_addr VARCHAR NOT NULL, "
+	"mmap_path VARCHAR NOT NULL, compart_id INTEGER NOT NULL, kve_protection INTEGER NOT NULL, "
+	"mmap_flags INTEGER NOT NULL, vnode_type INTEGER NOT NULL, plt_addr VARCHAR, "
+	"plt_size VARCHAR, got_addr VARCHAR, got_size VARCHAR);"
+	"CREATE TABLE cap_info(cap_loc_addr VARCHAR NOT NULL, cap_loc_path VARCHAR NOT NULL, "
+	"cap_addr VARCHAR NOT NULL, perms VARCHAR NOT NULL, base VARCHAR NOT NULL, top VARCHAR NOT NULL);"
+	"CREATE TABLE elf_sym(source_path VARCHAR NOT NULL, st_name VARCHAR NOT NULL, "
+	"st_value VARCHAR NOT NULL, st_shndx VARCHAR NOT NULL, type VARCHAR NOT NULL, "
+	"bind VARCHAR NOT NULL, addr VARCHAR NOT NULL);"
+	"INSERT INTO vm VALUES(\"0x40000000\", \"0x40010000\", \"/usr/lib/libc.so.7\", 1, 3, 0, 2, "
+	"\"0x40001000\", \"0x200\", NULL, NULL);"
+	"INSERT INTO cap_info VALUES(\"0x40000010\", \"/usr/lib/libc.so.7\", \"0x40008000\", \"rwRW\", "
+	"\"0x40008000\", \"0x40008100\");"
+	"INSERT INTO cap_info VALUES(\"0x40000020\", \"/usr/lib/libc.so.7\", \"0x1234\", \"\", "
+	"\"0x0\", \"0xffffffffffffffff\");"
+	"INSERT INTO elf_sym VALUES(\"/usr/lib/libc.so.7\", \"malloc\", \"0x8000\", \"12\", \"FUNC\", "
+	"\"GLOBAL\", \"0x40008000\");";
+
+/*
+ * The tables of version 6, whose snapshot_id does not refer to the snapshot
+ * table yet. The capability of snapshot 2 has lost its snapshot.
+ */
+static const char *version6_db =
+	"CREATE TABLE paths(path_id INTEGER PRIMARY KEY, path VARCHAR NOT NULL UNIQUE, "
+	"basename VARCHAR NOT NULL, suffix VARCHAR NOT NULL DEFAULT '');"
+	"CREATE TABLE snapshot(snapshot_id INTEGER PRIMARY KEY, pid INTEGER, started INTEGER, "
+	"command VARCHAR, duration REAL);"
+	"CREATE TABLE cap_info(cap_loc_addr INTEGER NOT NULL, cap_loc_path_id INTEGER NOT NULL, "
+	"cap_addr INTEGER NOT NULL, perms INTEGER NOT NULL, base INTEGER NOT NULL, "
+	"top INTEGER NOT NULL, snapshot_id INTEGER);"
+	"CREATE INDEX cap_info_snapshot_loc ON cap_info(snapshot_id, cap_loc_addr, perms);"
+	"CREATE TABLE comparts(compart_id INTEGER NOT NULL, compart_name VARCHAR, library_path VARCHAR, "
+	"start_addr INTEGER, end_addr INTEGER, is_default INTEGER, parent_id INTEGER, "
+	"snapshot_id INTEGER, PRIMARY KEY(snapshot_id, compart_id));"
+	"INSERT INTO paths VALUES(1, '/usr/lib/libc.so.7', 'libc.so.7', '');"
+	"INSERT INTO snapshot(snapshot_id, pid) VALUES(1, 100);"
+	"INSERT INTO cap_info(rowid, cap_loc_addr, cap_loc_path_id, cap_addr, perms, base, top, snapshot_id) "
+	"VALUES(7, 4112, 1, 8192, 3, 8192, 8448, 1);"
+	"INSERT INTO cap_info(rowid, cap_loc_addr, cap_loc_path_id, cap_addr, perms, base, top, snapshot_id) "
+	"VALUES(9, 4128, 1, 8208, 1, 8192, 8448, 2);"
+	"INSERT INTO comparts VALUES(1, 'libc', '/usr/lib/libc.so.7', 4096, 20480, 1, NULL, 1);"
+	"PRAGMA user_version = 6;";
+
+static sqlite3_int64 query_int(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 val;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	val = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return val;
+}
+
+static int query_text_eq(sqlite3 *db, const char *query, const char *expected)
+{
+	sqlite3_stmt *stmt;
+	int eq;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	eq = strcmp((const char *)sqlite3_column_text(stmt, 0), expected) == 0;
+	sqlite3_finalize(stmt);
+	return eq;
+}
+
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	int rc;
+	int64_t path_id;
+
+	set_print_level(NOPRINT);
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_exec(db, version0_db, NULL, NULL, NULL);
+	assert(rc == SQLITE_OK);
+	assert(query_int(db, "PRAGMA user_version;") == 0);
+
+	rc = migrate_db(db);
+	assert(rc == 0);
+	assert(query_int(db, "PRAGMA user_version;") == DB_SCHEMA_VERSION);
+
+	// Addresses are integers, so range queries compare numerically
+	assert(query_int(db, "SELECT typeof(start_addr) = 'integer' FROM vm;") == 1);
+	assert(query_int(db, "SELECT start_addr FROM vm;") == 0x40000000);
+	assert(query_int(db, "SELECT plt_size FROM vm;") == 0x200);
+	assert(query_int(db, "SELECT got_addr IS NULL FROM vm;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info c JOIN vm v "
+	    "ON c.cap_addr >= v.start_addr AND c.cap_addr < v.end_addr;") == 1);
+	assert(query_int(db, "SELECT perms FROM cap_info WHERE cap_loc_addr = 0x40000010;") ==
+	    (CAP_PERM_LOAD | CAP_PERM_STORE | CAP_PERM_LOAD_CAP | CAP_PERM_STORE_CAP));
+	assert((uint64_t)query_int(db, "SELECT top FROM cap_info WHERE cap_loc_addr = 0x40000020;") == UINT64_MAX);
+	assert(query_int(db, "SELECT addr FROM elf_sym;") == 0x40008000);
+
+	// The text views show the values as they used to be stored
+	assert(query_text_eq(db, "SELECT start_addr FROM vm_text;", "0x40000000"));
+	assert(query_text_eq(db, "SELECT perms FROM cap_info_text WHERE cap_loc_addr = '0x40000010';", "rwRW"));
+	assert(query_text_eq(db, "SELECT top FROM cap_info_text WHERE cap_loc_addr = '0x40000020';", "0xffffffffffffffff"));
+	assert(query_text_eq(db, "SELECT addr FROM elf_sym_text;", "0x40008000"));
+	// Symbols captured before their size was stored have none
+	assert(query_int(db, "SELECT st_size IS NULL FROM elf_sym;") == 1);
+	// The rows captured before snapshots were kept belong to snapshot 1
+	assert(query_int(db, "SELECT COUNT(*) FROM snapshot;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 1;") == 2);
+	assert(query_int(db, "SELECT snapshot_id FROM vm;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM snapshot_elf s JOIN elf_sym e ON e.elf_id = s.elf_id "
+	    "WHERE s.snapshot_id = 1;") == 1);
+	assert(get_snapshot_id(db) == 1);
+	// and refer to it
+	assert(query_int(db, "SELECT COUNT(*) FROM pragma_foreign_key_list('cap_info') WHERE \"table\" = 'snapshot';") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM pragma_foreign_key_list('snapshot_elf') WHERE \"table\" = 'snapshot';") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM pragma_foreign_key_check;") == 0);
+	// The paths are stored once, the rows keep their rowid
+	assert(query_int(db, "SELECT COUNT(*) FROM paths;") == 1);
+	assert(query_text_eq(db, "SELECT basename FROM paths;", "libc.so.7"));
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info_with_path WHERE cap_loc_path = '/usr/lib/libc.so.7';") == 2);
+	assert(query_int(db, "SELECT cap_loc_addr FROM cap_info WHERE rowid = 2;") == 0x40000020);
+	assert(query_text_eq(db, "SELECT mmap_path FROM vm_text;", "/usr/lib/libc.so.7"));
+	assert(query_text_eq(db, "SELECT source_path FROM elf_sym_text;", "/usr/lib/libc.so.7"));
+	assert(cap_info_for_lib_count(db, "libc") == 2);
+	assert(cap_info_for_lib_count(db, "libc.so.7") == 2);
+	assert(cap_info_for_lib_count(db, "libthr") == 0);
+
+	// Opening it again does not migrate it twice
+	rc = migrate_db(db);
+	assert(rc == 0);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info;") == 2);
+
+	arena strings_arena;
+	str_table strings;
+	arena_init(&strings_arena, 0);
+	str_table_init(&strings, &strings_arena);
+
+	vm_info *vms;
+	rc = get_all_vm_info(db, &strings, &vms);
+	assert(rc == 1);
+	assert(vms[0].end_addr == 0x40010000);
+	free(vms);
+
+	sym_info *syms;
+	rc = get_all_sym_info(db, &strings, &syms);
+	assert(rc == 1);
+	assert(strcmp(syms[0].sym_name, "malloc") == 0);
+	// Symbols stored before the cache keep their address, at a base of 0
+	assert(syms[0].addr == 0x40008000);
+	assert(query_int(db, "SELECT base_addr FROM snapshot_elf;") == 0);
+
+	sqlite3_close(db);
+
+	// A new database starts at the current version
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	assert(query_int(db, "PRAGMA user_version;") == DB_SCHEMA_VERSION);
+
+	// Its paths are split into their basename and the suffix of the plt and got
+	rc = create_vm_cap_db(db);
+	assert(rc == 0);
+	path_cache paths;
+	rc = path_cache_open(db, &paths);
+	assert(rc == 0);
+	int64_t libc_id = path_cache_id(&paths, "/usr/lib/libc.so.7");
+	int64_t got_id = path_cache_id(&paths, "/usr/lib/libc.so.7(.got)");
+	assert(libc_id != 0 && got_id != 0 && got_id != libc_id);
+	path_id = path_cache_id(&paths, "/usr/lib/libc.so.7");
+	assert(path_id == libc_id);
+	assert(paths.lookups == 3);
+	// A buffer the caller reuses for another path is not taken for the last one
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s", "/usr/lib/libc.so.7");
+	path_id = path_cache_id(&paths, buf);
+	assert(path_id == libc_id);
+	snprintf(buf, sizeof(buf), "%s", "/usr/lib/libc.so.7(.got)");
+	path_id = path_cache_id(&paths, buf);
+	assert(path_id == got_id);
+	assert(paths.lookups == 4);
+	path_cache_close(&paths);
+	assert(query_text_eq(db, "SELECT basename FROM paths WHERE path = '/usr/lib/libc.so.7(.got)';", "libc.so.7"));
+	assert(query_text_eq(db, "SELECT suffix FROM paths WHERE path = '/usr/lib/libc.so.7(.got)';", "(.got)"));
+	assert(query_int(db, "SELECT COUNT(*) FROM paths WHERE basename = 'libc.so.7';") == 2);
+	sqlite3_close(db);
+
+	// The snapshot_id of a version 6 database is made to refer to the snapshot
+	// table, the rows keep their rowid and a lost snapshot is added back
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_exec(db, version6_db, NULL, NULL, NULL);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	assert(query_int(db, "PRAGMA user_version;") == DB_SCHEMA_VERSION);
+	assert(query_int(db, "SELECT COUNT(*) FROM pragma_foreign_key_list('cap_info') WHERE \"table\" = 'snapshot';") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM pragma_foreign_key_list('comparts') WHERE \"table\" = 'snapshot';") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM pragma_foreign_key_check;") == 0);
+	assert(query_int(db, "SELECT snapshot_id FROM cap_info WHERE rowid = 9;") == 2);
+	assert(query_int(db, "SELECT COUNT(*) FROM snapshot;") == 2);
+	assert(query_int(db, "SELECT COUNT(*) FROM comparts_text;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info_with_path WHERE snapshot_id = 1;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE name = 'cap_info_snapshot_loc' "
+	    "AND tbl_name = 'cap_info';") == 1);
+	sqlite3_close(db);
+
+	printf("Test OK!\n");
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the ELF symbol cache: the symbols of this very binary are parsed for
+ * the first snapshot that loads it, and only relocated to another base for
+ * the next one. A copy of the file is another file, it is parsed again, but
+ * not a link to it. No descriptor is left open by the parsing.
+ *
+ * cc -D_GNU_SOURCE -I../includes -o elf_cache_test elf_cache_test.c \
+ *     ../src/elf_utils.c ../src/db_process.c ../src/arena.c ../src/common.c \
+ *     ../src/run_stats.c -lelf -lsqlite3 -lpthread
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_process.h"
+#include "elf_utils.h"
+
+static sqlite3_int64 query_int(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 val;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	val = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return val;
+}
+
+/* Address of the main symbol in the snapshot, 0 if there is none */
+static uint64_t main_addr(sqlite3 *db)
+{
+	db_cursor cursor;
+	sym_info sym;
+	uint64_t addr = 0;
+	int rc;
+
+	rc = sym_cursor_open(db, &cursor);
+	assert(rc == 0);
+	while (sym_cursor_next(&cursor, &sym) == 1) {
+		if (strcmp(sym.sym_name, "main") == 0) {
+			addr = sym.addr;
+		}
+	}
+	db_cursor_close(&cursor);
+	return addr;
+}
+
+static void copy_file(const char *from, const char *to)
+{
+	char buf[8192];
+	size_t len, written;
+	FILE *in = fopen(from, "r"), *out = fopen(to, "w");
+
+	assert(in != NULL && out != NULL);
+	while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+		written = fwrite(buf, 1, len, out);
+		assert(written == len);
+	}
+	fclose(in);
+	fclose(out);
+}
+
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	special_sections first, second, copy;
+	char copy_path[] = "/tmp/elf_cache_test.XXXXXX";
+	int rc;
+	int64_t snapshot_id;
+
+	set_print_level(NOPRINT);
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+
+	// The lowest free descriptor, which a leaked one would take
+	int lowest_fd = dup(0);
+	assert(lowest_fd != -1);
+	close(lowest_fd);
+
+	snapshot_id = snapshot_begin(db, 100, 0);
+	assert(snapshot_id == 1);
+	rc = load_elf_file(db, argv[0], 0x100000, &first);
+	assert(rc == 1);
+	sqlite3_int64 sym_rows = query_int(db, "SELECT COUNT(*) FROM elf_sym;");
+	assert(sym_rows > 0);
+	uint64_t first_main = main_addr(db);
+	assert(first_main > 0x100000);
+	// Found by the section headers, before the symbol tables are read
+	assert(first.got_size > 0 && first.got_addr > 0x100000);
+
+	// Another process loads the same file elsewhere
+	snapshot_id = snapshot_begin(db, 200, 0);
+	assert(snapshot_id == 2);
+	rc = load_elf_file(db, argv[0], 0x300000, &second);
+	assert(rc == 0);
+	assert(query_int(db, "SELECT COUNT(*) FROM elf_file;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM elf_sym;") == sym_rows);
+	assert(main_addr(db) == first_main + 0x200000);
+	assert(second.got_size == first.got_size && second.plt_size == first.plt_size);
+	assert(first.got_size == 0 || second.got_addr == first.got_addr + 0x200000);
+
+	// Each snapshot keeps its own base
+	rc = select_snapshot(db, 1);
+	assert(rc == 0);
+	assert(main_addr(db) == first_main);
+
+	// A copy has another identity
+	int fd = mkstemp(copy_path);
+	assert(fd != -1);
+	close(fd);
+	copy_file(argv[0], copy_path);
+	snapshot_id = snapshot_begin(db, 300, 0);
+	assert(snapshot_id == 3);
+	rc = load_elf_file(db, copy_path, 0x100000, &copy);
+	assert(rc == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM elf_file;") == 2);
+	assert(main_addr(db) == first_main);
+	assert(copy.got_addr == first.got_addr && copy.plt_size == first.plt_size);
+
+	// Files parsed by several threads, a new copy linked under two names
+	char new_copy_path[] = "/tmp/elf_cache_test.XXXXXX";
+	char link_path[sizeof(new_copy_path) + 5];
+	fd = mkstemp(new_copy_path);
+	assert(fd != -1);
+	close(fd);
+	copy_file(argv[0], new_copy_path);
+	snprintf(link_path, sizeof(link_path), "%s.link", new_copy_path);
+	rc = link(new_copy_path, link_path);
+	assert(rc == 0);
+	const char *paths[] = { argv[0], new_copy_path, link_path };
+	u_long bases[] = { 0x100000, 0x200000, 0x300000 };
+	special_sections batch[3];
+	snapshot_id = snapshot_begin(db, 400, 0);
+	assert(snapshot_id == 4);
+	rc = load_elf_files(db, 3, paths, bases, batch, 3);
+	assert(rc == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM elf_file;") == 3);
+	assert(query_int(db, "SELECT COUNT(*) FROM elf_sym;") == 3*sym_rows);
+	assert(query_int(db, "SELECT COUNT(*) FROM snapshot_elf WHERE snapshot_id = 4;") == 2);
+	assert(batch[1].got_addr == batch[0].got_addr + 0x100000);
+	assert(batch[2].got_addr == batch[0].got_addr + 0x200000);
+	unlink(copy_path);
+	unlink(new_copy_path);
+	unlink(link_path);
+
+	rc = load_elf_file(db, "/nonexistent/elf_cache_test", 0, &copy);
+	assert(rc == -1);
+
+	// A file that is not ELF is neither cached nor linked, the others are
+	char bad_path[] = "/tmp/elf_cache_test.XXXXXX";
+	fd = mkstemp(bad_path);
+	assert(fd != -1);
+	ssize_t written = write(fd, "not ELF", 7);
+	assert(written == 7);
+	close(fd);
+	const char *mixed_paths[] = { bad_path, argv[0] };
+	u_long mixed_bases[] = { 0x100000, 0x200000 };
+	special_sections mixed[2];
+	snapshot_id = snapshot_begin(db, 500, 0);
+	assert(snapshot_id == 5);
+	rc = load_elf_files(db, 2, mixed_paths, mixed_bases, mixed, 2);
+	assert(rc == -1);
+	assert(query_int(db, "SELECT COUNT(*) FROM elf_file;") == 3);
+	assert(query_int(db, "SELECT COUNT(*) FROM snapshot_elf WHERE snapshot_id = 5;") == 1);
+	assert(mixed[0].got_size == 0 && mixed[0].plt_size == 0);
+	assert(mixed[1].got_addr == first.got_addr + 0x100000);
+	unlink(bad_path);
+
+	fd = dup(0);
+	assert(fd == lowest_fd);
+	close(fd);
+
+	sqlite3_close(db);
+
+	printf("Test OK!\n");
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the lock-free ring: full and empty rings, and every element pushed
+ * by several producer threads being popped exactly once by several consumer
+ * threads.
+ *
+ * cc -I../includes -o mpmc_ring_test mpmc_ring_test.c ../src/mpmc_ring.c -lpthread
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mpmc_ring.h"
+
+#define PRODUCERS	4
+#define CONSUMERS	3
+#define PER_PRODUCER	200000
+
+static mpmc_ring ring;
+static atomic_int popped;
+static unsigned char seen[PRODUCERS*PER_PRODUCER];
+
+static void check_bounds(void)
+{
+	mpmc_ring small;
+	int value;
+	int rc;
+
+	rc = mpmc_ring_init(&small, 3, sizeof(int));
+	assert(rc == -1);
+	rc = mpmc_ring_init(&small, 4, sizeof(int));
+	assert(rc == 0);
+	rc = mpmc_ring_pop(&small, &value);
+	assert(rc == -1);
+	for (int i=0; i<4; i++) {
+		rc = mpmc_ring_push(&small, &i);
+		assert(rc == 0);
+	}
+	value = 4;
+	rc = mpmc_ring_push(&small, &value);
+	assert(rc == -1);
+
+	// Elements come out in order, and the ring wraps around
+	for (int lap=0; lap<3; lap++) {
+		for (int i=0; i<4; i++) {
+			rc = mpmc_ring_pop(&small, &value);
+			assert(rc == 0);
+			assert(value == lap*4 + i);
+		}
+		for (int i=0; i<4; i++) {
+			value = (lap+1)*4 + i;
+			rc = mpmc_ring_push(&small, &value);
+			assert(rc == 0);
+		}
+	}
+	mpmc_ring_free(&small);
+}
+
+static void *producer(void *arg)
+{
+	int first = *(int *)arg * PER_PRODUCER;
+
+	for (int i=first; i<first+PER_PRODUCER; i++) {
+		while (mpmc_ring_push(&ring, &i) != 0) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	int value;
+
+	while (atomic_load(&popped) < PRODUCERS*PER_PRODUCER) {
+		if (mpmc_ring_pop(&ring, &value) != 0) {
+			sched_yield();
+			continue;
+		}
+		assert(value >= 0 && value < PRODUCERS*PER_PRODUCER);
+		assert(seen[value] == 0);
+		seen[value] = 1;
+		atomic_fetch_add(&popped, 1);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t producers[PRODUCERS], consumers[CONSUMERS];
+	int ids[PRODUCERS];
+	int rc;
+
+	check_bounds();
+
+	rc = mpmc_ring_init(&ring, 1024, sizeof(int));
+	assert(rc == 0);
+	for (int c=0; c<CONSUMERS; c++) {
+		rc = pthread_create(&consumers[c], NULL, consumer, NULL);
+		assert(rc == 0);
+	}
+	for (int p=0; p<PRODUCERS; p++) {
+		ids[p] = p;
+		rc = pthread_create(&producers[p], NULL, producer, &ids[p]);
+		assert(rc == 0);
+	}
+	for (int p=0; p<PRODUCERS; p++) {
+		pthread_join(producers[p], NULL);
+	}
+	for (int c=0; c<CONSUMERS; c++) {
+		pthread_join(consumers[c], NULL);
+	}
+	for (int i=0; i<PRODUCERS*PER_PRODUCER; i++) {
+		assert(seen[i] == 1);
+	}
+	mpmc_ring_free(&ring);
+
+	printf("Test OK!\n");
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Writes a raw snapshot with every kind of record, reads it back and checks
+ * that the records come out as they went in, and that a snapshot cut short
+ * or of a newer version is rejected:
+ *
+ * cc -D_GNU_SOURCE -I../includes -o raw_snapshot_test raw_snapshot_test.c \
+ *     ../src/raw_snapshot.c ../src/common.c
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "raw_snapshot.h"
+
+static char path[] = "/tmp/raw_snapshot_testXXXXXX";
+
+static void write_snapshot(void)
+{
+	raw_writer writer;
+	int rc;
+	raw_snapshot_header header = { .page_size = 4096, .cap_size = 16, .pid = 1234, .timestamp = 1700000000,
+	    .machine = RAW_MACHINE_AARCH64 };
+
+	rc = raw_writer_open(&writer, path, &header);
+	assert(rc == 0);
+
+	raw_vm_entry vm = { 0x40000000, 0x40010000, 0x40000000, 3, 0x10, 2, "/lib/libc.so.7" };
+	rc = raw_write_vm_entry(&writer, &vm);
+	assert(rc == 0);
+	raw_vm_entry anon = { 0x50000000, 0x50001000, 0x40000000, 3, 0, 1, "" };
+	rc = raw_write_vm_entry(&writer, &anon);
+	assert(rc == 0);
+
+	unsigned char rdebug[20];
+	memset(rdebug, 0xab, sizeof(rdebug));
+	rc = raw_write_record(&writer, RAW_REC_R_DEBUG, rdebug, sizeof(rdebug));
+	assert(rc == 0);
+
+	raw_linkmap_obj obj = { 2, 0x40000000, 0x40010000, "/lib/libc.so.7" };
+	rc = raw_write_linkmap_obj(&writer, &obj);
+	assert(rc == 0);
+	raw_compart compart = { 5, 2, 0, 0x40002000, 0x40003000, "malloc", NULL };
+	rc = raw_write_compart(&writer, &compart);
+	assert(rc == 0);
+
+	// Capabilities in slots 1 and 255
+	unsigned char tags[RAW_TAG_BYTES_PER_PAGE] = {};
+	unsigned char caps[2*RAW_CAP_SIZE];
+	tags[0] = 0x02;
+	tags[31] = 0x80;
+	for (int i=0; i<(int)sizeof(caps); i++) {
+		caps[i] = i;
+	}
+	raw_page_caps page = { 0x40001000, tags, caps, 2 };
+	rc = raw_write_page(&writer, &page);
+	assert(rc == 0);
+
+	raw_snapshot_end end = { 1, 2, 5000 };
+	rc = raw_write_end(&writer, &end);
+	assert(rc == 0);
+	assert(writer.records == 7);
+	rc = raw_writer_close(&writer);
+	assert(rc == 0);
+}
+
+static void read_snapshot(void)
+{
+	raw_reader reader;
+	raw_record record;
+	int rc;
+
+	rc = raw_reader_open(&reader, path);
+	assert(rc == 0);
+	assert(reader.header.version == RAW_SNAPSHOT_VERSION);
+	assert(reader.header.pid == 1234 && reader.header.page_size == 4096);
+	assert(reader.header.timestamp == 1700000000);
+	assert(reader.header.machine == RAW_MACHINE_AARCH64);
+
+	raw_vm_entry vm;
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 1);
+	rc = raw_record_vm_entry(&record, &vm);
+	assert(rc == 0);
+	assert(vm.start == 0x40000000 && vm.end == 0x40010000 && vm.flags == 0x10);
+	assert(strcmp(vm.path, "/lib/libc.so.7") == 0);
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 1);
+	rc = raw_record_vm_entry(&record, &vm);
+	assert(rc == 0);
+	assert(vm.reservation == 0x40000000 && strcmp(vm.path, "") == 0);
+
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 1);
+	assert(record.type == RAW_REC_R_DEBUG && record.length == 20 && record.payload[19] == 0xab);
+	// Records of one type are not decoded as another
+	rc = raw_record_vm_entry(&record, &vm);
+	assert(rc == -1);
+
+	raw_linkmap_obj obj;
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 1);
+	rc = raw_record_linkmap_obj(&record, &obj);
+	assert(rc == 0);
+	assert(obj.compart_id == 2 && obj.end == 0x40010000 && strcmp(obj.path, "/lib/libc.so.7") == 0);
+
+	raw_compart compart;
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 1);
+	rc = raw_record_compart(&record, &compart);
+	assert(rc == 0);
+	assert(compart.compart_id == 5 && compart.parent_id == 2 && compart.start == 0x40002000);
+	assert(strcmp(compart.name, "malloc") == 0 && compart.library_path == NULL);
+
+	raw_page_caps page;
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 1);
+	rc = raw_record_page(&record, &page);
+	assert(rc == 0);
+	assert(page.page == 0x40001000 && page.ncaps == 2);
+	assert(page.tags[0] == 0x02 && page.tags[31] == 0x80);
+	assert(page.caps[0] == 0 && page.caps[2*RAW_CAP_SIZE-1] == 2*RAW_CAP_SIZE-1);
+
+	raw_snapshot_end end;
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 1);
+	rc = raw_record_end(&record, &end);
+	assert(rc == 0);
+	assert(end.pages == 1 && end.caps == 2 && end.stopped_ns == 5000);
+
+	rc = raw_reader_next(&reader, &record);
+	assert(rc == 0);
+	raw_reader_close(&reader);
+}
+
+static void check_rejected(void)
+{
+	raw_reader reader;
+	raw_record record;
+	FILE *f;
+	int rc;
+
+	// Cut in the middle of the last record
+	long size;
+	f = fopen(path, "r+");
+	assert(f != NULL);
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fclose(f);
+	rc = truncate(path, size - 4);
+	assert(rc == 0);
+
+	rc = raw_reader_open(&reader, path);
+	assert(rc == 0);
+	while ((rc = raw_reader_next(&reader, &record)) == 1) {
+		assert(record.type != RAW_REC_END);
+	}
+	assert(rc == -1);
+	raw_reader_close(&reader);
+
+	// A newer version
+	f = fopen(path, "r+");
+	assert(f != NULL);
+	fseek(f, RAW_SNAPSHOT_MAGIC_SIZE, SEEK_SET);
+	fputc(RAW_SNAPSHOT_VERSION + 1, f);
+	fclose(f);
+	rc = raw_reader_open(&reader, path);
+	assert(rc == -1);
+}
+
+int main(int argc, char *argv[])
+{
+	set_print_level(NOPRINT);
+
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+
+	write_snapshot();
+	read_snapshot();
+	check_rejected();
+	unlink(path);
+
+	printf("Test OK!\n");
+	return 0;
+}
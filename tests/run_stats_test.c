@@ -0,0 +1,112 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the phase timers and counters of --stats: nothing is recorded until
+ * they are enabled, and the counts of several threads add up.
+ *
+ * cc -I../includes -o run_stats_test run_stats_test.c ../src/run_stats.c -lpthread
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "run_stats.h"
+
+#define THREADS		4
+#define PER_THREAD	10000
+
+static void *count_main(void *arg)
+{
+	run_timer timer;
+
+	for (int i=0; i<PER_THREAD; i++) {
+		run_phase_begin(&timer, RUN_PHASE_CAP_READ);
+		run_count(RUN_PTRACE_CALLS, 1);
+		run_count(RUN_BYTES_READ, 16);
+		run_phase_end(&timer);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	run_timer timer;
+	run_stats stats;
+	pthread_t threads[THREADS];
+	struct timespec nap = { 0, 20000000 };
+	int rc;
+
+	// Disabled, the default
+	run_phase_begin(&timer, RUN_PHASE_PROCSTAT);
+	run_count(RUN_CAPS_FOUND, 10);
+	run_phase_end(&timer);
+	set_run_stats(1);
+	get_run_stats(&stats);
+	assert(stats.phases[RUN_PHASE_PROCSTAT].calls == 0);
+	assert(stats.counters[RUN_CAPS_FOUND] == 0);
+
+	// A wait takes wall time but next to no CPU
+	run_phase_begin(&timer, RUN_PHASE_PROCSTAT);
+	nanosleep(&nap, NULL);
+	run_phase_end(&timer);
+	run_phase_end(&timer);
+	get_run_stats(&stats);
+	printf("procstat: %lu calls, %.3fs wall, %.3fs cpu\n", stats.phases[RUN_PHASE_PROCSTAT].calls,
+	    stats.phases[RUN_PHASE_PROCSTAT].wall, stats.phases[RUN_PHASE_PROCSTAT].cpu);
+	assert(stats.phases[RUN_PHASE_PROCSTAT].calls == 1);
+	assert(stats.phases[RUN_PHASE_PROCSTAT].wall >= 0.02);
+	assert(stats.phases[RUN_PHASE_PROCSTAT].cpu < stats.phases[RUN_PHASE_PROCSTAT].wall);
+	assert(stats.wall >= stats.phases[RUN_PHASE_PROCSTAT].wall);
+
+	for (int t=0; t<THREADS; t++) {
+		rc = pthread_create(&threads[t], NULL, count_main, NULL);
+		assert(rc == 0);
+	}
+	for (int t=0; t<THREADS; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	get_run_stats(&stats);
+	printf("%s: %lu calls, %lu ptrace calls, %lu bytes\n", run_phase_name(RUN_PHASE_CAP_READ),
+	    stats.phases[RUN_PHASE_CAP_READ].calls, stats.counters[RUN_PTRACE_CALLS], stats.counters[RUN_BYTES_READ]);
+	assert(stats.phases[RUN_PHASE_CAP_READ].calls == THREADS*PER_THREAD);
+	assert(stats.counters[RUN_PTRACE_CALLS] == THREADS*PER_THREAD);
+	assert(stats.counters[RUN_BYTES_READ] == 16*THREADS*PER_THREAD);
+	assert(stats.phases[RUN_PHASE_TAG_READ].calls == 0);
+
+	printf("Test OK!\n");
+	return 0;
+}
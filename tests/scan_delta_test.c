@@ -0,0 +1,206 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the incremental scans of scan_delta against pages built by hand:
+ * the first scan writes every page, then only the pages that are new or have
+ * changed are decoded again, the others are copied from the previous
+ * snapshot of the same process, which is kept.
+ *
+ * cc -D_GNU_SOURCE -I../includes -o scan_delta_test scan_delta_test.c \
+ *     ../src/scan_delta.c ../src/scan_pool.c ../src/mpmc_ring.c ../src/tag_scan.c \
+ *     ../src/cap_decode.c ../src/db_process.c ../src/arena.c ../src/common.c \
+ *     ../src/run_stats.c -lsqlite3 -lpthread
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_process.h"
+#include "scan_delta.h"
+#include "scan_pool.h"
+#include "tag_scan.h"
+
+#define PAGE_A	0x40000000UL
+#define PAGE_B	0x40001000UL
+#define PAGE_C	0x40005000UL
+#define PAGE_D	0x40008000UL
+
+static raw_page pages[4];
+
+/* Tags every other slot of the page, up to ncaps of them */
+static void fill_page(raw_page *raw, u_long page, int ncaps, int seed)
+{
+	memset(raw, 0, sizeof(raw_page));
+	raw->page = page;
+	raw->path = "/lib/libc.so.7";
+	for (int i=0; i<ncaps; i++) {
+		int slot = i*2;
+		raw->tags[slot/8] |= 1 << (slot%8);
+		unsigned char *bytes = &raw->slots[slot*CAP_DECODE_SLOT_SIZE];
+		bytes[0] = 1;
+		for (int b=1; b<CAP_DECODE_SLOT_SIZE; b++) {
+			bytes[b] = seed + i + b;
+		}
+	}
+}
+
+static sqlite3_int64 query_int(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 val;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	val = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return val;
+}
+
+/* An incremental scan of process pid into a new snapshot, as -I takes it */
+static void run_scan(sqlite3 *db, scan_delta *delta, int64_t pid, raw_page **scanned, int count)
+{
+	int64_t previous_id = scan_delta_previous(db, pid);
+	int64_t snapshot_id = snapshot_begin(db, pid, 60);
+	assert(snapshot_id != 0);
+	int rc = scan_delta_open(db, delta, pid, previous_id);
+	assert(rc == 0);
+	for (int i=0; i<count; i++) {
+		scan_delta_page(delta, scanned[i]);
+	}
+	scan_delta_close(delta);
+}
+
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	scan_delta delta;
+	int rc;
+	int64_t snapshot_id;
+
+	set_print_level(NOPRINT);
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	create_vm_cap_db(db);
+	// Left by an earlier full scan
+	snapshot_id = snapshot_begin(db, 100, 0);
+	assert(snapshot_id == 1);
+	rc = sql_query_exec(db, "INSERT INTO paths VALUES(1, '/lib/libc.so.7', 'libc.so.7', '');"
+	    "INSERT INTO cap_info VALUES(1073741840, 1, 0, 0, 0, 0, 1);", NULL, NULL);
+	assert(rc == 0);
+	assert(scan_delta_previous(db, 100) == 0);
+
+	// The first incremental scan takes a new snapshot and writes all the pages
+	fill_page(&pages[0], PAGE_A, 4, 1);
+	fill_page(&pages[1], PAGE_B, 2, 2);
+	fill_page(&pages[2], PAGE_C, 1, 3);
+	raw_page *first[] = { &pages[0], &pages[1], &pages[2] };
+	run_scan(db, &delta, 100, first, 3);
+	assert(delta.writer.snapshot_id == 2 && delta.previous_id == 0);
+	assert(delta.unchanged == 0 && delta.changed == 3 && delta.removed == 0 && delta.caps == 7);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 2;") == 7);
+	assert(query_int(db, "SELECT COUNT(*) FROM page_hash WHERE pid = 100;") == 3);
+	assert(scan_delta_previous(db, 100) == 2);
+	assert(scan_delta_previous(db, 101) == 0);
+
+	// A is the same, B has changed, C has gone and D is new
+	pages[1].slots[1] ^= 0xff;
+	fill_page(&pages[3], PAGE_D, 3, 4);
+	raw_page *second[] = { &pages[0], &pages[1], &pages[3] };
+	run_scan(db, &delta, 100, second, 3);
+	assert(delta.writer.snapshot_id == 3 && delta.previous_id == 2);
+	assert(delta.unchanged == 1 && delta.changed == 2 && delta.removed == 1);
+	assert(delta.caps == 5 && delta.copied == 4);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 3;") == 9);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 3 AND cap_loc_addr >= 1073762304 "
+	    "AND cap_loc_addr < 1073766400;") == 0);
+	assert(query_int(db, "SELECT COUNT(*) FROM page_hash WHERE pid = 100;") == 3);
+	// The snapshot compared with is kept as it was
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 2;") == 7);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info a JOIN cap_info b ON a.cap_loc_addr = b.cap_loc_addr "
+	    "AND a.cap_addr = b.cap_addr AND a.cap_loc_path_id = b.cap_loc_path_id "
+	    "WHERE a.snapshot_id = 2 AND b.snapshot_id = 3 AND a.cap_loc_addr < 1073745920;") == 4);
+
+	// The untagged slots do not matter, a cleared tag does
+	pages[0].slots[CAP_DECODE_SLOT_SIZE] = 0x5a;
+	pages[3].tags[0] &= ~1;
+	run_scan(db, &delta, 100, second, 3);
+	assert(delta.unchanged == 2 && delta.changed == 1 && delta.removed == 0);
+	assert(delta.caps == 2 && delta.copied == 6);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 4;") == 8);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 4 AND cap_loc_addr = 1073774592;") == 0);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 3;") == 9);
+
+	// A full scan taken since does not matter
+	snapshot_id = snapshot_begin(db, 100, 120);
+	assert(snapshot_id == 5);
+	assert(scan_delta_previous(db, 100) == 4);
+
+	// Nor do the incremental scans of another process in between, each process
+	// compares with its own previous scan
+	raw_page *other[] = { &pages[0], &pages[2] };
+	run_scan(db, &delta, 200, other, 2);
+	assert(delta.writer.snapshot_id == 6 && delta.previous_id == 0);
+	assert(delta.unchanged == 0 && delta.changed == 2 && delta.caps == 5);
+	run_scan(db, &delta, 100, second, 3);
+	assert(delta.writer.snapshot_id == 7 && delta.previous_id == 4);
+	assert(delta.unchanged == 3 && delta.changed == 0 && delta.removed == 0 && delta.copied == 8);
+	run_scan(db, &delta, 200, other, 2);
+	assert(delta.writer.snapshot_id == 8 && delta.previous_id == 6);
+	assert(delta.unchanged == 2 && delta.changed == 0 && delta.copied == 5);
+	assert(query_int(db, "SELECT COUNT(*) FROM page_hash WHERE pid = 100;") == 3);
+	assert(query_int(db, "SELECT COUNT(*) FROM page_hash WHERE pid = 200;") == 2);
+	assert(scan_delta_previous(db, 100) == 7);
+	assert(scan_delta_previous(db, 200) == 8);
+	assert(scan_delta_previous(db, 300) == 0);
+
+	// The snapshot of the full scan is left as it was
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 1;") == 1);
+
+	sqlite3_close(db);
+
+	printf("Test OK!\n");
+	return 0;
+}
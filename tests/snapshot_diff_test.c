@@ -0,0 +1,191 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the comparison of two snapshots by snapshot_diff_run: the added,
+ * removed and modified capabilities it finds, in address order, and their
+ * counts by mapping and compartment. The capabilities must be read from the
+ * index in order, without sorting them.
+ *
+ * cc -D_GNU_SOURCE -I../includes -o snapshot_diff_test snapshot_diff_test.c \
+ *     ../src/snapshot_diff.c ../src/compart_index.c ../src/db_process.c \
+ *     ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_process.h"
+#include "snapshot_diff.h"
+
+typedef struct seen_change {
+	cap_diff_kind kind;
+	uint64_t cap_loc_addr;
+	char compart_name[16];
+} seen_change;
+
+static seen_change seen[8];
+static int seen_count;
+
+static void record_change(void *arg, cap_diff_kind kind, const cap_info *before,
+    const cap_info *after, const char *compart_name)
+{
+	assert(seen_count < 8);
+	assert((before == NULL) == (kind == CAP_DIFF_ADDED));
+	assert((after == NULL) == (kind == CAP_DIFF_REMOVED));
+	seen[seen_count].kind = kind;
+	seen[seen_count].cap_loc_addr = (after != NULL ? after : before)->cap_loc_addr;
+	snprintf(seen[seen_count].compart_name, sizeof(seen[seen_count].compart_name), "%s",
+	    compart_name != NULL ? compart_name : "-");
+	seen_count++;
+}
+
+static const cap_diff_counts *rollup(const cap_diff_rollups *rollups, const char *name)
+{
+	for (int i=0; i<rollups->count; i++) {
+		if ((name == NULL && rollups->entries[i].name == NULL) ||
+		    (name != NULL && rollups->entries[i].name != NULL &&
+		    strcmp(rollups->entries[i].name, name) == 0)) {
+			return &rollups->entries[i].counts;
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	snapshot_diff diff;
+	int rc;
+	int64_t snapshot_id;
+
+	set_print_level(NOPRINT);
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	create_vm_cap_db(db);
+	create_comparts_table(db);
+
+	// libc is a compartment, the capabilities of libthr are in none
+	snapshot_id = snapshot_begin(db, 100, 0);
+	assert(snapshot_id == 1);
+	rc = sql_query_exec(db,
+	    "INSERT INTO comparts VALUES(1, 'libc', '/lib/libc.so.7', 4096, 20480, 1, NULL, 1);"
+	    "INSERT INTO paths VALUES(1, '/lib/libc.so.7', 'libc.so.7', '');"
+	    "INSERT INTO paths VALUES(2, '/lib/libthr.so.3', 'libthr.so.3', '');"
+	    "INSERT INTO cap_info VALUES(4112, 1, 8192, 3, 8192, 8448, 1);"
+	    "INSERT INTO cap_info VALUES(4128, 1, 8208, 1, 8192, 8448, 1);"
+	    "INSERT INTO cap_info VALUES(4160, 1, 8224, 1, 8192, 8448, 1);"
+	    "INSERT INTO cap_info VALUES(32784, 2, 65536, 5, 65536, 69632, 1);",
+	    NULL, NULL);
+	assert(rc == 0);
+
+	// 4112 is the same, 4128 has lost a permission, 4144 is new, 4160 and
+	// 32784 have gone and 36880 is new
+	snapshot_id = snapshot_begin(db, 100, 60);
+	assert(snapshot_id == 2);
+	rc = sql_query_exec(db,
+	    "INSERT INTO comparts VALUES(1, 'libc', '/lib/libc.so.7', 4096, 20480, 1, NULL, 2);"
+	    "INSERT INTO cap_info VALUES(36880, 2, 65552, 5, 65536, 69632, 2);"
+	    "INSERT INTO cap_info VALUES(4144, 1, 8240, 1, 8192, 8448, 2);"
+	    "INSERT INTO cap_info VALUES(4128, 1, 8208, 0, 8192, 8448, 2);"
+	    "INSERT INTO cap_info VALUES(4112, 1, 8192, 3, 8192, 8448, 2);",
+	    NULL, NULL);
+	assert(rc == 0);
+
+	rc = snapshot_diff_run(db, 1, 2, record_change, NULL, &diff);
+	assert(rc == 0);
+	assert(diff.total.added == 2 && diff.total.removed == 2 && diff.total.modified == 1);
+	assert(diff.unchanged == 1);
+
+	assert(seen_count == 5);
+	assert(seen[0].kind == CAP_DIFF_MODIFIED && seen[0].cap_loc_addr == 4128);
+	assert(seen[1].kind == CAP_DIFF_ADDED && seen[1].cap_loc_addr == 4144);
+	assert(seen[2].kind == CAP_DIFF_REMOVED && seen[2].cap_loc_addr == 4160);
+	assert(strcmp(seen[2].compart_name, "libc") == 0);
+	assert(seen[3].kind == CAP_DIFF_REMOVED && seen[3].cap_loc_addr == 32784);
+	assert(strcmp(seen[3].compart_name, "-") == 0);
+	assert(seen[4].kind == CAP_DIFF_ADDED && seen[4].cap_loc_addr == 36880);
+
+	assert(diff.mappings.count == 2);
+	const cap_diff_counts *counts = rollup(&diff.mappings, "/lib/libc.so.7");
+	assert(counts->added == 1 && counts->removed == 1 && counts->modified == 1);
+	counts = rollup(&diff.mappings, "/lib/libthr.so.3");
+	assert(counts->added == 1 && counts->removed == 1 && counts->modified == 0);
+	assert(diff.comparts.count == 2);
+	assert(diff.comparts.entries[0].name == NULL);
+	counts = rollup(&diff.comparts, NULL);
+	assert(counts->added == 1 && counts->removed == 1);
+	counts = rollup(&diff.comparts, "libc");
+	assert(counts->added == 1 && counts->removed == 1 && counts->modified == 1);
+	snapshot_diff_free(&diff);
+
+	// The other way round, and against itself
+	seen_count = 0;
+	rc = snapshot_diff_run(db, 2, 1, record_change, NULL, &diff);
+	assert(rc == 0);
+	assert(diff.total.added == 2 && diff.total.removed == 2 && diff.total.modified == 1);
+	snapshot_diff_free(&diff);
+	seen_count = 0;
+	rc = snapshot_diff_run(db, 2, 2, record_change, NULL, &diff);
+	assert(rc == 0);
+	assert(seen_count == 0 && diff.unchanged == 4);
+	snapshot_diff_free(&diff);
+
+	// Each snapshot is read in order from the index
+	rc = sqlite3_prepare_v2(db, "EXPLAIN QUERY PLAN SELECT c.cap_loc_addr, p.path, c.cap_addr, "
+	    "c.perms, c.base, c.top FROM cap_info c CROSS JOIN paths p ON p.path_id = c.cap_loc_path_id "
+	    "WHERE c.snapshot_id = 1 ORDER BY c.cap_loc_addr;",
+	    -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+		assert(strstr(detail, "cap_info_snapshot_loc") != NULL || strstr(detail, "INTEGER PRIMARY KEY") != NULL);
+		assert(strstr(detail, "TEMP B-TREE") == NULL);
+	}
+	sqlite3_finalize(stmt);
+
+	sqlite3_close(db);
+
+	printf("Test OK!\n");
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Ingests a small synthetic raw snapshot with several workers and checks the
+ * vm entries, compartments and capabilities stored in the database, with the
+ * names scan_mem would have given the vm entries:
+ *
+ * cc -D_GNU_SOURCE -I../includes -o snapshot_ingest_test snapshot_ingest_test.c \
+ *     ../src/snapshot_ingest.c ../src/raw_snapshot.c ../src/target_log.c \
+ *     ../src/scan_pool.c ../src/mpmc_ring.c ../src/tag_scan.c ../src/cap_decode.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3 \
+ *     -lpthread
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_process.h"
+#include "raw_snapshot.h"
+#include "snapshot_ingest.h"
+
+#define LIBC		"/lib/libc.so.7"
+#define LIBC_BASE	0x40000000ULL
+#define HEAP_BASE	0x50000000ULL
+#define PAGES		1000
+
+static char path[] = "/tmp/snapshot_ingest_testXXXXXX";
+
+/* A read-write Morello capability to [base, base+0x100), with exponent 0 */
+static void morello_cap(unsigned char *bytes, uint64_t addr, uint64_t base)
+{
+	uint64_t pesbt = (1ULL << 63) | (1ULL << 62) | (1ULL << 30) |
+	    (((base + 0x100) & 0x3fff) << 16) | (base & 0xffff);
+
+	for (int i=0; i<8; i++) {
+		bytes[i] = addr >> (8*i);
+		bytes[8+i] = pesbt >> (8*i);
+	}
+}
+
+static void write_snapshot(void)
+{
+	raw_writer writer;
+	raw_snapshot_header header = { .page_size = 4096, .cap_size = 16, .machine = RAW_MACHINE_AARCH64 };
+	int rc;
+
+	rc = raw_writer_open(&writer, path, &header);
+	assert(rc == 0);
+
+	raw_vm_entry vms[] = {
+		{ LIBC_BASE, LIBC_BASE + 0x10000, LIBC_BASE, 5, 0, 2, LIBC },
+		{ LIBC_BASE + 0x10000, LIBC_BASE + 0x11000, LIBC_BASE, 3, 0, 2, LIBC },
+		{ LIBC_BASE + 0x11000, LIBC_BASE + 0x12000, LIBC_BASE, 3, 0, 1, "" },
+		{ HEAP_BASE, HEAP_BASE + PAGES*0x1000ULL, HEAP_BASE, 3, 0, 1, "" },
+		{ 0x7fff0000, 0x7fff1000, 0x7fff0000, 0, 0, RAW_KVME_TYPE_GUARD, "" },
+		{ 0x7fff1000, 0x7fff8000, 0x7fff1000, 3, RAW_KVME_FLAG_GROWS_DOWN, 1, "" },
+	};
+	for (int i=0; i<6; i++) {
+		rc = raw_write_vm_entry(&writer, &vms[i]);
+		assert(rc == 0);
+	}
+	raw_linkmap_obj obj = { 2, LIBC_BASE, LIBC_BASE + 0x12000, LIBC };
+	rc = raw_write_linkmap_obj(&writer, &obj);
+	assert(rc == 0);
+
+	// A record type this version does not know is skipped
+	unsigned char future[12] = {};
+	rc = raw_write_record(&writer, 99, future, sizeof(future));
+	assert(rc == 0);
+
+	// Every heap page holds capabilities in slots 0 and 9 to the libc data
+	unsigned char tags[RAW_TAG_BYTES_PER_PAGE] = { 0x01, 0x02 };
+	unsigned char caps[2*RAW_CAP_SIZE];
+	for (int p=0; p<PAGES; p++) {
+		uint64_t page = HEAP_BASE + p*0x1000ULL;
+		morello_cap(&caps[0], LIBC_BASE + 0x10010, LIBC_BASE + 0x10000);
+		morello_cap(&caps[RAW_CAP_SIZE], page, page);
+		raw_page_caps raw = { page, tags, caps, 2 };
+		rc = raw_write_page(&writer, &raw);
+		assert(rc == 0);
+	}
+
+	raw_compart comparts[] = {
+		{ 2, 0, 1, LIBC_BASE, LIBC_BASE + 0x12000, NULL, "libc.so.7" },
+		{ 5, 2, 0, LIBC_BASE + 0x1000, LIBC_BASE + 0x2000, "malloc", NULL },
+	};
+	rc = raw_write_compart(&writer, &comparts[0]);
+	assert(rc == 0);
+	rc = raw_write_compart(&writer, &comparts[1]);
+	assert(rc == 0);
+
+	raw_snapshot_end end = { PAGES, 2*PAGES, 0 };
+	rc = raw_write_end(&writer, &end);
+	assert(rc == 0);
+	rc = raw_writer_close(&writer);
+	assert(rc == 0);
+}
+
+/* Stands in for the ELF files, only libc is on this host */
+static int fake_elf(sqlite3 *db, const char *elf_path, uint64_t base, ingest_elf_sections *sections)
+{
+	if (strcmp(elf_path, LIBC) != 0) {
+		return -1;
+	}
+	memset(sections, 0, sizeof(ingest_elf_sections));
+	sections->got_addr = base + 0x11000;
+	sections->got_size = 0x100;
+	return 0;
+}
+
+static sqlite3_int64 query_int(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 val;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	val = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return val;
+}
+
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	ingest_stats stats;
+	int rc;
+
+	set_print_level(NOPRINT);
+
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+	write_snapshot();
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	rc = ingest_snapshot(db, path, 3, fake_elf, &stats);
+	assert(rc == 0);
+	assert(stats.complete && stats.vm_entries == 6 && stats.comparts == 2 && stats.elf_files == 1);
+	assert(stats.pages == PAGES && stats.caps == 2*PAGES && stats.skipped == 1);
+
+	// The anonymous entries are named as scan_mem names them
+	assert(query_int(db, "SELECT COUNT(*) FROM vm_with_path WHERE mmap_path = '" LIBC "' AND compart_id = 2;") == 2);
+	assert(query_int(db, "SELECT COUNT(*) FROM vm_with_path WHERE mmap_path = '" LIBC "(.got)' AND compart_id = 2;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM vm_with_path WHERE mmap_path = 'Heap(others)' AND compart_id = -1;") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM vm_with_path WHERE mmap_path = 'Guard';") == 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM vm_with_path WHERE mmap_path = 'Stack';") == 1);
+	assert(query_int(db, "SELECT got_addr FROM vm_with_path WHERE mmap_path = '" LIBC "' LIMIT 1;") ==
+	    (sqlite3_int64)(LIBC_BASE + 0x11000));
+
+	assert(query_int(db, "SELECT parent_id IS NULL FROM comparts WHERE compart_id = 2;") == 1);
+	assert(query_int(db, "SELECT parent_id FROM comparts WHERE compart_name = 'malloc';") == 2);
+
+	// The capabilities are decoded and stored in snapshot order
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info_with_path WHERE cap_loc_path = 'Heap(others)';") == 2*PAGES);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE cap_addr = 1073807376 AND "
+	    "base = 1073807360 AND top = 1073807616;") == PAGES);
+	assert(query_int(db, "SELECT cap_loc_addr FROM cap_info WHERE rowid = 2;") == (sqlite3_int64)(HEAP_BASE + 9*16));
+	assert(query_int(db, "SELECT cap_loc_addr FROM cap_info WHERE rowid = 3;") == (sqlite3_int64)(HEAP_BASE + 0x1000));
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE perms != 3;") == 0);
+
+	// A snapshot cut short is ingested up to the cut
+	rc = truncate(path, stats.bytes - 40);
+	assert(rc == 0);
+	sqlite3_close(db);
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	rc = ingest_snapshot(db, path, 1, NULL, &stats);
+	assert(rc == 0);
+	assert(!stats.complete && stats.pages == PAGES && stats.comparts == 1);
+	sqlite3_close(db);
+
+	unlink(path);
+	printf("Test OK!\n");
+	return 0;
+}
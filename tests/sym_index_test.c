@@ -0,0 +1,132 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the symbol index: exact matches, addresses inside a sized symbol,
+ * nested symbols, the symbols that are left out of the index, and a symbol
+ * covering the address space followed by many small ones.
+ *
+ * cc -I../includes -o sym_index_test sym_index_test.c ../src/sym_index.c
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "db_process.h"
+#include "sym_index.h"
+
+#define SMALL_SYMS 10000
+
+static const char *lookup_name(const sym_index *index, uint64_t addr, uint64_t *offset)
+{
+	const sym_info *sym = sym_index_lookup(index, addr, offset);
+
+	return sym == NULL ? NULL : sym->sym_name;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+
+	sym_info syms[] = {
+		{ .sym_name = "big_table", .shndx = "12", .addr = 0x3000, .size = 0x1000 },
+		{ .sym_name = "func", .shndx = "10", .addr = 0x1000, .size = 0x40 },
+		{ .sym_name = "func_alias", .shndx = "10", .addr = 0x1000, .size = 0x40 },
+		{ .sym_name = "inner", .shndx = "12", .addr = 0x3100, .size = 0x10 },
+		{ .sym_name = "label", .shndx = "10", .addr = 0x2000, .size = 0 },
+		{ .sym_name = "imported", .shndx = "UND", .addr = 0x5000, .size = 0x10 },
+		{ .sym_name = "unset", .shndx = "10", .addr = 0, .size = 0x10 },
+	};
+	sym_index index;
+	uint64_t offset;
+
+	rc = sym_index_build(&index, syms, sizeof(syms)/sizeof(syms[0]));
+	assert(rc == 5);
+
+	// Exact matches keep the first symbol of the table at an address
+	assert(strcmp(lookup_name(&index, 0x1000, &offset), "func") == 0);
+	assert(offset == 0);
+	assert(strcmp(lookup_name(&index, 0x2000, &offset), "label") == 0);
+	assert(offset == 0);
+
+	// Inside a sized symbol, up to its last byte
+	assert(strcmp(lookup_name(&index, 0x1010, &offset), "func") == 0);
+	assert(offset == 0x10);
+	assert(strcmp(lookup_name(&index, 0x103f, &offset), "func") == 0);
+	assert(offset == 0x3f);
+	assert(lookup_name(&index, 0x1040, &offset) == NULL);
+
+	// A symbol of size 0 only matches its own address
+	assert(lookup_name(&index, 0x2001, &offset) == NULL);
+
+	// The closest symbol wins, the outer one is found again past the inner one
+	assert(strcmp(lookup_name(&index, 0x3108, &offset), "inner") == 0);
+	assert(offset == 0x8);
+	assert(strcmp(lookup_name(&index, 0x3800, &offset), "big_table") == 0);
+	assert(offset == 0x800);
+
+	// Undefined symbols and symbols without an address are not indexed
+	assert(lookup_name(&index, 0x5000, &offset) == NULL);
+	assert(lookup_name(&index, 0x8, &offset) == NULL);
+
+	sym_index_free(&index);
+
+	// A symbol whose size runs to the end of the address space, followed by
+	// many small ones: the addresses between them are found in the big one
+	// through a single segment each, rather than by walking back over them.
+	sym_info many[SMALL_SYMS + 1];
+	char names[SMALL_SYMS][16];
+	many[0] = (sym_info){ .sym_name = "huge", .shndx = "12", .addr = 0x1000, .size = UINT64_MAX };
+	for (int i=0; i<SMALL_SYMS; i++) {
+		snprintf(names[i], sizeof(names[i]), "small%d", i);
+		many[i+1] = (sym_info){ .sym_name = names[i], .shndx = "10", .addr = 0x10000 + i*0x100, .size = 0x10 };
+	}
+	rc = sym_index_build(&index, many, SMALL_SYMS + 1);
+	assert(rc == SMALL_SYMS + 1);
+	assert(index.segment_count == 2*SMALL_SYMS + 1);
+	for (int i=0; i<SMALL_SYMS; i++) {
+		uint64_t addr = 0x10000 + i*0x100;
+		assert(strcmp(lookup_name(&index, addr + 0x8, &offset), names[i]) == 0);
+		assert(offset == 0x8);
+		assert(strcmp(lookup_name(&index, addr + 0x80, &offset), "huge") == 0);
+		assert(offset == addr + 0x80 - 0x1000);
+	}
+	assert(lookup_name(&index, 0x800, &offset) == NULL);
+	sym_index_free(&index);
+
+	printf("Test OK!\n");
+	return 0;
+}
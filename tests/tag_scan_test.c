@@ -0,0 +1,137 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Runs the chunked tag reader against a recorded tag bitmap instead of a live
+ * process, so that it can be exercised on hosts without CHERI support:
+ *
+ * cc -I../includes -o tag_scan_test tag_scan_test.c ../src/tag_scan.c ../src/common.c \
+ *     ../src/run_stats.c
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "tag_scan.h"
+
+#define RECORDED_BASE	0x40000000UL
+#define RECORDED_PAGES	1000
+
+/* Recorded tags, one TAG_SCAN_BYTES_PER_PAGE slice per page */
+static unsigned char recorded_tags[RECORDED_PAGES*TAG_SCAN_BYTES_PER_PAGE];
+/* Pages that cannot be read, as if they were not accessible */
+static int unreadable[RECORDED_PAGES];
+
+static ssize_t read_recorded_tags(void *arg, u_long start, unsigned char *tagsbuf, size_t len)
+{
+	size_t first = (start - RECORDED_BASE) / TAG_SCAN_PAGE_SIZE;
+	size_t npages = len / TAG_SCAN_BYTES_PER_PAGE;
+	size_t n;
+
+	for (n=0; n<npages && first+n<RECORDED_PAGES; n++) {
+		if (unreadable[first+n]) {
+			break;
+		}
+	}
+	if (n == 0) {
+		return -1;
+	}
+	memcpy(tagsbuf, &recorded_tags[first*TAG_SCAN_BYTES_PER_PAGE], n*TAG_SCAN_BYTES_PER_PAGE);
+	return n*TAG_SCAN_BYTES_PER_PAGE;
+}
+
+typedef struct visited {
+	int count;
+	u_long pages[RECORDED_PAGES];
+} visited;
+
+static void record_page(void *arg, u_long page, const unsigned char *page_tags)
+{
+	visited *v = (visited *)arg;
+	size_t index = (page - RECORDED_BASE) / TAG_SCAN_PAGE_SIZE;
+
+	assert(memcmp(page_tags, &recorded_tags[index*TAG_SCAN_BYTES_PER_PAGE], TAG_SCAN_BYTES_PER_PAGE) == 0);
+	v->pages[v->count++] = page;
+}
+
+static void check_scan(size_t chunk_pages, int expected_tagged, u_long expected_requests)
+{
+	visited v = {};
+	tag_scan_stats stats = {};
+
+	set_tag_scan_chunk_pages(chunk_pages);
+	tag_scan_range(RECORDED_BASE, RECORDED_BASE + RECORDED_PAGES*TAG_SCAN_PAGE_SIZE,
+	    read_recorded_tags, NULL, record_page, &v, &stats);
+
+	printf("chunk %zu: %lu pages, %lu tagged, %lu requests\n",
+	    chunk_pages, stats.pages, stats.tagged_pages, stats.requests);
+	assert(stats.pages == RECORDED_PAGES);
+	assert(v.count == expected_tagged);
+	assert(stats.tagged_pages == (u_long)expected_tagged);
+	assert(stats.requests == expected_requests);
+	for (int i=1; i<v.count; i++) {
+		assert(v.pages[i-1] < v.pages[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int tagged = 0;
+
+	set_print_level(NOPRINT);
+
+	// Every third page has a pointer in a different slot
+	for (int p=0; p<RECORDED_PAGES; p+=3) {
+		recorded_tags[p*TAG_SCAN_BYTES_PER_PAGE + (p % TAG_SCAN_BYTES_PER_PAGE)] = 1 << (p % 8);
+		tagged++;
+	}
+
+	check_scan(1, tagged, RECORDED_PAGES);
+	check_scan(256, tagged, 4);
+	check_scan(1000, tagged, 1);
+	check_scan(TAG_SCAN_MAX_CHUNK_PAGES, tagged, 1);
+
+	// A hole in the middle of the mapping: the second chunk is read up to
+	// the hole, the chunk starting at the hole is retried page by page, and
+	// the tags of the unreadable page are skipped.
+	unreadable[300] = 1;
+	// 0-255, 256-299 (short read), 300-555 (1 + 256 retries), 556-811, 812-999
+	check_scan(256, tagged - 1, 1 + 1 + (1 + 256) + 1 + 1);
+
+	printf("Test OK!\n");
+	return 0;
+}
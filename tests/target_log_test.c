@@ -0,0 +1,254 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Jessica Man 
+ *
+ * This software was developed by the University of Cambridge Computer
+ * Laboratory (Department of Computer Science and Technology) as part of the
+ * CHERI for Hypervisors and Operating Systems (CHaOS) project, funded by
+ * EPSRC grant EP/V000292/1.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scans a synthetic target through a target_recorder into a database and a
+ * record file, then ingests the record, which replays the scan, and checks
+ * that it stores the same capabilities. A read that was not recorded fails.
+ *
+ * cc -D_GNU_SOURCE -I../includes -o target_log_test target_log_test.c \
+ *     ../src/target_log.c ../src/snapshot_ingest.c ../src/raw_snapshot.c \
+ *     ../src/scan_pool.c ../src/mpmc_ring.c ../src/tag_scan.c ../src/cap_decode.c \
+ *     ../src/db_process.c ../src/arena.c ../src/common.c ../src/run_stats.c -lsqlite3 \
+ *     -lpthread
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "cap_decode.h"
+#include "common.h"
+#include "db_process.h"
+#include "raw_snapshot.h"
+#include "scan_pool.h"
+#include "snapshot_ingest.h"
+#include "tag_scan.h"
+#include "target_log.h"
+
+#define HEAP_BASE	0x50000000ULL
+#define PAGES		300
+#define BAD_PAGE	5
+#define NAME_ADDR	0x7fff2000ULL
+
+static char path[] = "/tmp/target_log_testXXXXXX";
+static const char name[] = "libc.so.7";
+
+/* Every page holds capabilities in slots 0 and 9 */
+static ssize_t read_tags(void *arg, u_long start, unsigned char *tagsbuf, size_t len)
+{
+	memset(tagsbuf, 0, len);
+	for (size_t i=0; i<len; i+=TAG_SCAN_BYTES_PER_PAGE) {
+		tagsbuf[i] = 0x01;
+		tagsbuf[i+1] = 0x02;
+	}
+	return len;
+}
+
+/* A read-write Morello capability to its own page, slot 9 of BAD_PAGE cannot be read */
+static int read_caps(void *arg, u_long addr, unsigned char *capbuf, int nslots)
+{
+	u_long page = addr & ~(u_long)(TAG_SCAN_PAGE_SIZE - 1);
+
+	if (page == HEAP_BASE + BAD_PAGE*TAG_SCAN_PAGE_SIZE && (nslots > 1 || addr != page)) {
+		return -1;
+	}
+	for (int i=0; i<nslots; i++) {
+		unsigned char *slot = &capbuf[i*CAP_DECODE_SLOT_SIZE];
+		uint64_t pesbt = (1ULL << 63) | (1ULL << 62) | (1ULL << 30) |
+		    (((page + 0x100) & 0x3fff) << 16) | (page & 0xffff);
+		slot[0] = 1;
+		for (int b=0; b<8; b++) {
+			slot[1+b] = (page + 0x10) >> (8*b);
+			slot[9+b] = pesbt >> (8*b);
+		}
+	}
+	return 0;
+}
+
+static int read_data(void *arg, u_long addr, void *buf, size_t len)
+{
+	if (addr != NAME_ADDR || len > sizeof(name)) {
+		return -1;
+	}
+	memcpy(buf, name, len);
+	return 0;
+}
+
+static sqlite3_int64 query_int(sqlite3 *db, const char *query)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 val;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+	assert(rc == SQLITE_OK);
+	rc = sqlite3_step(stmt);
+	assert(rc == SQLITE_ROW);
+	val = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return val;
+}
+
+/* Scans the synthetic target into snapshot 1 of db, recording it to path */
+static void record_scan(sqlite3 *db)
+{
+	raw_writer writer;
+	raw_snapshot_header header = { .page_size = 4096, .cap_size = 16, .machine = RAW_MACHINE_AARCH64 };
+	scan_target live = { read_tags, read_caps, read_data, NULL };
+	scan_target target;
+	target_recorder recorder;
+	cap_writer caps;
+	int rc;
+	int64_t snapshot_id;
+
+	rc = raw_writer_open(&writer, path, &header);
+	assert(rc == 0);
+	raw_vm_entry vm = { HEAP_BASE, HEAP_BASE + PAGES*0x1000ULL, HEAP_BASE, 3, 0, 1, "" };
+	rc = raw_write_vm_entry(&writer, &vm);
+	assert(rc == 0);
+	target_recorder_init(&recorder, &live, &writer, &target);
+
+	char buf[sizeof(name)];
+	rc = target.read_data(target.arg, NAME_ADDR, buf, sizeof(buf));
+	assert(rc == 0);
+	assert(strcmp(buf, name) == 0);
+
+	snapshot_id = snapshot_begin(db, 1000, 0);
+	assert(snapshot_id == 1);
+	begin_transaction(db);
+	rc = cap_writer_open(db, &caps);
+	assert(rc == 0);
+	scan_pool *pool = scan_pool_create(&target, &caps, 4);
+	scan_pool_add(pool, vm.start, vm.end, "Heap(others)");
+	target_recorder_range(&recorder, vm.start, vm.end);
+	cap_scan_stats stats = {};
+	u_long found = scan_pool_run(pool, &stats);
+	assert(found == 2*PAGES - 1);
+	scan_pool_free(pool);
+	cap_writer_close(&caps);
+	commit_transaction(db);
+
+	// The tags, the batched and single reads of every page, and the name
+	assert(recorder.reads == stats.tags.requests + stats.cap_requests + 1);
+	target_recorder_destroy(&recorder);
+
+	raw_snapshot_end end = {};
+	rc = raw_write_end(&writer, &end);
+	assert(rc == 0);
+	rc = raw_writer_close(&writer);
+	assert(rc == 0);
+}
+
+/* The reads that were not recorded fail */
+static void check_misses(void)
+{
+	raw_reader reader;
+	raw_record record;
+	target_replay replay = {};
+	scan_target target;
+	unsigned char capbuf[CAP_DECODE_SLOT_SIZE];
+	char buf[sizeof(name)];
+	int rc;
+
+	rc = raw_reader_open(&reader, path);
+	assert(rc == 0);
+	while (raw_reader_next(&reader, &record) == 1) {
+		if (record.type == RAW_REC_TARGET_READ) {
+			rc = target_replay_add(&replay, &record);
+			assert(rc == 0);
+		}
+	}
+	target_replay_start(&replay, &target);
+
+	rc = target.read_data(target.arg, NAME_ADDR, buf, sizeof(buf));
+	assert(rc == 0);
+	assert(strcmp(buf, name) == 0);
+	rc = target.read_data(target.arg, NAME_ADDR, buf, 4);
+	assert(rc == -1);
+	rc = target.read_caps(target.arg, HEAP_BASE + 16, capbuf, 1);
+	assert(rc == -1);
+	rc = target.read_caps(target.arg, HEAP_BASE, capbuf, 1);
+	assert(rc == -1);
+	rc = target.read_caps(target.arg, HEAP_BASE + BAD_PAGE*0x1000ULL, capbuf, 1);
+	assert(rc == 0);
+	assert(capbuf[0] == 1);
+	assert(atomic_load(&replay.hits) == 2 && atomic_load(&replay.misses) == 3);
+
+	target_replay_free(&replay);
+	raw_reader_close(&reader);
+}
+
+int main(int argc, char *argv[])
+{
+	sqlite3 *db;
+	ingest_stats stats;
+	int rc;
+
+	set_print_level(NOPRINT);
+
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+
+	rc = sqlite3_open(":memory:", &db);
+	assert(rc == SQLITE_OK);
+	rc = migrate_db(db);
+	assert(rc == 0);
+	create_vm_cap_db(db);
+	record_scan(db);
+
+	// The replay stores the same capabilities as the scan, as snapshot 2
+	rc = ingest_snapshot(db, path, 3, NULL, &stats);
+	assert(rc == 0);
+	assert(stats.snapshot_id == 2 && stats.complete && stats.vm_entries == 1 && stats.skipped == 0);
+	assert(stats.caps == 2*PAGES - 1 && stats.pages == PAGES);
+	assert(stats.replayed_reads > PAGES && stats.missed_reads == 0);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info a JOIN cap_info b "
+	    "ON a.cap_loc_addr = b.cap_loc_addr AND a.cap_loc_path_id = b.cap_loc_path_id AND "
+	    "a.cap_addr = b.cap_addr AND a.perms = b.perms AND a.base = b.base AND a.top = b.top "
+	    "WHERE a.snapshot_id = 1 AND b.snapshot_id = 2;") == 2*PAGES - 1);
+	assert(query_int(db, "SELECT COUNT(*) FROM cap_info WHERE snapshot_id = 2;") == 2*PAGES - 1);
+
+	check_misses();
+
+	sqlite3_close(db);
+	unlink(path);
+	printf("Test OK!\n");
+	return 0;
+}